@@ -6,6 +6,7 @@
 #define __BROWSERJAM_DOCUMENT_H__
 
 #include <BrowserJam/FontDescription.h>
+#include <BrowserJam/HitGrid.h>
 #include <BrowserJam/StyleFactory.h>
 
 #include <d2d1.h>
@@ -74,6 +75,9 @@ namespace sb
         PageElement* mRoot;
         StyleFactory mStyleFactory;
 
+        // Finds the elements under the mouse; rebuilt with every layout
+        HitGrid mHitGrid;
+
         Cursor mCursor;
 
     private:
@@ -35,8 +35,11 @@ namespace sb
         inline const Rect& GetLayoutBounds() {return mLayoutBounds; }
         inline const Rect& GetContentBounds() {return mContentBounds; }
 
-        virtual void OnMouseMove(float x, float y);
-        virtual void OnMouseDown(float x, float y);
+        // Handle the mouse being over this element; the document finds the element
+        virtual void OnMouseMove();
+        // Handle a click on this element. Returns true if the element took it, in
+        // which case its children don't get it
+        virtual bool OnMouseDown();
 
         // Update the layout of this element and it's children
         virtual Point Arrange(const Rect& availableSpace, Point cursor, float blockAdvance);
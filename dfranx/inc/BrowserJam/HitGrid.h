@@ -0,0 +1,63 @@
+#ifndef __BROWSERJAM_HITGRID_H__
+#define __BROWSERJAM_HITGRID_H__
+
+#include <BrowserJam/Rect.h>
+
+#include <cstdint>
+#include <vector>
+
+
+namespace sb
+{
+    class PageElement;
+
+    // A uniform grid over the laid out elements of a document, so that a mouse
+    // event only tests the elements whose bounds touch the cell under it
+    // instead of walking the whole tree
+    class HitGrid
+    {
+    public:
+        struct Entry
+        {
+            PageElement* element;
+
+            // The content bounds of the element, cut down to the bounds of its
+            // ancestors, as the events never reach the parts outside of them
+            Rect bounds;
+
+            // Whether an <a> element encloses this one, in which case clicks
+            // are handled by that one
+            bool isInsideLink;
+        };
+
+        // Rebuild the grid from the elements under root; needed after every layout
+        void Build(PageElement* root);
+        void Clear();
+
+        // Get the elements under the given point, in document order. The root
+        // isn't included, as it gets every event
+        void Query(float x, float y, std::vector<const Entry*>& out) const;
+
+    private:
+        void AddElement(PageElement* element, const Rect* parentBounds, bool isInsideLink);
+
+        // Get the cells that the bounds touch, inclusive
+        void GetCellRange(const Rect& bounds, uint32_t& x0, uint32_t& y0,
+            uint32_t& x1, uint32_t& y1) const;
+
+        std::vector<Entry> mEntries;
+
+        float mOriginX = 0.0f;
+        float mOriginY = 0.0f;
+        float mCellSize = 0.0f;
+        uint32_t mColumns = 0;
+        uint32_t mRows = 0;
+
+        // The entries of cell i are mCellEntries[mCellStart[i] .. mCellStart[i + 1]),
+        // in document order
+        std::vector<uint32_t> mCellStart;
+        std::vector<uint32_t> mCellEntries;
+    };
+}
+
+#endif //__BROWSERJAM_HITGRID_H__
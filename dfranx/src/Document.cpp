@@ -65,12 +65,35 @@ void Document::LoadHTML(const char* html, unsigned int html_length)
 
 void Document::OnMouseMove(float x, float y)
 {
-    if (mRoot) mRoot->OnMouseMove(x, y);
+    if (!mRoot) return;
+
+    // The last element in document order is the innermost one, whose cursor wins
+    std::vector<const HitGrid::Entry*> hits;
+    mHitGrid.Query(x, y, hits);
+    if (hits.empty())
+    {
+        mRoot->OnMouseMove();
+    }
+    else
+    {
+        hits.back()->element->OnMouseMove();
+    }
 }
 
 void Document::OnMouseDown(float x, float y)
 {
-    if (mRoot) mRoot->OnMouseDown(x, y);
+    if (!mRoot || mRoot->OnMouseDown()) return;
+
+    std::vector<const HitGrid::Entry*> hits;
+    mHitGrid.Query(x, y, hits);
+    for (auto hit : hits)
+    {
+        // Clicks inside a link go to the link
+        if (!hit->isInsideLink)
+        {
+            hit->element->OnMouseDown();
+        }
+    }
 }
 
 void Document::ProcessHTMLNode(struct myhtml_tree* tree, struct myhtml_tree_node* node, PageElement* parent)
@@ -262,6 +285,7 @@ void Document::Shutdown()
     }
     mBrushCache.clear();
 
+    mHitGrid.Clear();
     DeleteElement(mRoot);
     mRoot = nullptr;
 }
@@ -269,6 +293,7 @@ void Document::Shutdown()
 void Document::InvalidateLayout()
 {
     mRoot->Arrange(GetBounds(), {0.0f, 0.0f }, 0.0f);
+    mHitGrid.Build(mRoot);
 }
 
 void Document::Render()
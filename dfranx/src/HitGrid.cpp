@@ -0,0 +1,161 @@
+#include <BrowserJam/HitGrid.h>
+#include <BrowserJam/Elements/PageElement.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+using namespace sb;
+
+
+// Elements are bucketed into square cells of this size
+static const float CellSize = 128.0f;
+
+// The grid never has more cells than this; on documents that are larger
+// than it covers, the cells are made larger instead
+static const uint32_t MaxCells = 64 * 1024;
+
+
+static Rect Intersect(const Rect& a, const Rect& b)
+{
+    float left = std::max(a.x, b.x);
+    float top = std::max(a.y, b.y);
+    float right = std::min(a.x + a.width, b.x + b.width);
+    float bottom = std::min(a.y + a.height, b.y + b.height);
+    return Rect(left, top, right - left, bottom - top);
+}
+
+void HitGrid::Build(PageElement* root)
+{
+    Clear();
+
+    if (root == nullptr) return;
+
+    bool isRootLink = root->GetTag() == "a";
+    for (auto& child : root->GetChildren())
+    {
+        AddElement(child, nullptr, isRootLink);
+    }
+
+    if (mEntries.empty()) return;
+
+    float left = mEntries[0].bounds.x;
+    float top = mEntries[0].bounds.y;
+    float right = left;
+    float bottom = top;
+    for (auto& entry : mEntries)
+    {
+        left = std::min(left, entry.bounds.x);
+        top = std::min(top, entry.bounds.y);
+        right = std::max(right, entry.bounds.x + entry.bounds.width);
+        bottom = std::max(bottom, entry.bounds.y + entry.bounds.height);
+    }
+
+    // Counted in floats, as the number of cells can overflow before the cells are grown
+    mCellSize = CellSize;
+    while ((std::floor((right - left) / mCellSize) + 1.0f) *
+        (std::floor((bottom - top) / mCellSize) + 1.0f) > MaxCells)
+    {
+        mCellSize *= 2.0f;
+    }
+
+    mOriginX = left;
+    mOriginY = top;
+    mColumns = (uint32_t)((right - left) / mCellSize) + 1;
+    mRows = (uint32_t)((bottom - top) / mCellSize) + 1;
+
+    // Counting sort by cell; an entry is in every cell that its bounds touch
+    mCellStart.assign(mColumns * mRows + 1, 0);
+    for (auto& entry : mEntries)
+    {
+        uint32_t x0, y0, x1, y1;
+        GetCellRange(entry.bounds, x0, y0, x1, y1);
+        for (uint32_t y = y0; y <= y1; y++)
+        {
+            for (uint32_t x = x0; x <= x1; x++)
+            {
+                mCellStart[y * mColumns + x + 1]++;
+            }
+        }
+    }
+
+    for (uint32_t i = 1; i < mCellStart.size(); i++)
+    {
+        mCellStart[i] += mCellStart[i - 1];
+    }
+
+    mCellEntries.resize(mCellStart.back());
+    std::vector<uint32_t> next(mCellStart.begin(), mCellStart.end() - 1);
+    for (uint32_t i = 0; i < mEntries.size(); i++)
+    {
+        uint32_t x0, y0, x1, y1;
+        GetCellRange(mEntries[i].bounds, x0, y0, x1, y1);
+        for (uint32_t y = y0; y <= y1; y++)
+        {
+            for (uint32_t x = x0; x <= x1; x++)
+            {
+                mCellEntries[next[y * mColumns + x]++] = i;
+            }
+        }
+    }
+}
+
+void HitGrid::Clear()
+{
+    mEntries.clear();
+    mCellStart.clear();
+    mCellEntries.clear();
+    mColumns = mRows = 0;
+}
+
+void HitGrid::Query(float x, float y, std::vector<const Entry*>& out) const
+{
+    out.clear();
+
+    if (mEntries.empty()) return;
+
+    float column = std::floor((x - mOriginX) / mCellSize);
+    float row = std::floor((y - mOriginY) / mCellSize);
+    if (!(column >= 0.0f && column < mColumns && row >= 0.0f && row < mRows)) return;
+
+    uint32_t cell = (uint32_t)row * mColumns + (uint32_t)column;
+    for (uint32_t i = mCellStart[cell]; i < mCellStart[cell + 1]; i++)
+    {
+        const Entry& entry = mEntries[mCellEntries[i]];
+        if (entry.bounds.Contains(x, y))
+        {
+            out.push_back(&entry);
+        }
+    }
+}
+
+void HitGrid::AddElement(PageElement* element, const Rect* parentBounds, bool isInsideLink)
+{
+    Rect bounds = element->GetContentBounds();
+    if (parentBounds)
+    {
+        bounds = Intersect(bounds, *parentBounds);
+    }
+
+    // Neither the element nor its children can be under the mouse
+    if (bounds.width < 0.0f || bounds.height < 0.0f) return;
+
+    // Entries are added in document order, which the cells keep
+    mEntries.push_back({ element, bounds, isInsideLink });
+
+    bool isLink = isInsideLink || element->GetTag() == "a";
+    for (auto& child : element->GetChildren())
+    {
+        AddElement(child, &bounds, isLink);
+    }
+}
+
+void HitGrid::GetCellRange(const Rect& bounds, uint32_t& x0, uint32_t& y0,
+    uint32_t& x1, uint32_t& y1) const
+{
+    // Every entry is inside the grid, but rounding may put its far edge just past it
+    x0 = std::min((uint32_t)((bounds.x - mOriginX) / mCellSize), mColumns - 1);
+    y0 = std::min((uint32_t)((bounds.y - mOriginY) / mCellSize), mRows - 1);
+    x1 = std::min((uint32_t)((bounds.x + bounds.width - mOriginX) / mCellSize), mColumns - 1);
+    y1 = std::min((uint32_t)((bounds.y + bounds.height - mOriginY) / mCellSize), mRows - 1);
+}
@@ -24,43 +24,24 @@ DisplayType PageElement::GetDisplayType() const
     return DisplayType_Block;
 }
 
-void PageElement::OnMouseMove(float x, float y)
+void PageElement::OnMouseMove()
 {
-    bool handled = false;
-
     if (mStyle)
     {
+        // The cursor is inherited, so it is only missing if no ancestor sets one either
         if (mStyle->Has(StylePropertyId_Cursor))
         {
-            Cursor cursor = Unbox<Cursor>(mStyle->Get(StylePropertyId_Cursor));
-            if (mDocument->GetMouseCursor() != cursor)
-            {
-                handled = true;
-                mDocument->SetMouseCursor(cursor);
-            }
+            mDocument->SetMouseCursor(Unbox<Cursor>(mStyle->Get(StylePropertyId_Cursor)));
         }
-        else if (mDocument->GetMouseCursor() != Cursor_Default)
+        else
         {
             mDocument->SetMouseCursor(Cursor_Default);
         }
     }
-
-    if (!handled)
-    {
-        for (auto& child: mChildren)
-        {
-            if (child->GetContentBounds().Contains(x, y))
-            {
-                child->OnMouseMove(x, y);
-            }
-        }
-    }
 }
 
-void PageElement::OnMouseDown(float x, float y)
+bool PageElement::OnMouseDown()
 {
-    bool handled = false;
-
     if (mTag == "a")
     {
         std::string link = mAttributes["href"];
@@ -69,19 +50,10 @@ void PageElement::OnMouseDown(float x, float y)
             mDocument->Redirect(link);
         }
 
-        handled = true;
+        return true;
     }
 
-    if (!handled)
-    {
-        for (auto& child: mChildren)
-        {
-            if (child->GetContentBounds().Contains(x, y))
-            {
-                child->OnMouseDown(x, y);
-            }
-        }
-    }
+    return false;
 }
 
 Point PageElement::Arrange(const Rect& availableSpace, Point cursor, float blockAdvance)
@@ -37,6 +37,9 @@ struct GPU_Surface_t {
 
   b32 isSizeMoving = false;
   b32 isOccluded = false;
+  // Set when the window needs to be painted again; Surface_getEvents turns
+  // it into a GET_Redraw event
+  b32 isDamaged = false;
   b32 isCapturing = false;
   UINT resizeWidth = 0;
   UINT resizeHeight = 0;
@@ -69,6 +72,8 @@ struct GPU_Device_t {
   IDXGIFactory2 *pDxgiFactory = nullptr;
 
   VertexShader vertexShader;
+  // Expands glyph instances into quads
+  VertexShader glyphShader;
 
   SurfaceShader surfaceShader;
   ID3D11SamplerState *samplerBilinear;
@@ -81,10 +86,18 @@ struct GPU_Mesh_t {
   ID3D11Buffer *vertexBuffer;
   u32 stride;
   u32 offset;
+  // Null for meshes of glyphs, whose vertex buffer holds the instances
   ID3D11Buffer *indexBuffer;
   DXGI_FORMAT indexFormat;
   D3D11_PRIMITIVE_TOPOLOGY topology;
   u32 numIndices;
+  u32 numGlyphs;
+};
+
+struct GPU_GlyphTable_t {
+  ID3D11Buffer *buffer;
+  ID3D11ShaderResourceView *view;
+  u32 capacity;
 };
 
 struct GPU_Image_t {
@@ -106,7 +119,8 @@ struct BatchConstants {};
 
 static b32 VertexShader_init(VertexShader *self,
                              GPU_Device_t *renderer,
-                             const char *vsEntry) {
+                             const char *vsEntry,
+                             Slice<D3D11_INPUT_ELEMENT_DESC> elems) {
   ID3D11Device1 *device = renderer->pDevice;
   ID3DBlob *vsBlob, *err;
   HRESULT hr;
@@ -130,43 +144,29 @@ static b32 VertexShader_init(VertexShader *self,
   device->CreateVertexShader(vsBlob->GetBufferPointer(),
                              vsBlob->GetBufferSize(), nullptr, &self->shader);
 
-  D3D11_INPUT_ELEMENT_DESC elems[4];
-  elems[0] = {"POSITION",
-              0,
-              DXGI_FORMAT_R32G32B32_FLOAT,
-              0,
-              0 * sizeof(f32),
-              D3D11_INPUT_PER_VERTEX_DATA,
-              0};
-  elems[1] = {"TEXCOORD",
-              0,
-              DXGI_FORMAT_R32G32_FLOAT,
-              0,
-              3 * sizeof(f32),
-              D3D11_INPUT_PER_VERTEX_DATA,
-              0};
-  elems[2] = {"COLOR",
-              0,
-              DXGI_FORMAT_R32G32B32A32_FLOAT,
-              0,
-              5 * sizeof(f32),
-              D3D11_INPUT_PER_VERTEX_DATA,
-              0};
-  elems[3] = {"COLOR",
-              1,
-              DXGI_FORMAT_R32G32B32A32_FLOAT,
-              0,
-              9 * sizeof(f32),
-              D3D11_INPUT_PER_VERTEX_DATA,
-              0};
-
-  device->CreateInputLayout(elems, 4, vsBlob->GetBufferPointer(),
+  device->CreateInputLayout(elems.data, elems.length,
+                            vsBlob->GetBufferPointer(),
                             vsBlob->GetBufferSize(), &self->inputLayout);
 
   self->blob = vsBlob;
   return true;
 }
 
+static void VertexShader_destroy(VertexShader *vs) {
+  if (vs->shader) {
+    if (vs->inputLayout) {
+      vs->inputLayout->Release();
+    }
+
+    vs->shader->Release();
+    vs->blob->Release();
+    vs->shader = nullptr;
+    vs->blob = nullptr;
+  } else {
+    CHECK(vs->blob == nullptr);
+  }
+}
+
 static void VertexShader_bind(const VertexShader *self,
                               ID3D11DeviceContext1 *ctx) {
   ctx->VSSetShader(self->shader, nullptr, 0);
@@ -203,8 +203,11 @@ static b32 SurfaceShader_init(SurfaceShader *self,
   rasterizerdesc.CullMode = D3D11_CULL_BACK;
   device->CreateRasterizerState(&rasterizerdesc, &self->rasterizerState);
 
+  // NOTE: everything is drawn at the same depth in submission order,
+  // so a depth test would only reject the parts of a glyph quad that overlap
+  // one drawn before it, e.g. the padding around distance field glyphs
   D3D11_DEPTH_STENCIL_DESC depthstencildesc = {};
-  depthstencildesc.DepthEnable = TRUE;
+  depthstencildesc.DepthEnable = FALSE;
   depthstencildesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
   depthstencildesc.DepthFunc = D3D11_COMPARISON_LESS;
   device->CreateDepthStencilState(&depthstencildesc, &self->depthStencilState);
@@ -292,6 +295,7 @@ static LRESULT wndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hWnd, &ps);
         EndPaint(hWnd, &ps);
+        pWnd->isDamaged = true;
       }
       break;
     }
@@ -313,6 +317,7 @@ static LRESULT wndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
       }
       pWnd->resizeWidth = (UINT)LOWORD(lParam);
       pWnd->resizeHeight = (UINT)HIWORD(lParam);
+      pWnd->isDamaged = true;
       return 0;
     }
   }
@@ -398,7 +403,64 @@ b32 GPU_create(Arena *arena, GPU_Device *out) {
   renderer->pDevice = device;
   renderer->pDxgiFactory = dxgiFactory;
 
-  VertexShader_init(&renderer->vertexShader, renderer, "vs_main");
+  D3D11_INPUT_ELEMENT_DESC vertexElems[4];
+  vertexElems[0] = {"POSITION",
+                    0,
+                    DXGI_FORMAT_R32G32B32_FLOAT,
+                    0,
+                    0 * sizeof(f32),
+                    D3D11_INPUT_PER_VERTEX_DATA,
+                    0};
+  vertexElems[1] = {"TEXCOORD",
+                    0,
+                    DXGI_FORMAT_R32G32B32_FLOAT,
+                    0,
+                    3 * sizeof(f32),
+                    D3D11_INPUT_PER_VERTEX_DATA,
+                    0};
+  vertexElems[2] = {"COLOR",
+                    0,
+                    DXGI_FORMAT_R32G32B32A32_FLOAT,
+                    0,
+                    6 * sizeof(f32),
+                    D3D11_INPUT_PER_VERTEX_DATA,
+                    0};
+  vertexElems[3] = {"COLOR",
+                    1,
+                    DXGI_FORMAT_R32G32B32A32_FLOAT,
+                    0,
+                    10 * sizeof(f32),
+                    D3D11_INPUT_PER_VERTEX_DATA,
+                    0};
+  VertexShader_init(&renderer->vertexShader, renderer, "vs_main",
+                    {vertexElems, 4});
+
+  // One element of the vertex buffer per glyph; the corners of its quad are
+  // told apart by SV_VertexID
+  D3D11_INPUT_ELEMENT_DESC glyphElems[3];
+  glyphElems[0] = {"POSITION",
+                   0,
+                   DXGI_FORMAT_R32G32_FLOAT,
+                   0,
+                   offsetof(GPU_GlyphInstance, position),
+                   D3D11_INPUT_PER_INSTANCE_DATA,
+                   1};
+  glyphElems[1] = {"GLYPH",
+                   0,
+                   DXGI_FORMAT_R16G16_UINT,
+                   0,
+                   offsetof(GPU_GlyphInstance, idxGlyph),
+                   D3D11_INPUT_PER_INSTANCE_DATA,
+                   1};
+  glyphElems[2] = {"COLOR",
+                   0,
+                   DXGI_FORMAT_R8G8B8A8_UNORM,
+                   0,
+                   offsetof(GPU_GlyphInstance, color),
+                   D3D11_INPUT_PER_INSTANCE_DATA,
+                   1};
+  VertexShader_init(&renderer->glyphShader, renderer, "vs_glyph",
+                    {glyphElems, 3});
 
   if (!SurfaceShader_init(&renderer->surfaceShader, renderer, "ps_main")) {
     log_error("Failed to create surface shader");
@@ -479,19 +541,8 @@ b32 GPU_destroy(GPU_Device renderer) {
 
   renderer->pCtx->Flush();
 
-  VertexShader *vs = &renderer->vertexShader;
-  if (vs->shader) {
-    if (vs->inputLayout) {
-      vs->inputLayout->Release();
-    }
-
-    vs->shader->Release();
-    vs->blob->Release();
-    vs->shader = nullptr;
-    vs->blob = nullptr;
-  } else {
-    CHECK(vs->blob == nullptr);
-  }
+  VertexShader_destroy(&renderer->vertexShader);
+  VertexShader_destroy(&renderer->glyphShader);
 
   SurfaceShader_destroy(&renderer->surfaceShader);
 
@@ -580,15 +631,50 @@ b32 GPU_createSurface(GPU_Device device,
     case GSK_NativeWindow:
       return GPU_createNativeWindowSurface(
           device, arena, (const GPU_NativeWindowSurfaceDesc *)desc, out);
+    default:
+      log_error("Headless surfaces need the software renderer");
+      break;
   }
 
   return false;
 }
 
+static b32 GPU_createGlyphMesh(GPU_Device renderer,
+                               Arena *arena,
+                               const GPU_MeshDesc *desc,
+                               GPU_Mesh *out) {
+  D3D11_BUFFER_DESC bufferDesc = {};
+  bufferDesc.ByteWidth = desc->glyphs.length * sizeof(GPU_GlyphInstance);
+  bufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+  bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+  D3D11_SUBRESOURCE_DATA instanceData = {desc->glyphs.data};
+  ID3D11Buffer *instanceBuffer;
+  if (FAILED(renderer->pDevice->CreateBuffer(&bufferDesc, &instanceData,
+                                             &instanceBuffer))) {
+    return false;
+  }
+
+  GPU_Mesh mesh = alloc<GPU_Mesh_t>(arena);
+  mesh->vertexBuffer = instanceBuffer;
+  mesh->indexBuffer = nullptr;
+  mesh->topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;
+  mesh->stride = sizeof(GPU_GlyphInstance);
+  mesh->offset = 0;
+  mesh->numGlyphs = desc->glyphs.length;
+
+  *out = mesh;
+  return true;
+}
+
 b32 GPU_createMesh(GPU_Device renderer,
                    Arena *arena,
                    const GPU_MeshDesc *desc,
                    GPU_Mesh *out) {
+  if (desc->glyphs.length != 0) {
+    return GPU_createGlyphMesh(renderer, arena, desc, out);
+  }
+
   ID3D11Buffer *vertexBuffer, *indexBuffer;
 
   // Upload the vertex buffers
@@ -621,7 +707,9 @@ b32 GPU_createMesh(GPU_Device renderer,
 }
 
 b32 GPU_destroyMesh(GPU_Device device, GPU_Mesh mesh) {
-  mesh->indexBuffer->Release();
+  if (mesh->indexBuffer) {
+    mesh->indexBuffer->Release();
+  }
   mesh->vertexBuffer->Release();
 
   return true;
@@ -771,11 +859,33 @@ Slice<GPU_Event> Surface_getEvents(GPU_Device device,
     DispatchMessage(&msg);
   }
 
+  // The window procedure runs while the messages are dispatched
+  if (surface->isDamaged) {
+    surface->isDamaged = false;
+    GPU_Event *dst = append(temp.arena, &events);
+    dst->kind = GET_Redraw;
+  }
+
   Slice<GPU_Event> ret = copyToSlice(arena, events);
   releaseScratch(temp);
   return ret;
 }
 
+b32 Surface_waitForEvents(GPU_Surface surface, u32 timeoutMs) {
+  if (surface->kind != GSK_NativeWindow) {
+    return false;
+  }
+  if (surface->isDamaged) {
+    return true;
+  }
+
+  // NOTE: MWMO_INPUTAVAILABLE also wakes up for messages that
+  // were already in the queue, not only for the ones posted from now on
+  DWORD res = MsgWaitForMultipleObjectsEx(0, nullptr, timeoutMs, QS_ALLINPUT,
+                                          MWMO_INPUTAVAILABLE);
+  return res == WAIT_OBJECT_0;
+}
+
 b32 Surface_isCapturingMouse(GPU_Surface surface) {
   return surface->isCapturing;
 }
@@ -841,6 +951,27 @@ b32 Surface_releaseMouse(GPU_Surface surf) {
   return false;
 }
 
+b32 Surface_setCursor(GPU_Surface surface, GPU_Cursor cursor) {
+  // NOTE: the window class has no cursor, so Windows never resets
+  // the one set here while the mouse is over the window
+  LPCSTR id = IDC_ARROW;
+  switch (cursor) {
+    case GC_Arrow:
+      id = IDC_ARROW;
+      break;
+    case GC_Hand:
+      id = IDC_HAND;
+      break;
+  }
+
+  HCURSOR handle = LoadCursorA(NULL, id);
+  if (handle == NULL) {
+    return false;
+  }
+  SetCursor(handle);
+  return true;
+}
+
 b32 GPU_beginFrame(GPU_Device renderer,
                    GPU_Surface surf,
                    GPU_NativeWindowSurface *pWnd,
@@ -985,7 +1116,7 @@ b32 GPU_submit(GPU_Device renderer,
   b32 shaderResourcesDirty = false;
   memset(shaderResources, 0, sizeof(shaderResources));
 
-  VertexShader_bind(&renderer->vertexShader, ctx);
+  const VertexShader *boundVertexShader = nullptr;
   SurfaceShader_bind(&renderer->surfaceShader, ctx);
   ctx->PSSetSamplers(0, 1, &renderer->samplerBilinear);
 
@@ -1008,16 +1139,28 @@ b32 GPU_submit(GPU_Device renderer,
       case GPU_CmdKind::BindMesh: {
         if (mesh != cmd.bindMesh.mesh) {
           mesh = cmd.bindMesh.mesh;
-          ID3D11InputLayout *inputLayout = renderer->vertexShader.inputLayout;
+          const VertexShader *vertexShader = mesh->indexBuffer
+                                                 ? &renderer->vertexShader
+                                                 : &renderer->glyphShader;
+          if (vertexShader != boundVertexShader) {
+            boundVertexShader = vertexShader;
+            VertexShader_bind(vertexShader, ctx);
+            ctx->IASetInputLayout(vertexShader->inputLayout);
+          }
 
           ctx->IASetPrimitiveTopology(mesh->topology);
-          ctx->IASetInputLayout(inputLayout);
           ctx->IASetVertexBuffers(0, 1, &mesh->vertexBuffer, &mesh->stride,
                                   &mesh->offset);
-          ctx->IASetIndexBuffer(mesh->indexBuffer, mesh->indexFormat, 0);
+          if (mesh->indexBuffer) {
+            ctx->IASetIndexBuffer(mesh->indexBuffer, mesh->indexFormat, 0);
+          }
         }
         break;
       }
+      case GPU_CmdKind::BindGlyphTable: {
+        ctx->VSSetShaderResources(0, 1, &cmd.bindGlyphTable.table->view);
+        break;
+      }
       case GPU_CmdKind::SetView: {
         ViewConstants viewConstantsData;
         viewConstantsData.projection = cmd.setView.projection;
@@ -1058,7 +1201,11 @@ b32 GPU_submit(GPU_Device renderer,
             ctx->PSSetShaderResources(0, 8, shaderResources);
           }
 
-          ctx->DrawIndexedInstanced(mesh->numIndices, 1, 0, 0, 0);
+          if (mesh->indexBuffer) {
+            ctx->DrawIndexedInstanced(mesh->numIndices, 1, 0, 0, 0);
+          } else {
+            ctx->DrawInstanced(4, mesh->numGlyphs, 0, 0);
+          }
         }
         break;
       }
@@ -1075,6 +1222,11 @@ b32 Surface_getSize(GPU_Surface surface, i32 *w, i32 *h) {
   return true;
 }
 
+Slice<u8> Surface_getPixels(GPU_Surface surface) {
+  // Window surfaces aren't read back
+  return {};
+}
+
 #pragma comment(lib, "dxguid.lib")
 
 b32 GPU_destroyImage(GPU_Device renderer, GPU_Image image) {
@@ -1120,35 +1272,46 @@ b32 GPU_createImage(GPU_Device renderer,
 
   ArenaTemp temp = getScratch(&arena, 1);
 
+  u32 numLayers = max(image->numLayers, 1u);
+
   ID3D11Texture2D *texture = nullptr;
   D3D11_TEXTURE2D_DESC textureDesc = {};
   textureDesc.Width = image->width;
   textureDesc.Height = image->height;
   textureDesc.MipLevels = 1;
-  textureDesc.ArraySize = 1;
+  textureDesc.ArraySize = numLayers;
   textureDesc.Format = imageFormat;
   textureDesc.SampleDesc.Count = 1;
   textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-  textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
-
-  D3D11_SUBRESOURCE_DATA subresource = {};
-  subresource.pSysMem = image->pixels.data;
-  subresource.SysMemPitch = pitch;
-  subresource.SysMemSlicePitch = 0;
+  textureDesc.Usage =
+      image->isUpdatable ? D3D11_USAGE_DEFAULT : D3D11_USAGE_IMMUTABLE;
+
+  u32 sizLayer = pitch * image->height;
+  Slice<D3D11_SUBRESOURCE_DATA> subresources;
+  alloc(temp.arena, numLayers, subresources);
+  for (auto [subresource, idxLayer] : subresources) {
+    subresource.pSysMem = image->pixels.data + idxLayer * sizLayer;
+    subresource.SysMemPitch = pitch;
+    subresource.SysMemSlicePitch = 0;
+  }
 
-  res =
-      renderer->pDevice->CreateTexture2D(&textureDesc, &subresource, &texture);
+  res = renderer->pDevice->CreateTexture2D(&textureDesc, subresources.data,
+                                           &texture);
   if (!SUCCEEDED(res)) {
     return false;
   }
 
+  // NOTE: every image is viewed as an array, even one with a single
+  // layer, so that the same shader samples all of them
   ID3D11ShaderResourceView *view, *viewSrgb;
 
   D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
   viewDesc.Format = linearFormat;
-  viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-  viewDesc.Texture2D.MipLevels = -1;
-  viewDesc.Texture2D.MostDetailedMip = 0;
+  viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+  viewDesc.Texture2DArray.MipLevels = -1;
+  viewDesc.Texture2DArray.MostDetailedMip = 0;
+  viewDesc.Texture2DArray.FirstArraySlice = 0;
+  viewDesc.Texture2DArray.ArraySize = numLayers;
   res = renderer->pDevice->CreateShaderResourceView(texture, &viewDesc, &view);
   if (!SUCCEEDED(res)) {
     return false;
@@ -1156,9 +1319,11 @@ b32 GPU_createImage(GPU_Device renderer,
 
   D3D11_SHADER_RESOURCE_VIEW_DESC descSrgb = {};
   descSrgb.Format = srgbFormat;
-  descSrgb.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-  descSrgb.Texture2D.MipLevels = -1;
-  descSrgb.Texture2D.MostDetailedMip = 0;
+  descSrgb.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+  descSrgb.Texture2DArray.MipLevels = -1;
+  descSrgb.Texture2DArray.MostDetailedMip = 0;
+  descSrgb.Texture2DArray.FirstArraySlice = 0;
+  descSrgb.Texture2DArray.ArraySize = numLayers;
   res = renderer->pDevice->CreateShaderResourceView(texture, &descSrgb,
                                                     &viewSrgb);
   if (!SUCCEEDED(res)) {
@@ -1203,6 +1368,100 @@ b32 GPU_discardUpdateImage(GPU_Device device,
   return true;
 }
 
+b32 GPU_updateImageRegion(GPU_Device device,
+                          GPU_Image image,
+                          u32 layer,
+                          u32 x,
+                          u32 y,
+                          u32 width,
+                          u32 height,
+                          Slice<u8> pixels,
+                          u32 rowPitch) {
+  if (width == 0 || height == 0) {
+    return true;
+  }
+
+  D3D11_BOX box = {};
+  box.left = x;
+  box.top = y;
+  box.front = 0;
+  box.right = x + width;
+  box.bottom = y + height;
+  box.back = 1;
+  device->pCtx->UpdateSubresource(image->texture,
+                                  D3D11CalcSubresource(0, layer, 1), &box,
+                                  pixels.data, rowPitch, 0);
+  return true;
+}
+
+b32 GPU_createGlyphTable(GPU_Device device,
+                         Arena *arena,
+                         const GPU_GlyphTableDesc *desc,
+                         GPU_GlyphTable *out) {
+  D3D11_BUFFER_DESC bufferDesc = {};
+  bufferDesc.ByteWidth = desc->capacity * sizeof(GPU_Glyph);
+  bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+  bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+  bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+  bufferDesc.StructureByteStride = sizeof(GPU_Glyph);
+
+  ID3D11Buffer *buffer;
+  if (FAILED(device->pDevice->CreateBuffer(&bufferDesc, nullptr, &buffer))) {
+    log_error("Failed to create a glyph table of %u glyphs", desc->capacity);
+    return false;
+  }
+
+  D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
+  viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+  viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+  viewDesc.Buffer.FirstElement = 0;
+  viewDesc.Buffer.NumElements = desc->capacity;
+  ID3D11ShaderResourceView *view;
+  if (FAILED(device->pDevice->CreateShaderResourceView(buffer, &viewDesc,
+                                                       &view))) {
+    buffer->Release();
+    return false;
+  }
+
+  GPU_GlyphTable table = alloc<GPU_GlyphTable_t>(arena);
+  table->buffer = buffer;
+  table->view = view;
+  table->capacity = desc->capacity;
+
+  *out = table;
+  return true;
+}
+
+b32 GPU_updateGlyphTable(GPU_Device device,
+                         GPU_GlyphTable table,
+                         u32 idxFirst,
+                         Slice<GPU_Glyph> glyphs) {
+  if (glyphs.length == 0) {
+    return true;
+  }
+  if (idxFirst + glyphs.length > table->capacity) {
+    return false;
+  }
+
+  D3D11_BOX box = {};
+  box.left = idxFirst * sizeof(GPU_Glyph);
+  box.right = (idxFirst + glyphs.length) * sizeof(GPU_Glyph);
+  box.top = 0;
+  box.bottom = 1;
+  box.front = 0;
+  box.back = 1;
+  device->pCtx->UpdateSubresource(table->buffer, 0, &box, glyphs.data, 0, 0);
+  return true;
+}
+
+b32 GPU_destroyGlyphTable(GPU_Device device, GPU_GlyphTable table) {
+  table->view->Release();
+  table->view = nullptr;
+  table->buffer->Release();
+  table->buffer = nullptr;
+  return true;
+}
+
 void *GPU_getRawHandle(GPU_Image image) {
   return image->viewSrgb;
 }
@@ -8,6 +8,7 @@ typedef struct GPU_Device_t *GPU_Device;
 typedef struct GPU_Surface_t *GPU_Surface;
 typedef struct GPU_Mesh_t *GPU_Mesh;
 typedef struct GPU_Image_t *GPU_Image;
+typedef struct GPU_GlyphTable_t *GPU_GlyphTable;
 
 enum class GPU_CmdKind {
   SetView,
@@ -15,6 +16,7 @@ enum class GPU_CmdKind {
   BindImage,
   SetSurfaceConstants,
   RenderInstance,
+  BindGlyphTable,
 };
 
 struct GPU_SetView {
@@ -41,6 +43,10 @@ struct GPU_SetSurfaceConstants {
 
 struct GPU_RenderInstance {};
 
+struct GPU_BindGlyphTable {
+  GPU_GlyphTable table;
+};
+
 struct GPU_RenderCmd {
   GPU_CmdKind kind;
 
@@ -50,6 +56,7 @@ struct GPU_RenderCmd {
     GPU_BindMesh bindMesh;
     GPU_SetSurfaceConstants setSurfaceConstants;
     GPU_RenderInstance renderInstance;
+    GPU_BindGlyphTable bindGlyphTable;
   };
 };
 
@@ -60,6 +67,9 @@ enum GPU_EventType {
   GET_MouseMoveAbs,
   GET_MouseUp,
   GET_MouseWheel,
+  // What was drawn on the surface is gone or has the wrong size, e.g. after
+  // the window was resized, and has to be drawn again
+  GET_Redraw,
 };
 
 enum GPU_KeyCode {
@@ -104,6 +114,14 @@ struct GPU_Event {
 
 enum GPU_SurfaceKind {
   GSK_NativeWindow,
+  // Not shown anywhere; its pixels are read back with Surface_getPixels. Only
+  // the software renderer supports it.
+  GSK_Headless,
+};
+
+enum GPU_Cursor {
+  GC_Arrow,
+  GC_Hand,
 };
 
 struct GPU_SurfaceDesc {
@@ -114,6 +132,11 @@ struct GPU_NativeWindowSurfaceDesc {
   GPU_SurfaceDesc header;
 };
 
+struct GPU_HeadlessSurfaceDesc {
+  GPU_SurfaceDesc header;
+  u32 width, height;
+};
+
 enum class GPU_PixelFormat {
   R8G8B8A8,
   R8,
@@ -122,19 +145,65 @@ enum class GPU_PixelFormat {
 struct GPU_ImageDesc {
   GPU_PixelFormat format;
   u32 width, height;
+  // Images with more than one layer are arrays of images of the same size,
+  // and `pixels` holds the layers one after the other. 0 means 1.
+  u32 numLayers;
   Slice<u8> pixels;
+  // Whether parts of the image may be replaced later through
+  // GPU_updateImageRegion
+  b32 isUpdatable;
 };
 
 struct GPU_Vertex {
   v3 position;
-  v2 texcoord0;
+  // The third coordinate is the layer of the image
+  v3 texcoord0;
   v4 color0;
   v4 color1;
 };
 
+/**
+ * A glyph on the bound image. Glyph instances refer to it by its index in a
+ * glyph table.
+ */
+struct GPU_Glyph {
+  // The corners of the quad relative to the pen, before it's scaled
+  v2 offset0, offset1;
+  // The corners of the glyph on the image
+  v2 texcoord0, texcoord1;
+  u32 layer;
+  // Nonzero if the image holds a distance field of the glyph instead of its
+  // coverage
+  u32 isDistanceField;
+};
+
+struct GPU_GlyphTableDesc {
+  // How many glyphs the table has room for; at most 65536
+  u32 capacity;
+};
+
+// The scale of a glyph instance that draws the glyph at its own size
+static const u32 GPU_GLYPH_SCALE_ONE = 4096;
+
+/**
+ * A quad that shows a glyph of the bound glyph table. It takes the place of
+ * four vertices and six indices.
+ */
+struct GPU_GlyphInstance {
+  // Where the pen is
+  v2 position;
+  u16 idxGlyph;
+  // How much the quad is scaled, in 1/GPU_GLYPH_SCALE_ONE steps
+  u16 scale;
+  // RGBA with 8 bits per channel, red in the lowest byte
+  u32 color;
+};
+
 struct GPU_MeshDesc {
   Slice<GPU_Vertex> vertexData;
   Slice<u32> indices;
+  // A mesh of glyphs has these instead of vertices and indices
+  Slice<GPU_GlyphInstance> glyphs;
 };
 
 b32 GPU_create(Arena *arena, GPU_Device *out);
@@ -153,7 +222,33 @@ b32 GPU_discardUpdateImage(GPU_Device device,
                            Slice<u8> newContents,
                            u32 numRows,
                            u32 rowPitch);
+/**
+ * Replaces the pixels of a layer of the image in the rectangle at (x, y). Row
+ * `i` of the rectangle is read from `pixels` at offset `i * rowPitch`. The
+ * image must have been created with `isUpdatable` set.
+ */
+b32 GPU_updateImageRegion(GPU_Device device,
+                          GPU_Image image,
+                          u32 layer,
+                          u32 x,
+                          u32 y,
+                          u32 width,
+                          u32 height,
+                          Slice<u8> pixels,
+                          u32 rowPitch);
 b32 GPU_destroyImage(GPU_Device device, GPU_Image image);
+b32 GPU_createGlyphTable(GPU_Device device,
+                         Arena *arena,
+                         const GPU_GlyphTableDesc *desc,
+                         GPU_GlyphTable *out);
+/**
+ * Replaces the glyphs of the table starting at `idxFirst`.
+ */
+b32 GPU_updateGlyphTable(GPU_Device device,
+                         GPU_GlyphTable table,
+                         u32 idxFirst,
+                         Slice<GPU_Glyph> glyphs);
+b32 GPU_destroyGlyphTable(GPU_Device device, GPU_GlyphTable table);
 b32 GPU_destroy(GPU_Device device);
 
 b32 GPU_createSurface(GPU_Device device,
@@ -164,12 +259,28 @@ void Surface_destroy(GPU_Surface self);
 b32 Surface_isCapturingMouse(GPU_Surface surface);
 b32 Surface_captureMouse(GPU_Surface pWnd);
 b32 Surface_releaseMouse(GPU_Surface pWnd);
+/**
+ * Changes the mouse cursor while it is over the surface.
+ */
+b32 Surface_setCursor(GPU_Surface surface, GPU_Cursor cursor);
 b32 Surface_wasClosed(GPU_Surface surface);
 b32 Surface_getSize(GPU_Surface surface, i32 *w, i32 *h);
+/**
+ * Returns what the last GPU_submit drew on a headless surface: RGBA with 8
+ * bits per channel in sRGB, rows top to bottom. The pixels stay valid until
+ * the next submit. Empty for other kinds of surfaces.
+ */
+Slice<u8> Surface_getPixels(GPU_Surface surface);
 
 Slice<GPU_Event> Surface_getEvents(GPU_Device device,
                                    Arena *arena,
                                    GPU_Surface surface);
+/**
+ * Blocks until Surface_getEvents has something to return or `timeoutMs`
+ * milliseconds have passed.
+ * @returns Whether there are events waiting.
+ */
+b32 Surface_waitForEvents(GPU_Surface surface, u32 timeoutMs);
 
 b32 Surface_setCurrentImage(GPU_Surface surface, u32 idxColor, u32 idxDepth);
 
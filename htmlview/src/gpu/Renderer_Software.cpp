@@ -0,0 +1,1428 @@
+// NOTE: these come first because std/vec.h defines min and max as
+// macros, which the standard library headers don't survive
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "gpu/Renderer.hpp"
+#include "log/log.h"
+#include "std/Check.h"
+#include "std/Chronometry.h"
+#include "std/Utils.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: this backend draws into memory on the CPU. It follows the
+// D3D11 backend and shaders.hlsl closely enough that pages look the same:
+// white clear, no depth test, back faces (counter-clockwise on the screen)
+// culled, bilinear wrap sampling of the red channel and source-over blending
+// in linear space on an sRGB target.
+//
+// Differences from the GPU: the pixels between draws are kept as linear
+// floats instead of 8-bit sRGB, and attributes are interpolated affinely,
+// which is exact as long as the projection leaves w at 1 (it does for pages).
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define GPU_SOFT_SSE2 (1)
+#include <emmintrin.h>
+#else
+#define GPU_SOFT_SSE2 (0)
+#endif
+
+// Side of the square tiles the surface is split into. A tile is rasterized
+// start to finish by a single thread, so tiles need no synchronization.
+#define TILE_SIZE (64)
+#define TILE_NUM_PIXELS (TILE_SIZE * TILE_SIZE)
+#define MAX_WORKERS (16)
+
+// Size of the table that gives a first guess when encoding linear values to
+// sRGB
+#define SRGB_ENCODE_LUT_SIZE (4096)
+
+struct GPU_Mesh_t {
+  GPU_Vertex *vertices;
+  u32 numVertices;
+  u32 *indices;
+  u32 numIndices;
+  GPU_GlyphInstance *glyphs;
+  u32 numGlyphs;
+};
+
+struct GPU_GlyphTable_t {
+  GPU_Glyph *glyphs;
+  u32 capacity;
+};
+
+struct GPU_Image_t {
+  GPU_PixelFormat format;
+  u32 width, height;
+  u32 numLayers;
+  u32 bytesPerPixel;
+  // The layers one after the other, rows top to bottom
+  u8 *pixels;
+};
+
+/**
+ * The colors of the tile a worker is rasterizing. Each channel is a separate
+ * plane and the pixels are stored 2x2 quad by 2x2 quad, so that one SIMD
+ * register holds a quad.
+ */
+struct TileBuffer {
+  f32 *r, *g, *b, *a;
+};
+
+struct RasterJob;
+
+/**
+ * The threads that rasterize tiles besides the one calling GPU_submit. They
+ * live as long as the device and wait for a job between submits.
+ */
+struct WorkerPool {
+  std::mutex mutex;
+  std::condition_variable jobPosted;
+  std::condition_variable jobDone;
+
+  // The job of the current submit, or null between submits
+  RasterJob *job;
+  // Incremented for every job, so that a worker takes each job once
+  u64 idxJob;
+  // Workers that haven't finished the current job yet
+  u32 numBusy;
+  b32 isQuitting;
+
+  // Worker i rasterizes into tile buffer i + 1
+  std::thread threads[MAX_WORKERS - 1];
+  u32 numThreads;
+};
+
+struct GPU_Device_t {
+  u32 numWorkers;
+  TileBuffer tiles[MAX_WORKERS];
+  // NOTE: on the heap, since the arena never runs its constructor
+  WorkerPool *pool;
+
+  b32 hasLastFrame;
+  TimePoint timeLastFrame;
+
+  // Texel values to the values seen by the shader
+  f32 unormDecode[256];
+  f32 srgbDecode[256];
+  u8 srgbEncode[SRGB_ENCODE_LUT_SIZE];
+  // srgbEncodeMin[i] is the smallest linear value encoded as `i`
+  f32 srgbEncodeMin[257];
+};
+
+struct GPU_Surface_t {
+  GPU_SurfaceKind kind;
+
+  u32 width, height;
+  // RGBA, rows top to bottom
+  u8 *pixels;
+};
+
+// ----------------------------------------------------------------------------
+// Four lanes of f32; a lane of a comparison result is all ones or all zeros
+// ----------------------------------------------------------------------------
+
+#if GPU_SOFT_SSE2
+struct f32x4 {
+  __m128 v;
+};
+
+static inline f32x4 f32x4_set1(f32 x) {
+  return {_mm_set1_ps(x)};
+}
+
+static inline f32x4 f32x4_set(f32 x0, f32 x1, f32 x2, f32 x3) {
+  return {_mm_setr_ps(x0, x1, x2, x3)};
+}
+
+static inline f32x4 f32x4_load(const f32 *src) {
+  return {_mm_load_ps(src)};
+}
+
+static inline void f32x4_store(f32 *dst, f32x4 x) {
+  _mm_store_ps(dst, x.v);
+}
+
+static inline f32x4 f32x4_add(f32x4 a, f32x4 b) {
+  return {_mm_add_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_sub(f32x4 a, f32x4 b) {
+  return {_mm_sub_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_mul(f32x4 a, f32x4 b) {
+  return {_mm_mul_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_div(f32x4 a, f32x4 b) {
+  return {_mm_div_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_min(f32x4 a, f32x4 b) {
+  return {_mm_min_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) {
+  return {_mm_max_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_cmpgt(f32x4 a, f32x4 b) {
+  return {_mm_cmpgt_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_cmpeq(f32x4 a, f32x4 b) {
+  return {_mm_cmpeq_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_cmpneq(f32x4 a, f32x4 b) {
+  return {_mm_cmpneq_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_and(f32x4 a, f32x4 b) {
+  return {_mm_and_ps(a.v, b.v)};
+}
+
+static inline f32x4 f32x4_or(f32x4 a, f32x4 b) {
+  return {_mm_or_ps(a.v, b.v)};
+}
+
+/**
+ * Picks the lanes of `a` where `mask` is set and those of `b` elsewhere.
+ */
+static inline f32x4 f32x4_select(f32x4 mask, f32x4 a, f32x4 b) {
+  return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+}
+
+/**
+ * Bit `i` of the result is set when lane `i` of `mask` is set.
+ */
+static inline u32 f32x4_movemask(f32x4 mask) {
+  return (u32)_mm_movemask_ps(mask.v);
+}
+
+static inline f32x4 f32x4_abs(f32x4 x) {
+  return {_mm_andnot_ps(_mm_set1_ps(-0.0f), x.v)};
+}
+
+static inline f32x4 f32x4_floor(f32x4 x) {
+  // Truncation rounds negative numbers up; step those back by one
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x.v));
+  return {_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x.v), _mm_set1_ps(1)))};
+}
+
+/**
+ * Differences between the lanes across the quad; lanes 0 and 1 are the top
+ * row of the quad and lanes 2 and 3 the bottom one. Like the coarse
+ * derivatives of a GPU, the same value is returned in every lane.
+ */
+static inline f32x4 f32x4_ddx(f32x4 x) {
+  return {_mm_sub_ps(_mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(1, 1, 1, 1)),
+                     _mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(0, 0, 0, 0)))};
+}
+
+static inline f32x4 f32x4_ddy(f32x4 x) {
+  return {_mm_sub_ps(_mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(2, 2, 2, 2)),
+                     _mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(0, 0, 0, 0)))};
+}
+#else
+union f32x4 {
+  f32 f[4];
+  u32 u[4];
+};
+
+static inline f32x4 f32x4_set1(f32 x) {
+  f32x4 ret;
+  for (u32 i = 0; i < 4; i++) {
+    ret.f[i] = x;
+  }
+  return ret;
+}
+
+static inline f32x4 f32x4_set(f32 x0, f32 x1, f32 x2, f32 x3) {
+  f32x4 ret;
+  ret.f[0] = x0;
+  ret.f[1] = x1;
+  ret.f[2] = x2;
+  ret.f[3] = x3;
+  return ret;
+}
+
+static inline f32x4 f32x4_load(const f32 *src) {
+  f32x4 ret;
+  memcpy(ret.f, src, sizeof(ret.f));
+  return ret;
+}
+
+static inline void f32x4_store(f32 *dst, f32x4 x) {
+  memcpy(dst, x.f, sizeof(x.f));
+}
+
+#define F32X4_LANEWISE(name, expr)                \
+  static inline f32x4 name(f32x4 a, f32x4 b) {    \
+    f32x4 ret;                                    \
+    for (u32 i = 0; i < 4; i++) {                 \
+      expr;                                       \
+    }                                             \
+    return ret;                                   \
+  }
+
+F32X4_LANEWISE(f32x4_add, ret.f[i] = a.f[i] + b.f[i])
+F32X4_LANEWISE(f32x4_sub, ret.f[i] = a.f[i] - b.f[i])
+F32X4_LANEWISE(f32x4_mul, ret.f[i] = a.f[i] * b.f[i])
+F32X4_LANEWISE(f32x4_div, ret.f[i] = a.f[i] / b.f[i])
+F32X4_LANEWISE(f32x4_min, ret.f[i] = a.f[i] < b.f[i] ? a.f[i] : b.f[i])
+F32X4_LANEWISE(f32x4_max, ret.f[i] = a.f[i] > b.f[i] ? a.f[i] : b.f[i])
+F32X4_LANEWISE(f32x4_cmpgt, ret.u[i] = a.f[i] > b.f[i] ? ~0u : 0)
+F32X4_LANEWISE(f32x4_cmpeq, ret.u[i] = a.f[i] == b.f[i] ? ~0u : 0)
+F32X4_LANEWISE(f32x4_cmpneq, ret.u[i] = a.f[i] != b.f[i] ? ~0u : 0)
+F32X4_LANEWISE(f32x4_and, ret.u[i] = a.u[i] & b.u[i])
+F32X4_LANEWISE(f32x4_or, ret.u[i] = a.u[i] | b.u[i])
+
+#undef F32X4_LANEWISE
+
+static inline f32x4 f32x4_select(f32x4 mask, f32x4 a, f32x4 b) {
+  f32x4 ret;
+  for (u32 i = 0; i < 4; i++) {
+    ret.u[i] = (mask.u[i] & a.u[i]) | (~mask.u[i] & b.u[i]);
+  }
+  return ret;
+}
+
+static inline u32 f32x4_movemask(f32x4 mask) {
+  u32 ret = 0;
+  for (u32 i = 0; i < 4; i++) {
+    ret |= (mask.u[i] >> 31) << i;
+  }
+  return ret;
+}
+
+static inline f32x4 f32x4_abs(f32x4 x) {
+  f32x4 ret;
+  for (u32 i = 0; i < 4; i++) {
+    ret.f[i] = fabsf(x.f[i]);
+  }
+  return ret;
+}
+
+static inline f32x4 f32x4_floor(f32x4 x) {
+  f32x4 ret;
+  for (u32 i = 0; i < 4; i++) {
+    ret.f[i] = floorf(x.f[i]);
+  }
+  return ret;
+}
+
+static inline f32x4 f32x4_ddx(f32x4 x) {
+  return f32x4_set1(x.f[1] - x.f[0]);
+}
+
+static inline f32x4 f32x4_ddy(f32x4 x) {
+  return f32x4_set1(x.f[2] - x.f[0]);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// sRGB
+// ----------------------------------------------------------------------------
+
+static f32 srgbToLinear(f32 x) {
+  if (x <= 0.04045f) {
+    return x / 12.92f;
+  }
+  return powf((x + 0.055f) / 1.055f, 2.4f);
+}
+
+static void initSrgbTables(GPU_Device device) {
+  for (u32 i = 0; i < 256; i++) {
+    device->unormDecode[i] = i / 255.0f;
+    device->srgbDecode[i] = srgbToLinear(i / 255.0f);
+  }
+
+  device->srgbEncodeMin[0] = -INFINITY;
+  for (u32 i = 1; i < 256; i++) {
+    device->srgbEncodeMin[i] = srgbToLinear((i - 0.5f) / 255.0f);
+  }
+  device->srgbEncodeMin[256] = INFINITY;
+
+  u32 code = 0;
+  for (u32 i = 0; i < SRGB_ENCODE_LUT_SIZE; i++) {
+    f32 x = i / (f32)(SRGB_ENCODE_LUT_SIZE - 1);
+    while (device->srgbEncodeMin[code + 1] <= x) {
+      code++;
+    }
+    device->srgbEncode[i] = (u8)code;
+  }
+}
+
+static inline u8 encodeSrgb(const GPU_Device_t *device, f32 x) {
+  x = x < 0 ? 0 : (x > 1 ? 1 : x);
+  // The table is only a guess for the values between two of its entries;
+  // the thresholds settle it
+  u32 code =
+      device->srgbEncode[(u32)(x * (SRGB_ENCODE_LUT_SIZE - 1) + 0.5f)];
+  if (x < device->srgbEncodeMin[code]) {
+    code--;
+  } else if (device->srgbEncodeMin[code + 1] <= x) {
+    code++;
+  }
+  return (u8)code;
+}
+
+// ----------------------------------------------------------------------------
+// Device and resources
+// ----------------------------------------------------------------------------
+
+static void poolWorkerMain(GPU_Device device, u32 idxTile);
+
+b32 GPU_create(Arena *arena, GPU_Device *out) {
+  GPU_Device device = alloc<GPU_Device_t>(arena);
+
+  u32 numCores = std::thread::hardware_concurrency();
+  numCores = numCores != 0 ? numCores : 1;
+  device->numWorkers = numCores < MAX_WORKERS ? numCores : MAX_WORKERS;
+
+  for (u32 i = 0; i < device->numWorkers; i++) {
+    TileBuffer *tile = &device->tiles[i];
+    f32 *planes = (f32 *)allocNZ(arena, sizeof(f32), 16, 4 * TILE_NUM_PIXELS);
+    tile->r = planes + 0 * TILE_NUM_PIXELS;
+    tile->g = planes + 1 * TILE_NUM_PIXELS;
+    tile->b = planes + 2 * TILE_NUM_PIXELS;
+    tile->a = planes + 3 * TILE_NUM_PIXELS;
+  }
+
+  initSrgbTables(device);
+
+  // The calling thread of GPU_submit is the first worker
+  WorkerPool *pool = new WorkerPool();
+  device->pool = pool;
+  pool->numThreads = device->numWorkers - 1;
+  for (u32 i = 0; i < pool->numThreads; i++) {
+    pool->threads[i] = std::thread(poolWorkerMain, device, i + 1);
+  }
+
+  log_info("Software renderer: %u worker threads, %s", device->numWorkers,
+           GPU_SOFT_SSE2 ? "SSE2" : "scalar");
+
+  *out = device;
+  return true;
+}
+
+b32 GPU_destroy(GPU_Device device) {
+  WorkerPool *pool = device->pool;
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->isQuitting = true;
+  }
+  pool->jobPosted.notify_all();
+  for (u32 i = 0; i < pool->numThreads; i++) {
+    pool->threads[i].join();
+  }
+
+  delete pool;
+  device->pool = nullptr;
+  return true;
+}
+
+// NOTE: meshes and images live on the heap rather than in the arena
+// passed by the caller, the same way the D3D11 backend keeps them in GPU
+// memory; the arena only holds the handle.
+
+b32 GPU_createMesh(GPU_Device device,
+                   Arena *arena,
+                   const GPU_MeshDesc *desc,
+                   GPU_Mesh *out) {
+  u64 sizVertices = u64(desc->vertexData.length) * sizeof(GPU_Vertex);
+  u64 sizIndices = u64(desc->indices.length) * sizeof(u32);
+  u64 sizGlyphs = u64(desc->glyphs.length) * sizeof(GPU_GlyphInstance);
+  u64 sizStorage = sizVertices + sizIndices + sizGlyphs;
+  u8 *storage = (u8 *)malloc(sizStorage);
+  if (storage == nullptr && sizStorage != 0) {
+    return false;
+  }
+
+  GPU_Mesh mesh = alloc<GPU_Mesh_t>(arena);
+  mesh->vertices = (GPU_Vertex *)storage;
+  mesh->numVertices = desc->vertexData.length;
+  mesh->indices = (u32 *)(storage + sizVertices);
+  mesh->numIndices = desc->indices.length;
+  mesh->glyphs = (GPU_GlyphInstance *)(storage + sizVertices + sizIndices);
+  mesh->numGlyphs = desc->glyphs.length;
+  if (sizVertices != 0) {
+    memcpy(mesh->vertices, desc->vertexData.data, sizVertices);
+  }
+  if (sizIndices != 0) {
+    memcpy(mesh->indices, desc->indices.data, sizIndices);
+  }
+  if (sizGlyphs != 0) {
+    memcpy(mesh->glyphs, desc->glyphs.data, sizGlyphs);
+  }
+
+  *out = mesh;
+  return true;
+}
+
+b32 GPU_destroyMesh(GPU_Device device, GPU_Mesh mesh) {
+  free(mesh->vertices);
+  mesh->vertices = nullptr;
+  mesh->indices = nullptr;
+  mesh->glyphs = nullptr;
+  return true;
+}
+
+b32 GPU_createGlyphTable(GPU_Device device,
+                         Arena *arena,
+                         const GPU_GlyphTableDesc *desc,
+                         GPU_GlyphTable *out) {
+  GPU_Glyph *glyphs = (GPU_Glyph *)calloc(desc->capacity, sizeof(GPU_Glyph));
+  if (glyphs == nullptr && desc->capacity != 0) {
+    return false;
+  }
+
+  GPU_GlyphTable table = alloc<GPU_GlyphTable_t>(arena);
+  table->glyphs = glyphs;
+  table->capacity = desc->capacity;
+
+  *out = table;
+  return true;
+}
+
+b32 GPU_updateGlyphTable(GPU_Device device,
+                         GPU_GlyphTable table,
+                         u32 idxFirst,
+                         Slice<GPU_Glyph> glyphs) {
+  if (idxFirst + glyphs.length > table->capacity) {
+    return false;
+  }
+
+  if (glyphs.length != 0) {
+    memcpy(table->glyphs + idxFirst, glyphs.data,
+           glyphs.length * sizeof(GPU_Glyph));
+  }
+  return true;
+}
+
+b32 GPU_destroyGlyphTable(GPU_Device device, GPU_GlyphTable table) {
+  free(table->glyphs);
+  table->glyphs = nullptr;
+  table->capacity = 0;
+  return true;
+}
+
+b32 GPU_createImage(GPU_Device device,
+                    Arena *arena,
+                    const GPU_ImageDesc *image,
+                    GPU_Image *out) {
+  u32 bytesPerPixel;
+  switch (image->format) {
+    case GPU_PixelFormat::R8G8B8A8:
+      bytesPerPixel = 4;
+      break;
+    case GPU_PixelFormat::R8:
+      bytesPerPixel = 1;
+      break;
+    default:
+      TODO();
+      return false;
+  }
+
+  u32 numLayers = max(image->numLayers, 1u);
+  u64 siz = u64(bytesPerPixel) * image->width * image->height * numLayers;
+  if (image->pixels.length < siz) {
+    log_error("GPU_createImage: %u bytes of pixels given, %llu needed",
+              image->pixels.length, (unsigned long long)siz);
+    return false;
+  }
+
+  u8 *pixels = (u8 *)malloc(siz);
+  if (pixels == nullptr && siz != 0) {
+    return false;
+  }
+  if (siz != 0) {
+    memcpy(pixels, image->pixels.data, siz);
+  }
+
+  GPU_Image i = alloc<GPU_Image_t>(arena);
+  i->format = image->format;
+  i->width = image->width;
+  i->height = image->height;
+  i->numLayers = numLayers;
+  i->bytesPerPixel = bytesPerPixel;
+  i->pixels = pixels;
+  *out = i;
+  return true;
+}
+
+b32 GPU_destroyImage(GPU_Device device, GPU_Image image) {
+  CHECK(image->pixels || image->width * image->height == 0);
+  free(image->pixels);
+  image->pixels = nullptr;
+  return true;
+}
+
+b32 GPU_discardUpdateImage(GPU_Device device,
+                           GPU_Image image,
+                           u32 idxSubresource,
+                           Slice<u8> newContents,
+                           u32 numRows,
+                           u32 rowPitch) {
+  if (idxSubresource >= image->numLayers) {
+    return false;
+  }
+
+  u32 pitch = image->bytesPerPixel * image->width;
+  u32 numCopied = min(numRows, image->height);
+  u32 sizRow = min(pitch, rowPitch);
+  u8 *dst = image->pixels + u64(idxSubresource) * pitch * image->height;
+  for (u32 row = 0; row < numCopied; row++) {
+    memcpy(dst + u64(row) * pitch, &newContents[row * rowPitch], sizRow);
+  }
+
+  return true;
+}
+
+b32 GPU_updateImageRegion(GPU_Device device,
+                          GPU_Image image,
+                          u32 layer,
+                          u32 x,
+                          u32 y,
+                          u32 width,
+                          u32 height,
+                          Slice<u8> pixels,
+                          u32 rowPitch) {
+  if (width == 0 || height == 0) {
+    return true;
+  }
+  if (layer >= image->numLayers || x + width > image->width ||
+      y + height > image->height) {
+    return false;
+  }
+
+  u32 pitch = image->bytesPerPixel * image->width;
+  u32 sizRow = image->bytesPerPixel * width;
+  u8 *dst = image->pixels + u64(layer) * pitch * image->height +
+            u64(y) * pitch + x * image->bytesPerPixel;
+  for (u32 row = 0; row < height; row++) {
+    memcpy(dst + u64(row) * pitch, &pixels[row * rowPitch], sizRow);
+  }
+
+  return true;
+}
+
+void *GPU_getRawHandle(GPU_Image image) {
+  return image->pixels;
+}
+
+b32 GPU_getRawHandle(GPU_Device device, void **out) {
+  if (!device || !out) {
+    return false;
+  }
+
+  *out = device;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Surfaces
+// ----------------------------------------------------------------------------
+
+b32 GPU_createSurface(GPU_Device device,
+                      Arena *arena,
+                      const GPU_SurfaceDesc *desc,
+                      GPU_Surface *out) {
+  switch (desc->kind) {
+    case GSK_Headless: {
+      auto *headless = (const GPU_HeadlessSurfaceDesc *)desc;
+      if (headless->width == 0 || headless->height == 0) {
+        return false;
+      }
+
+      u64 siz = u64(headless->width) * headless->height * 4;
+      u8 *pixels = (u8 *)malloc(siz);
+      if (pixels == nullptr) {
+        return false;
+      }
+      memset(pixels, 0xFF, siz);
+
+      GPU_Surface surface = alloc<GPU_Surface_t>(arena);
+      surface->kind = GSK_Headless;
+      surface->width = headless->width;
+      surface->height = headless->height;
+      surface->pixels = pixels;
+      *out = surface;
+      return true;
+    }
+    default:
+      log_error("The software renderer can only create headless surfaces");
+      return false;
+  }
+}
+
+void Surface_destroy(GPU_Surface self) {
+  free(self->pixels);
+  self->pixels = nullptr;
+}
+
+Slice<u8> Surface_getPixels(GPU_Surface surface) {
+  if (surface->kind != GSK_Headless) {
+    return {};
+  }
+
+  return {surface->pixels, surface->width * surface->height * 4};
+}
+
+b32 Surface_isCapturingMouse(GPU_Surface surface) {
+  return false;
+}
+
+b32 Surface_captureMouse(GPU_Surface surface) {
+  return false;
+}
+
+b32 Surface_releaseMouse(GPU_Surface surface) {
+  return true;
+}
+
+b32 Surface_setCursor(GPU_Surface surface, GPU_Cursor cursor) {
+  return true;
+}
+
+b32 Surface_wasClosed(GPU_Surface surface) {
+  return false;
+}
+
+b32 Surface_getSize(GPU_Surface surface, i32 *w, i32 *h) {
+  *w = surface->width;
+  *h = surface->height;
+  return true;
+}
+
+Slice<GPU_Event> Surface_getEvents(GPU_Device device,
+                                   Arena *arena,
+                                   GPU_Surface surface) {
+  return {};
+}
+
+b32 Surface_waitForEvents(GPU_Surface surface, u32 timeoutMs) {
+  // Nothing ever sends events to a headless surface
+  std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+  return false;
+}
+
+b32 GPU_beginFrame(GPU_Device renderer, GPU_Surface surface, f32 *deltaTime) {
+  TimePoint now = chrono_getCurrentTime();
+  *deltaTime = 0;
+  if (renderer->hasLastFrame) {
+    *deltaTime = (f32)chrono_secondsBetween(renderer->timeLastFrame, now);
+  }
+  renderer->timeLastFrame = now;
+  renderer->hasLastFrame = true;
+  return true;
+}
+
+b32 GPU_present(GPU_Device renderer, GPU_Surface surface, u32 interval) {
+  // The pixels are already in memory by the end of GPU_submit
+  return true;
+}
+
+b32 GPU_present(GPU_Device renderer, GPU_Surface surface) {
+  return GPU_present(renderer, surface, 1);
+}
+
+// ----------------------------------------------------------------------------
+// Rasterization
+// ----------------------------------------------------------------------------
+
+enum TriangleAttribute {
+  TA_U,
+  TA_V,
+  TA_Layer,
+  TA_Red,
+  TA_Green,
+  TA_Blue,
+  TA_Alpha,
+  // color1.x; nonzero when the image holds distance fields
+  TA_DistanceField,
+
+  TA_Max
+};
+
+/**
+ * A triangle after the vertex stage, in pixels. Pixel (x, y) covers the
+ * square from (x, y) to (x + 1, y + 1) and is sampled at its center.
+ */
+struct Triangle {
+  // Edge i is inside where `edgeA[i] * (x - edgeX[i]) + edgeB[i] * (y -
+  // edgeY[i])` is positive, or zero on a top or left edge
+  f64 edgeA[3], edgeB[3], edgeX[3], edgeY[3];
+  b32 isTopLeft[3];
+
+  // Attribute k at (x, y) is
+  // `attrs[k] + attrDx[k] * (x - x0) + attrDy[k] * (y - y0)`
+  f32 x0, y0;
+  f32 attrs[TA_Max];
+  f32 attrDx[TA_Max];
+  f32 attrDy[TA_Max];
+
+  // The pixels that may be covered; the end is exclusive
+  i32 minX, minY, maxX, maxY;
+
+  const GPU_Image_t *image;
+  b32 isSrgb;
+};
+
+struct ScreenVertex {
+  f32 x, y;
+  f32 attrs[TA_Max];
+};
+
+static ScreenVertex transformVertex(const GPU_Vertex &v,
+                                    const mat4x4 &projection,
+                                    u32 width,
+                                    u32 height) {
+  // Same as the vertex shader: the position is float2(x, y), z = 0, w = 1
+  const mat4x4 &m = projection;
+  f32 clipX = v.position.x * m.c0.x + v.position.y * m.c1.x + m.c3.x;
+  f32 clipY = v.position.x * m.c0.y + v.position.y * m.c1.y + m.c3.y;
+  f32 clipW = v.position.x * m.c0.w + v.position.y * m.c1.w + m.c3.w;
+
+  ScreenVertex ret;
+  ret.x = (clipX / clipW + 1) * 0.5f * width;
+  ret.y = (1 - clipY / clipW) * 0.5f * height;
+  // Snapped to the subpixel precision of D3D11
+  ret.x = roundf(ret.x * 256) / 256;
+  ret.y = roundf(ret.y * 256) / 256;
+  ret.attrs[TA_U] = v.texcoord0.x;
+  ret.attrs[TA_V] = v.texcoord0.y;
+  ret.attrs[TA_Layer] = v.texcoord0.z;
+  ret.attrs[TA_Red] = v.color0.x;
+  ret.attrs[TA_Green] = v.color0.y;
+  ret.attrs[TA_Blue] = v.color0.z;
+  ret.attrs[TA_Alpha] = v.color0.w;
+  ret.attrs[TA_DistanceField] = v.color1.x;
+  return ret;
+}
+
+/**
+ * Expands the glyph instance into the corners of its quad the same way that
+ * vs_glyph does: top left, top right, bottom left and bottom right.
+ */
+static void expandGlyph(const GPU_GlyphInstance &instance,
+                        const GPU_Glyph &glyph,
+                        GPU_Vertex *corners) {
+  f32 scale = (f32)instance.scale / GPU_GLYPH_SCALE_ONE;
+  v4 color = {(f32)((instance.color >> 0) & 0xFF) / 255.0f,
+              (f32)((instance.color >> 8) & 0xFF) / 255.0f,
+              (f32)((instance.color >> 16) & 0xFF) / 255.0f,
+              (f32)((instance.color >> 24) & 0xFF) / 255.0f};
+  v4 imageKind = {glyph.isDistanceField != 0 ? 1.0f : 0.0f, 0, 0, 0};
+
+  for (u32 i = 0; i < 4; i++) {
+    b32 isRight = i & 1;
+    b32 isBottom = i >> 1;
+    f32 offsetX = isRight ? glyph.offset1.x : glyph.offset0.x;
+    f32 offsetY = isBottom ? glyph.offset1.y : glyph.offset0.y;
+    corners[i].position = {instance.position.x + scale * offsetX,
+                           instance.position.y + scale * offsetY, 0};
+    corners[i].texcoord0 = {isRight ? glyph.texcoord1.x : glyph.texcoord0.x,
+                            isBottom ? glyph.texcoord1.y : glyph.texcoord0.y,
+                            (f32)glyph.layer};
+    corners[i].color0 = color;
+    corners[i].color1 = imageKind;
+  }
+}
+
+static f32 clampf(f32 x, f32 lo, f32 hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+/**
+ * Sets up the triangle for rasterization.
+ * @returns Whether any of it may be visible; back faces and triangles without
+ * area or outside of the surface are dropped.
+ */
+static b32 Triangle_init(Triangle *self,
+                         const ScreenVertex *v,
+                         u32 width,
+                         u32 height) {
+  f32 e1x = v[1].x - v[0].x;
+  f32 e1y = v[1].y - v[0].y;
+  f32 e2x = v[2].x - v[0].x;
+  f32 e2y = v[2].y - v[0].y;
+  // Positive when the triangle is clockwise on the screen, which is the front
+  // face for the rasterizer state of the D3D11 backend
+  f64 area = f64(e1x) * e2y - f64(e2x) * e1y;
+  if (!(area > 0)) {
+    return false;
+  }
+
+  // Pixel centers inside of the bounding box
+  f32 minX = fminf(v[0].x, fminf(v[1].x, v[2].x));
+  f32 maxX = fmaxf(v[0].x, fmaxf(v[1].x, v[2].x));
+  f32 minY = fminf(v[0].y, fminf(v[1].y, v[2].y));
+  f32 maxY = fmaxf(v[0].y, fmaxf(v[1].y, v[2].y));
+  self->minX = (i32)ceilf(clampf(minX - 0.5f, -1, (f32)width));
+  self->maxX = (i32)floorf(clampf(maxX - 0.5f, -1, (f32)width)) + 1;
+  self->minY = (i32)ceilf(clampf(minY - 0.5f, -1, (f32)height));
+  self->maxY = (i32)floorf(clampf(maxY - 0.5f, -1, (f32)height)) + 1;
+  self->minX = max(self->minX, 0);
+  self->minY = max(self->minY, 0);
+  self->maxX = min(self->maxX, (i32)width);
+  self->maxY = min(self->maxY, (i32)height);
+  if (self->minX >= self->maxX || self->minY >= self->maxY) {
+    return false;
+  }
+
+  for (u32 i = 0; i < 3; i++) {
+    const ScreenVertex &a = v[i];
+    const ScreenVertex &b = v[(i + 1) % 3];
+    // NOTE: the vertices are on a 1/256 pixel grid, so the edge
+    // functions are exact in doubles anywhere near the surface. An edge
+    // shared by two triangles then gets exactly opposite values in both,
+    // and the top-left rule settles the pixels on it; there are no gaps and
+    // no pixels drawn twice.
+    self->edgeA[i] = f64(a.y) - b.y;
+    self->edgeB[i] = f64(b.x) - a.x;
+    self->edgeX[i] = a.x;
+    self->edgeY[i] = a.y;
+    // Going clockwise, left edges go up and top edges go right
+    self->isTopLeft[i] =
+        self->edgeA[i] > 0 || (self->edgeA[i] == 0 && self->edgeB[i] > 0);
+  }
+
+  self->x0 = v[0].x;
+  self->y0 = v[0].y;
+  for (u32 k = 0; k < TA_Max; k++) {
+    f32 d1 = v[1].attrs[k] - v[0].attrs[k];
+    f32 d2 = v[2].attrs[k] - v[0].attrs[k];
+    self->attrs[k] = v[0].attrs[k];
+    self->attrDx[k] = (f32)((d1 * e2y - d2 * e1y) / area);
+    self->attrDy[k] = (f32)((d2 * e1x - d1 * e2x) / area);
+  }
+
+  return true;
+}
+
+static inline f32x4 Triangle_attribute(const Triangle *self,
+                                       TriangleAttribute k,
+                                       f32x4 dx,
+                                       f32x4 dy) {
+  return f32x4_add(
+      f32x4_set1(self->attrs[k]),
+      f32x4_add(f32x4_mul(f32x4_set1(self->attrDx[k]), dx),
+                f32x4_mul(f32x4_set1(self->attrDy[k]), dy)));
+}
+
+/**
+ * Wrap addressing; `x` is moved into [0, size).
+ */
+static inline u32 wrapCoordinate(i32 x, u32 size) {
+  if ((u32)x < size) {
+    return x;
+  }
+  x %= (i32)size;
+  return x < 0 ? x + size : x;
+}
+
+/**
+ * Bilinear sample of the red channel of the image in every lane.
+ */
+static f32x4 Image_sample(const GPU_Image_t *image,
+                          const GPU_Device_t *device,
+                          b32 isSrgb,
+                          f32x4 u,
+                          f32x4 v,
+                          f32x4 layer) {
+  if (image == nullptr || image->width == 0 || image->height == 0) {
+    return f32x4_set1(0);
+  }
+
+  // Single channel images have no sRGB view
+  const f32 *decode = isSrgb && image->bytesPerPixel == 4
+                          ? device->srgbDecode
+                          : device->unormDecode;
+  u32 bpp = image->bytesPerPixel;
+  u32 pitch = image->width * bpp;
+
+  f32x4 tx = f32x4_sub(f32x4_mul(u, f32x4_set1((f32)image->width)),
+                       f32x4_set1(0.5f));
+  f32x4 ty = f32x4_sub(f32x4_mul(v, f32x4_set1((f32)image->height)),
+                       f32x4_set1(0.5f));
+  f32x4 fx0 = f32x4_floor(tx);
+  f32x4 fy0 = f32x4_floor(ty);
+  f32x4 wx = f32x4_sub(tx, fx0);
+  f32x4 wy = f32x4_sub(ty, fy0);
+
+  alignas(16) f32 x0[4], y0[4], layers[4];
+  alignas(16) f32 t00[4], t10[4], t01[4], t11[4];
+  f32x4_store(x0, fx0);
+  f32x4_store(y0, fy0);
+  f32x4_store(layers, layer);
+  for (u32 i = 0; i < 4; i++) {
+    // Like the GPU, the layer is rounded and clamped; the coordinates are
+    // kept in range so that the conversions are defined
+    f32 l = clampf(floorf(layers[i] + 0.5f), 0, (f32)(image->numLayers - 1));
+    i32 x = (i32)clampf(x0[i], -65536.0f, 65536.0f);
+    i32 y = (i32)clampf(y0[i], -65536.0f, 65536.0f);
+    u32 xa = wrapCoordinate(x, image->width) * bpp;
+    u32 xb = wrapCoordinate(x + 1, image->width) * bpp;
+    const u8 *base = image->pixels + u64(l) * pitch * image->height;
+    const u8 *rowA = base + u64(wrapCoordinate(y, image->height)) * pitch;
+    const u8 *rowB = base + u64(wrapCoordinate(y + 1, image->height)) * pitch;
+    t00[i] = decode[rowA[xa]];
+    t10[i] = decode[rowA[xb]];
+    t01[i] = decode[rowB[xa]];
+    t11[i] = decode[rowB[xb]];
+  }
+
+  f32x4 top = f32x4_load(t00);
+  top = f32x4_add(top, f32x4_mul(wx, f32x4_sub(f32x4_load(t10), top)));
+  f32x4 bottom = f32x4_load(t01);
+  bottom =
+      f32x4_add(bottom, f32x4_mul(wx, f32x4_sub(f32x4_load(t11), bottom)));
+  return f32x4_add(top, f32x4_mul(wy, f32x4_sub(bottom, top)));
+}
+
+static inline f32x4 smoothstep(f32x4 e0, f32x4 e1, f32x4 x) {
+  f32x4 t = f32x4_div(f32x4_sub(x, e0), f32x4_sub(e1, e0));
+  t = f32x4_min(f32x4_max(t, f32x4_set1(0)), f32x4_set1(1));
+  return f32x4_mul(f32x4_mul(t, t),
+                   f32x4_sub(f32x4_set1(3), f32x4_mul(f32x4_set1(2), t)));
+}
+
+/**
+ * Index of the pixel at (x, y), relative to the tile, in the planes of a
+ * TileBuffer.
+ */
+static inline u32 tilePixelIndex(u32 x, u32 y) {
+  return ((y >> 1) * (TILE_SIZE / 2) + (x >> 1)) * 4 + (y & 1) * 2 + (x & 1);
+}
+
+static void rasterizeTriangle(const GPU_Device_t *device,
+                              TileBuffer *tile,
+                              i32 tileX,
+                              i32 tileY,
+                              const Triangle *tri) {
+  // Quads of the tile that the triangle may cover
+  i32 x0 = max(tri->minX, tileX) & ~1;
+  i32 y0 = max(tri->minY, tileY) & ~1;
+  i32 x1 = min(tri->maxX, tileX + TILE_SIZE);
+  i32 y1 = min(tri->maxY, tileY + TILE_SIZE);
+
+  const f32x4 laneX = f32x4_set(0.5f, 1.5f, 0.5f, 1.5f);
+  const f32x4 laneY = f32x4_set(0.5f, 0.5f, 1.5f, 1.5f);
+  const f32x4 zero = f32x4_set1(0);
+  const f32x4 one = f32x4_set1(1);
+  const f32x4 allOnes = f32x4_cmpeq(zero, zero);
+
+  f32x4 topLeft[3];
+  for (u32 i = 0; i < 3; i++) {
+    topLeft[i] = tri->isTopLeft[i] ? allOnes : zero;
+  }
+
+  for (i32 y = y0; y < y1; y += 2) {
+    f32x4 py = f32x4_add(f32x4_set1((f32)y), laneY);
+
+    // The edge functions at the center of the first pixel of the row; they
+    // step exactly in doubles. Only their sign matters, which survives the
+    // conversion to f32.
+    f64 rowEdge[3];
+    for (u32 i = 0; i < 3; i++) {
+      rowEdge[i] = tri->edgeA[i] * (x0 + 0.5 - tri->edgeX[i]) +
+                   tri->edgeB[i] * (y + 0.5 - tri->edgeY[i]);
+    }
+
+    for (i32 x = x0; x < x1; x += 2) {
+      f32x4 px = f32x4_add(f32x4_set1((f32)x), laneX);
+
+      f32x4 inside = allOnes;
+      for (u32 i = 0; i < 3; i++) {
+        f64 e0 = rowEdge[i];
+        f64 e1 = e0 + tri->edgeA[i];
+        f64 e2 = e0 + tri->edgeB[i];
+        f64 e3 = e1 + tri->edgeB[i];
+        rowEdge[i] = e1 + tri->edgeA[i];
+
+        f32x4 e = f32x4_set((f32)e0, (f32)e1, (f32)e2, (f32)e3);
+        f32x4 onEdge = f32x4_and(f32x4_cmpeq(e, zero), topLeft[i]);
+        inside = f32x4_and(inside, f32x4_or(f32x4_cmpgt(e, zero), onEdge));
+      }
+      if (f32x4_movemask(inside) == 0) {
+        continue;
+      }
+
+      f32x4 dx = f32x4_sub(px, f32x4_set1(tri->x0));
+      f32x4 dy = f32x4_sub(py, f32x4_set1(tri->y0));
+
+      u32 idx = tilePixelIndex(x - tileX, y - tileY);
+
+      // The pixel shader; it runs on the whole quad so that the derivatives
+      // are defined
+      f32x4 mask = Image_sample(tri->image, device, tri->isSrgb,
+                                Triangle_attribute(tri, TA_U, dx, dy),
+                                Triangle_attribute(tri, TA_V, dx, dy),
+                                Triangle_attribute(tri, TA_Layer, dx, dy));
+      f32x4 isDistanceField = f32x4_cmpneq(
+          Triangle_attribute(tri, TA_DistanceField, dx, dy), zero);
+      if (f32x4_movemask(isDistanceField) != 0) {
+        // Must match SDF_ON_EDGE in shaders.hlsl
+        const f32x4 onEdge = f32x4_set1(128.0f / 255.0f);
+        f32x4 fwidth =
+            f32x4_add(f32x4_abs(f32x4_ddx(mask)), f32x4_abs(f32x4_ddy(mask)));
+        f32x4 edgeWidth = f32x4_max(f32x4_mul(f32x4_set1(0.5f), fwidth),
+                                    f32x4_set1(1.0f / 1024.0f));
+        f32x4 smoothed = smoothstep(f32x4_sub(onEdge, edgeWidth),
+                                    f32x4_add(onEdge, edgeWidth), mask);
+        mask = f32x4_select(isDistanceField, smoothed, mask);
+      }
+
+      f32x4 srcAlpha =
+          f32x4_mul(Triangle_attribute(tri, TA_Alpha, dx, dy), mask);
+      f32x4 dstFactor = f32x4_sub(one, srcAlpha);
+
+      f32 *planes[3] = {tile->r + idx, tile->g + idx, tile->b + idx};
+      TriangleAttribute channels[3] = {TA_Red, TA_Green, TA_Blue};
+      for (u32 c = 0; c < 3; c++) {
+        f32x4 src = Triangle_attribute(tri, channels[c], dx, dy);
+        f32x4 dst = f32x4_load(planes[c]);
+        f32x4 blended =
+            f32x4_add(f32x4_mul(src, srcAlpha), f32x4_mul(dst, dstFactor));
+        f32x4_store(planes[c], f32x4_select(inside, blended, dst));
+      }
+      // The alpha channel isn't blended
+      f32x4 dstAlpha = f32x4_load(tile->a + idx);
+      f32x4_store(tile->a + idx, f32x4_select(inside, srcAlpha, dstAlpha));
+    }
+  }
+}
+
+struct RasterJob {
+  const GPU_Device_t *device;
+  GPU_Surface surface;
+
+  const Triangle *triangles;
+  // Tile i draws the triangles `binTriangles[binOffsets[i]]` through
+  // `binTriangles[binOffsets[i + 1] - 1]`, in submission order
+  const u32 *binOffsets;
+  const u32 *binTriangles;
+
+  u32 numTilesX;
+  u32 numTiles;
+  std::atomic<u32> idxNextTile;
+};
+
+static void rasterizeTile(RasterJob *job, TileBuffer *tile, u32 idxTile) {
+  GPU_Surface surface = job->surface;
+  i32 tileX = (idxTile % job->numTilesX) * TILE_SIZE;
+  i32 tileY = (idxTile / job->numTilesX) * TILE_SIZE;
+  u32 width = min((u32)TILE_SIZE, surface->width - tileX);
+  u32 height = min((u32)TILE_SIZE, surface->height - tileY);
+  u32 pitch = surface->width * 4;
+  u8 *dst = surface->pixels + u64(tileY) * pitch + tileX * 4;
+
+  u32 idxBegin = job->binOffsets[idxTile];
+  u32 idxEnd = job->binOffsets[idxTile + 1];
+  if (idxBegin == idxEnd) {
+    // Nothing but the clear color
+    for (u32 y = 0; y < height; y++) {
+      memset(dst + u64(y) * pitch, 0xFF, width * 4);
+    }
+    return;
+  }
+
+  for (u32 i = 0; i < TILE_NUM_PIXELS; i++) {
+    tile->r[i] = 1;
+    tile->g[i] = 1;
+    tile->b[i] = 1;
+    tile->a[i] = 1;
+  }
+
+  for (u32 i = idxBegin; i < idxEnd; i++) {
+    rasterizeTriangle(job->device, tile, tileX, tileY,
+                      &job->triangles[job->binTriangles[i]]);
+  }
+
+  // Resolve quad by quad; most of a page is background, which is written
+  // without encoding it
+  const f32x4 one = f32x4_set1(1);
+  const u32 WHITE = 0xFFFFFFFF;
+  for (u32 y = 0; y < height; y += 2) {
+    for (u32 x = 0; x < width; x += 2) {
+      u32 idx = tilePixelIndex(x, y);
+      f32x4 isWhite = f32x4_and(
+          f32x4_and(f32x4_cmpeq(f32x4_load(tile->r + idx), one),
+                    f32x4_cmpeq(f32x4_load(tile->g + idx), one)),
+          f32x4_and(f32x4_cmpeq(f32x4_load(tile->b + idx), one),
+                    f32x4_cmpeq(f32x4_load(tile->a + idx), one)));
+      b32 allWhite = f32x4_movemask(isWhite) == 0xF;
+
+      for (u32 lane = 0; lane < 4; lane++) {
+        u32 px = x + (lane & 1);
+        u32 py = y + (lane >> 1);
+        if (px >= width || py >= height) {
+          continue;
+        }
+
+        u8 *pixel = dst + u64(py) * pitch + px * 4;
+        if (allWhite) {
+          memcpy(pixel, &WHITE, 4);
+          continue;
+        }
+        pixel[0] = encodeSrgb(job->device, tile->r[idx + lane]);
+        pixel[1] = encodeSrgb(job->device, tile->g[idx + lane]);
+        pixel[2] = encodeSrgb(job->device, tile->b[idx + lane]);
+        f32 alpha = clampf(tile->a[idx + lane], 0, 1);
+        pixel[3] = (u8)(alpha * 255 + 0.5f);
+      }
+    }
+  }
+}
+
+static void rasterWorkerMain(RasterJob *job, TileBuffer *tile) {
+  while (true) {
+    u32 idxTile = job->idxNextTile.fetch_add(1);
+    if (idxTile >= job->numTiles) {
+      break;
+    }
+    rasterizeTile(job, tile, idxTile);
+  }
+}
+
+static void poolWorkerMain(GPU_Device device, u32 idxTile) {
+  WorkerPool *pool = device->pool;
+  u64 idxLastJob = 0;
+  while (true) {
+    RasterJob *job;
+    {
+      std::unique_lock<std::mutex> lock(pool->mutex);
+      while (!pool->isQuitting && pool->idxJob == idxLastJob) {
+        pool->jobPosted.wait(lock);
+      }
+      if (pool->isQuitting) {
+        return;
+      }
+      idxLastJob = pool->idxJob;
+      job = pool->job;
+    }
+
+    rasterWorkerMain(job, &device->tiles[idxTile]);
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->numBusy--;
+    if (pool->numBusy == 0) {
+      pool->jobDone.notify_one();
+    }
+  }
+}
+
+b32 GPU_submit(GPU_Device renderer,
+               GPU_Surface surface,
+               Slice<GPU_RenderCmd> commands) {
+  if (surface->kind != GSK_Headless) {
+    return false;
+  }
+
+  ArenaTemp temp = getScratch(nullptr, 0);
+
+  // Upper bound on the number of triangles
+  u32 maxTriangles = 0;
+  {
+    GPU_Mesh mesh = nullptr;
+    for (u32 idxCmd = 0; idxCmd < commands.length; idxCmd++) {
+      auto &cmd = commands[idxCmd];
+      if (cmd.kind == GPU_CmdKind::BindMesh) {
+        mesh = cmd.bindMesh.mesh;
+      } else if (cmd.kind == GPU_CmdKind::RenderInstance && mesh) {
+        maxTriangles += mesh->numIndices / 3 + 2 * mesh->numGlyphs;
+      }
+    }
+  }
+
+  // The vertex stage; done here on the calling thread since it's a small
+  // fraction of the work for pages
+  Slice<Triangle> triangles;
+  allocNZ(temp.arena, maxTriangles, triangles);
+  u32 numTriangles = 0;
+  {
+    mat4x4 projection = mat4x4_id();
+    GPU_Mesh mesh = nullptr;
+    const GPU_GlyphTable_t *glyphTable = nullptr;
+    const GPU_Image_t *image = nullptr;
+    b32 isSrgb = false;
+    Slice<ScreenVertex> screenVertices = {};
+
+    for (u32 idxCmd = 0; idxCmd < commands.length; idxCmd++) {
+      auto &cmd = commands[idxCmd];
+
+      switch (cmd.kind) {
+        case GPU_CmdKind::BindImage: {
+          image = cmd.bindImage.image;
+          isSrgb = cmd.bindImage.colorSpace == GCS_Srgb;
+          break;
+        }
+        case GPU_CmdKind::BindMesh: {
+          mesh = cmd.bindMesh.mesh;
+          screenVertices = {};
+          break;
+        }
+        case GPU_CmdKind::SetView: {
+          projection = cmd.setView.projection;
+          screenVertices = {};
+          break;
+        }
+        case GPU_CmdKind::SetSurfaceConstants: {
+          // Nothing in the pixel shader reads them
+          break;
+        }
+        case GPU_CmdKind::BindGlyphTable: {
+          glyphTable = cmd.bindGlyphTable.table;
+          break;
+        }
+        case GPU_CmdKind::RenderInstance: {
+          if (!mesh) {
+            break;
+          }
+
+          if (mesh->numGlyphs != 0) {
+            if (!glyphTable) {
+              break;
+            }
+
+            for (u32 i = 0; i < mesh->numGlyphs; i++) {
+              const GPU_GlyphInstance &instance = mesh->glyphs[i];
+              if (instance.idxGlyph >= glyphTable->capacity) {
+                continue;
+              }
+
+              GPU_Vertex corners[4];
+              expandGlyph(instance, glyphTable->glyphs[instance.idxGlyph],
+                          corners);
+              ScreenVertex v[4];
+              for (u32 j = 0; j < 4; j++) {
+                v[j] = transformVertex(corners[j], projection, surface->width,
+                                       surface->height);
+              }
+
+              // The same two triangles as the strip
+              ScreenVertex halves[2][3] = {{v[0], v[1], v[2]},
+                                           {v[2], v[1], v[3]}};
+              for (u32 j = 0; j < 2; j++) {
+                Triangle *tri = &triangles[numTriangles];
+                if (Triangle_init(tri, halves[j], surface->width,
+                                  surface->height)) {
+                  tri->image = image;
+                  tri->isSrgb = isSrgb;
+                  numTriangles++;
+                }
+              }
+            }
+            break;
+          }
+
+          if (screenVertices.data == nullptr) {
+            allocNZ(temp.arena, mesh->numVertices, screenVertices);
+            for (u32 i = 0; i < mesh->numVertices; i++) {
+              screenVertices[i] =
+                  transformVertex(mesh->vertices[i], projection,
+                                  surface->width, surface->height);
+            }
+          }
+
+          for (u32 i = 0; i + 2 < mesh->numIndices; i += 3) {
+            ScreenVertex v[3];
+            b32 isValid = true;
+            for (u32 j = 0; j < 3; j++) {
+              u32 idxVertex = mesh->indices[i + j];
+              isValid = isValid && idxVertex < mesh->numVertices;
+              v[j] = isValid ? screenVertices[idxVertex] : ScreenVertex{};
+            }
+            if (!isValid) {
+              continue;
+            }
+
+            Triangle *tri = &triangles[numTriangles];
+            if (Triangle_init(tri, v, surface->width, surface->height)) {
+              tri->image = image;
+              tri->isSrgb = isSrgb;
+              numTriangles++;
+            }
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  // Bin the triangles by tile
+  u32 numTilesX = (surface->width + TILE_SIZE - 1) / TILE_SIZE;
+  u32 numTilesY = (surface->height + TILE_SIZE - 1) / TILE_SIZE;
+  u32 numTiles = numTilesX * numTilesY;
+
+  Slice<u32> binOffsets;
+  alloc(temp.arena, numTiles + 1, binOffsets);
+  for (u32 i = 0; i < numTriangles; i++) {
+    const Triangle &tri = triangles[i];
+    for (i32 ty = tri.minY / TILE_SIZE; ty <= (tri.maxY - 1) / TILE_SIZE;
+         ty++) {
+      for (i32 tx = tri.minX / TILE_SIZE; tx <= (tri.maxX - 1) / TILE_SIZE;
+           tx++) {
+        binOffsets[ty * numTilesX + tx + 1]++;
+      }
+    }
+  }
+  for (u32 i = 0; i < numTiles; i++) {
+    binOffsets[i + 1] += binOffsets[i];
+  }
+
+  Slice<u32> binTriangles, binCursors;
+  allocNZ(temp.arena, binOffsets[numTiles], binTriangles);
+  allocNZ(temp.arena, numTiles, binCursors);
+  memcpy(binCursors.data, binOffsets.data, numTiles * sizeof(u32));
+  for (u32 i = 0; i < numTriangles; i++) {
+    const Triangle &tri = triangles[i];
+    for (i32 ty = tri.minY / TILE_SIZE; ty <= (tri.maxY - 1) / TILE_SIZE;
+         ty++) {
+      for (i32 tx = tri.minX / TILE_SIZE; tx <= (tri.maxX - 1) / TILE_SIZE;
+           tx++) {
+        binTriangles[binCursors[ty * numTilesX + tx]++] = i;
+      }
+    }
+  }
+
+  RasterJob job;
+  job.device = renderer;
+  job.surface = surface;
+  job.triangles = triangles.data;
+  job.binOffsets = binOffsets.data;
+  job.binTriangles = binTriangles.data;
+  job.numTilesX = numTilesX;
+  job.numTiles = numTiles;
+  job.idxNextTile = 0;
+
+  // Every worker of the pool takes part, even if there are fewer tiles than
+  // workers; the ones without a tile are done right away
+  WorkerPool *pool = renderer->pool;
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->job = &job;
+    pool->idxJob++;
+    pool->numBusy = pool->numThreads;
+  }
+  pool->jobPosted.notify_all();
+  rasterWorkerMain(&job, &renderer->tiles[0]);
+  {
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (pool->numBusy != 0) {
+      pool->jobDone.wait(lock);
+    }
+    pool->job = nullptr;
+  }
+
+  releaseScratch(temp);
+  return true;
+}
@@ -11,23 +11,63 @@ cbuffer BatchConstants : register(b2) {}
 struct VertexOut {
   float4 position : SV_POSITION;
 
-  float2 uv : TEXCOORD0;
+  float3 uv : TEXCOORD0;
   float4 color0 : COLOR0;
+  // x is 1 if the image holds signed distance fields instead of coverage
+  float4 color1 : COLOR1;
 };
 
 SamplerState samplerBilinear : register(s0);
 
-Texture2D texImage : register(t0);
+Texture2DArray texImage : register(t0);
+
+// Same as GPU_Glyph
+struct Glyph {
+  float2 offset0;
+  float2 offset1;
+  float2 texcoord0;
+  float2 texcoord1;
+  uint layer;
+  uint isDistanceField;
+};
+
+StructuredBuffer<Glyph> glyphTable : register(t0);
 
 static const float PI = 3.14159265359f;
+// The value of a distance field on the outline; must match GLYPH_SDF_ON_EDGE
+static const float SDF_ON_EDGE = 128.0f / 255.0f;
+// Must match GPU_GLYPH_SCALE_ONE
+static const float GLYPH_SCALE_ONE = 4096.0f;
 
 VertexOut vs_main(float2 position: POSITION,
-                  float2 texcoord0: TEXCOORD0,
-                  float4 color0: COLOR0) {
+                  float3 texcoord0: TEXCOORD0,
+                  float4 color0: COLOR0,
+                  float4 color1: COLOR1) {
   VertexOut ret;
   ret.position = mul(float4(position, 0, 1), cameraToClip);
   ret.uv = texcoord0;
   ret.color0 = color0;
+  ret.color1 = color1;
+  return ret;
+}
+
+// Draws a glyph instance as a strip of two triangles; the corners are the
+// top left, top right, bottom left and bottom right one
+VertexOut vs_glyph(uint idxCorner: SV_VertexID,
+                   float2 position: POSITION,
+                   uint2 glyph: GLYPH,
+                   float4 color: COLOR0) {
+  Glyph g = glyphTable[glyph.x];
+  float scale = glyph.y / GLYPH_SCALE_ONE;
+  // Picks the right and bottom sides per component
+  bool2 isFar = bool2(idxCorner & 1, idxCorner >> 1);
+
+  VertexOut ret;
+  float2 offset = isFar ? g.offset1 : g.offset0;
+  ret.position = mul(float4(position + scale * offset, 0, 1), cameraToClip);
+  ret.uv = float3(isFar ? g.texcoord1 : g.texcoord0, g.layer);
+  ret.color0 = color;
+  ret.color1 = float4(g.isDistanceField != 0 ? 1 : 0, 0, 0, 0);
   return ret;
 }
 
@@ -35,5 +75,11 @@ VertexOut vs_main(float2 position: POSITION,
 
 float4 ps_main(VertexOut input) : SV_TARGET {
   float mask = texImage.Sample(samplerBilinear, input.uv).r;
+  // The outline is smoothed over about a pixel on the screen, however much
+  // the field is scaled
+  float edgeWidth = max(0.5f * fwidth(mask), 1.0f / 1024.0f);
+  if (input.color1.x != 0) {
+    mask = smoothstep(SDF_ON_EDGE - edgeWidth, SDF_ON_EDGE + edgeWidth, mask);
+  }
   return float4(input.color0.rgb, input.color0.a * mask);
 }
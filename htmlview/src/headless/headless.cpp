@@ -0,0 +1,467 @@
+#include "gpu/Renderer.hpp"
+#include "log/log.h"
+#include "std/Arena.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: draws a fixed scene with the software renderer into a headless
+// surface and writes what it drew into a PPM file, or compares it against one
+// written earlier. The scene touches every path of the rasterizer that pages
+// use: solid and textured triangles, translucent blending, glyphs from
+// coverage and from distance fields, and sRGB images.
+
+#define SURFACE_WIDTH (320)
+#define SURFACE_HEIGHT (200)
+// The workers are kept between submits, so the scene is drawn more than once
+// and every frame has to come out the same
+#define NUM_FRAMES (4)
+
+// Side of the layers of the mask image
+#define MASK_SIZE (64)
+
+enum MaskLayer {
+  ML_Solid,
+  ML_Disc,
+  ML_DiscDistance,
+
+  ML_Max
+};
+
+static Arena arenaPerm;
+static Arena arenaTemp;
+
+static void Arena_init(Arena *dst, u32 size) {
+  dst->beg = (u8 *)malloc(size);
+  if (dst->beg == nullptr) {
+    log_error("Can't allocate %u bytes", size);
+    exit(EXIT_FAILURE);
+  }
+  dst->end = dst->beg + size;
+}
+
+void handleOOM(Arena *arena) {
+  // The scene is fixed, so running out means the arenas are too small
+  log_error("Out of memory");
+  abort();
+}
+
+ArenaTemp getScratch(Arena **pConflicts, u32 numConflicts) {
+  ArenaTemp ret;
+  if (!pConflicts || numConflicts == 0 || pConflicts[0] != &arenaTemp) {
+    ret.arena = &arenaTemp;
+  } else {
+    ret.arena = &arenaPerm;
+  }
+  ret.saved = *ret.arena;
+  return ret;
+}
+
+static f32 clampf(f32 x, f32 lo, f32 hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+/**
+ * Fills the layers of an R8 image: white, a disc as coverage and the same
+ * disc as a distance field.
+ */
+static Slice<u8> makeMaskPixels(Arena *arena) {
+  const u32 sizLayer = MASK_SIZE * MASK_SIZE;
+  Slice<u8> pixels = {alloc<u8>(arena, ML_Max * sizLayer), ML_Max * sizLayer};
+
+  f32 center = MASK_SIZE * 0.5f;
+  for (u32 y = 0; y < MASK_SIZE; y++) {
+    for (u32 x = 0; x < MASK_SIZE; x++) {
+      f32 dx = x + 0.5f - center;
+      f32 dy = y + 0.5f - center;
+      f32 dist = sqrtf(dx * dx + dy * dy);
+      u32 idx = y * MASK_SIZE + x;
+
+      pixels[ML_Solid * sizLayer + idx] = 255;
+      pixels[ML_Disc * sizLayer + idx] =
+          (u8)(clampf(28.5f - dist, 0, 1) * 255 + 0.5f);
+      // The edge is at 128, like in the distance fields of the glyph atlas
+      pixels[ML_DiscDistance * sizLayer + idx] =
+          (u8)clampf(128 + (24 - dist) * 8, 0, 255);
+    }
+  }
+  return pixels;
+}
+
+/**
+ * Appends an axis aligned quad, wound like the quads of glyphs.
+ */
+static void appendQuad(GPU_Vertex *vertices,
+                       u32 *indices,
+                       u32 &numVertices,
+                       u32 &numIndices,
+                       v2 p0,
+                       v2 p1,
+                       MaskLayer layer,
+                       v4 color) {
+  u32 base = numVertices;
+  for (u32 i = 0; i < 4; i++) {
+    b32 isRight = i & 1;
+    b32 isBottom = i >> 1;
+    GPU_Vertex *v = &vertices[numVertices++];
+    v->position = {isRight ? p1.x : p0.x, isBottom ? p1.y : p0.y, 0};
+    v->texcoord0 = {isRight ? 1.0f : 0.0f, isBottom ? 1.0f : 0.0f,
+                    (f32)layer};
+    v->color0 = color;
+    v->color1 = {0, 0, 0, 0};
+  }
+
+  const u32 QUAD_INDICES[6] = {0, 1, 2, 2, 1, 3};
+  for (u32 i = 0; i < 6; i++) {
+    indices[numIndices++] = base + QUAD_INDICES[i];
+  }
+}
+
+struct Scene {
+  GPU_Image mask;
+  GPU_Image checker;
+  GPU_GlyphTable glyphTable;
+  GPU_Mesh shapes;
+  GPU_Mesh checkerQuad;
+  GPU_Mesh glyphs;
+};
+
+static b32 Scene_createImages(Scene *self,
+                              GPU_Device gpu,
+                              Arena *arena,
+                              Arena *temp) {
+  GPU_ImageDesc maskDesc = {};
+  maskDesc.format = GPU_PixelFormat::R8;
+  maskDesc.width = MASK_SIZE;
+  maskDesc.height = MASK_SIZE;
+  maskDesc.numLayers = ML_Max;
+  maskDesc.pixels = makeMaskPixels(temp);
+
+  // 4x4 texels in sRGB; only the red channel is sampled
+  u8 checkerPixels[4 * 4 * 4];
+  for (u32 i = 0; i < 16; i++) {
+    b32 isDark = ((i % 4) + (i / 4)) & 1;
+    u8 *texel = &checkerPixels[i * 4];
+    texel[0] = isDark ? 64 : 224;
+    texel[1] = texel[2] = 0;
+    texel[3] = 255;
+  }
+  GPU_ImageDesc checkerDesc = {};
+  checkerDesc.format = GPU_PixelFormat::R8G8B8A8;
+  checkerDesc.width = 4;
+  checkerDesc.height = 4;
+  checkerDesc.pixels = {checkerPixels, sizeof(checkerPixels)};
+
+  return GPU_createImage(gpu, arena, &maskDesc, &self->mask) &&
+         GPU_createImage(gpu, arena, &checkerDesc, &self->checker);
+}
+
+static b32 Scene_createGlyphTable(Scene *self, GPU_Device gpu, Arena *arena) {
+  GPU_GlyphTableDesc tableDesc = {};
+  tableDesc.capacity = 2;
+  if (!GPU_createGlyphTable(gpu, arena, &tableDesc, &self->glyphTable)) {
+    return false;
+  }
+
+  GPU_Glyph glyphs[2] = {};
+  for (u32 i = 0; i < 2; i++) {
+    glyphs[i].offset0 = {0, -16};
+    glyphs[i].offset1 = {16, 0};
+    glyphs[i].texcoord0 = {0, 0};
+    glyphs[i].texcoord1 = {1, 1};
+  }
+  glyphs[0].layer = ML_Disc;
+  glyphs[1].layer = ML_DiscDistance;
+  glyphs[1].isDistanceField = 1;
+  return GPU_updateGlyphTable(gpu, self->glyphTable, 0, {glyphs, 2});
+}
+
+static b32 Scene_createShapes(Scene *self,
+                              GPU_Device gpu,
+                              Arena *arena,
+                              Arena *temp) {
+  const u32 MAX_QUADS = 8;
+  GPU_Vertex *vertices = alloc<GPU_Vertex>(temp, 4 * MAX_QUADS);
+  u32 *indices = alloc<u32>(temp, 6 * MAX_QUADS + 3);
+  u32 numVertices = 0;
+  u32 numIndices = 0;
+
+  // A gradient; the colors of the corners are set after the quad is added
+  appendQuad(vertices, indices, numVertices, numIndices, {8, 8}, {312, 96},
+             ML_Solid, {1, 1, 1, 1});
+  vertices[0].color0 = {1, 0, 0, 1};
+  vertices[1].color0 = {0, 1, 0, 1};
+  vertices[2].color0 = {0, 0, 1, 1};
+  vertices[3].color0 = {1, 1, 0, 1};
+
+  // Translucent quads over the gradient and over each other
+  appendQuad(vertices, indices, numVertices, numIndices, {24, 24}, {104, 80},
+             ML_Solid, {1, 1, 1, 0.5f});
+  appendQuad(vertices, indices, numVertices, numIndices, {64, 40}, {144, 112},
+             ML_Solid, {0, 0, 0, 0.5f});
+  appendQuad(vertices, indices, numVertices, numIndices, {104.25f, 56.5f},
+             {184.75f, 128.25f}, ML_Solid, {0.2f, 0.4f, 0.8f, 0.75f});
+
+  // The disc magnified, so that it's sampled between texels
+  appendQuad(vertices, indices, numVertices, numIndices, {16, 120}, {88, 192},
+             ML_Disc, {0, 0, 0, 1});
+
+  // A sliver of a triangle, which is mostly edges
+  GPU_Vertex corners[3] = {};
+  corners[0].position = {200.5f, 110.25f, 0};
+  corners[1].position = {315.75f, 118, 0};
+  corners[2].position = {190, 197.5f, 0};
+  for (u32 i = 0; i < 3; i++) {
+    corners[i].texcoord0 = {0.5f, 0.5f, (f32)ML_Solid};
+    corners[i].color0 = {0.1f, 0.6f, 0.2f, 1};
+    indices[numIndices++] = numVertices;
+    vertices[numVertices++] = corners[i];
+  }
+
+  GPU_MeshDesc shapesDesc = {};
+  shapesDesc.vertexData = {vertices, numVertices};
+  shapesDesc.indices = {indices, numIndices};
+  if (!GPU_createMesh(gpu, arena, &shapesDesc, &self->shapes)) {
+    return false;
+  }
+
+  numVertices = 0;
+  numIndices = 0;
+  appendQuad(vertices, indices, numVertices, numIndices, {96, 136}, {152, 192},
+             ML_Solid, {1, 0.5f, 0, 1});
+  GPU_MeshDesc checkerQuadDesc = {};
+  checkerQuadDesc.vertexData = {vertices, numVertices};
+  checkerQuadDesc.indices = {indices, numIndices};
+  return GPU_createMesh(gpu, arena, &checkerQuadDesc, &self->checkerQuad);
+}
+
+static b32 Scene_createGlyphs(Scene *self, GPU_Device gpu, Arena *arena) {
+  // Both kinds of glyphs at sizes from smaller to larger than the mask
+  const u16 SCALES[] = {1024, 2048, 4096, 6144, 12288};
+  const u32 COLORS[] = {0xFF000000, 0xFF2040C0, 0x80FFFFFF, 0xC000A0FF};
+  const u32 NUM_SCALES = sizeof(SCALES) / sizeof(SCALES[0]);
+
+  GPU_GlyphInstance instances[2 * NUM_SCALES];
+  f32 x = 160;
+  for (u32 i = 0; i < 2 * NUM_SCALES; i++) {
+    GPU_GlyphInstance *instance = &instances[i];
+    u16 scale = SCALES[i % NUM_SCALES];
+    instance->position = {x, i < NUM_SCALES ? 60.0f : 100.0f};
+    instance->idxGlyph = i < NUM_SCALES ? 0 : 1;
+    instance->scale = scale;
+    instance->color = COLORS[i % 4];
+    x = i + 1 == NUM_SCALES ? 160 : x + 16.0f * scale / GPU_GLYPH_SCALE_ONE + 2;
+  }
+
+  GPU_MeshDesc glyphsDesc = {};
+  glyphsDesc.glyphs = {instances, 2 * NUM_SCALES};
+  return GPU_createMesh(gpu, arena, &glyphsDesc, &self->glyphs);
+}
+
+static b32 Scene_create(Scene *self, GPU_Device gpu, Arena *arena) {
+  ArenaTemp temp = getScratch(&arena, 1);
+  b32 ret = Scene_createImages(self, gpu, arena, temp.arena) &&
+            Scene_createGlyphTable(self, gpu, arena) &&
+            Scene_createShapes(self, gpu, arena, temp.arena) &&
+            Scene_createGlyphs(self, gpu, arena);
+  releaseScratch(temp);
+  return ret;
+}
+
+static Slice<GPU_RenderCmd> Scene_record(Scene *self, Arena *arena) {
+  const u32 MAX_COMMANDS = 16;
+  GPU_RenderCmd *commands = alloc<GPU_RenderCmd>(arena, MAX_COMMANDS);
+  u32 numCommands = 0;
+
+  // Surface pixels, with y going down like on pages
+  GPU_RenderCmd *cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::SetView;
+  cmd->setView.projection = mat4x4_id();
+  cmd->setView.projection.c0.x = 2.0f / SURFACE_WIDTH;
+  cmd->setView.projection.c1.y = -2.0f / SURFACE_HEIGHT;
+  cmd->setView.projection.c3.x = -1.0f;
+  cmd->setView.projection.c3.y = 1.0f;
+
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::BindImage;
+  cmd->bindImage.image = self->mask;
+  cmd->bindImage.colorSpace = GCS_Linear;
+
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::BindMesh;
+  cmd->bindMesh.mesh = self->shapes;
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::RenderInstance;
+  cmd->renderInstance = {};
+
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::BindGlyphTable;
+  cmd->bindGlyphTable.table = self->glyphTable;
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::BindMesh;
+  cmd->bindMesh.mesh = self->glyphs;
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::RenderInstance;
+  cmd->renderInstance = {};
+
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::BindImage;
+  cmd->bindImage.image = self->checker;
+  cmd->bindImage.colorSpace = GCS_Srgb;
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::BindMesh;
+  cmd->bindMesh.mesh = self->checkerQuad;
+  cmd = &commands[numCommands++];
+  cmd->kind = GPU_CmdKind::RenderInstance;
+  cmd->renderInstance = {};
+
+  return {commands, numCommands};
+}
+
+static void Scene_destroy(Scene *self, GPU_Device gpu) {
+  GPU_destroyMesh(gpu, self->glyphs);
+  GPU_destroyMesh(gpu, self->checkerQuad);
+  GPU_destroyMesh(gpu, self->shapes);
+  GPU_destroyGlyphTable(gpu, self->glyphTable);
+  GPU_destroyImage(gpu, self->checker);
+  GPU_destroyImage(gpu, self->mask);
+}
+
+/**
+ * Writes the RGB channels of the RGBA pixels as a binary PPM.
+ */
+static b32 writePPM(const char *path, Slice<u8> pixels, u32 width, u32 height) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  b32 ret = fprintf(f, "P6\n%u %u\n255\n", width, height) > 0;
+  for (u32 i = 0; ret && i < width * height; i++) {
+    ret = fwrite(&pixels[i * 4], 1, 3, f) == 3;
+  }
+  return fclose(f) == 0 && ret;
+}
+
+/**
+ * Reads a binary PPM as written by writePPM into RGB pixels.
+ */
+static b32 readPPM(const char *path,
+                   Arena *arena,
+                   Slice<u8> &rgb,
+                   u32 &width,
+                   u32 &height) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+
+  u32 maxValue;
+  b32 ret = fscanf(f, "P6 %u %u %u", &width, &height, &maxValue) == 3 &&
+            maxValue == 255 && fgetc(f) != EOF && width <= 16384 &&
+            height <= 16384;
+  if (ret) {
+    rgb = {alloc<u8>(arena, width * height * 3), width * height * 3};
+    ret = fread(rgb.data, 1, rgb.length, f) == rgb.length;
+  }
+  fclose(f);
+  return ret;
+}
+
+/**
+ * Compares the RGB channels of the RGBA pixels with the expected ones.
+ * @returns How many pixels differ.
+ */
+static u32 countDifferentPixels(Slice<u8> pixels, Slice<u8> expected) {
+  u32 numDifferent = 0;
+  for (u32 i = 0; i < expected.length / 3; i++) {
+    if (memcmp(&pixels[i * 4], &expected[i * 3], 3) != 0) {
+      numDifferent++;
+    }
+  }
+  return numDifferent;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "USAGE: %s {output} [{expected}]\n\n"
+            "  Draws a test scene with the software renderer into {output}\n"
+            "  as a PPM. If {expected} is given, fails unless the output is\n"
+            "  the same as that PPM.\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Arena_init(&arenaPerm, 16 * 1024 * 1024);
+  Arena_init(&arenaTemp, 16 * 1024 * 1024);
+
+  GPU_Device gpu;
+  if (!GPU_create(&arenaPerm, &gpu)) {
+    log_error("Failed to create the renderer");
+    return EXIT_FAILURE;
+  }
+
+  GPU_HeadlessSurfaceDesc surfaceDesc = {};
+  surfaceDesc.header.kind = GSK_Headless;
+  surfaceDesc.width = SURFACE_WIDTH;
+  surfaceDesc.height = SURFACE_HEIGHT;
+  GPU_Surface surface;
+  Scene scene = {};
+  if (!GPU_createSurface(gpu, &arenaPerm, &surfaceDesc.header, &surface) ||
+      !Scene_create(&scene, gpu, &arenaPerm)) {
+    log_error("Failed to create the scene");
+    return EXIT_FAILURE;
+  }
+
+  int ret = EXIT_SUCCESS;
+  const u32 sizFrame = SURFACE_WIDTH * SURFACE_HEIGHT * 4;
+  u8 *firstFrame = alloc<u8>(&arenaPerm, sizFrame);
+  for (u32 i = 0; i < NUM_FRAMES; i++) {
+    ArenaTemp temp = getScratch(nullptr, 0);
+    GPU_submit(gpu, surface, Scene_record(&scene, temp.arena));
+    releaseScratch(temp);
+
+    Slice<u8> pixels = Surface_getPixels(surface);
+    if (i == 0) {
+      memcpy(firstFrame, pixels.data, sizFrame);
+    } else if (memcmp(firstFrame, pixels.data, sizFrame) != 0) {
+      log_error("Frame %u differs from the first one", i);
+      ret = EXIT_FAILURE;
+    }
+  }
+
+  Slice<u8> pixels = Surface_getPixels(surface);
+  if (!writePPM(argv[1], pixels, SURFACE_WIDTH, SURFACE_HEIGHT)) {
+    log_error("Failed to write %s", argv[1]);
+    ret = EXIT_FAILURE;
+  }
+
+  if (argc > 2) {
+    Slice<u8> expected;
+    u32 width, height;
+    if (!readPPM(argv[2], &arenaTemp, expected, width, height)) {
+      log_error("Failed to read %s", argv[2]);
+      ret = EXIT_FAILURE;
+    } else if (width != SURFACE_WIDTH || height != SURFACE_HEIGHT) {
+      log_error("%s is %ux%u instead of %ux%u", argv[2], width, height,
+                SURFACE_WIDTH, SURFACE_HEIGHT);
+      ret = EXIT_FAILURE;
+    } else {
+      u32 numDifferent = countDifferentPixels(pixels, expected);
+      if (numDifferent != 0) {
+        log_error("%u pixels differ from %s", numDifferent, argv[2]);
+        ret = EXIT_FAILURE;
+      } else {
+        log_info("Same as %s", argv[2]);
+      }
+    }
+  }
+
+  Scene_destroy(&scene, gpu);
+  Surface_destroy(surface);
+  GPU_destroy(gpu);
+  return ret;
+}
@@ -1,7 +1,10 @@
 #include "htmlview/DOM.hpp"
 #include <cstdio>
 #include "htmlview/HTML.hpp"
+#include "htmlview/OS.hpp"
+#include "log/log.h"
 #include "std/Arena.h"
+#include "std/Chronometry.h"
 #include "std/Slice.hpp"
 #include "std/Utils.hpp"
 #include "std/Vector.hpp"
@@ -33,6 +36,8 @@ struct DOM_Parser {
   InsMode insertionMode = InsMode::Initial;
   b32 cannotChangeMode = false;
 
+  // These are reserved in the scratch arena up front; the tree's arrays are
+  // a compacted copy of them
   Vector<DOM_Node> nodes;
   Vector<DOM_ElementData> elementData;
   Vector<DOM_TextData> textData;
@@ -40,33 +45,11 @@ struct DOM_Parser {
   u32 idxHtmlNode;
   u32 idxHeadNode;
 
-  Slice<HTMLToken> tokens;
+  // The token being processed
+  HTMLToken token;
   b32 reparse = false;
 };
 
-const Slice<u8> TAG_HTML = SLICE_FROM_STRLIT("html");
-const Slice<u8> TAG_HEAD = SLICE_FROM_STRLIT("head");
-const Slice<u8> TAG_TITLE = SLICE_FROM_STRLIT("title");
-const Slice<u8> TAG_BODY = SLICE_FROM_STRLIT("body");
-const Slice<u8> TAG_DD = SLICE_FROM_STRLIT("dd");
-const Slice<u8> TAG_DT = SLICE_FROM_STRLIT("dt");
-const Slice<u8> TAG_P = SLICE_FROM_STRLIT("p");
-const Slice<u8> TAG_A = SLICE_FROM_STRLIT("a");
-const Slice<u8> TAG_DIV = SLICE_FROM_STRLIT("div");
-const Slice<u8> TAG_DL = SLICE_FROM_STRLIT("dl");
-const Slice<u8> TAG_UL = SLICE_FROM_STRLIT("ul");
-const Slice<u8> TAG_TABLE = SLICE_FROM_STRLIT("table");
-const Slice<u8> TAG_TD = SLICE_FROM_STRLIT("td");
-const Slice<u8> TAG_TH = SLICE_FROM_STRLIT("th");
-const Slice<u8> TAG_H1 = SLICE_FROM_STRLIT("h1");
-const Slice<u8> TAG_H2 = SLICE_FROM_STRLIT("h2");
-const Slice<u8> TAG_H3 = SLICE_FROM_STRLIT("h3");
-const Slice<u8> TAG_H4 = SLICE_FROM_STRLIT("h4");
-const Slice<u8> TAG_H5 = SLICE_FROM_STRLIT("h5");
-const Slice<u8> TAG_H6 = SLICE_FROM_STRLIT("h6");
-const Slice<u8> TAG_HEADER = SLICE_FROM_STRLIT("header");
-const Slice<u8> TAG_ADDRESS = SLICE_FROM_STRLIT("address");
-
 static OpenElement &currentOpenElement(DOM_Parser &P) {
   DCHECK(P.openElementStack.length != 0);
 
@@ -104,19 +87,6 @@ b32 equalCaseInsensitive(Slice<u8> l, Slice<u8> r) {
   return true;
 }
 
-static b32 equalCaseInsensitiveAny(Slice<u8> self) {
-  return false;
-}
-
-template <typename... Args>
-static b32 equalCaseInsensitiveAny(Slice<u8> self, Slice<u8> r, Args... rest) {
-  if (equalCaseInsensitive(self, r)) {
-    return true;
-  }
-
-  return equalCaseInsensitiveAny(self, rest...);
-}
-
 static DOM_Node *createElement(Arena *arena,
                                DOM_Parser &P,
                                HTMLOpenTag &token,
@@ -128,6 +98,7 @@ static DOM_Node *createElement(Arena *arena,
   DCHECK(idxElement < P.elementData.length);
   data->idxNode = idxNode;
   data->name = token.name;
+  data->tag = token.tag;
   data->attributes = token.attributes;
   data->isSelfClosing = token.isSelfClosing;
 
@@ -143,7 +114,7 @@ static DOM_Node *createElement(Arena *arena,
 
 static DOM_Node *createElement(Arena *arena,
                                DOM_Parser &P,
-                               Slice<u8> name,
+                               TagId tag,
                                u32 &idxNode) {
   u32 idxElement = P.elementData.length;
   idxNode = P.nodes.length;
@@ -151,7 +122,8 @@ static DOM_Node *createElement(Arena *arena,
   DOM_ElementData *data = append(arena, &P.elementData);
   DCHECK(idxElement < P.elementData.length);
   data->idxNode = idxNode;
-  data->name = name;
+  data->name = Tag_name(tag);
+  data->tag = tag;
   data->attributes = {};
 
   DOM_Node *node = append(arena, &P.nodes);
@@ -222,9 +194,9 @@ static DOM_Node *insertElement(Arena *arena,
 
 static DOM_Node *insertElement(Arena *arena,
                                DOM_Parser &P,
-                               Slice<u8> name,
+                               TagId tag,
                                u32 &idxNode) {
-  DOM_Node *node = createElement(arena, P, name, idxNode);
+  DOM_Node *node = createElement(arena, P, tag, idxNode);
   insertNode(arena, P, idxNode);
   return node;
 }
@@ -243,9 +215,9 @@ static void popOpenElement(DOM_Parser &P) {
   OpenElement &openElem = currentOpenElement(P);
   DCHECK(openElem.idxNode != DOM_INVALID_INDEX);
 
-  // Seal the children array
+  // Seal the children array; it's copied into the tree's child pool later
   DOM_Node &node = P.nodes[openElem.idxNode];
-  node.children = copyToSlice(P.arena, openElem.children);
+  node.children = {openElem.children.data, openElem.children.length};
 
   P.openElementStack.length--;
 }
@@ -254,9 +226,7 @@ static void pushOpenElement(Arena *arena, DOM_Parser &P, u32 idxNode) {
   *append(arena, &P.openElementStack) = {idxNode, {}};
 }
 
-static void generateImpliedEndTags(Arena *arena,
-                                   DOM_Parser &P,
-                                   Slice<u8> except) {
+static void generateImpliedEndTags(Arena *arena, DOM_Parser &P, TagId except) {
   while (P.openElementStack.length != 0) {
     OpenElement &openElem = currentOpenElement(P);
 
@@ -264,23 +234,14 @@ static void generateImpliedEndTags(Arena *arena,
     DOM_Node &node = P.nodes[openElem.idxNode];
     DCHECK(node.kind == DOM_NodeKind::Element);
     DOM_ElementData &data = P.elementData[node.idxElement];
-    Slice<u8> name = data.name;
 
-    if (!empty(except) && equalCaseInsensitive(name, except)) {
+    // Only known tags have implied end tags, so an unknown `except` can't
+    // match any of them
+    if (except != TagId::Unknown && data.tag == except) {
       return;
     }
 
-    if (equalCaseInsensitive(name, TAG_DD) ||
-        equalCaseInsensitive(name, TAG_DT) ||
-        equalCaseInsensitiveLit(name, "li") ||
-        equalCaseInsensitiveLit(name, "optgroup") ||
-        equalCaseInsensitiveLit(name, "nextid") ||
-        equalCaseInsensitiveLit(name, "option") ||
-        equalCaseInsensitive(name, TAG_P) ||
-        equalCaseInsensitiveLit(name, "rb") ||
-        equalCaseInsensitiveLit(name, "rp") ||
-        equalCaseInsensitiveLit(name, "rt") ||
-        equalCaseInsensitiveLit(name, "rtc")) {
+    if (Tag_hasCategory(data.tag, TC_ImpliedEnd)) {
       popOpenElement(P);
     } else {
       return;
@@ -289,16 +250,16 @@ static void generateImpliedEndTags(Arena *arena,
 }
 
 static void DOM_parse_beforeHtml(Arena *arena, DOM_Parser &P) {
-  HTMLToken &token = P.tokens[0];
+  HTMLToken &token = P.token;
 
   switch (token.kind) {
     case HTMLTokenKind::OpenTag: {
       CHECK(P.idxHtmlNode == DOM_INVALID_INDEX);
 
-      if (equalCaseInsensitiveLit(token.openTag.name, "html")) {
+      if (token.openTag.tag == TagId::Html) {
         createElement(arena, P, token.openTag, P.idxHtmlNode);
       } else {
-        createElement(arena, P, TAG_HTML, P.idxHtmlNode);
+        createElement(arena, P, TagId::Html, P.idxHtmlNode);
         P.reparse = true;
       }
       pushOpenElement(arena, P, P.idxHtmlNode);
@@ -306,11 +267,10 @@ static void DOM_parse_beforeHtml(Arena *arena, DOM_Parser &P) {
       break;
     }
     case HTMLTokenKind::CloseTag: {
-      if (equalCaseInsensitive(token.closeTag.name, TAG_HEAD) ||
-          equalCaseInsensitive(token.closeTag.name, TAG_BODY) ||
-          equalCaseInsensitive(token.closeTag.name, TAG_HTML) ||
-          equalCaseInsensitiveLit(token.closeTag.name, "br")) {
-        DOM_Node *node = createElement(arena, P, TAG_HTML, P.idxHtmlNode);
+      TagId tag = token.closeTag.tag;
+      if (tag == TagId::Head || tag == TagId::Body || tag == TagId::Html ||
+          tag == TagId::Br) {
+        DOM_Node *node = createElement(arena, P, TagId::Html, P.idxHtmlNode);
         pushOpenElement(arena, P, P.idxHtmlNode);
         P.reparse = true;
         P.insertionMode = InsMode::BeforeHead;
@@ -322,7 +282,7 @@ static void DOM_parse_beforeHtml(Arena *arena, DOM_Parser &P) {
     }
     case HTMLTokenKind::Text: {
       CHECK(P.idxHtmlNode == DOM_INVALID_INDEX);
-      DOM_Node *node = createElement(arena, P, TAG_HTML, P.idxHtmlNode);
+      DOM_Node *node = createElement(arena, P, TagId::Html, P.idxHtmlNode);
       pushOpenElement(arena, P, P.idxHtmlNode);
 
       P.insertionMode = InsMode::BeforeHead;
@@ -336,12 +296,12 @@ static void DOM_parse_beforeHtml(Arena *arena, DOM_Parser &P) {
 
 static void DOM_parse_beforeHead(Arena *arena, DOM_Parser &P) {
   CHECK(P.idxHtmlNode != DOM_INVALID_INDEX);
-  HTMLToken &token = P.tokens[0];
+  HTMLToken &token = P.token;
 
   switch (token.kind) {
     case HTMLTokenKind::OpenTag: {
       CHECK(P.idxHeadNode == DOM_INVALID_INDEX);
-      if (equalCaseInsensitive(token.openTag.name, TAG_HEAD)) {
+      if (token.openTag.tag == TagId::Head) {
         insertElement(arena, P, token.openTag, P.idxHeadNode);
         DCHECK(P.idxHeadNode != DOM_INVALID_INDEX);
         pushOpenElement(arena, P, P.idxHeadNode);
@@ -349,8 +309,8 @@ static void DOM_parse_beforeHead(Arena *arena, DOM_Parser &P) {
         return;
       }
 
-      if (!equalCaseInsensitive(token.openTag.name, TAG_HTML)) {
-        insertElement(arena, P, TAG_HEAD, P.idxHeadNode);
+      if (token.openTag.tag != TagId::Html) {
+        insertElement(arena, P, TagId::Head, P.idxHeadNode);
         DCHECK(P.idxHeadNode != DOM_INVALID_INDEX);
         pushOpenElement(arena, P, P.idxHeadNode);
         P.insertionMode = InsMode::InHead;
@@ -360,11 +320,10 @@ static void DOM_parse_beforeHead(Arena *arena, DOM_Parser &P) {
       break;
     }
     case HTMLTokenKind::CloseTag: {
-      if (equalCaseInsensitiveLit(token.closeTag.name, "head") ||
-          equalCaseInsensitiveLit(token.closeTag.name, "body") ||
-          equalCaseInsensitiveLit(token.closeTag.name, "html") ||
-          equalCaseInsensitiveLit(token.closeTag.name, "br")) {
-        insertElement(arena, P, TAG_HEAD, P.idxHeadNode);
+      TagId tag = token.closeTag.tag;
+      if (tag == TagId::Head || tag == TagId::Body || tag == TagId::Html ||
+          tag == TagId::Br) {
+        insertElement(arena, P, TagId::Head, P.idxHeadNode);
         DCHECK(P.idxHeadNode != DOM_INVALID_INDEX);
         pushOpenElement(arena, P, P.idxHeadNode);
         P.reparse = true;
@@ -376,7 +335,7 @@ static void DOM_parse_beforeHead(Arena *arena, DOM_Parser &P) {
       break;
     }
     case HTMLTokenKind::Text: {
-      insertElement(arena, P, TAG_HEAD, P.idxHeadNode);
+      insertElement(arena, P, TagId::Head, P.idxHeadNode);
       DCHECK(P.idxHeadNode != DOM_INVALID_INDEX);
       pushOpenElement(arena, P, P.idxHeadNode);
       P.insertionMode = InsMode::InHead;
@@ -394,13 +353,13 @@ static void popHeadElement(DOM_Parser &P) {
 }
 
 static void DOM_parse_inHead(Arena *arena, DOM_Parser &P) {
-  HTMLToken &token = P.tokens[0];
+  HTMLToken &token = P.token;
   CHECK(P.idxHtmlNode != DOM_INVALID_INDEX);
   CHECK(P.idxHeadNode != DOM_INVALID_INDEX);
 
   switch (token.kind) {
     case HTMLTokenKind::OpenTag: {
-      if (equalCaseInsensitive(token.openTag.name, TAG_HEAD)) {
+      if (token.openTag.tag == TagId::Head) {
         // Ignore
         return;
       }
@@ -415,11 +374,11 @@ static void DOM_parse_inHead(Arena *arena, DOM_Parser &P) {
       break;
     }
     case HTMLTokenKind::CloseTag: {
-      if (equalCaseInsensitiveLit(token.closeTag.name, "head")) {
+      if (token.closeTag.tag == TagId::Head) {
         popHeadElement(P);
         return;
       }
-      if (equalCaseInsensitiveLit(token.closeTag.name, "html")) {
+      if (token.closeTag.tag == TagId::Html) {
         return;
       }
 
@@ -435,12 +394,12 @@ static void DOM_parse_inHead(Arena *arena, DOM_Parser &P) {
 }
 
 static void DOM_parse_afterHead(Arena *arena, DOM_Parser &P) {
-  HTMLToken &token = P.tokens[0];
+  HTMLToken &token = P.token;
 
   switch (token.kind) {
     case HTMLTokenKind::OpenTag: {
       u32 idxNode;
-      if (equalCaseInsensitive(token.openTag.name, TAG_BODY)) {
+      if (token.openTag.tag == TagId::Body) {
         insertElement(arena, P, token.openTag, idxNode);
         pushOpenElement(arena, P, idxNode);
         P.insertionMode = InsMode::InBody;
@@ -448,7 +407,7 @@ static void DOM_parse_afterHead(Arena *arena, DOM_Parser &P) {
       }
 
       // Insert a <body>
-      insertElement(arena, P, TAG_BODY, idxNode);
+      insertElement(arena, P, TagId::Body, idxNode);
       pushOpenElement(arena, P, idxNode);
 
       P.insertionMode = InsMode::InBody;
@@ -456,17 +415,16 @@ static void DOM_parse_afterHead(Arena *arena, DOM_Parser &P) {
       break;
     }
     case HTMLTokenKind::CloseTag: {
-      if (equalCaseInsensitiveLit(token.closeTag.name, "body") ||
-          equalCaseInsensitiveLit(token.closeTag.name, "html") ||
-          equalCaseInsensitiveLit(token.closeTag.name, "br")) {
+      TagId tag = token.closeTag.tag;
+      if (tag == TagId::Body || tag == TagId::Html || tag == TagId::Br) {
         u32 idxNode;
-        insertElement(arena, P, SLICE_FROM_STRLIT("body"), idxNode);
+        insertElement(arena, P, TagId::Body, idxNode);
         pushOpenElement(arena, P, idxNode);
         P.insertionMode = InsMode::InBody;
         P.reparse = true;
         return;
       }
-      if (equalCaseInsensitive(token.closeTag.name, TAG_HTML)) {
+      if (tag == TagId::Html) {
         return;
       }
 
@@ -475,7 +433,7 @@ static void DOM_parse_afterHead(Arena *arena, DOM_Parser &P) {
     }
     case HTMLTokenKind::Text: {
       u32 idxNode;
-      insertElement(arena, P, TAG_BODY, idxNode);
+      insertElement(arena, P, TagId::Body, idxNode);
       pushOpenElement(arena, P, idxNode);
       P.insertionMode = InsMode::InBody;
       P.reparse = true;
@@ -485,14 +443,14 @@ static void DOM_parse_afterHead(Arena *arena, DOM_Parser &P) {
 }
 
 static void DOM_parse_afterBody(Arena *arena, DOM_Parser &P) {
-  HTMLToken &token = P.tokens[0];
+  HTMLToken &token = P.token;
 
   switch (token.kind) {
     case HTMLTokenKind::OpenTag: {
       break;
     }
     case HTMLTokenKind::CloseTag: {
-      if (equalCaseInsensitive(token.closeTag.name, TAG_HTML)) {
+      if (token.closeTag.tag == TagId::Html) {
         P.insertionMode = InsMode::AfterAfterBody;
         return;
       }
@@ -507,56 +465,72 @@ static void DOM_parse_afterBody(Arena *arena, DOM_Parser &P) {
   }
 }
 
-static Slice<u8> getOpenElementName(DOM_Parser &P, OpenElement &openElem) {
+static DOM_ElementData &getOpenElementData(DOM_Parser &P,
+                                           OpenElement &openElem) {
   DOM_Node &node = P.nodes[openElem.idxNode];
   CHECK(node.idxElement != DOM_INVALID_INDEX);
-  DOM_ElementData &data = P.elementData[node.idxElement];
-  return data.name;
+  return P.elementData[node.idxElement];
 }
 
-static b32 openElementIsNamed(DOM_Parser &P,
-                              OpenElement &openElem,
-                              Slice<u8> name) {
+/**
+ * Checks whether the open element has the given tag. `name` is only compared
+ * if both tags are unknown.
+ */
+static b32 openElementIs(DOM_Parser &P,
+                         OpenElement &openElem,
+                         TagId tag,
+                         Slice<u8> name) {
   DOM_Node &node = P.nodes[openElem.idxNode];
   if (node.idxElement == DOM_INVALID_INDEX) {
     return false;
   }
 
-  return equalCaseInsensitive(getOpenElementName(P, openElem), name);
+  DOM_ElementData &data = getOpenElementData(P, openElem);
+  if (tag != TagId::Unknown || data.tag != TagId::Unknown) {
+    return data.tag == tag;
+  }
+
+  return equalCaseInsensitive(data.name, name);
 }
 
-static b32 currentOpenElementIsNamed(DOM_Parser &P, Slice<u8> name) {
+static b32 currentOpenElementIs(DOM_Parser &P, TagId tag, Slice<u8> name) {
   if (P.openElementStack.length == 0) {
     return false;
   }
 
   OpenElement &openElem = currentOpenElement(P);
-  return openElementIsNamed(P, openElem, name);
+  return openElementIs(P, openElem, tag, name);
+}
+
+static b32 currentOpenElementIs(DOM_Parser &P, TagId tag) {
+  DCHECK(tag != TagId::Unknown);
+  return currentOpenElementIs(P, tag, {});
 }
 
-static b32 hasElementInScope(DOM_Parser &P, Slice<u8> name) {
+static b32 hasElementInScope(DOM_Parser &P, TagId tag) {
   u32 lenStack = P.openElementStack.length;
   for (u32 i = lenStack - 1; i < lenStack; i--) {
-    Slice<u8> elemName = getOpenElementName(P, P.openElementStack[i]);
-    if (equalCaseInsensitive(elemName, name)) {
+    TagId elemTag = getOpenElementData(P, P.openElementStack[i]).tag;
+    if (elemTag == tag) {
       return true;
     }
 
-    if (equalCaseInsensitiveAny(elemName, TAG_HTML, TAG_TABLE, TAG_TH,
-                                TAG_TD)) {
+    if (Tag_hasCategory(elemTag, TC_Scope)) {
       return false;
     }
   }
 
   DCHECK(!"there should be a html element in the stack");
+  return false;
 }
 
 static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
-  HTMLToken &token = P.tokens[0];
+  HTMLToken &token = P.token;
 
   switch (token.kind) {
     case HTMLTokenKind::OpenTag: {
-      if (equalCaseInsensitive(token.openTag.name, TAG_BODY)) {
+      TagId tag = token.openTag.tag;
+      if (tag == TagId::Body) {
         return;
       }
 
@@ -564,52 +538,49 @@ static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
       // "blockquote", "center", "details", "dialog", "dir", "div", "dl",
       // "fieldset", "figcaption", "figure", "footer", "header", "hgroup",
       // "main", "menu", "nav", "ol", "p", "search", "section", "summary", "ul"
-      if (equalCaseInsensitiveAny(token.openTag.name, TAG_ADDRESS, TAG_DIV,
-                                  TAG_DL, TAG_P, TAG_UL)) {
-        if (currentOpenElementIsNamed(P, TAG_P)) {
+      if (Tag_hasCategory(tag, TC_ClosesP)) {
+        if (currentOpenElementIs(P, TagId::P)) {
           popOpenElement(P);
         }
       }
 
       // A start tag whose tag name is one of: "h1", "h2", "h3", "h4", "h5",
       // "h6"
-      if (equalCaseInsensitiveAny(token.openTag.name, TAG_H1, TAG_H2, TAG_H3,
-                                  TAG_H4, TAG_H5, TAG_H6)) {
-        if (hasElementInScope(P, TAG_P)) {
+      if (Tag_hasCategory(tag, TC_Heading)) {
+        if (hasElementInScope(P, TagId::P)) {
           popOpenElement(P);
         }
       }
 
       // A start tag whose tag name is one of: "dd", "dt"
-      if (equalCaseInsensitive(token.openTag.name, TAG_DD) ||
-          equalCaseInsensitive(token.openTag.name, TAG_DT)) {
+      if (tag == TagId::Dd || tag == TagId::Dt) {
         while (true) {
-          if (currentOpenElementIsNamed(P, TAG_DD)) {
-            generateImpliedEndTags(arena, P, TAG_DD);
+          if (currentOpenElementIs(P, TagId::Dd)) {
+            generateImpliedEndTags(arena, P, TagId::Dd);
 
-            while (!currentOpenElementIsNamed(P, TAG_DD)) {
+            while (!currentOpenElementIs(P, TagId::Dd)) {
               popOpenElement(P);
             }
             popOpenElement(P);
             break;
           }
 
-          if (currentOpenElementIsNamed(P, TAG_DT)) {
-            generateImpliedEndTags(arena, P, TAG_DT);
+          if (currentOpenElementIs(P, TagId::Dt)) {
+            generateImpliedEndTags(arena, P, TagId::Dt);
 
-            while (!currentOpenElementIsNamed(P, TAG_DT)) {
+            while (!currentOpenElementIs(P, TagId::Dt)) {
               popOpenElement(P);
             }
             popOpenElement(P);
             break;
           }
 
-          if (!currentOpenElementIsNamed(P, TAG_P)) {
+          if (!currentOpenElementIs(P, TagId::P)) {
             break;
           }
         }
 
-        if (currentOpenElementIsNamed(P, TAG_P)) {
+        if (currentOpenElementIs(P, TagId::P)) {
           popOpenElement(P);
         }
 
@@ -622,14 +593,17 @@ static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
 
       u32 idxNode;
       insertElement(arena, P, token.openTag, idxNode);
-      if (!token.openTag.isSelfClosing) {
+      // Void elements like <br> have no end tag even if they are not written
+      // as self-closing
+      if (!token.openTag.isSelfClosing && !Tag_hasCategory(tag, TC_Void)) {
         pushOpenElement(arena, P, idxNode);
       }
       break;
     }
     case HTMLTokenKind::CloseTag: {
-      if (equalCaseInsensitive(token.closeTag.name, TAG_BODY)) {
-        if (!hasElementInScope(P, TAG_BODY)) {
+      HTMLCloseTag &closeTag = token.closeTag;
+      if (closeTag.tag == TagId::Body) {
+        if (!hasElementInScope(P, TagId::Body)) {
           // Parse error; ignore
           return;
         }
@@ -639,8 +613,8 @@ static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
         return;
       }
 
-      if (equalCaseInsensitive(token.closeTag.name, TAG_HTML)) {
-        if (!currentOpenElementIsNamed(P, token.closeTag.name)) {
+      if (closeTag.tag == TagId::Html) {
+        if (!currentOpenElementIs(P, TagId::Html)) {
           // Parse error; ignore
           return;
         }
@@ -652,9 +626,9 @@ static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
       }
 
       // Generate implied end tags
-      generateImpliedEndTags(arena, P, token.closeTag.name);
+      generateImpliedEndTags(arena, P, closeTag.tag);
 
-      if (!currentOpenElementIsNamed(P, token.closeTag.name)) {
+      if (!currentOpenElementIs(P, closeTag.tag, closeTag.name)) {
         // FIXME(danielm): check that the "the stack of open elements does not
         // have an element in scope that is an HTML element with the same tag
         // name as that of the token"
@@ -662,7 +636,7 @@ static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
         return;
       }
 
-      while (!currentOpenElementIsNamed(P, token.closeTag.name)) {
+      while (!currentOpenElementIs(P, closeTag.tag, closeTag.name)) {
         popOpenElement(P);
       }
 
@@ -678,40 +652,55 @@ static void DOM_parse_inBody(Arena *arena, DOM_Parser &P) {
   }
 }
 
-b32 DOM_Tree_init(DOM_Tree *self, Arena *arena, Slice<HTMLToken> tokens) {
-  DOM_Parser parser = {};
-  parser.tokens = tokens;
-  parser.idxHtmlNode = DOM_INVALID_INDEX;
-  parser.idxHeadNode = DOM_INVALID_INDEX;
+static void DOM_Parser_init(DOM_Parser &P,
+                            Arena *arena,
+                            Arena *scratch,
+                            u32 numOpenTags,
+                            u32 numTexts) {
+  P = {};
+  P.idxHtmlNode = DOM_INVALID_INDEX;
+  P.idxHeadNode = DOM_INVALID_INDEX;
 
   // TODO(danielm): doctype
 
-  parser.insertionMode = InsMode::BeforeHtml;
-  parser.arena = arena;
-
-  ArenaTemp temp = getScratch(&arena, 1);
+  P.insertionMode = InsMode::BeforeHtml;
+  P.arena = arena;
+
+  // Every open tag and text token creates at most one node; the <html>,
+  // <head> and <body> elements may also be created implicitly
+  const u32 NUM_IMPLIED_ELEMENTS = 3;
+  u32 numElements = numOpenTags + NUM_IMPLIED_ELEMENTS;
+  P.elementData =
+      vectorWithInitialCapacity<DOM_ElementData>(scratch, numElements);
+  P.textData = vectorWithInitialCapacity<DOM_TextData>(scratch, numTexts);
+  P.nodes = vectorWithInitialCapacity<DOM_Node>(scratch, numElements + numTexts);
+}
 
-  while (parser.tokens.length > 0) {
-    parser.reparse = false;
+/**
+ * Runs the tree construction stage on `P.token`.
+ */
+static void DOM_Parser_processToken(Arena *arena, DOM_Parser &P) {
+  do {
+    P.reparse = false;
 
-    switch (parser.insertionMode) {
+    switch (P.insertionMode) {
       case InsMode::BeforeHtml:
-        DOM_parse_beforeHtml(temp.arena, parser);
+        DOM_parse_beforeHtml(arena, P);
         break;
       case InsMode::BeforeHead:
-        DOM_parse_beforeHead(temp.arena, parser);
+        DOM_parse_beforeHead(arena, P);
         break;
       case InsMode::InHead:
-        DOM_parse_inHead(temp.arena, parser);
+        DOM_parse_inHead(arena, P);
         break;
       case InsMode::AfterHead:
-        DOM_parse_afterHead(temp.arena, parser);
+        DOM_parse_afterHead(arena, P);
         break;
       case InsMode::InBody:
-        DOM_parse_inBody(temp.arena, parser);
+        DOM_parse_inBody(arena, P);
         break;
       case InsMode::AfterBody:
-        DOM_parse_afterBody(temp.arena, parser);
+        DOM_parse_afterBody(arena, P);
         break;
       case InsMode::AfterAfterBody:
         break;
@@ -719,28 +708,572 @@ b32 DOM_Tree_init(DOM_Tree *self, Arena *arena, Slice<HTMLToken> tokens) {
         TODO();
         break;
     }
+  } while (P.reparse);
+}
+
+static const Slice<u8> INDEXED_ATTRIBUTE_NAMES[(u32)DOM_AttrId::Count] = {
+#define DOM_ATTR_NAME(id, name) {(u8 *)name, sizeof(name) - 1},
+    DOM_INDEXED_ATTRIBUTES(DOM_ATTR_NAME)
+#undef DOM_ATTR_NAME
+};
+
+DOM_AttrId DOM_attrFromName(Slice<u8> name) {
+  for (u32 i = 0; i < (u32)DOM_AttrId::Count; i++) {
+    if (equalCaseInsensitive(name, INDEXED_ATTRIBUTE_NAMES[i])) {
+      return (DOM_AttrId)i;
+    }
+  }
+  return DOM_AttrId::Count;
+}
+
+/**
+ * Builds the tag and attribute lookup tables of the tree by counting sort, so
+ * that the entries of every tag and attribute remain in document order.
+ */
+static void DOM_Index_init(DOM_Index *self, Arena *arena, DOM_Tree *tree) {
+  const u32 NUM_TAGS = (u32)TagId::Count;
+  const u32 NUM_ATTRS = (u32)DOM_AttrId::Count;
+
+  *self = {};
+  alloc(arena, NUM_TAGS + 1, self->idxFirstElement);
+  alloc(arena, NUM_ATTRS + 1, self->idxFirstAttribute);
+
+  // Count the occurrences of each tag and attribute; the counts are stored
+  // one slot to the right so that the prefix sums below turn them into
+  // starting offsets
+  u32 numAttributes = 0;
+  for (auto [elem, _] : tree->elementData) {
+    self->idxFirstElement[(u32)elem.tag + 1]++;
+
+    u32 seen = 0;
+    for (auto [attr, _] : elem.attributes) {
+      DOM_AttrId id = DOM_attrFromName(attr.name);
+      if (id != DOM_AttrId::Count && (seen & (1 << (u32)id)) == 0) {
+        seen |= 1 << (u32)id;
+        self->idxFirstAttribute[(u32)id + 1]++;
+        numAttributes++;
+      }
+    }
+  }
+
+  for (u32 i = 1; i <= NUM_TAGS; i++) {
+    self->idxFirstElement[i] += self->idxFirstElement[i - 1];
+  }
+  for (u32 i = 1; i <= NUM_ATTRS; i++) {
+    self->idxFirstAttribute[i] += self->idxFirstAttribute[i - 1];
+  }
+
+  alloc(arena, tree->elementData.length, self->elements);
+  alloc(arena, numAttributes, self->attributes);
+
+  ArenaTemp temp = getScratch(&arena, 1);
+  Slice<u32> cursorElements, cursorAttributes;
+  alloc(temp.arena, NUM_TAGS, cursorElements);
+  alloc(temp.arena, NUM_ATTRS, cursorAttributes);
+  copy(cursorElements, subarray(self->idxFirstElement, 0, NUM_TAGS));
+  copy(cursorAttributes, subarray(self->idxFirstAttribute, 0, NUM_ATTRS));
+
+  for (auto [elem, idxElement] : tree->elementData) {
+    self->elements[cursorElements[(u32)elem.tag]++] = idxElement;
+
+    u32 seen = 0;
+    for (auto [attr, _] : elem.attributes) {
+      DOM_AttrId id = DOM_attrFromName(attr.name);
+      if (id != DOM_AttrId::Count && (seen & (1 << (u32)id)) == 0) {
+        seen |= 1 << (u32)id;
+        self->attributes[cursorAttributes[(u32)id]++] = {idxElement,
+                                                         attr.value};
+      }
+    }
+  }
+
+  releaseScratch(temp);
+}
+
+Slice<u32> DOM_Tree_elementsWithTag(DOM_Tree *self, TagId tag) {
+  DOM_Index &index = self->index;
+  DCHECK(index.idxFirstElement.length != 0);
+  u32 idxFirst = index.idxFirstElement[(u32)tag];
+  u32 idxEnd = index.idxFirstElement[(u32)tag + 1];
+  return {index.elements.data + idxFirst, idxEnd - idxFirst};
+}
+
+Slice<DOM_AttributeEntry> DOM_Tree_elementsWithAttribute(DOM_Tree *self,
+                                                         DOM_AttrId attr) {
+  DOM_Index &index = self->index;
+  DCHECK(index.idxFirstAttribute.length != 0);
+  u32 idxFirst = index.idxFirstAttribute[(u32)attr];
+  u32 idxEnd = index.idxFirstAttribute[(u32)attr + 1];
+  return {index.attributes.data + idxFirst, idxEnd - idxFirst};
+}
+
+static u32 remapIndex(Slice<u32> newIndices, u32 idxOld) {
+  return idxOld == DOM_INVALID_INDEX ? DOM_INVALID_INDEX : newIndices[idxOld];
+}
+
+/**
+ * Copies the parsed tree into `self`, renumbering the nodes into depth-first
+ * pre-order. The element and text data follow the same order and all the
+ * children arrays are placed in a single pool.
+ */
+static void DOM_Parser_finish(Arena *scratch, DOM_Parser &P, DOM_Tree *self) {
+  while (P.openElementStack.length != 0) {
+    popOpenElement(P);
+  }
+
+  *self = {};
+  self->idxHtmlNode = DOM_INVALID_INDEX;
+  self->idxHeadNode = DOM_INVALID_INDEX;
+  if (P.idxHtmlNode == DOM_INVALID_INDEX) {
+    return;
+  }
+
+  // Visit the nodes in pre-order; `order` maps the new indices to the old
+  // ones and `newIndices` the other way around
+  Slice<u32> order, newIndices;
+  alloc(scratch, P.nodes.length, order);
+  alloc(scratch, P.nodes.length, newIndices);
+  for (u32 i = 0; i < newIndices.length; i++) {
+    newIndices[i] = DOM_INVALID_INDEX;
+  }
+
+  u32 numNodes = 0;
+  u32 numElements = 0;
+  u32 numTexts = 0;
+  Vector<u32> stack = vectorWithInitialCapacity<u32>(scratch, 256);
+  *append(scratch, &stack) = P.idxHtmlNode;
+  while (stack.length != 0) {
+    u32 idxOld = stack[stack.length - 1];
+    stack.length--;
+
+    DOM_Node &node = P.nodes[idxOld];
+    newIndices[idxOld] = numNodes;
+    order[numNodes++] = idxOld;
+    if (node.kind == DOM_NodeKind::Element) {
+      numElements++;
+    } else {
+      numTexts++;
+    }
+
+    for (u32 i = node.children.length - 1; i < node.children.length; i--) {
+      *append(scratch, &stack) = node.children[i];
+    }
+  }
+
+  alloc(P.arena, numNodes, self->nodes);
+  alloc(P.arena, numElements, self->elementData);
+  alloc(P.arena, numTexts, self->textData);
+  // Every node except for the root is the child of exactly one node
+  Slice<u32> childPool;
+  alloc(P.arena, numNodes - 1, childPool);
+
+  u32 idxElement = 0;
+  u32 idxText = 0;
+  u32 idxChildPool = 0;
+  for (u32 idxNode = 0; idxNode < numNodes; idxNode++) {
+    DOM_Node &oldNode = P.nodes[order[idxNode]];
+    DOM_Node &node = self->nodes[idxNode];
+
+    node.kind = oldNode.kind;
+    node.idxPrev = remapIndex(newIndices, oldNode.idxPrev);
+    node.idxNext = remapIndex(newIndices, oldNode.idxNext);
+    node.idxParent = remapIndex(newIndices, oldNode.idxParent);
+
+    if (node.kind == DOM_NodeKind::Element) {
+      node.idxElement = idxElement;
+      self->elementData[idxElement] = P.elementData[oldNode.idxElement];
+      self->elementData[idxElement].idxNode = idxNode;
+      idxElement++;
+    } else {
+      node.idxText = idxText;
+      self->textData[idxText] = P.textData[oldNode.idxText];
+      self->textData[idxText].idxNode = idxNode;
+      idxText++;
+    }
+
+    node.children = {};
+    if (oldNode.children.length != 0) {
+      node.children = {childPool.data + idxChildPool, oldNode.children.length};
+      for (auto [idxChild, i] : oldNode.children) {
+        node.children[i] = newIndices[idxChild];
+      }
+      idxChildPool += oldNode.children.length;
+    }
+  }
+  DCHECK(idxChildPool == childPool.length);
+
+  // A node's last descendant is the last descendant of its last child, which
+  // comes after it in pre-order
+  for (u32 idxNode = numNodes - 1; idxNode < numNodes; idxNode--) {
+    DOM_Node &node = self->nodes[idxNode];
+    node.idxLastDescendant = idxNode;
+    if (node.children.length != 0) {
+      u32 idxLastChild = node.children[node.children.length - 1];
+      node.idxLastDescendant = self->nodes[idxLastChild].idxLastDescendant;
+    }
+  }
+
+  self->idxHtmlNode = remapIndex(newIndices, P.idxHtmlNode);
+  self->idxHeadNode = remapIndex(newIndices, P.idxHeadNode);
+}
+
+b32 DOM_Tree_init(DOM_Tree *self,
+                  Arena *arena,
+                  Slice<HTMLToken> tokens,
+                  u32 flags) {
+  u32 numOpenTags = 0;
+  u32 numTexts = 0;
+  for (auto [token, _] : tokens) {
+    numOpenTags += token.kind == HTMLTokenKind::OpenTag;
+    numTexts += token.kind == HTMLTokenKind::Text;
+  }
+
+  ArenaTemp temp = getScratch(&arena, 1);
+
+  DOM_Parser parser;
+  DOM_Parser_init(parser, arena, temp.arena, numOpenTags, numTexts);
+
+  for (auto [token, _] : tokens) {
+    parser.token = token;
+    DOM_Parser_processToken(temp.arena, parser);
+  }
+
+  DOM_Parser_finish(temp.arena, parser, self);
+  if (flags & DTF_BuildIndex) {
+    DOM_Index_init(&self->index, arena, self);
+  }
+
+  releaseScratch(temp);
+  return true;
+}
+
+struct DOM_TreeBuilder {
+  // Everything but the finished tree is allocated here
+  Arena *scratch;
+  DOM_Parser parser;
+
+  // Set while the tree is built on a thread of its own; the queue is in
+  // `scratch` and grows in `queueArena`
+  os_thread thread;
+  HTMLTokenQueue *queue;
+  Arena *queueArena;
+};
+
+static void DOM_TreeBuilder_init(DOM_TreeBuilder *self,
+                                 Arena *scratch,
+                                 u32 numOpenTags,
+                                 u32 numTexts) {
+  self->scratch = scratch;
+  self->thread = nullptr;
+  self->queue = nullptr;
+  self->queueArena = nullptr;
+  // The return arena is only known once the tree is finished
+  DOM_Parser_init(self->parser, nullptr, scratch, numOpenTags, numTexts);
+}
+
+// Roughly what the pages we've seen average; only used to size the parser's
+// arrays, which grow if it's too low
+static const u32 ESTIMATED_BYTES_PER_TOKEN = 24;
+
+DOM_TreeBuilder *DOM_TreeBuilder_create(Arena *scratch, u32 lenSourceHint) {
+  u32 numTokens = lenSourceHint / ESTIMATED_BYTES_PER_TOKEN;
+  DOM_TreeBuilder *ret = alloc<DOM_TreeBuilder>(scratch);
+  DOM_TreeBuilder_init(ret, scratch, numTokens / 2, numTokens / 2);
+  return ret;
+}
+
+static void DOM_TreeBuilder_build(DOM_TreeBuilder *self,
+                                  const HTMLTokenStream &tokens) {
+  DOM_Parser &parser = self->parser;
+  u32 numTokens = HTML_TokenStream_length(&tokens);
+  for (u32 i = 0; i < numTokens; i++) {
+    HTML_TokenStream_get(&tokens, self->scratch, i, parser.token);
+    DOM_Parser_processToken(self->scratch, parser);
+  }
+}
+
+static void DOM_TreeBuilder_consumeQueue(void *user) {
+  DOM_TreeBuilder *self = (DOM_TreeBuilder *)user;
+
+  HTMLTokenStream batch;
+  while (HTML_TokenQueue_pop(self->queue, batch)) {
+    DOM_TreeBuilder_build(self, batch);
+    HTML_TokenQueue_release(self->queue);
+  }
+}
+
+b32 DOM_TreeBuilder_startThread(DOM_TreeBuilder *self, Arena *arena) {
+  DCHECK(self->thread == nullptr);
+  HTMLTokenQueue *queue = alloc<HTMLTokenQueue>(self->scratch);
+  if (!HTML_TokenQueue_init(queue, self->scratch)) {
+    log_warn("Couldn't create the token queue");
+    return false;
+  }
 
-    if (!parser.reparse) {
-      shrinkFromLeft(&parser.tokens);
+  self->queue = queue;
+  self->queueArena = arena;
+  self->thread = os_start_thread(DOM_TreeBuilder_consumeQueue, self);
+  if (self->thread == nullptr) {
+    log_warn("Couldn't start the tree builder thread");
+    HTML_TokenQueue_destroy(queue);
+    self->queue = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void DOM_TreeBuilder_feed(DOM_TreeBuilder *self,
+                          const HTMLTokenStream &tokens) {
+  if (self->thread != nullptr) {
+    HTML_TokenQueue_push(self->queue, self->queueArena, tokens);
+  } else {
+    DOM_TreeBuilder_build(self, tokens);
+  }
+}
+
+/**
+ * Moves the attribute lists of the elements into a single array in `arena`.
+ */
+static void DOM_Tree_copyAttributes(DOM_Tree *self, Arena *arena) {
+  u32 numAttributes = 0;
+  for (auto [elem, _] : self->elementData) {
+    numAttributes += elem.attributes.length;
+  }
+
+  Slice<HTMLAttribute> pool;
+  alloc(arena, numAttributes, pool);
+  u32 idxPool = 0;
+  for (auto [elem, _] : self->elementData) {
+    if (elem.attributes.length == 0) {
+      continue;
     }
+
+    Slice<HTMLAttribute> attributes = {pool.data + idxPool,
+                                       elem.attributes.length};
+    copy(attributes, elem.attributes);
+    elem.attributes = attributes;
+    idxPool += attributes.length;
+  }
+}
+
+void DOM_TreeBuilder_finish(DOM_TreeBuilder *self,
+                            DOM_Tree *tree,
+                            Arena *arena,
+                            u32 flags) {
+  if (self->thread != nullptr) {
+    HTML_TokenQueue_close(self->queue);
+    os_join_thread(self->thread);
+    HTML_TokenQueue_destroy(self->queue);
+    self->thread = nullptr;
+    self->queue = nullptr;
+  }
+
+  self->parser.arena = arena;
+  DOM_Parser_finish(self->scratch, self->parser, tree);
+  DOM_Tree_copyAttributes(tree, arena);
+  if (flags & DTF_BuildIndex) {
+    DOM_Index_init(&tree->index, arena, tree);
+  }
+}
+
+b32 DOM_Tree_init(DOM_Tree *self,
+                  Arena *arena,
+                  const HTMLTokenStream &tokens,
+                  u32 flags) {
+  u32 numTokens = HTML_TokenStream_length(&tokens);
+  u32 numOpenTags = 0;
+  u32 numTexts = 0;
+  for (u32 i = 0; i < numTokens; i++) {
+    numOpenTags += tokens.kinds[i] == HTMLTokenKind::OpenTag;
+    numTexts += tokens.kinds[i] == HTMLTokenKind::Text;
+  }
+
+  ArenaTemp temp = getScratch(&arena, 1);
+
+  DOM_TreeBuilder builder;
+  DOM_TreeBuilder_init(&builder, temp.arena, numOpenTags, numTexts);
+  DOM_TreeBuilder_feed(&builder, tokens);
+  DOM_TreeBuilder_finish(&builder, self, arena, flags);
+
+  releaseScratch(temp);
+  return true;
+}
+
+// Below this, starting a thread costs more than the overlap saves
+static const u32 MIN_PIPELINED_SIZE = 64 * 1024;
+// How much of the document is tokenized before the tokens are handed over
+static const u32 PIPELINE_STEP_SIZE = 16 * 1024;
+
+b32 DOM_Tree_initPipelined(DOM_Tree *self,
+                           Arena *arena,
+                           Slice<u8> source,
+                           u32 flags) {
+  ArenaTemp temp = getScratch(&arena, 1);
+
+  // The tokenizer allocates in `arena` and the tree builder in the scratch
+  // arena, so the two threads never share an arena until they are joined
+  DOM_TreeBuilder *builder = DOM_TreeBuilder_create(temp.arena, source.length);
+  if (source.length >= MIN_PIPELINED_SIZE && os_get_num_cores() > 1) {
+    DOM_TreeBuilder_startThread(builder, arena);
+  }
+
+  HTML_Tokenizer tokenizer;
+  HTML_Tokenizer_init(&tokenizer, arena, arena);
+  HTMLTokenStream tokens;
+  b32 ok = true;
+  for (u32 offStep = 0; ok && offStep < source.length;
+       offStep += PIPELINE_STEP_SIZE) {
+    // The steps are adjacent, so they are tokenized in place
+    Slice<u8> step = subarray(source, offStep, offStep + PIPELINE_STEP_SIZE);
+    ok = HTML_Tokenizer_feed(&tokenizer, step);
+    HTML_Tokenizer_takeTokens(&tokenizer, tokens);
+    DOM_TreeBuilder_feed(builder, tokens);
   }
+  if (ok) {
+    ok = HTML_Tokenizer_finish(&tokenizer);
+    HTML_Tokenizer_takeTokens(&tokenizer, tokens);
+    DOM_TreeBuilder_feed(builder, tokens);
+  }
+
+  DOM_TreeBuilder_finish(builder, self, arena, flags);
+  releaseScratch(temp);
+  return ok;
+}
+
+template <typename Tokens>
+static f64 timeTreeConstruction(Tokens &tokens, u32 numPasses) {
+  TimePoint t0 = chrono_getCurrentTime();
+  for (u32 pass = 0; pass < numPasses; pass++) {
+    ArenaTemp temp = getScratch(nullptr, 0);
+    DOM_Tree tree = {};
+    DOM_Tree_init(&tree, temp.arena, tokens);
+    releaseScratch(temp);
+  }
+  TimePoint t1 = chrono_getCurrentTime();
 
-  while (parser.openElementStack.length != 0) {
-    popOpenElement(parser);
+  return chrono_secondsBetween(t0, t1) / numPasses;
+}
+
+void DOM_benchmarkTokenEncodings(Slice<u8> source) {
+  if (empty(source)) {
+    return;
+  }
+
+  const u32 NUM_PASSES = 16;
+  ArenaTemp temp = getScratch(nullptr, 0);
+
+  // Arenas grow downwards
+  u8 *endBefore = temp.arena->end;
+  Slice<HTMLToken> tokens;
+  if (!HTML_tokenize(temp.arena, source, tokens)) {
+    releaseScratch(temp);
+    return;
   }
+  u64 arenaTokens = (u64)(endBefore - temp.arena->end);
 
-  self->elementData = copyToSlice(arena, parser.elementData);
+  endBefore = temp.arena->end;
+  DOM_Tree tree = {};
+  DOM_Tree_init(&tree, temp.arena, tokens);
+  u64 arenaTree = (u64)(endBefore - temp.arena->end);
 
-  DCHECK(self->elementData.length == parser.elementData.length);
-  self->textData = copyToSlice(arena, parser.textData);
-  self->nodes = copyToSlice(arena, parser.nodes);
-  self->idxHtmlNode = parser.idxHtmlNode;
-  self->idxHeadNode = parser.idxHeadNode;
+  HTMLTokenStream stream;
+  CHECK(HTML_tokenize(temp.arena, source, stream));
+
+  u64 sizeTokens = (u64)tokens.length * sizeof(HTMLToken);
+  for (auto [token, _] : tokens) {
+    if (token.kind == HTMLTokenKind::OpenTag) {
+      sizeTokens += token.openTag.attributes.length * sizeof(HTMLAttribute);
+    }
+  }
+  u64 sizeStream = HTML_TokenStream_sizeInBytes(&stream);
+
+  f64 secsTokens = timeTreeConstruction(tokens, NUM_PASSES);
+  f64 secsStream = timeTreeConstruction(stream, NUM_PASSES);
+
+  log_info("Tokens  %u tokens, %8llu bytes, tree built in %.3f ms",
+           tokens.length, (unsigned long long)sizeTokens, secsTokens * 1000);
+  log_info("Stream  %u tokens, %8llu bytes, tree built in %.3f ms",
+           HTML_TokenStream_length(&stream), (unsigned long long)sizeStream,
+           secsStream * 1000);
+  log_info("Arena usage: %llu bytes for the tokens, %llu bytes for the tree",
+           (unsigned long long)arenaTokens, (unsigned long long)arenaTree);
 
   releaseScratch(temp);
+}
+
+static b32 equalTrees(DOM_Tree &l, DOM_Tree &r) {
+  if (l.nodes.length != r.nodes.length ||
+      l.elementData.length != r.elementData.length ||
+      l.textData.length != r.textData.length) {
+    return false;
+  }
+
+  for (auto [node, i] : l.nodes) {
+    DOM_Node &other = r.nodes[i];
+    if (node.kind != other.kind || node.idxElement != other.idxElement ||
+        node.idxParent != other.idxParent ||
+        node.idxLastDescendant != other.idxLastDescendant) {
+      return false;
+    }
+  }
+  for (auto [elem, i] : l.elementData) {
+    DOM_ElementData &other = r.elementData[i];
+    if (elem.tag != other.tag || elem.name.data != other.name.data ||
+        elem.attributes.length != other.attributes.length) {
+      return false;
+    }
+  }
+  for (auto [text, i] : l.textData) {
+    if (text.contents.data != r.textData[i].contents.data) {
+      return false;
+    }
+  }
+
   return true;
 }
 
+void DOM_benchmarkPipeline(Slice<u8> source) {
+  if (empty(source)) {
+    return;
+  }
+
+  const u32 NUM_PASSES = 8;
+  ArenaTemp temp = getScratch(nullptr, 0);
+
+  DOM_Tree sequential = {};
+  DOM_Tree pipelined = {};
+  f64 secsSequential = 0;
+  f64 secsPipelined = 0;
+  for (u32 pass = 0; pass < NUM_PASSES; pass++) {
+    resetScratch(temp);
+
+    TimePoint t0 = chrono_getCurrentTime();
+    Slice<HTMLToken> tokens = {};
+    if (!HTML_tokenize(temp.arena, source, tokens)) {
+      // The pipeline would build a partial tree
+      releaseScratch(temp);
+      return;
+    }
+    sequential = {};
+    DOM_Tree_init(&sequential, temp.arena, tokens);
+    TimePoint t1 = chrono_getCurrentTime();
+    pipelined = {};
+    DOM_Tree_initPipelined(&pipelined, temp.arena, source);
+    TimePoint t2 = chrono_getCurrentTime();
+
+    secsSequential += chrono_secondsBetween(t0, t1);
+    secsPipelined += chrono_secondsBetween(t1, t2);
+  }
+
+  log_info("Tokenize, then build tree: %.3f ms",
+           secsSequential * 1000 / NUM_PASSES);
+  log_info("Pipelined:                 %.3f ms (%s)",
+           secsPipelined * 1000 / NUM_PASSES,
+           equalTrees(sequential, pipelined) ? "same tree" : "TREES DIFFER");
+
+  releaseScratch(temp);
+}
+
 #include <stdio.h>
 
 b32 DOM_Tree_print(DOM_Tree *self, u32 idxNode) {
@@ -775,13 +1308,3 @@ b32 DOM_Tree_print(DOM_Tree *self, u32 idxNode) {
 b32 DOM_Tree_print(DOM_Tree *self) {
   return DOM_Tree_print(self, self->idxHtmlNode);
 }
-
-b32 DOM_isBlock(DOM_ElementData &elem) {
-  return equalCaseInsensitiveAny(elem.name, TAG_BODY, TAG_DIV, TAG_P, TAG_H1,
-                                 TAG_H2, TAG_H3, TAG_H4, TAG_H5, TAG_H6, TAG_DL,
-                                 TAG_DT, TAG_DD, TAG_HEADER, TAG_ADDRESS);
-}
-
-b32 DOM_isInline(DOM_ElementData &elem) {
-  return equalCaseInsensitiveAny(elem.name, TAG_A);
-}
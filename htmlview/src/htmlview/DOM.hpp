@@ -1,6 +1,7 @@
 #pragma once
 
 #include "htmlview/HTML.hpp"
+#include "htmlview/Tag.hpp"
 #include "std/Arena.h"
 #include "std/Slice.hpp"
 
@@ -22,6 +23,9 @@ struct DOM_Node {
   u32 idxPrev;
   u32 idxNext;
   u32 idxParent;
+  // The subtree of this node is the range [index of this node,
+  // idxLastDescendant]
+  u32 idxLastDescendant;
 
   Slice<u32> children;
 };
@@ -29,6 +33,7 @@ struct DOM_Node {
 struct DOM_ElementData {
   u32 idxNode;
   Slice<u8> name;
+  TagId tag;
   Slice<HTMLAttribute> attributes;
   b32 isSelfClosing;
 };
@@ -38,6 +43,54 @@ struct DOM_TextData {
   Slice<u8> contents;
 };
 
+// X(identifier, name)
+#define DOM_INDEXED_ATTRIBUTES(X) \
+  X(Href, "href")                 \
+  X(Id, "id")                     \
+  X(Class, "class")               \
+  X(Name, "name")
+
+/**
+ * The attributes whose values are collected by the tree's index.
+ */
+enum class DOM_AttrId : u8 {
+#define DOM_ATTR_ENUM(id, name) id,
+  DOM_INDEXED_ATTRIBUTES(DOM_ATTR_ENUM)
+#undef DOM_ATTR_ENUM
+      Count,
+};
+
+struct DOM_AttributeEntry {
+  u32 idxElement;
+  Slice<u8> value;
+};
+
+/**
+ * Lookup tables from tag and attribute names to the elements that have them.
+ * Both are ordered by element index, i.e. in document order.
+ */
+struct DOM_Index {
+  // The indices of the elements with tag T are
+  // `elements[idxFirstElement[T] .. idxFirstElement[T + 1]]`
+  Slice<u32> idxFirstElement;
+  Slice<u32> elements;
+
+  // Likewise for the occurrences of attribute A; only the first one of each
+  // element is recorded
+  Slice<u32> idxFirstAttribute;
+  Slice<DOM_AttributeEntry> attributes;
+};
+
+enum DOM_TreeFlags : u32 {
+  DTF_BuildIndex = 1 << 0,
+};
+
+/**
+ * The nodes are stored in depth-first pre-order, so a node's parent always
+ * precedes it and its descendants immediately follow it. The element and text
+ * data are in the same order, and the children arrays of all nodes are
+ * adjacent parts of a single pool.
+ */
 struct DOM_Tree {
   Slice<DOM_ElementData> elementData;
   Slice<DOM_TextData> textData;
@@ -45,36 +98,111 @@ struct DOM_Tree {
 
   u32 idxHtmlNode;
   u32 idxHeadNode;
+
+  // Only built when DTF_BuildIndex is passed to DOM_Tree_init
+  DOM_Index index;
 };
 
-extern const Slice<u8> TAG_HTML;
-extern const Slice<u8> TAG_HEAD;
-extern const Slice<u8> TAG_TITLE;
-extern const Slice<u8> TAG_BODY;
-extern const Slice<u8> TAG_DD;
-extern const Slice<u8> TAG_DT;
-extern const Slice<u8> TAG_P;
-extern const Slice<u8> TAG_A;
-extern const Slice<u8> TAG_DIV;
-extern const Slice<u8> TAG_DL;
-extern const Slice<u8> TAG_UL;
-extern const Slice<u8> TAG_TABLE;
-extern const Slice<u8> TAG_TD;
-extern const Slice<u8> TAG_TH;
-extern const Slice<u8> TAG_H1;
-extern const Slice<u8> TAG_H2;
-extern const Slice<u8> TAG_H3;
-extern const Slice<u8> TAG_H4;
-extern const Slice<u8> TAG_H5;
-extern const Slice<u8> TAG_H6;
-extern const Slice<u8> TAG_HEADER;
-
-b32 DOM_Tree_init(DOM_Tree *self, Arena *arena, Slice<HTMLToken> tokens);
+b32 DOM_Tree_init(DOM_Tree *self,
+                  Arena *arena,
+                  Slice<HTMLToken> tokens,
+                  u32 flags = 0);
+/**
+ * Builds the tree from a compact token stream. Unlike with the other overload,
+ * the resulting tree doesn't point into the tokens, only into the source
+ * document, so the stream can be discarded once this returns.
+ */
+b32 DOM_Tree_init(DOM_Tree *self,
+                  Arena *arena,
+                  const HTMLTokenStream &tokens,
+                  u32 flags = 0);
+
+/**
+ * Builds a tree from tokens that arrive in batches, e.g. from the streaming
+ * tokenizer while the document is being received.
+ */
+struct DOM_TreeBuilder;
+/**
+ * Everything the builder needs until the tree is finished is allocated in
+ * `scratch`. `lenSourceHint` is the expected length of the document, if
+ * known, and is only used to size the builder's arrays.
+ */
+DOM_TreeBuilder *DOM_TreeBuilder_create(Arena *scratch, u32 lenSourceHint);
+/**
+ * Moves tree construction to a thread of its own, so that it overlaps with
+ * tokenizing: from then on, DOM_TreeBuilder_feed only queues the tokens,
+ * waiting whenever the thread falls behind. The builder's scratch arena
+ * belongs to that thread until DOM_TreeBuilder_finish, and the queue grows in
+ * `arena`. Returns false, and the builder keeps running on the calling
+ * thread, if the thread can't be started.
+ */
+b32 DOM_TreeBuilder_startThread(DOM_TreeBuilder *self, Arena *arena);
+/**
+ * Adds the tokens to the tree. The batch can be discarded afterwards, but the
+ * document that the tokens refer to must outlive the tree.
+ */
+void DOM_TreeBuilder_feed(DOM_TreeBuilder *self,
+                          const HTMLTokenStream &tokens);
+/**
+ * Finishes the tree in `arena`, closing the elements that are still open.
+ * Like with the stream overload of DOM_Tree_init, the tree doesn't point into
+ * the builder's scratch arena.
+ */
+void DOM_TreeBuilder_finish(DOM_TreeBuilder *self,
+                            DOM_Tree *tree,
+                            Arena *arena,
+                            u32 flags = 0);
+/**
+ * Tokenizes the document and builds the tree at the same time: the tokenizer
+ * runs on the calling thread and hands batches of tokens to the tree builder
+ * on another one. Small documents, or any document when there is a single
+ * core or no thread can be started, are built on the calling thread.
+ * If the document is malformed, the tree is built from the tokens before the
+ * error and false is returned.
+ */
+b32 DOM_Tree_initPipelined(DOM_Tree *self,
+                           Arena *arena,
+                           Slice<u8> source,
+                           u32 flags = 0);
 b32 DOM_Tree_print(DOM_Tree *self);
 
+/**
+ * Returns the indices of the elements with the tag, in document order. The
+ * tree must have been built with DTF_BuildIndex.
+ */
+Slice<u32> DOM_Tree_elementsWithTag(DOM_Tree *self, TagId tag);
+/**
+ * Returns the elements that have the attribute along with its value, in
+ * document order. The tree must have been built with DTF_BuildIndex.
+ */
+Slice<DOM_AttributeEntry> DOM_Tree_elementsWithAttribute(DOM_Tree *self,
+                                                         DOM_AttrId attr);
+/**
+ * Looks up the id of an attribute name case-insensitively. Returns
+ * DOM_AttrId::Count if the attribute isn't indexed.
+ */
+DOM_AttrId DOM_attrFromName(Slice<u8> name);
+
+/**
+ * Logs the memory footprint of the HTMLToken array and the HTMLTokenStream
+ * encodings of the document and how long it takes to build a tree from each,
+ * as well as how much arena memory HTML_tokenize and DOM_Tree_init use.
+ */
+void DOM_benchmarkTokenEncodings(Slice<u8> source);
+/**
+ * Compares tokenizing and then building the tree with DOM_Tree_initPipelined
+ * and logs the timings and whether the trees are identical.
+ */
+void DOM_benchmarkPipeline(Slice<u8> source);
+
 b32 equalCaseInsensitive(Slice<u8> l, Slice<u8> r);
 #define equalCaseInsensitiveLit(l, s) \
   equalCaseInsensitive(l, SLICE_FROM_STRLIT(s))
 
-b32 DOM_isBlock(DOM_ElementData &elem);
-b32 DOM_isInline(DOM_ElementData &elem);
+inline b32 DOM_isBlock(DOM_ElementData &elem) {
+  return Tag_hasCategory(elem.tag, TC_Block);
+}
+
+inline b32 DOM_isInline(DOM_ElementData &elem) {
+  return Tag_hasCategory(elem.tag, TC_Inline);
+}
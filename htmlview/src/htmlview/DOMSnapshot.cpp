@@ -0,0 +1,464 @@
+#include "htmlview/DOMSnapshot.hpp"
+#include "std/Check.h"
+#include "std/Utils.hpp"
+
+static const u32 SNAPSHOT_MAGIC = 'H' | ('V' << 8) | ('D' << 16) | ('S' << 24);
+static const u32 SNAPSHOT_VERSION = 2;
+
+// `length` is a number of elements, not bytes
+struct SnapshotSection {
+  u32 offset;
+  u32 length;
+};
+
+struct SnapshotHeader {
+  u32 magic;
+  u32 version;
+  u32 size;
+
+  u32 idxHtmlNode;
+  u32 idxHeadNode;
+
+  // The URL of the page
+  SnapshotSection url;
+  // The source document, followed by the strings of the tree that aren't part
+  // of it
+  SnapshotSection bytes;
+  u32 lenSource;
+
+  SnapshotSection elementData;
+  SnapshotSection textData;
+  SnapshotSection nodes;
+  // The children of all nodes and the attributes of all elements
+  SnapshotSection children;
+  SnapshotSection attributes;
+
+  SnapshotSection idxFirstElement;
+  SnapshotSection indexElements;
+  SnapshotSection idxFirstAttribute;
+  SnapshotSection indexAttributes;
+};
+
+struct SnapshotWriter {
+  u8 *base;
+  Slice<u8> source;
+  // Where the next string that is not part of the source goes
+  u32 offNextString;
+};
+
+static u32 alignOffset(u32 offset) {
+  return (offset + 7) & ~7u;
+}
+
+template <typename T>
+static b32 isInside(Slice<T> outer, Slice<T> s) {
+  return outer.data <= s.data && s.data + s.length <= outer.data + outer.length;
+}
+
+static u32 lengthOutside(Slice<u8> source, Slice<u8> s) {
+  return isInside(source, s) ? 0 : s.length;
+}
+
+template <typename T>
+static Slice<T> asOffset(u32 offset, u32 length) {
+  if (length == 0) {
+    return {nullptr, 0};
+  }
+  return {(T *)(uintptr_t)offset, length};
+}
+
+/**
+ * Reserves space for an array of `length` elements of T at `cursor`.
+ */
+template <typename T>
+static SnapshotSection allocSection(u32 &cursor, u32 length) {
+  SnapshotSection ret = {cursor, length};
+  cursor = alignOffset(cursor + length * sizeof(T));
+  return ret;
+}
+
+template <typename T>
+static T *sectionData(SnapshotWriter &W, SnapshotSection section) {
+  return (T *)(W.base + section.offset);
+}
+
+/**
+ * Copies an array into a section. Empty arrays may have no data pointer, which
+ * memcpy doesn't accept even for zero bytes.
+ */
+template <typename T>
+static void writeArray(T *dst, Slice<T> src) {
+  if (src.length != 0) {
+    memcpy(dst, src.data, src.length * sizeof(T));
+  }
+}
+
+static Slice<u8> writeString(SnapshotWriter &W,
+                             u32 offSource,
+                             Slice<u8> s) {
+  if (s.length == 0) {
+    return {nullptr, 0};
+  }
+
+  if (isInside(W.source, s)) {
+    return asOffset<u8>(offSource + (u32)(s.data - W.source.data), s.length);
+  }
+
+  u32 offset = W.offNextString;
+  memcpy(W.base + offset, s.data, s.length);
+  W.offNextString += s.length;
+  return asOffset<u8>(offset, s.length);
+}
+
+Slice<u8> DOM_Snapshot_write(Arena *arena,
+                             DOM_Tree *tree,
+                             Slice<u8> source,
+                             Slice<u8> url) {
+  DOM_Index &index = tree->index;
+
+  u32 numChildren = 0;
+  for (auto [node, _] : tree->nodes) {
+    numChildren += node.children.length;
+  }
+
+  u32 numAttributes = 0;
+  u32 lenStrings = 0;
+  for (auto [elem, _] : tree->elementData) {
+    numAttributes += elem.attributes.length;
+    lenStrings += lengthOutside(source, elem.name);
+    for (auto [attr, _] : elem.attributes) {
+      lenStrings += lengthOutside(source, attr.name);
+      lenStrings += lengthOutside(source, attr.value);
+    }
+  }
+  for (auto [text, _] : tree->textData) {
+    lenStrings += lengthOutside(source, text.contents);
+  }
+  for (auto [entry, _] : index.attributes) {
+    lenStrings += lengthOutside(source, entry.value);
+  }
+
+  SnapshotHeader header = {};
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.idxHtmlNode = tree->idxHtmlNode;
+  header.idxHeadNode = tree->idxHeadNode;
+  header.lenSource = source.length;
+
+  u32 cursor = alignOffset(sizeof(SnapshotHeader));
+  header.url = allocSection<u8>(cursor, url.length);
+  header.bytes = allocSection<u8>(cursor, source.length + lenStrings);
+  header.elementData =
+      allocSection<DOM_ElementData>(cursor, tree->elementData.length);
+  header.textData = allocSection<DOM_TextData>(cursor, tree->textData.length);
+  header.nodes = allocSection<DOM_Node>(cursor, tree->nodes.length);
+  header.children = allocSection<u32>(cursor, numChildren);
+  header.attributes = allocSection<HTMLAttribute>(cursor, numAttributes);
+  header.idxFirstElement =
+      allocSection<u32>(cursor, index.idxFirstElement.length);
+  header.indexElements = allocSection<u32>(cursor, index.elements.length);
+  header.idxFirstAttribute =
+      allocSection<u32>(cursor, index.idxFirstAttribute.length);
+  header.indexAttributes =
+      allocSection<DOM_AttributeEntry>(cursor, index.attributes.length);
+  header.size = cursor;
+
+  SnapshotWriter W = {};
+  W.base = alloc(arena, 1, 8, header.size);
+  W.source = source;
+  W.offNextString = header.bytes.offset + source.length;
+
+  memcpy(W.base, &header, sizeof(header));
+  writeArray(W.base + header.url.offset, url);
+  memcpy(W.base + header.bytes.offset, source.data, source.length);
+
+  u32 offSource = header.bytes.offset;
+
+  DOM_ElementData *elementData =
+      sectionData<DOM_ElementData>(W, header.elementData);
+  HTMLAttribute *attributes = sectionData<HTMLAttribute>(W, header.attributes);
+  u32 idxNextAttribute = 0;
+  for (auto [elem, i] : tree->elementData) {
+    DOM_ElementData &out = elementData[i];
+    out = elem;
+    out.name = writeString(W, offSource, elem.name);
+    out.attributes = asOffset<HTMLAttribute>(
+        header.attributes.offset + idxNextAttribute * sizeof(HTMLAttribute),
+        elem.attributes.length);
+
+    for (auto [attr, _] : elem.attributes) {
+      HTMLAttribute &outAttr = attributes[idxNextAttribute++];
+      outAttr.name = writeString(W, offSource, attr.name);
+      outAttr.value = writeString(W, offSource, attr.value);
+    }
+  }
+
+  DOM_TextData *textData = sectionData<DOM_TextData>(W, header.textData);
+  for (auto [text, i] : tree->textData) {
+    textData[i].idxNode = text.idxNode;
+    textData[i].contents = writeString(W, offSource, text.contents);
+  }
+
+  DOM_Node *nodes = sectionData<DOM_Node>(W, header.nodes);
+  u32 *children = sectionData<u32>(W, header.children);
+  u32 idxNextChild = 0;
+  for (auto [node, i] : tree->nodes) {
+    nodes[i] = node;
+    nodes[i].children =
+        asOffset<u32>(header.children.offset + idxNextChild * sizeof(u32),
+                      node.children.length);
+    writeArray(children + idxNextChild, node.children);
+    idxNextChild += node.children.length;
+  }
+
+  writeArray(sectionData<u32>(W, header.idxFirstElement),
+             index.idxFirstElement);
+  writeArray(sectionData<u32>(W, header.indexElements), index.elements);
+  writeArray(sectionData<u32>(W, header.idxFirstAttribute),
+             index.idxFirstAttribute);
+
+  DOM_AttributeEntry *indexAttributes =
+      sectionData<DOM_AttributeEntry>(W, header.indexAttributes);
+  for (auto [entry, i] : index.attributes) {
+    indexAttributes[i].idxElement = entry.idxElement;
+    indexAttributes[i].value = writeString(W, offSource, entry.value);
+  }
+
+  DCHECK(W.offNextString == header.bytes.offset + header.bytes.length);
+  return {W.base, header.size};
+}
+
+/**
+ * Turns a slice written by asOffset back into a pointer into the snapshot.
+ * Returns false if it would point outside of it.
+ */
+template <typename T>
+static b32 relocate(Slice<u8> snapshot, Slice<T> &s) {
+  if (s.length == 0) {
+    s.data = nullptr;
+    return true;
+  }
+
+  uintptr_t offset = (uintptr_t)s.data;
+  if (offset > snapshot.length || offset % alignof(T) != 0 ||
+      (snapshot.length - offset) / sizeof(T) < s.length) {
+    return false;
+  }
+
+  s.data = (T *)(snapshot.data + offset);
+  return true;
+}
+
+/**
+ * Like relocate, but the slice must also stay inside of the section `outer`
+ * that it was written to.
+ */
+template <typename T>
+static b32 relocateInto(Slice<u8> snapshot, Slice<T> outer, Slice<T> &s) {
+  return relocate(snapshot, s) && (s.length == 0 || isInside(outer, s));
+}
+
+template <typename T>
+static b32 getSection(Slice<u8> snapshot,
+                      SnapshotSection section,
+                      Slice<T> &out) {
+  out = asOffset<T>(section.offset, section.length);
+  return relocate(snapshot, out);
+}
+
+static b32 isNodeIndex(DOM_Tree *tree, u32 idxNode) {
+  return idxNode < tree->nodes.length;
+}
+
+static b32 isNodeIndexOrInvalid(DOM_Tree *tree, u32 idxNode) {
+  return idxNode == DOM_INVALID_INDEX || isNodeIndex(tree, idxNode);
+}
+
+/**
+ * Checks that a lookup table of the index has an entry for every key plus
+ * one, and that its ranges are in order and inside of `numEntries`.
+ */
+static b32 isValidIndexTable(Slice<u32> idxFirst,
+                             u32 numKeys,
+                             u32 numEntries) {
+  if (idxFirst.length != numKeys + 1 || idxFirst[0] != 0 ||
+      idxFirst[numKeys] != numEntries) {
+    return false;
+  }
+  for (u32 i = 0; i < numKeys; i++) {
+    if (idxFirst[i] > idxFirst[i + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Checks that every index stored in the tree refers to something that exists,
+ * so that walking the tree can't leave its arrays.
+ */
+static b32 isValidTree(DOM_Tree *tree) {
+  if (!isNodeIndexOrInvalid(tree, tree->idxHtmlNode) ||
+      !isNodeIndexOrInvalid(tree, tree->idxHeadNode)) {
+    return false;
+  }
+
+  for (auto [node, idxNode] : tree->nodes) {
+    switch (node.kind) {
+      case DOM_NodeKind::Element:
+        if (node.idxElement >= tree->elementData.length) {
+          return false;
+        }
+        break;
+      case DOM_NodeKind::Text:
+        if (node.idxText >= tree->textData.length) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+
+    if (!isNodeIndexOrInvalid(tree, node.idxPrev) ||
+        !isNodeIndexOrInvalid(tree, node.idxNext) ||
+        !isNodeIndexOrInvalid(tree, node.idxParent) ||
+        !isNodeIndex(tree, node.idxLastDescendant) ||
+        node.idxLastDescendant < idxNode) {
+      return false;
+    }
+
+    for (auto [idxChild, _] : node.children) {
+      if (!isNodeIndex(tree, idxChild)) {
+        return false;
+      }
+    }
+  }
+
+  for (auto [elem, _] : tree->elementData) {
+    if (!isNodeIndex(tree, elem.idxNode) ||
+        (u32)elem.tag >= (u32)TagId::Count) {
+      return false;
+    }
+  }
+
+  for (auto [text, _] : tree->textData) {
+    if (!isNodeIndex(tree, text.idxNode)) {
+      return false;
+    }
+  }
+
+  // The index is only there if the tree was built with it
+  DOM_Index &index = tree->index;
+  if (index.idxFirstElement.length != 0 &&
+      !isValidIndexTable(index.idxFirstElement, (u32)TagId::Count,
+                         index.elements.length)) {
+    return false;
+  }
+  if (index.idxFirstAttribute.length != 0 &&
+      !isValidIndexTable(index.idxFirstAttribute, (u32)DOM_AttrId::Count,
+                         index.attributes.length)) {
+    return false;
+  }
+
+  for (auto [idxElement, _] : index.elements) {
+    if (idxElement >= tree->elementData.length) {
+      return false;
+    }
+  }
+
+  for (auto [entry, _] : index.attributes) {
+    if (entry.idxElement >= tree->elementData.length) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+b32 DOM_Snapshot_load(Slice<u8> snapshot,
+                      Slice<u8> url,
+                      DOM_Tree *tree,
+                      Slice<u8> &source) {
+  SnapshotHeader header;
+  if (snapshot.length < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, snapshot.data, sizeof(header));
+  if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+      header.size > snapshot.length) {
+    return false;
+  }
+  snapshot.length = header.size;
+
+  *tree = {};
+  tree->idxHtmlNode = header.idxHtmlNode;
+  tree->idxHeadNode = header.idxHeadNode;
+
+  DOM_Index &index = tree->index;
+  Slice<u8> snapshotUrl;
+  Slice<u8> bytes;
+  Slice<u32> children;
+  Slice<HTMLAttribute> attributes;
+  if (!getSection(snapshot, header.url, snapshotUrl) ||
+      !getSection(snapshot, header.bytes, bytes) ||
+      !getSection(snapshot, header.elementData, tree->elementData) ||
+      !getSection(snapshot, header.textData, tree->textData) ||
+      !getSection(snapshot, header.nodes, tree->nodes) ||
+      !getSection(snapshot, header.children, children) ||
+      !getSection(snapshot, header.attributes, attributes) ||
+      !getSection(snapshot, header.idxFirstElement, index.idxFirstElement) ||
+      !getSection(snapshot, header.indexElements, index.elements) ||
+      !getSection(snapshot, header.idxFirstAttribute,
+                  index.idxFirstAttribute) ||
+      !getSection(snapshot, header.indexAttributes, index.attributes)) {
+    return false;
+  }
+
+  // A snapshot of another page, e.g. one left behind by an earlier session
+  if (snapshotUrl.length != url.length ||
+      (url.length != 0 &&
+       memcmp(snapshotUrl.data, url.data, url.length) != 0)) {
+    return false;
+  }
+
+  if (header.lenSource > bytes.length) {
+    return false;
+  }
+  source = {bytes.data, header.lenSource};
+
+  // Every slice has to stay inside of the section that it was written to, not
+  // just inside of the snapshot
+  for (auto [attr, _] : attributes) {
+    if (!relocateInto(snapshot, bytes, attr.name) ||
+        !relocateInto(snapshot, bytes, attr.value)) {
+      return false;
+    }
+  }
+
+  for (auto [elem, _] : tree->elementData) {
+    if (!relocateInto(snapshot, bytes, elem.name) ||
+        !relocateInto(snapshot, attributes, elem.attributes)) {
+      return false;
+    }
+  }
+
+  for (auto [text, _] : tree->textData) {
+    if (!relocateInto(snapshot, bytes, text.contents)) {
+      return false;
+    }
+  }
+
+  for (auto [node, _] : tree->nodes) {
+    if (!relocateInto(snapshot, children, node.children)) {
+      return false;
+    }
+  }
+
+  for (auto [entry, _] : index.attributes) {
+    if (!relocateInto(snapshot, bytes, entry.value)) {
+      return false;
+    }
+  }
+
+  return isValidTree(tree);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "htmlview/DOM.hpp"
+#include "std/Arena.h"
+#include "std/Slice.hpp"
+
+/**
+ * A parsed page stored as a single relocatable buffer: the source document
+ * followed by the arrays of the DOM tree, in the same layout as in memory
+ * except that every pointer is stored as an offset from the start of the
+ * buffer. Loading one is a single pass of pointer fixups, without tokenizing
+ * or building the tree again.
+ */
+
+/**
+ * Serializes the tree along with the source document it points into and the
+ * URL of the page. Strings of the tree that don't point into `source` (e.g.
+ * the names of implied elements) are copied into the snapshot after it.
+ */
+Slice<u8> DOM_Snapshot_write(Arena *arena,
+                             DOM_Tree *tree,
+                             Slice<u8> source,
+                             Slice<u8> url);
+
+/**
+ * Restores a tree from a snapshot in place. The buffer must be writable and
+ * must outlive the tree, as the tree points into it afterwards. Returns false
+ * if the buffer isn't a well-formed snapshot, e.g. one of its indices is out
+ * of range, or if it was written for a page other than `url`; in that case
+ * its contents are unspecified.
+ */
+b32 DOM_Snapshot_load(Slice<u8> snapshot,
+                      Slice<u8> url,
+                      DOM_Tree *tree,
+                      Slice<u8> &source);
@@ -1,11 +1,15 @@
 #include "htmlview/HTML.hpp"
+#include "htmlview/HTMLScan.hpp"
+#include "htmlview/OS.hpp"
 #include "log/log.h"
+#include "std/Chronometry.h"
 #include "std/Arena.h"
 #include "std/Slice.hpp"
 #include "std/Utils.hpp"
 #include "std/Vector.hpp"
+#include "std/vec.h"
 
-static b32 isAlphanumeric(u8 ch) {
+b32 HTML_isAlphanumeric(u8 ch) {
   if ('a' <= ch && ch <= 'z') {
     return true;
   }
@@ -24,13 +28,189 @@ b32 HTML_isWhitespace(u8 ch) {
 }
 
 static b32 eatWhitespace(Slice<u8> &cur) {
-  while (!empty(cur) && HTML_isWhitespace(cur[0])) {
-    shrinkFromLeft(&cur);
-  }
+  shrinkFromLeftByCount(&cur, HTML_scanWhitespace(cur.data, cur.length));
 
   return !empty(cur);
 }
 
+template <typename T>
+static void reserveExactly(Arena *arena, Vector<T> &v, u32 count) {
+  if (v.length + count <= v.capacity) {
+    return;
+  }
+
+  T *data = alloc<T>(arena, v.length + count);
+  if (v.length != 0) {
+    memcpy(data, v.data, v.length * sizeof(T));
+  }
+  v.data = data;
+  v.capacity = v.length + count;
+}
+
+/**
+ * Makes room for this many more tokens and attributes, without any slack.
+ */
+static void HTML_reserve(HTMLTokenSink &out,
+                         u32 numTokens,
+                         u32 numAttributes) {
+  switch (out.mode) {
+    case HTMLSinkMode::Count:
+      break;
+    case HTMLSinkMode::Tokens:
+      reserveExactly(out.arena, out.tokens, numTokens);
+      reserveExactly(out.arena, out.attributes, numAttributes);
+      break;
+    case HTMLSinkMode::Stream:
+      reserveExactly(out.arena, out.kinds, numTokens);
+      reserveExactly(out.arena, out.tags, numTokens);
+      reserveExactly(out.arena, out.flags, numTokens);
+      reserveExactly(out.arena, out.offsets, numTokens);
+      reserveExactly(out.arena, out.lengths, numTokens);
+      reserveExactly(out.arena, out.idxFirstAttribute, numTokens);
+      reserveExactly(out.arena, out.attributeRefs, numAttributes);
+      break;
+  }
+}
+
+static void HTML_initStreamSink(HTMLTokenSink &out,
+                                Arena *arena,
+                                const u8 *base) {
+  out = {};
+  out.mode = HTMLSinkMode::Stream;
+  out.arena = arena;
+  out.base = base;
+  // The attributes of the first token start at the first attribute
+  *append(arena, &out.idxFirstAttribute) = 0;
+}
+
+/**
+ * Returns the tokens of a stream sink from `idxFirstToken` on. The attribute
+ * indices of the tokens count from the start of the sink, so the stream gets
+ * all of its attributes.
+ */
+static HTMLTokenStream HTML_streamOfSink(HTMLTokenSink &out,
+                                         Slice<u8> source,
+                                         u32 idxFirstToken) {
+  DCHECK(out.mode == HTMLSinkMode::Stream);
+  u32 numTokens = out.kinds.length - idxFirstToken;
+
+  HTMLTokenStream ret;
+  ret.source = source;
+  ret.kinds = {out.kinds.data + idxFirstToken, numTokens};
+  ret.tags = {out.tags.data + idxFirstToken, numTokens};
+  ret.flags = {out.flags.data + idxFirstToken, numTokens};
+  ret.offsets = {out.offsets.data + idxFirstToken, numTokens};
+  ret.lengths = {out.lengths.data + idxFirstToken, numTokens};
+  ret.idxFirstAttribute = {out.idxFirstAttribute.data + idxFirstToken,
+                           numTokens + 1};
+  ret.attributes = {out.attributeRefs.data, out.attributeRefs.length};
+  return ret;
+}
+
+/**
+ * Offset of the string in the document; empty strings are at offset 0.
+ */
+static u32 offsetInDocument(HTMLTokenSink &out, Slice<u8> s) {
+  return s.length != 0 ? (u32)(s.data - out.base) : 0;
+}
+
+static void emitStreamToken(HTMLTokenSink &out,
+                            HTMLTokenKind kind,
+                            TagId tag,
+                            u8 flags,
+                            Slice<u8> str) {
+  *append(out.arena, &out.kinds) = kind;
+  *append(out.arena, &out.tags) = tag;
+  *append(out.arena, &out.flags) = flags;
+  *append(out.arena, &out.offsets) = offsetInDocument(out, str);
+  *append(out.arena, &out.lengths) = str.length;
+  // Ends the attribute range of this token and starts that of the next one
+  *append(out.arena, &out.idxFirstAttribute) = out.numAttributes;
+}
+
+/**
+ * Returns the attributes emitted since `idxFirst`.
+ */
+static Slice<HTMLAttribute> attributesSince(HTMLTokenSink &out, u32 idxFirst) {
+  u32 count = out.numAttributes - idxFirst;
+  if (count == 0) {
+    return {};
+  }
+
+  // If the vector has grown since then, the earlier attributes have been
+  // copied along, so the range is contiguous either way
+  return {out.attributes.data + out.attributes.length - count, count};
+}
+
+static void dropAttributesSince(HTMLTokenSink &out, u32 idxFirst) {
+  u32 count = out.numAttributes - idxFirst;
+  out.numAttributes = idxFirst;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    out.attributes.length -= count;
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    out.attributeRefs.length -= count;
+  }
+}
+
+static void emitAttribute(HTMLTokenSink &out,
+                          Slice<u8> name,
+                          Slice<u8> value) {
+  out.numAttributes++;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    *append(out.arena, &out.attributes) = {name, value};
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    *append(out.arena, &out.attributeRefs) = {
+        offsetInDocument(out, name), name.length,
+        offsetInDocument(out, value), value.length};
+  }
+}
+
+/**
+ * Emits an open tag whose attributes are the ones emitted since
+ * `idxFirstAttribute`.
+ */
+static void emitOpenTag(HTMLTokenSink &out,
+                        Slice<u8> name,
+                        b32 isSelfClosing,
+                        u32 idxFirstAttribute) {
+  out.numTokens++;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    HTMLToken *token = append(out.arena, &out.tokens);
+    token->kind = HTMLTokenKind::OpenTag;
+    token->openTag.name = name;
+    token->openTag.tag = Tag_fromName(name);
+    token->openTag.isSelfClosing = isSelfClosing;
+    token->openTag.attributes = attributesSince(out, idxFirstAttribute);
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    emitStreamToken(out, HTMLTokenKind::OpenTag, Tag_fromName(name),
+                    isSelfClosing ? HTF_SelfClosing : 0, name);
+  }
+}
+
+static void emitCloseTag(HTMLTokenSink &out, Slice<u8> name) {
+  out.numTokens++;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    HTMLToken *token = append(out.arena, &out.tokens);
+    token->kind = HTMLTokenKind::CloseTag;
+    token->closeTag.name = name;
+    token->closeTag.tag = Tag_fromName(name);
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    emitStreamToken(out, HTMLTokenKind::CloseTag, Tag_fromName(name), 0,
+                    name);
+  }
+}
+
+static void emitText(HTMLTokenSink &out, Slice<u8> contents) {
+  out.numTokens++;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    HTMLToken *token = append(out.arena, &out.tokens);
+    token->kind = HTMLTokenKind::Text;
+    token->text.contents = contents;
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    emitStreamToken(out, HTMLTokenKind::Text, TagId::Unknown, 0, contents);
+  }
+}
+
 static b32 eatUntilEscapableDelimiter(u8 ch, Slice<u8> &cur, Slice<u8> &value) {
   // Single quoted
   shrinkFromLeft(&cur);
@@ -41,18 +221,24 @@ static b32 eatUntilEscapableDelimiter(u8 ch, Slice<u8> &cur, Slice<u8> &value) {
   value = cur;
   value.length = 0;
 
-  b32 escaped = false;
-  while (!empty(cur) && (cur[0] != ch || escaped)) {
-    escaped = false;
-
-    if (cur[0] == '\\') {
-      escaped = true;
+  while (true) {
+    value.length += HTML_scanQuoted(cur.data + value.length,
+                                    cur.length - value.length, ch);
+    if (value.length == cur.length || cur[value.length] == ch) {
+      break;
     }
 
-    value.length++;
-    shrinkFromLeft(&cur);
+    // A backslash escapes the next character, which may be another backslash
+    while (value.length < cur.length && cur[value.length] == '\\') {
+      value.length++;
+    }
+    if (value.length < cur.length) {
+      value.length++;
+    }
   }
 
+  shrinkFromLeftByCount(&cur, value.length);
+
   if (empty(cur) || cur[0] != ch) {
     return false;
   }
@@ -62,15 +248,13 @@ static b32 eatUntilEscapableDelimiter(u8 ch, Slice<u8> &cur, Slice<u8> &value) {
   return true;
 }
 
-static b32 HTML_eatAttribute(Arena *arena,
-                             Slice<u8> &cur,
-                             Vector<HTMLAttribute> &attributes) {
+static b32 HTML_eatAttribute(HTMLTokenSink &out, Slice<u8> &cur) {
   DCHECK(!empty(cur));
 
   Slice<u8> name = cur;
   name.length = 0;
 
-  while (!empty(cur) && isAlphanumeric(cur[0])) {
+  while (!empty(cur) && HTML_isAlphanumeric(cur[0])) {
     name.length++;
     shrinkFromLeft(&cur);
   }
@@ -81,11 +265,9 @@ static b32 HTML_eatAttribute(Arena *arena,
 
   if (cur[0] == '=') {
     shrinkFromLeft(&cur);
-  } else if (isAlphanumeric(cur[0])) {
+  } else if (HTML_isAlphanumeric(cur[0])) {
     // Empty attribute
-    HTMLAttribute *attr = append(arena, &attributes);
-    attr->name = name;
-    attr->value = {};
+    emitAttribute(out, name, {});
     return true;
   }
 
@@ -102,9 +284,7 @@ static b32 HTML_eatAttribute(Arena *arena,
       return false;
     }
 
-    HTMLAttribute *attr = append(arena, &attributes);
-    attr->name = name;
-    attr->value = value;
+    emitAttribute(out, name, value);
   } else if (cur[0] == '"') {
     // Double quoted
     Slice<u8> value;
@@ -112,9 +292,7 @@ static b32 HTML_eatAttribute(Arena *arena,
       return false;
     }
 
-    HTMLAttribute *attr = append(arena, &attributes);
-    attr->name = name;
-    attr->value = value;
+    emitAttribute(out, name, value);
   } else {
     // Unquoted
     Slice<u8> value = cur;
@@ -131,24 +309,21 @@ static b32 HTML_eatAttribute(Arena *arena,
       return false;
     }
 
-    HTMLAttribute *attr = append(arena, &attributes);
-    attr->name = name;
-    attr->value = value;
+    emitAttribute(out, name, value);
   }
 
   return true;
 }
 
-static b32 HTML_tokenizeTag(Arena *arena,
+static b32 HTML_tokenizeTag(HTMLTokenSink &out,
                             Slice<u8> &cur,
-                            Vector<HTMLToken> &tokens) {
+                            b32 isFinal) {
   DCHECK(!empty(cur) && cur[0] == '<');
 
   if (cur.length == 1) {
-    // End of the document
-    HTMLToken *token = append(arena, &tokens);
-    token->kind = HTMLTokenKind::Text;
-    token->text.contents = cur;
+    // A '<' at the end of the document is text
+    emitText(out, cur);
+    shrinkFromLeft(&cur);
     return true;
   }
 
@@ -161,7 +336,7 @@ static b32 HTML_tokenizeTag(Arena *arena,
     Slice<u8> name = cur;
     name.length = 0;
 
-    while (!empty(cur) && isAlphanumeric(cur[0])) {
+    while (!empty(cur) && HTML_isAlphanumeric(cur[0])) {
       name.length++;
       shrinkFromLeft(&cur);
     }
@@ -177,23 +352,26 @@ static b32 HTML_tokenizeTag(Arena *arena,
 
     shrinkFromLeft(&cur);  // eat '>'
 
-    HTMLToken *token = append(arena, &tokens);
-    token->kind = HTMLTokenKind::CloseTag;
-    token->closeTag.name = name;
+    emitCloseTag(out, name);
   } else if (cur[0] == '!') {
-    if (cur.length > 8 && memcmp(cur.data, "!DOCTYPE", 8) == 0) {
-      while (!empty(cur) && cur[0] != '>') {
-        shrinkFromLeft(&cur);
-      }
+    // Compare only the available part so that a doctype split across chunks
+    // is reported as incomplete
+    u32 lenCmp = min(cur.length, 8u);
+    if (memcmp(cur.data, "!DOCTYPE", lenCmp) != 0) {
+      return false;
+    }
+    while (!empty(cur) && cur[0] != '>') {
       shrinkFromLeft(&cur);
-    } else {
+    }
+    if (empty(cur)) {
       return false;
     }
-  } else if (isAlphanumeric(cur[0])) {
+    shrinkFromLeft(&cur);
+  } else if (HTML_isAlphanumeric(cur[0])) {
     Slice<u8> name = cur;
     name.length = 1;
     shrinkFromLeft(&cur);
-    while (!empty(cur) && isAlphanumeric(cur[0])) {
+    while (!empty(cur) && HTML_isAlphanumeric(cur[0])) {
       name.length++;
       shrinkFromLeft(&cur);
     }
@@ -202,9 +380,9 @@ static b32 HTML_tokenizeTag(Arena *arena,
       return false;
     }
 
-    ArenaTemp temp = getScratch(&arena, 1);
-    Vector<HTMLAttribute> attributes;
+    u32 idxFirstAttribute = out.numAttributes;
     b32 isSelfClosing = false;
+    b32 isClosed = false;
     while (!empty(cur)) {
       if (!eatWhitespace(cur)) {
         return false;
@@ -213,6 +391,7 @@ static b32 HTML_tokenizeTag(Arena *arena,
 
       if (cur[0] == '>') {
         shrinkFromLeft(&cur);
+        isClosed = true;
         break;
       } else if (cur[0] == '/') {
         isSelfClosing = true;
@@ -221,19 +400,21 @@ static b32 HTML_tokenizeTag(Arena *arena,
           return false;
         }
         shrinkFromLeft(&cur);
+        isClosed = true;
         break;
       } else {
-        if (!HTML_eatAttribute(arena, cur, attributes)) {
+        if (!HTML_eatAttribute(out, cur)) {
           return false;
         }
       }
     }
 
-    HTMLToken *token = append(arena, &tokens);
-    token->kind = HTMLTokenKind::OpenTag;
-    token->openTag.name = name;
-    token->openTag.isSelfClosing = isSelfClosing;
-    token->openTag.attributes = copyToSlice(arena, attributes);
+    if (!isClosed && !isFinal) {
+      // The rest of the tag is in the next chunk
+      return false;
+    }
+
+    emitOpenTag(out, name, isSelfClosing, idxFirstAttribute);
 
     return true;
   } else {
@@ -243,79 +424,736 @@ static b32 HTML_tokenizeTag(Arena *arena,
   return true;
 }
 
-static b32 HTML_tokenizeText(Arena *arena,
+static b32 HTML_tokenizeText(HTMLTokenSink &out,
                              Slice<u8> &cur,
-                             Vector<HTMLToken> &tokens) {
+                             b32 isFinal) {
   Slice<u8> contents = cur;
-  contents.length = 0;
-  const u32 origLength = cur.length;
-  b32 stop = false;
-  while (!empty(cur) && !stop) {
-    switch (cur[0]) {
-      case '<': {
-        if (cur.length > 1) {
-          if (cur[1] == '/' || isAlphanumeric(cur[1])) {
-            // This is the beginning of a tag
-            stop = true;
-            break;
-          }
+  contents.length = HTML_scanText(cur.data, cur.length);
+  if (contents.length == cur.length && !isFinal) {
+    // The text may continue in the next chunk
+    return false;
+  }
+  shrinkFromLeftByCount(&cur, contents.length);
+
+  emitText(out, contents);
+
+  return true;
+}
+
+enum class HTMLStepResult {
+  Ok,
+  NeedMoreData,
+  Error,
+};
+
+/**
+ * Emits the token at the start of `cur`. When `isFinal` is false, input that
+ * ends in the middle of a token is left unconsumed and NeedMoreData is
+ * returned.
+ */
+static HTMLStepResult HTML_tokenizeStep(HTMLTokenSink &out,
+                                        Slice<u8> &cur,
+                                        b32 isFinal) {
+  DCHECK(!empty(cur));
+
+  switch (cur[0]) {
+    case '<': {
+      // Element
+      if (cur.length == 1 && !isFinal) {
+        return HTMLStepResult::NeedMoreData;
+      }
+
+      // Work on a copy so that an incomplete tag can be retried later
+      Slice<u8> tag = cur;
+      u32 numAttributes = out.numAttributes;
+      if (!HTML_tokenizeTag(out, tag, isFinal)) {
+        // Drop the attributes of the incomplete tag
+        dropAttributesSince(out, numAttributes);
+
+        // Running out of input is only an error at the end of the document
+        if (!isFinal && empty(tag)) {
+          return HTMLStepResult::NeedMoreData;
         }
-        contents.length++;
-        shrinkFromLeft(&cur);
-        break;
+        return HTMLStepResult::Error;
       }
-      default: {
-        contents.length++;
-        shrinkFromLeft(&cur);
-        break;
+      cur = tag;
+      break;
+    }
+    case ' ':
+    case '\t':
+      // Whitespace
+      shrinkFromLeft(&cur);
+      break;
+    default:
+      // Text
+      if (!HTML_tokenizeText(out, cur, isFinal)) {
+        return HTMLStepResult::NeedMoreData;
       }
+      break;
+  }
+
+  return HTMLStepResult::Ok;
+}
+
+/**
+ * Tokenizes `cur` until it's empty or a step doesn't succeed, and returns the
+ * result of the last step.
+ */
+static HTMLStepResult HTML_tokenizeSpan(HTMLTokenSink &out,
+                                        Slice<u8> &cur,
+                                        b32 isFinal) {
+  while (!empty(cur)) {
+    HTMLStepResult res = HTML_tokenizeStep(out, cur, isFinal);
+    if (res != HTMLStepResult::Ok) {
+      return res;
     }
   }
 
-  DCHECK(contents.length <= origLength);
+  return HTMLStepResult::Ok;
+}
+
+static b32 HTML_tokenizeAll(HTMLTokenSink &out, Slice<u8> source) {
+  Slice<u8> cur = source;
+  return HTML_tokenizeSpan(out, cur, true) == HTMLStepResult::Ok;
+}
+
+/**
+ * Tokenizes the document into `out`. The tokens and attributes are counted
+ * first, so that the arrays can be allocated with their final size instead
+ * of being grown.
+ */
+static b32 HTML_tokenizeSequential(HTMLTokenSink &out, Slice<u8> source) {
+  HTMLTokenSink counter = {};
+  if (!HTML_tokenizeAll(counter, source)) {
+    return false;
+  }
 
-  HTMLToken *token = append(arena, &tokens);
-  token->kind = HTMLTokenKind::Text;
-  token->text.contents = contents;
+  u32 numTokens = out.numTokens + counter.numTokens;
+  u32 numAttributes = out.numAttributes + counter.numAttributes;
+  HTML_reserve(out, counter.numTokens, counter.numAttributes);
+  CHECK(HTML_tokenizeAll(out, source));
+  DCHECK(out.numTokens == numTokens);
+  DCHECK(out.numAttributes == numAttributes);
 
   return true;
 }
 
-b32 HTML_tokenize(Arena *arena, Slice<u8> source, Slice<HTMLToken> &out) {
-  Vector<HTMLToken> tokens;
+/**
+ * A section of the document that is tokenized on its own.
+ *
+ * Chunks begin at a `<` that looks like a tag start, but that may just as
+ * well be inside of a quoted attribute value. Since the tokenizer carries no
+ * state from one token to the next, a chunk's tokens are the same as the
+ * sequential tokenizer's exactly when the previous chunk stops right where
+ * this one begins; otherwise the chunk is redone from the right position.
+ */
+struct HTMLChunk {
+  u32 idxStart;
+  // Tokenization stops at the first token boundary at or after this, which
+  // is usually the start of the next chunk
+  u32 idxLimit;
+  u32 idxEnd;
+  // Anything but Ok means that the chunk stopped before its limit
+  HTMLStepResult result;
+
+  u32 numTokens;
+  u32 numAttributes;
+  // Where the chunk's tokens and attributes go in the output
+  u32 idxFirstToken;
+  u32 idxFirstAttribute;
+};
+
+struct HTMLChunkedTokenization {
+  Slice<u8> source;
+  Slice<HTMLChunk> chunks;
+  HTMLTokenSink *out;
+  b32 isFinal;
+};
+
+// Documents smaller than this are not worth splitting up
+static const u32 MIN_CHUNK_SIZE = 256 * 1024;
+static const u32 MAX_CHUNKS = 64;
+
+static u32 HTML_numChunks(u32 lenSource) {
+  return min(min(os_get_num_cores(), lenSource / MIN_CHUNK_SIZE), MAX_CHUNKS);
+}
+
+template <typename T>
+static void viewRange(Vector<T> &dst,
+                      Vector<T> &src,
+                      u32 idxFirst,
+                      u32 count) {
+  DCHECK(idxFirst + count <= src.capacity);
+  dst.data = src.data + idxFirst;
+  dst.length = 0;
+  dst.capacity = count;
+}
+
+/**
+ * Returns a sink that writes the chunk's tokens and attributes to the part
+ * of `out` that has been reserved for them. It never has to grow, so it
+ * needs no arena.
+ */
+static HTMLTokenSink HTML_sinkForChunk(HTMLTokenSink &out,
+                                       HTMLChunk &chunk) {
+  HTMLTokenSink ret = {};
+  ret.mode = out.mode;
+  ret.base = out.base;
+  ret.numTokens = chunk.idxFirstToken;
+  ret.numAttributes = chunk.idxFirstAttribute;
+
+  u32 idxToken = chunk.idxFirstToken;
+  u32 numTokens = chunk.numTokens;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    viewRange(ret.tokens, out.tokens, idxToken, numTokens);
+    viewRange(ret.attributes, out.attributes, chunk.idxFirstAttribute,
+              chunk.numAttributes);
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    viewRange(ret.kinds, out.kinds, idxToken, numTokens);
+    viewRange(ret.tags, out.tags, idxToken, numTokens);
+    viewRange(ret.flags, out.flags, idxToken, numTokens);
+    viewRange(ret.offsets, out.offsets, idxToken, numTokens);
+    viewRange(ret.lengths, out.lengths, idxToken, numTokens);
+    // The entry before the chunk's first one is the previous chunk's
+    // terminator
+    viewRange(ret.idxFirstAttribute, out.idxFirstAttribute, idxToken + 1,
+              numTokens);
+    viewRange(ret.attributeRefs, out.attributeRefs, chunk.idxFirstAttribute,
+              chunk.numAttributes);
+  }
+  return ret;
+}
+
+/**
+ * Takes the tokens and attributes that the chunk sinks have written into the
+ * reserved part of `out`.
+ */
+static void HTML_appendReserved(HTMLTokenSink &out,
+                                u32 numTokens,
+                                u32 numAttributes) {
+  out.numTokens += numTokens;
+  out.numAttributes += numAttributes;
+  if (out.mode == HTMLSinkMode::Tokens) {
+    out.tokens.length += numTokens;
+    out.attributes.length += numAttributes;
+  } else if (out.mode == HTMLSinkMode::Stream) {
+    out.kinds.length += numTokens;
+    out.tags.length += numTokens;
+    out.flags.length += numTokens;
+    out.offsets.length += numTokens;
+    out.lengths.length += numTokens;
+    out.idxFirstAttribute.length += numTokens;
+    out.attributeRefs.length += numAttributes;
+  }
+}
+
+static void HTML_tokenizeChunk(HTMLTokenSink &out,
+                               Slice<u8> source,
+                               HTMLChunk &chunk,
+                               b32 isFinal) {
+  // The chunk extends to the end of the source so that tokens crossing the
+  // limit are read the same way as by the sequential tokenizer
+  Slice<u8> cur = subarray(source, chunk.idxStart);
+  const u8 *limit = source.data + chunk.idxLimit;
+  chunk.result = HTMLStepResult::Ok;
+  while (!empty(cur) && cur.data < limit) {
+    chunk.result = HTML_tokenizeStep(out, cur, isFinal);
+    if (chunk.result != HTMLStepResult::Ok) {
+      break;
+    }
+  }
+  chunk.idxEnd = (u32)(cur.data - source.data);
+}
+
+static void HTML_countChunk(Slice<u8> source, HTMLChunk &chunk, b32 isFinal) {
+  HTMLTokenSink counter = {};
+  HTML_tokenizeChunk(counter, source, chunk, isFinal);
+  chunk.numTokens = counter.numTokens;
+  chunk.numAttributes = counter.numAttributes;
+}
+
+static void HTML_countChunkTask(void *user, u32 idxChunk) {
+  HTMLChunkedTokenization *T = (HTMLChunkedTokenization *)user;
+  HTML_countChunk(T->source, T->chunks[idxChunk], T->isFinal);
+}
+
+static void HTML_fillChunkTask(void *user, u32 idxChunk) {
+  HTMLChunkedTokenization *T = (HTMLChunkedTokenization *)user;
+  HTMLChunk &chunk = T->chunks[idxChunk];
+
+  // Every chunk writes to its own part of the output arrays
+  HTMLTokenSink sink = HTML_sinkForChunk(*T->out, chunk);
+  HTML_tokenizeChunk(sink, T->source, chunk, T->isFinal);
+  DCHECK(sink.numTokens == chunk.idxFirstToken + chunk.numTokens);
+  DCHECK(sink.numAttributes == chunk.idxFirstAttribute + chunk.numAttributes);
+}
+
+/**
+ * Tokenizes `cur` into `out` in chunks, in parallel. The arrays of `out` must
+ * hold exactly `out.numTokens` tokens and `out.numAttributes` attributes,
+ * which is the case for a sink that was only appended to by the tokenizer.
+ *
+ * Works like HTML_tokenizeSpan: the tokens and the result are the same, and
+ * so is where `cur` is left if the tokenizer stops early.
+ */
+static HTMLStepResult HTML_tokenizeParallel(HTMLTokenSink &out,
+                                            Slice<u8> &cur,
+                                            u32 numChunks,
+                                            b32 isFinal) {
+  DCHECK(numChunks <= MAX_CHUNKS);
+  HTMLChunk chunks[MAX_CHUNKS] = {};
+
+  Slice<u8> source = cur;
+  HTMLChunkedTokenization T = {};
+  T.source = source;
+  T.chunks = {chunks, numChunks};
+  T.out = &out;
+  T.isFinal = isFinal;
+
+  u32 idxPrevStart = 0;
+  for (u32 i = 0; i < numChunks; i++) {
+    u32 idxStart = 0;
+    if (i != 0) {
+      u32 idxTarget = max((u32)((u64)source.length * i / numChunks), idxPrevStart);
+      idxStart = idxTarget +
+                 HTML_scanText(source.data + idxTarget, source.length - idxTarget);
+    }
+    T.chunks[i].idxStart = idxStart;
+    if (i != 0) {
+      T.chunks[i - 1].idxLimit = idxStart;
+    }
+    idxPrevStart = idxStart;
+  }
+  T.chunks[numChunks - 1].idxLimit = source.length;
 
-  ArenaTemp temp = getScratch(&arena, 1);
+  os_parallel_for(numChunks, HTML_countChunkTask, &T);
+
+  // Check that the chunks line up and redo the ones that don't. Whatever
+  // follows a chunk that stopped early is never reached by the sequential
+  // tokenizer.
+  u32 numTokens = 0;
+  u32 numAttributes = 0;
+  u32 idxPos = 0;
+  HTMLStepResult result = HTMLStepResult::Ok;
+  for (u32 i = 0; i < numChunks; i++) {
+    HTMLChunk &chunk = T.chunks[i];
+    DCHECK(idxPos >= chunk.idxStart);
+    if (chunk.idxStart != idxPos) {
+      chunk.idxStart = idxPos;
+      HTML_countChunk(source, chunk, isFinal);
+    }
+
+    if (chunk.result != HTMLStepResult::Ok) {
+      T.chunks.length = i;
+      result = chunk.result;
+      break;
+    }
+
+    chunk.idxFirstToken = out.numTokens + numTokens;
+    chunk.idxFirstAttribute = out.numAttributes + numAttributes;
+    numTokens += chunk.numTokens;
+    numAttributes += chunk.numAttributes;
+    idxPos = chunk.idxEnd;
+  }
+
+  HTML_reserve(out, numTokens, numAttributes);
+  os_parallel_for(T.chunks.length, HTML_fillChunkTask, &T);
+  HTML_appendReserved(out, numTokens, numAttributes);
+
+  // Unlike subarray, this keeps pointing into the source when it's empty
+  cur = {source.data + idxPos, source.length - idxPos};
+  if (result != HTMLStepResult::Ok) {
+    // The chunk that stopped may have emitted attributes that it dropped
+    // again, which the reserved space doesn't account for, so it's redone
+    // into `out` directly
+    result = HTML_tokenizeSpan(out, cur, isFinal);
+  }
+  return result;
+}
+
+/**
+ * Tokenizes the whole document into `out`, in parallel if it's large enough.
+ */
+static b32 HTML_tokenizeInto(HTMLTokenSink &out, Slice<u8> source) {
+  u32 numChunks = HTML_numChunks(source.length);
+  if (numChunks < 2) {
+    return HTML_tokenizeSequential(out, source);
+  }
 
   Slice<u8> cur = source;
-  while (!empty(cur)) {
-    switch (cur[0]) {
-      case '<':
-        // Element
-        if (!HTML_tokenizeTag(arena, cur, tokens)) {
-          releaseScratch(temp);
-          return false;
-        }
-        break;
-      case ' ':
-      case '\t':
-        // Whitespace
-        shrinkFromLeft(&cur);
-        break;
-      default:
-        // Text
-        if (!HTML_tokenizeText(temp.arena, cur, tokens)) {
-          releaseScratch(temp);
+  return HTML_tokenizeParallel(out, cur, numChunks, true) ==
+         HTMLStepResult::Ok;
+}
+
+b32 HTML_tokenize(Arena *arena, Slice<u8> source, Slice<HTMLToken> &out) {
+  HTMLTokenSink sink = {};
+  sink.mode = HTMLSinkMode::Tokens;
+  sink.arena = arena;
+  if (!HTML_tokenizeInto(sink, source)) {
+    return false;
+  }
+
+  out = {sink.tokens.data, sink.tokens.length};
+  return true;
+}
+
+b32 HTML_tokenize(Arena *arena, Slice<u8> source, HTMLTokenStream &out) {
+  HTMLTokenSink sink;
+  HTML_initStreamSink(sink, arena, source.data);
+  if (!HTML_tokenizeInto(sink, source)) {
+    return false;
+  }
+
+  out = HTML_streamOfSink(sink, source, 0);
+  return true;
+}
+
+static b32 equalSlices(Slice<u8> l, Slice<u8> r) {
+  return l.length == r.length && (l.length == 0 || l.data == r.data);
+}
+
+static b32 equalTokens(HTMLToken &l, HTMLToken &r) {
+  if (l.kind != r.kind) {
+    return false;
+  }
+
+  switch (l.kind) {
+    case HTMLTokenKind::OpenTag: {
+      HTMLOpenTag &lt = l.openTag;
+      HTMLOpenTag &rt = r.openTag;
+      if (!equalSlices(lt.name, rt.name) || lt.tag != rt.tag ||
+          lt.isSelfClosing != rt.isSelfClosing ||
+          lt.attributes.length != rt.attributes.length) {
+        return false;
+      }
+      for (u32 i = 0; i < lt.attributes.length; i++) {
+        if (!equalSlices(lt.attributes[i].name, rt.attributes[i].name) ||
+            !equalSlices(lt.attributes[i].value, rt.attributes[i].value)) {
           return false;
         }
-        break;
+      }
+      return true;
     }
+    case HTMLTokenKind::CloseTag:
+      return equalSlices(l.closeTag.name, r.closeTag.name) &&
+             l.closeTag.tag == r.closeTag.tag;
+    case HTMLTokenKind::Text:
+      return equalSlices(l.text.contents, r.text.contents);
   }
 
-  out = copyToSlice(arena, tokens);
+  return false;
+}
+
+void HTML_benchmarkTokenizer(Slice<u8> source) {
+  u32 numChunks = HTML_numChunks(source.length);
+  if (numChunks < 2) {
+    log_info("Document is too small to be tokenized in parallel");
+    return;
+  }
+
+  ArenaTemp temp = getScratch(nullptr, 0);
+
+  HTMLTokenSink seq = {};
+  seq.mode = HTMLSinkMode::Tokens;
+  seq.arena = temp.arena;
+  HTMLTokenSink par = seq;
+  TimePoint t0 = chrono_getCurrentTime();
+  b32 okSeq = HTML_tokenizeSequential(seq, source);
+  TimePoint t1 = chrono_getCurrentTime();
+  Slice<u8> cur = source;
+  b32 okPar = HTML_tokenizeParallel(par, cur, numChunks, true) ==
+              HTMLStepResult::Ok;
+  TimePoint t2 = chrono_getCurrentTime();
+
+  b32 isIdentical = okSeq == okPar && seq.tokens.length == par.tokens.length;
+  for (u32 i = 0; isIdentical && i < seq.tokens.length; i++) {
+    isIdentical = equalTokens(seq.tokens[i], par.tokens[i]);
+  }
+
+  f64 secsSeq = chrono_secondsBetween(t0, t1);
+  f64 secsPar = chrono_secondsBetween(t1, t2);
+  log_info("Tokenizer sequential %.3f ms, %u chunks %.3f ms (%.2fx), %s",
+           secsSeq * 1000, numChunks, secsPar * 1000,
+           secsPar > 0 ? secsSeq / secsPar : 0.0,
+           isIdentical ? "identical" : "MISMATCH");
+
   releaseScratch(temp);
+}
+
+static Slice<u8> sourceRange(const HTMLTokenStream *self, u32 off, u32 len) {
+  if (len == 0) {
+    return {};
+  }
+  return {self->source.data + off, len};
+}
+
+void HTML_TokenStream_get(const HTMLTokenStream *self,
+                          Arena *arena,
+                          u32 idxToken,
+                          HTMLToken &out) {
+  DCHECK(idxToken < HTML_TokenStream_length(self));
+
+  Slice<u8> str =
+      sourceRange(self, self->offsets[idxToken], self->lengths[idxToken]);
+  out.kind = self->kinds[idxToken];
+  switch (out.kind) {
+    case HTMLTokenKind::OpenTag: {
+      u32 idxFirst = self->idxFirstAttribute[idxToken];
+      u32 numAttributes = self->idxFirstAttribute[idxToken + 1] - idxFirst;
+
+      out.openTag.name = str;
+      out.openTag.tag = self->tags[idxToken];
+      out.openTag.isSelfClosing =
+          (self->flags[idxToken] & HTF_SelfClosing) != 0;
+      out.openTag.attributes = {};
+      if (numAttributes != 0) {
+        alloc(arena, numAttributes, out.openTag.attributes);
+        for (u32 i = 0; i < numAttributes; i++) {
+          const HTMLAttributeRef &ref = self->attributes[idxFirst + i];
+          out.openTag.attributes[i].name =
+              sourceRange(self, ref.offName, ref.lenName);
+          out.openTag.attributes[i].value =
+              sourceRange(self, ref.offValue, ref.lenValue);
+        }
+      }
+      break;
+    }
+    case HTMLTokenKind::CloseTag:
+      out.closeTag.name = str;
+      out.closeTag.tag = self->tags[idxToken];
+      break;
+    case HTMLTokenKind::Text:
+      out.text.contents = str;
+      break;
+  }
+}
+
+u64 HTML_TokenStream_sizeInBytes(const HTMLTokenStream *self) {
+  u64 numTokens = HTML_TokenStream_length(self);
+  return numTokens * (sizeof(HTMLTokenKind) + sizeof(TagId) + sizeof(u8) +
+                      2 * sizeof(u32)) +
+         (numTokens + 1) * sizeof(u32) +
+         (u64)self->attributes.length * sizeof(HTMLAttributeRef);
+}
+
+void HTML_Tokenizer_init(HTML_Tokenizer *self,
+                         Arena *arena,
+                         Arena *scratch) {
+  *self = {};
+  self->arena = arena;
+  HTML_initStreamSink(self->sink, scratch, nullptr);
+}
+
+static b32 HTML_Tokenizer_run(HTML_Tokenizer *self, b32 isFinal) {
+  HTMLTokenSink &sink = self->sink;
+  if (self->numTokensTaken == sink.numTokens) {
+    // Every token has been taken, so the arrays can be reused
+    sink.numTokens = 0;
+    sink.numAttributes = 0;
+    sink.kinds.length = 0;
+    sink.tags.length = 0;
+    sink.flags.length = 0;
+    sink.offsets.length = 0;
+    sink.lengths.length = 0;
+    sink.idxFirstAttribute.length = 1;
+    sink.attributeRefs.length = 0;
+    self->numTokensTaken = 0;
+  }
+
+  // A large part of the document that arrives at once, e.g. because the
+  // connection delivers it faster than it's tokenized, is split up like by
+  // HTML_tokenize
+  Slice<u8> pending = {self->document.data + self->offPending,
+                       self->document.length - self->offPending};
+  u32 numChunks = HTML_numChunks(pending.length);
+  HTMLStepResult res;
+  if (numChunks < 2) {
+    res = HTML_tokenizeSpan(sink, pending, isFinal);
+  } else {
+    res = HTML_tokenizeParallel(sink, pending, numChunks, isFinal);
+  }
+  if (res == HTMLStepResult::Error) {
+    self->failed = true;
+    return false;
+  }
+  self->offPending = (u32)(pending.data - self->document.data);
+
   return true;
 }
 
+b32 HTML_Tokenizer_feed(HTML_Tokenizer *self, Slice<u8> chunk) {
+  if (self->failed) {
+    return false;
+  }
+
+  if (empty(chunk)) {
+    return true;
+  }
+
+  if (empty(self->document)) {
+    // Tokenize the chunk in place
+    self->document = chunk;
+  } else if (self->document.data + self->document.length == chunk.data) {
+    // The chunk continues the document in memory, e.g. when the chunks are
+    // consecutive parts of the same receive buffer
+    self->document.length += chunk.length;
+  } else {
+    u32 lenRequired = self->document.length + chunk.length;
+    u8 *endDocument = self->document.data + self->document.length;
+    if (self->endOwnedBuffer == nullptr ||
+        (u32)(self->endOwnedBuffer - endDocument) < chunk.length) {
+      // The offsets of the tokens stay valid in the copy. Whoever holds a
+      // stream with the old source can keep using it, so the old buffer is
+      // abandoned instead of being reused.
+      u32 capacity = max(2 * lenRequired, 4096u);
+      u8 *buffer = allocNZ(self->arena, 1, 1, capacity);
+      memcpy(buffer, self->document.data, self->document.length);
+      self->document.data = buffer;
+      self->endOwnedBuffer = buffer + capacity;
+    }
+
+    memcpy(self->document.data + self->document.length, chunk.data,
+           chunk.length);
+    self->document.length = lenRequired;
+  }
+  self->sink.base = self->document.data;
+
+  return HTML_Tokenizer_run(self, false);
+}
+
+b32 HTML_Tokenizer_finish(HTML_Tokenizer *self) {
+  if (self->failed) {
+    return false;
+  }
+
+  return HTML_Tokenizer_run(self, true);
+}
+
+void HTML_Tokenizer_takeTokens(HTML_Tokenizer *self, HTMLTokenStream &out) {
+  DCHECK(self->numTokensTaken <= self->sink.numTokens);
+  out = HTML_streamOfSink(self->sink, self->document, self->numTokensTaken);
+  self->numTokensTaken = self->sink.numTokens;
+}
+
+b32 HTML_TokenQueue_init(HTMLTokenQueue *self, Arena *arena) {
+  const u32 N = HTML_TOKEN_QUEUE_BATCH_SIZE;
+  for (u32 i = 0; i < HTML_TOKEN_QUEUE_NUM_BATCHES; i++) {
+    HTMLTokenStream &batch = self->batches[i];
+    batch = {};
+    allocNZ(arena, N, batch.kinds);
+    allocNZ(arena, N, batch.tags);
+    allocNZ(arena, N, batch.flags);
+    allocNZ(arena, N, batch.offsets);
+    allocNZ(arena, N, batch.lengths);
+    allocNZ(arena, N + 1, batch.idxFirstAttribute);
+    // Most tokens have no attributes
+    allocNZ(arena, N, batch.attributes);
+    self->attributeCapacities[i] = N;
+  }
+  self->numPushed.store(0, std::memory_order_relaxed);
+  self->numReleased.store(0, std::memory_order_relaxed);
+  self->isClosed.store(false, std::memory_order_relaxed);
+
+  self->batchPushed = os_create_event();
+  self->batchReleased = os_create_event();
+  if (self->batchPushed == nullptr || self->batchReleased == nullptr) {
+    HTML_TokenQueue_destroy(self);
+    return false;
+  }
+  return true;
+}
+
+void HTML_TokenQueue_destroy(HTMLTokenQueue *self) {
+  if (self->batchPushed != nullptr) {
+    os_destroy_event(self->batchPushed);
+  }
+  if (self->batchReleased != nullptr) {
+    os_destroy_event(self->batchReleased);
+  }
+  self->batchPushed = nullptr;
+  self->batchReleased = nullptr;
+}
+
+template <typename T>
+static void copyRange(Slice<T> &dst, Slice<T> src, u32 idxFirst, u32 count) {
+  dst.length = count;
+  copy(dst, subarray(src, idxFirst, idxFirst + count));
+}
+
+void HTML_TokenQueue_push(HTMLTokenQueue *self,
+                          Arena *arena,
+                          const HTMLTokenStream &tokens) {
+  u32 numTokens = HTML_TokenStream_length(&tokens);
+  u32 idxFirst = 0;
+  while (idxFirst < numTokens) {
+    u32 numPushed = self->numPushed.load(std::memory_order_relaxed);
+    while (numPushed - self->numReleased.load(std::memory_order_acquire) ==
+           HTML_TOKEN_QUEUE_NUM_BATCHES) {
+      // The ring is full
+      os_wait_event(self->batchReleased);
+    }
+
+    u32 idxBatch = numPushed % HTML_TOKEN_QUEUE_NUM_BATCHES;
+    HTMLTokenStream &batch = self->batches[idxBatch];
+    u32 count = min(numTokens - idxFirst, (u32)HTML_TOKEN_QUEUE_BATCH_SIZE);
+    batch.source = tokens.source;
+    copyRange(batch.kinds, tokens.kinds, idxFirst, count);
+    copyRange(batch.tags, tokens.tags, idxFirst, count);
+    copyRange(batch.flags, tokens.flags, idxFirst, count);
+    copyRange(batch.offsets, tokens.offsets, idxFirst, count);
+    copyRange(batch.lengths, tokens.lengths, idxFirst, count);
+
+    // The attribute indices of the batch start at zero
+    u32 idxFirstAttribute = tokens.idxFirstAttribute[idxFirst];
+    u32 numAttributes =
+        tokens.idxFirstAttribute[idxFirst + count] - idxFirstAttribute;
+    batch.idxFirstAttribute.length = count + 1;
+    for (u32 i = 0; i <= count; i++) {
+      batch.idxFirstAttribute[i] =
+          tokens.idxFirstAttribute[idxFirst + i] - idxFirstAttribute;
+    }
+    u32 &capacity = self->attributeCapacities[idxBatch];
+    if (numAttributes > capacity) {
+      capacity = max(numAttributes, 2 * capacity);
+      allocNZ(arena, capacity, batch.attributes);
+    }
+    copyRange(batch.attributes, tokens.attributes, idxFirstAttribute,
+              numAttributes);
+
+    self->numPushed.store(numPushed + 1, std::memory_order_release);
+    os_signal_event(self->batchPushed);
+    idxFirst += count;
+  }
+}
+
+void HTML_TokenQueue_close(HTMLTokenQueue *self) {
+  self->isClosed.store(true, std::memory_order_release);
+  os_signal_event(self->batchPushed);
+}
+
+b32 HTML_TokenQueue_pop(HTMLTokenQueue *self, HTMLTokenStream &batch) {
+  u32 numReleased = self->numReleased.load(std::memory_order_relaxed);
+  while (self->numPushed.load(std::memory_order_acquire) == numReleased) {
+    if (self->isClosed.load(std::memory_order_acquire)) {
+      // The last batch may have been pushed right before closing
+      if (self->numPushed.load(std::memory_order_acquire) == numReleased) {
+        return false;
+      }
+      break;
+    }
+    os_wait_event(self->batchPushed);
+  }
+
+  batch = self->batches[numReleased % HTML_TOKEN_QUEUE_NUM_BATCHES];
+  return true;
+}
+
+void HTML_TokenQueue_release(HTMLTokenQueue *self) {
+  u32 numReleased = self->numReleased.load(std::memory_order_relaxed);
+  self->numReleased.store(numReleased + 1, std::memory_order_release);
+  os_signal_event(self->batchReleased);
+}
+
 b32 HTML_print(Slice<HTMLToken> tokens) {
   for (u32 i = 0; i < tokens.length; i++) {
     HTMLToken &token = tokens[i];
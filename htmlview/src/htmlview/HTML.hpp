@@ -1,7 +1,12 @@
 #pragma once
 
+#include "htmlview/OS.hpp"
+#include "htmlview/Tag.hpp"
 #include "std/Arena.h"
 #include "std/Slice.hpp"
+#include "std/Vector.hpp"
+
+#include <atomic>
 
 struct HTMLAttribute {
   Slice<u8> name;
@@ -10,6 +15,7 @@ struct HTMLAttribute {
 
 struct HTMLOpenTag {
   Slice<u8> name;
+  TagId tag;
   Slice<HTMLAttribute> attributes;
   b32 isSelfClosing;
 };
@@ -20,9 +26,10 @@ struct HTMLText {
 
 struct HTMLCloseTag {
   Slice<u8> name;
+  TagId tag;
 };
 
-enum class HTMLTokenKind {
+enum class HTMLTokenKind : u8 {
   OpenTag,
   Text,
   CloseTag,
@@ -38,6 +45,216 @@ struct HTMLToken {
   };
 };
 
+struct HTMLAttributeRef {
+  u32 offName;
+  u32 lenName;
+  u32 offValue;
+  u32 lenValue;
+};
+
+enum HTMLTokenFlags : u8 {
+  HTF_SelfClosing = 1 << 0,
+};
+
+/**
+ * A compact encoding of a token list. The tokens are stored as parallel
+ * arrays and refer to the document by offsets rather than pointers, which
+ * takes about a quarter of the memory of the equivalent HTMLToken array and
+ * keeps the fields the tree builder dispatches on densely packed.
+ *
+ * For tags, `offsets`/`lengths` locate the tag name; for text, the contents.
+ * The attributes of token `i` are
+ * `attributes[idxFirstAttribute[i] .. idxFirstAttribute[i + 1]]`.
+ */
+struct HTMLTokenStream {
+  Slice<u8> source;
+
+  Slice<HTMLTokenKind> kinds;
+  Slice<TagId> tags;
+  Slice<u8> flags;
+  Slice<u32> offsets;
+  Slice<u32> lengths;
+  // One entry per token plus a terminating one
+  Slice<u32> idxFirstAttribute;
+
+  Slice<HTMLAttributeRef> attributes;
+};
+
+enum class HTMLSinkMode : u8 {
+  // Nothing is stored, only the number of tokens and attributes is tallied
+  Count,
+  // HTMLToken and HTMLAttribute arrays
+  Tokens,
+  // The arrays of an HTMLTokenStream
+  Stream,
+};
+
+/**
+ * Destination of the tokenizer's output. The attributes of all tags are
+ * stored in a single array and every open tag refers to a range of it.
+ *
+ * HTML_tokenize counts first, so that it can allocate its arrays with their
+ * final sizes.
+ */
+struct HTMLTokenSink {
+  HTMLSinkMode mode;
+  Arena *arena;
+  u32 numTokens;
+  u32 numAttributes;
+
+  // HTMLSinkMode::Tokens
+  Vector<HTMLToken> tokens;
+  Vector<HTMLAttribute> attributes;
+
+  // HTMLSinkMode::Stream; the offsets are relative to `base`
+  const u8 *base;
+  Vector<HTMLTokenKind> kinds;
+  Vector<TagId> tags;
+  Vector<u8> flags;
+  Vector<u32> offsets;
+  Vector<u32> lengths;
+  Vector<u32> idxFirstAttribute;
+  Vector<HTMLAttributeRef> attributeRefs;
+};
+
+/**
+ * A resumable tokenizer. The document can be fed to it in chunks as they
+ * arrive; tokens are emitted as soon as they are complete and partial tags or
+ * text are carried over to the next chunk.
+ *
+ * The tokens are emitted in the compact encoding, with offsets relative to
+ * the start of the document. The document is kept in one piece: chunks that
+ * continue the previous one in memory are tokenized in place, anything else
+ * is appended to a copy of the document in `arena`.
+ *
+ * The tokens themselves are only needed until they have been consumed, so
+ * they are kept in the scratch arena passed to HTML_Tokenizer_init. Once all
+ * of them have been taken, their arrays are reused for the next chunk.
+ */
+struct HTML_Tokenizer {
+  Arena *arena;
+
+  // The document received so far
+  Slice<u8> document;
+  // End of the buffer owned by the tokenizer that `document` points into;
+  // null if `document` points into memory supplied by the caller
+  u8 *endOwnedBuffer;
+  // Where the bytes that haven't been tokenized yet begin
+  u32 offPending;
+
+  HTMLTokenSink sink;
+  u32 numTokensTaken;
+  b32 failed;
+};
+
+#define HTML_TOKEN_QUEUE_NUM_BATCHES (8)
+#define HTML_TOKEN_QUEUE_BATCH_SIZE (1024)
+
+/**
+ * A single-producer single-consumer ring of token batches, through which the
+ * tokenizer hands its output to a consumer on another thread. Both sides block
+ * on an event while the ring is full or empty.
+ *
+ * A batch is a slot of the ring that is overwritten once the consumer has
+ * released it, so the consumer has to copy whatever it keeps. The documents
+ * that the tokens refer to are not part of the ring and remain valid.
+ */
+struct HTMLTokenQueue {
+  // The arrays of each slot hold up to HTML_TOKEN_QUEUE_BATCH_SIZE tokens;
+  // the attribute arrays grow as needed
+  HTMLTokenStream batches[HTML_TOKEN_QUEUE_NUM_BATCHES];
+  u32 attributeCapacities[HTML_TOKEN_QUEUE_NUM_BATCHES];
+  os_event batchPushed;
+  os_event batchReleased;
+
+  // The number of batches pushed and released so far. Each counter is only
+  // written by one side, so they are kept on separate cache lines.
+  alignas(64) std::atomic<u32> numPushed;
+  alignas(64) std::atomic<u32> numReleased;
+  // Set by the producer after it has pushed its last batch
+  std::atomic<b32> isClosed;
+};
+
+/**
+ * Tokenizes the whole document. Large documents are split into chunks that
+ * are tokenized in parallel; the result is the same either way.
+ */
 b32 HTML_tokenize(Arena *arena, Slice<u8> source, Slice<HTMLToken> &out);
+/**
+ * Tokenizes the document into the compact representation, directly and with
+ * every array allocated with its final size.
+ */
+b32 HTML_tokenize(Arena *arena, Slice<u8> source, HTMLTokenStream &out);
+inline u32 HTML_TokenStream_length(const HTMLTokenStream *self) {
+  return self->kinds.length;
+}
+/**
+ * Expands a token of the stream. The attribute list, if any, is allocated in
+ * `arena`.
+ */
+void HTML_TokenStream_get(const HTMLTokenStream *self,
+                          Arena *arena,
+                          u32 idxToken,
+                          HTMLToken &out);
+/**
+ * Returns the number of bytes occupied by the stream's arrays.
+ */
+u64 HTML_TokenStream_sizeInBytes(const HTMLTokenStream *self);
+
+void HTML_Tokenizer_init(HTML_Tokenizer *self,
+                         Arena *arena,
+                         Arena *scratch);
+/**
+ * Tokenizes as much of the chunk as possible. Returns false if the document
+ * is malformed. If a lot of the document is waiting to be tokenized, it's
+ * split up and tokenized in parallel like by HTML_tokenize.
+ */
+b32 HTML_Tokenizer_feed(HTML_Tokenizer *self, Slice<u8> chunk);
+/**
+ * Tokenizes whatever is left at the end of the document.
+ */
+b32 HTML_Tokenizer_finish(HTML_Tokenizer *self);
+/**
+ * Returns the tokens that were emitted since the last call. The stream's
+ * source is the document received so far. The arrays of the stream are
+ * reused once the tokenizer is fed again, but the document remains valid.
+ */
+void HTML_Tokenizer_takeTokens(HTML_Tokenizer *self, HTMLTokenStream &out);
+
+/**
+ * Allocates the ring in `arena`. Returns false if the events couldn't be
+ * created.
+ */
+b32 HTML_TokenQueue_init(HTMLTokenQueue *self, Arena *arena);
+void HTML_TokenQueue_destroy(HTMLTokenQueue *self);
+/**
+ * Producer side: copies the tokens into the ring, split into as many batches
+ * as needed, waiting for the consumer whenever the ring is full. Attribute
+ * arrays that outgrow their slot are reallocated in `arena`, which the
+ * consumer must not use.
+ */
+void HTML_TokenQueue_push(HTMLTokenQueue *self,
+                          Arena *arena,
+                          const HTMLTokenStream &tokens);
+/**
+ * Producer side: tells the consumer that no more batches will be pushed.
+ */
+void HTML_TokenQueue_close(HTMLTokenQueue *self);
+/**
+ * Consumer side: waits for the next batch. Returns false once the queue has
+ * been closed and every batch has been consumed.
+ */
+b32 HTML_TokenQueue_pop(HTMLTokenQueue *self, HTMLTokenStream &batch);
+/**
+ * Gives the batch returned by the last pop back to the producer.
+ */
+void HTML_TokenQueue_release(HTMLTokenQueue *self);
+
 b32 HTML_print(Slice<HTMLToken> tokens);
+/**
+ * Compares the sequential and the parallel tokenizer on the document, logs
+ * the timings and whether the tokens were identical.
+ */
+void HTML_benchmarkTokenizer(Slice<u8> source);
 b32 HTML_isWhitespace(u8 ch);
+b32 HTML_isAlphanumeric(u8 ch);
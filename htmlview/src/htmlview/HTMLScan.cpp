@@ -0,0 +1,349 @@
+#include <atomic>
+
+#include "htmlview/HTMLScan.hpp"
+#include "htmlview/HTML.hpp"
+#include "log/log.h"
+#include "std/Chronometry.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HV_SCAN_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define HV_SCAN_X64 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define HV_TARGET_AVX2
+#endif
+
+struct ScanFns {
+  const char *name;
+  u32 (*text)(const u8 *p, u32 len);
+  u32 (*quoted)(const u8 *p, u32 len, u8 delim);
+  u32 (*whitespace)(const u8 *p, u32 len);
+};
+
+static b32 isTagStart(const u8 *p, u32 len, u32 idx) {
+  if (idx + 1 >= len) {
+    return false;
+  }
+
+  return p[idx + 1] == '/' || HTML_isAlphanumeric(p[idx + 1]);
+}
+
+static u32 scanText_scalar(const u8 *p, u32 len) {
+  for (u32 i = 0; i < len; i++) {
+    if (p[i] == '<' && isTagStart(p, len, i)) {
+      return i;
+    }
+  }
+  return len;
+}
+
+static u32 scanQuoted_scalar(const u8 *p, u32 len, u8 delim) {
+  for (u32 i = 0; i < len; i++) {
+    if (p[i] == delim || p[i] == '\\') {
+      return i;
+    }
+  }
+  return len;
+}
+
+static u32 scanWhitespace_scalar(const u8 *p, u32 len) {
+  for (u32 i = 0; i < len; i++) {
+    if (!HTML_isWhitespace(p[i])) {
+      return i;
+    }
+  }
+  return len;
+}
+
+static const ScanFns SCAN_SCALAR = {
+    "scalar",
+    scanText_scalar,
+    scanQuoted_scalar,
+    scanWhitespace_scalar,
+};
+
+#if HV_SCAN_X64
+
+static u32 countTrailingZeros(u32 x) {
+  DCHECK(x != 0);
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long ret;
+  _BitScanForward(&ret, x);
+  return ret;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+static b32 cpuHasAVX2() {
+  u32 regs1[4], regs7[4];
+#if defined(_MSC_VER)
+  int r[4];
+  __cpuid(r, 0);
+  if (r[0] < 7) {
+    return false;
+  }
+  __cpuid(r, 1);
+  for (u32 i = 0; i < 4; i++) {
+    regs1[i] = r[i];
+  }
+  __cpuidex(r, 7, 0);
+  for (u32 i = 0; i < 4; i++) {
+    regs7[i] = r[i];
+  }
+#else
+  if (__get_cpuid_max(0, nullptr) < 7) {
+    return false;
+  }
+  __cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+  __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+#endif
+
+  // The OS must have enabled XSAVE and the AVX state
+  const u32 OSXSAVE = 1u << 27;
+  const u32 AVX = 1u << 28;
+  if ((regs1[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX)) {
+    return false;
+  }
+
+#if defined(_MSC_VER) && !defined(__clang__)
+  u64 xcr0 = _xgetbv(0);
+#else
+  u32 xcr0Lo, xcr0Hi;
+  __asm__("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+  u64 xcr0 = ((u64)xcr0Hi << 32) | xcr0Lo;
+#endif
+  if ((xcr0 & 0x6) != 0x6) {
+    return false;
+  }
+
+  const u32 AVX2 = 1u << 5;
+  return (regs7[1] & AVX2) != 0;
+}
+
+static u32 scanText_sse2(const u8 *p, u32 len) {
+  const __m128i lt = _mm_set1_epi8('<');
+  u32 i = 0;
+  while (i + 16 <= len) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lt));
+    while (mask != 0) {
+      u32 idx = i + countTrailingZeros(mask);
+      if (isTagStart(p, len, idx)) {
+        return idx;
+      }
+      mask &= mask - 1;
+    }
+    i += 16;
+  }
+
+  return i + scanText_scalar(p + i, len - i);
+}
+
+static u32 scanQuoted_sse2(const u8 *p, u32 len, u8 delim) {
+  const __m128i d = _mm_set1_epi8((char)delim);
+  const __m128i bs = _mm_set1_epi8('\\');
+  u32 i = 0;
+  while (i + 16 <= len) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, bs));
+    u32 mask = (u32)_mm_movemask_epi8(hit);
+    if (mask != 0) {
+      return i + countTrailingZeros(mask);
+    }
+    i += 16;
+  }
+
+  return i + scanQuoted_scalar(p + i, len - i, delim);
+}
+
+static u32 scanWhitespace_sse2(const u8 *p, u32 len) {
+  // Most runs of whitespace are a single byte long or empty
+  if (len == 0 || !HTML_isWhitespace(p[0])) {
+    return 0;
+  }
+
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i lo = _mm_set1_epi8(0x08);
+  const __m128i hi = _mm_set1_epi8(0x0E);
+  const __m128i vt = _mm_set1_epi8(0x0B);
+  u32 i = 0;
+  while (i + 16 <= len) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    // TAB, LF, FF and CR are in the range (0x08, 0x0E), except for VT
+    __m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    ctl = _mm_andnot_si128(_mm_cmpeq_epi8(v, vt), ctl);
+    __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), ctl);
+    u32 mask = ~(u32)_mm_movemask_epi8(ws) & 0xFFFF;
+    if (mask != 0) {
+      return i + countTrailingZeros(mask);
+    }
+    i += 16;
+  }
+
+  return i + scanWhitespace_scalar(p + i, len - i);
+}
+
+HV_TARGET_AVX2 static u32 scanText_avx2(const u8 *p, u32 len) {
+  const __m256i lt = _mm256_set1_epi8('<');
+  u32 i = 0;
+  while (i + 32 <= len) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lt));
+    while (mask != 0) {
+      u32 idx = i + countTrailingZeros(mask);
+      if (isTagStart(p, len, idx)) {
+        return idx;
+      }
+      mask &= mask - 1;
+    }
+    i += 32;
+  }
+
+  return i + scanText_sse2(p + i, len - i);
+}
+
+HV_TARGET_AVX2 static u32 scanQuoted_avx2(const u8 *p, u32 len, u8 delim) {
+  const __m256i d = _mm256_set1_epi8((char)delim);
+  const __m256i bs = _mm256_set1_epi8('\\');
+  u32 i = 0;
+  while (i + 32 <= len) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i hit =
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, d), _mm256_cmpeq_epi8(v, bs));
+    u32 mask = (u32)_mm256_movemask_epi8(hit);
+    if (mask != 0) {
+      return i + countTrailingZeros(mask);
+    }
+    i += 32;
+  }
+
+  return i + scanQuoted_sse2(p + i, len - i, delim);
+}
+
+HV_TARGET_AVX2 static u32 scanWhitespace_avx2(const u8 *p, u32 len) {
+  if (len == 0 || !HTML_isWhitespace(p[0])) {
+    return 0;
+  }
+
+  const __m256i space = _mm256_set1_epi8(0x20);
+  const __m256i lo = _mm256_set1_epi8(0x08);
+  const __m256i hi = _mm256_set1_epi8(0x0E);
+  const __m256i vt = _mm256_set1_epi8(0x0B);
+  u32 i = 0;
+  while (i + 32 <= len) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i ctl =
+        _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+    ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, vt), ctl);
+    __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), ctl);
+    u32 mask = ~(u32)_mm256_movemask_epi8(ws);
+    if (mask != 0) {
+      return i + countTrailingZeros(mask);
+    }
+    i += 32;
+  }
+
+  return i + scanWhitespace_sse2(p + i, len - i);
+}
+
+static const ScanFns SCAN_SSE2 = {
+    "SSE2",
+    scanText_sse2,
+    scanQuoted_sse2,
+    scanWhitespace_sse2,
+};
+
+static const ScanFns SCAN_AVX2 = {
+    "AVX2",
+    scanText_avx2,
+    scanQuoted_avx2,
+    scanWhitespace_avx2,
+};
+
+#endif /* HV_SCAN_X64 */
+
+static const ScanFns *selectScanFns() {
+#if HV_SCAN_X64
+  if (cpuHasAVX2()) {
+    return &SCAN_AVX2;
+  }
+  // SSE2 is part of the x86-64 baseline
+  return &SCAN_SSE2;
+#else
+  return &SCAN_SCALAR;
+#endif
+}
+
+// The scanners picked for this CPU. The tokenizer runs on worker threads, so
+// threads that race to pick them all store the same pointer and read it back
+// through the atomic.
+static std::atomic<const ScanFns *> gScanFns = nullptr;
+
+static const ScanFns *getScanFns() {
+  const ScanFns *fns = gScanFns.load(std::memory_order_acquire);
+  if (fns == nullptr) {
+    fns = selectScanFns();
+    gScanFns.store(fns, std::memory_order_release);
+  }
+  return fns;
+}
+
+u32 HTML_scanText(const u8 *p, u32 len) {
+  return getScanFns()->text(p, len);
+}
+
+u32 HTML_scanQuoted(const u8 *p, u32 len, u8 delim) {
+  return getScanFns()->quoted(p, len, delim);
+}
+
+u32 HTML_scanWhitespace(const u8 *p, u32 len) {
+  return getScanFns()->whitespace(p, len);
+}
+
+static void benchmarkScanFns(const ScanFns *fns, Slice<u8> source) {
+  const u32 NUM_PASSES = 16;
+  u32 numTagStarts = 0;
+
+  TimePoint t0 = chrono_getCurrentTime();
+  for (u32 pass = 0; pass < NUM_PASSES; pass++) {
+    u32 pos = 0;
+    while (pos < source.length) {
+      pos += fns->text(source.data + pos, source.length - pos);
+      if (pos < source.length) {
+        numTagStarts++;
+        pos++;
+      }
+    }
+  }
+  TimePoint t1 = chrono_getCurrentTime();
+
+  f64 secs = chrono_secondsBetween(t0, t1);
+  f64 megabytes = (f64)source.length * NUM_PASSES / (1024.0 * 1024.0);
+  log_info("Scanner %-6s %10.1f MB/s (%u tags per pass)", fns->name,
+           secs > 0 ? megabytes / secs : 0.0, numTagStarts / NUM_PASSES);
+}
+
+void HTML_benchmarkScanner(Slice<u8> source) {
+  if (empty(source)) {
+    return;
+  }
+
+  benchmarkScanFns(&SCAN_SCALAR, source);
+#if HV_SCAN_X64
+  benchmarkScanFns(&SCAN_SSE2, source);
+  if (cpuHasAVX2()) {
+    benchmarkScanFns(&SCAN_AVX2, source);
+  }
+#endif
+}
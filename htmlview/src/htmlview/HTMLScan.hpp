@@ -0,0 +1,28 @@
+#pragma once
+
+#include "std/Slice.hpp"
+#include "std/Types.h"
+
+/**
+ * Returns the number of bytes before the first `<` that begins a tag, i.e.
+ * one that is followed by a `/` or an alphanumeric character. Returns `len`
+ * if there is no such `<` in the buffer.
+ */
+u32 HTML_scanText(const u8 *p, u32 len);
+
+/**
+ * Returns the number of bytes before the first occurrence of `delim` or a
+ * backslash. Returns `len` if neither occurs in the buffer.
+ */
+u32 HTML_scanQuoted(const u8 *p, u32 len, u8 delim);
+
+/**
+ * Returns the number of leading whitespace bytes in the buffer.
+ */
+u32 HTML_scanWhitespace(const u8 *p, u32 len);
+
+/**
+ * Measures the throughput of every scanner implementation supported by this
+ * CPU on the provided document and logs the results in MB/s.
+ */
+void HTML_benchmarkScanner(Slice<u8> source);
@@ -3,10 +3,22 @@
 #include "std/Utils.hpp"
 #include "std/Vector.hpp"
 
+#if _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include "winsock2.h"
 #include "ws2tcpip.h"
+#else
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket close
+#endif
 
 static const Slice<u8> PROTOCOL_HTTP = SLICE_FROM_STRLIT("http://");
 static const Slice<u8> PORT_80 = SLICE_FROM_STRLIT("80");
@@ -103,24 +115,78 @@ static void appendStr(Arena *arena, Vector<u8> *dst, const char *s) {
   memcpy(p, s, lenStr);
 }
 
+static int lastSocketError() {
+#if _WIN32
+  return WSAGetLastError();
+#else
+  return errno;
+#endif
+}
+
+/**
+ * Receives at most `size` bytes. Returns false on error; `numRecv` is zero if
+ * the connection was closed.
+ */
+static b32 receive(SOCKET hSock, u8 *buf, u32 size, u32 &numRecv) {
+#if _WIN32
+  WSABUF wsaBuf = {size, (CHAR *)buf};
+  DWORD flags = 0;
+  DWORD numRecvWsa = 0;
+  int rc = WSARecv(hSock, &wsaBuf, 1, &numRecvWsa, &flags, nullptr, nullptr);
+  numRecv = numRecvWsa;
+  return rc == 0;
+#else
+  ssize_t rc;
+  do {
+    rc = recv(hSock, buf, size, 0);
+  } while (rc < 0 && errno == EINTR);
+  numRecv = rc > 0 ? (u32)rc : 0;
+  return rc >= 0;
+#endif
+}
+
+static b32 sendAll(SOCKET hSock, Slice<u8> buf) {
+#if _WIN32
+  WSABUF wsaBuf = {buf.length, (CHAR *)buf.data};
+  DWORD numBytesSent = 0;
+  return WSASend(hSock, &wsaBuf, 1, &numBytesSent, 0, nullptr, nullptr) == 0;
+#else
+  u32 offCursor = 0;
+  while (offCursor < buf.length) {
+    // A closed connection is reported as an error instead of a SIGPIPE
+    ssize_t rc = send(hSock, buf.data + offCursor, buf.length - offCursor,
+                      MSG_NOSIGNAL);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      return false;
+    }
+    offCursor += (u32)rc;
+  }
+  return true;
+#endif
+}
+
 static b32 readUntilDelimiter(Arena *arena,
                               SOCKET hSock,
                               char delimiterCh,
                               Slice<u8> &out) {
-  int rc;
-  DWORD numRecv = 0;
+  u32 numRecv = 0;
 
   ArenaTemp temp = getScratch(&arena, 1);
   Vector<u8> tempVec;
   b32 isWaitingForLF = false;
   while (true) {
     u8 *buf = append(temp.arena, &tempVec);
-    WSABUF wsaBuf = {1, (CHAR *)buf};
-    DWORD flags = 0;
-    rc = WSARecv(hSock, &wsaBuf, 1, &numRecv, &flags, nullptr, nullptr);
-    if (rc != 0) {
-      log_info("WSARecv failed while reading until delimiter [%d]",
-               WSAGetLastError());
+    if (!receive(hSock, buf, 1, numRecv)) {
+      log_info("recv failed while reading until delimiter [%d]",
+               lastSocketError());
+      releaseScratch(temp);
+      return false;
+    }
+    if (numRecv == 0) {
+      log_info("Connection closed while reading until delimiter");
       releaseScratch(temp);
       return false;
     }
@@ -173,9 +239,6 @@ static b32 readStatusLine(Arena *arena,
                           Slice<u8> &version,
                           i32 &code,
                           Slice<u8> &reason) {
-  int rc;
-  DWORD numRecv = 0;
-
   if (!readUntilDelimiter(arena, hSock, ' ', version)) {
     return false;
   }
@@ -206,9 +269,6 @@ static ReadHeaderStatus readHeader(Arena *arena,
                                    SOCKET hSock,
                                    Slice<u8> &key,
                                    Slice<u8> &value) {
-  int rc;
-  DWORD numRecv = 0;
-
   if (!readUntilDelimiter(arena, hSock, ':', key)) {
     return ReadHeaderStatus::RecvError;
   }
@@ -232,8 +292,9 @@ static b32 fetchFromSocket(Arena *arena,
                            SOCKET hSock,
                            const Url &url,
                            i32 &responseCode,
-                           Slice<u8> &body) {
-  int rc;
+                           Slice<u8> &body,
+                           HTTP_BodyCallback onBody,
+                           void *user) {
   ArenaTemp temp = getScratch(&arena, 1);
   Vector<u8> request = vectorWithInitialCapacity<u8>(temp.arena, 1024);
   // Request line
@@ -259,14 +320,12 @@ static b32 fetchFromSocket(Arena *arena,
   appendStr(temp.arena, &request, "\r\n");
 
   log_info("Sending request");
-  WSABUF wsaBuf = {request.length, (CHAR *)request.data};
-  DWORD numBytesSent = 0;
-  rc = WSASend(hSock, &wsaBuf, 1, &numBytesSent, 0, nullptr, nullptr);
+  b32 isSent = sendAll(hSock, {request.data, request.length});
   log_info("Sent request:\n\"\"\"\n%.*s\n\"\"\"", FMT_SLICE(request));
 
   resetScratch(temp);
-  if (rc != 0) {
-    log_error("WSASend failed [%d]", rc);
+  if (!isSent) {
+    log_error("send failed [%d]", lastSocketError());
     releaseScratch(temp);
     return false;
   }
@@ -302,7 +361,9 @@ static b32 fetchFromSocket(Arena *arena,
     }
   }
 
-  resetScratch(temp);
+  // The body callback may allocate in the scratch arena, so it's given back
+  // before the body is read
+  releaseScratch(temp);
 
   // Read the body
   log_info("Content length: %d bytes", contentLength);
@@ -311,23 +372,38 @@ static b32 fetchFromSocket(Arena *arena,
   u32 offCursor = 0;
 
   while (offCursor < contentLength) {
-    WSABUF wsaBuf = {contentLength - offCursor, (CHAR *)body.data + offCursor};
-    DWORD flags = 0;
-    DWORD numRecv = 0;
-    rc = WSARecv(hSock, &wsaBuf, 1, &numRecv, &flags, nullptr, nullptr);
-    if (rc != 0) {
-      log_error("WSARecv failed [%d]", WSAGetLastError());
-      releaseScratch(temp);
+    u32 numRecv = 0;
+    if (!receive(hSock, body.data + offCursor, contentLength - offCursor,
+                 numRecv)) {
+      log_error("recv failed [%d]", lastSocketError());
+      return false;
+    }
+    if (numRecv == 0) {
+      log_error("Connection closed after %u of %d bytes", offCursor,
+                contentLength);
+      return false;
+    }
+    if (onBody != nullptr &&
+        !onBody(user, responseCode, {body.data + offCursor, (u32)numRecv})) {
+      log_error("Fetch aborted after %u of %d bytes", offCursor + numRecv,
+                contentLength);
       return false;
     }
     offCursor += numRecv;
   }
 
-  releaseScratch(temp);
   return true;
 }
 
 b32 HTTP_fetch(Arena *arena, Slice<u8> urlIn, HTTP_Response &res) {
+  return HTTP_fetch(arena, urlIn, res, nullptr, nullptr);
+}
+
+b32 HTTP_fetch(Arena *arena,
+               Slice<u8> urlIn,
+               HTTP_Response &res,
+               HTTP_BodyCallback onBody,
+               void *user) {
   Url url = {};
   if (!Url_initFromString(&url, arena, urlIn)) {
     return false;
@@ -341,10 +417,10 @@ b32 HTTP_fetch(Arena *arena, Slice<u8> urlIn, HTTP_Response &res) {
   log_info("Resolving address of %.*s:%.*s", FMT_SLICE(url.host),
            FMT_SLICE(url.port));
 
-  INT rc;
+  int rc;
   struct addrinfo *resAddrInfo;
-  rc = getaddrinfo((PCSTR)url.host.data, (PCSTR)url.port.data, &hints,
-                   &resAddrInfo);
+  rc = getaddrinfo((const char *)url.host.data, (const char *)url.port.data,
+                   &hints, &resAddrInfo);
   if (rc != 0) {
     log_error("Address resolution failed [%d]", rc);
     return false;
@@ -381,8 +457,8 @@ b32 HTTP_fetch(Arena *arena, Slice<u8> urlIn, HTTP_Response &res) {
 
   i32 responseCode;
   Slice<u8> responseBody;
-  b32 fetchStatus =
-      fetchFromSocket(arena, hSock, url, responseCode, responseBody);
+  b32 fetchStatus = fetchFromSocket(arena, hSock, url, responseCode,
+                                    responseBody, onBody, user);
   closesocket(hSock);
   if (!fetchStatus) {
     return false;
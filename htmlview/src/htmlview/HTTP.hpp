@@ -18,4 +18,20 @@ struct HTTP_Response {
   i32 code;
 };
 
+/**
+ * Invoked every time a part of the response body has been received. `chunk`
+ * points into the buffer that will be returned as the response body, so
+ * consecutive chunks are adjacent in memory. HTTP_fetch doesn't use the
+ * scratch arena while the body is received, so the callback may allocate in
+ * it.
+ *
+ * Returning false aborts the fetch, which then fails.
+ */
+typedef b32 (*HTTP_BodyCallback)(void *user, i32 code, Slice<u8> chunk);
+
 b32 HTTP_fetch(Arena *arena, Slice<u8> urlIn, HTTP_Response &res);
+b32 HTTP_fetch(Arena *arena,
+               Slice<u8> urlIn,
+               HTTP_Response &res,
+               HTTP_BodyCallback onBody,
+               void *user);
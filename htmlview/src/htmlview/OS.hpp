@@ -7,5 +7,73 @@
 void *os_reserve_vm(u64 size);
 b32 os_commit_vm(void *ptr, u64 size);
 
+/**
+ * Maps the whole file into memory copy-on-write: the view may be written to,
+ * but the changes stay private to the process and never reach the file.
+ * Returns an empty slice if the file can't be mapped.
+ */
+Slice<u8> os_map_file(const char *path);
+void os_unmap_file(Slice<u8> view);
+/**
+ * Creates the file, or truncates it if it exists, and writes the contents into
+ * it.
+ */
+b32 os_write_file(const char *path, Slice<u8> contents);
+b32 os_delete_file(const char *path);
+
+// Enough for the paths that the program builds, including the terminator
+static const u32 OS_MAX_PATH = 260;
+/**
+ * Writes the path of the directory for temporary files into `buf`, ending in a
+ * path separator. Returns false if it doesn't fit.
+ */
+b32 os_get_temp_dir(char *buf, u32 size);
+/**
+ * Like os_get_temp_dir, but for files that are kept between sessions, like
+ * caches. The directory is created if it doesn't exist yet.
+ */
+b32 os_get_cache_dir(char *buf, u32 size);
+
+u32 os_get_process_id();
+
 void os_sleep(u32 milliseconds);
 void os_abort();
+
+u32 os_get_num_cores();
+
+typedef void (*os_thread_proc)(void *user);
+typedef void *os_thread;
+/**
+ * Starts a thread that calls `proc`. Returns null if the thread couldn't be
+ * created.
+ */
+os_thread os_start_thread(os_thread_proc proc, void *user);
+/**
+ * Waits for the thread to finish and frees it.
+ */
+void os_join_thread(os_thread thread);
+
+typedef void *os_event;
+/**
+ * Creates an auto-reset event: a signal stays pending until a thread waits
+ * for it, which consumes it. Returns null if the event couldn't be created.
+ */
+os_event os_create_event();
+void os_destroy_event(os_event event);
+void os_signal_event(os_event event);
+/**
+ * Blocks until the event is signaled, unless a signal is already pending.
+ */
+void os_wait_event(os_event event);
+
+typedef void (*os_task_proc)(void *user, u32 idxTask);
+/**
+ * Calls `proc` once for every task index in [0, numTasks) on a pool of up to
+ * `os_get_num_cores()` threads, one of which is the calling thread. Returns
+ * once all tasks have finished.
+ *
+ * The other threads are started on first use and kept for the rest of the
+ * process. They run one call at a time; a call made while they are busy, e.g.
+ * from one of the tasks, runs all of its tasks on the calling thread.
+ */
+void os_parallel_for(u32 numTasks, os_task_proc proc, void *user);
@@ -0,0 +1,367 @@
+#include "htmlview/OS.hpp"
+#include "std/Utils.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+void *os_reserve_vm(u64 size) {
+  void *ret = mmap(NULL, size, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return ret == MAP_FAILED ? nullptr : ret;
+}
+
+b32 os_commit_vm(void *ptr, u64 size) {
+  return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+Slice<u8> os_map_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return {nullptr, 0};
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > 0xFFFFFFFF) {
+    close(fd);
+    return {nullptr, 0};
+  }
+
+  // The mapping keeps the file alive on its own
+  void *view =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    return {nullptr, 0};
+  }
+
+  return {(u8 *)view, (u32)st.st_size};
+}
+
+void os_unmap_file(Slice<u8> view) {
+  if (view.data != nullptr) {
+    munmap(view.data, view.length);
+  }
+}
+
+b32 os_write_file(const char *path, Slice<u8> contents) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  u32 offCursor = 0;
+  while (offCursor < contents.length) {
+    ssize_t numWritten =
+        write(fd, contents.data + offCursor, contents.length - offCursor);
+    if (numWritten < 0 && errno == EINTR) {
+      continue;
+    }
+    if (numWritten <= 0) {
+      break;
+    }
+    offCursor += (u32)numWritten;
+  }
+  return close(fd) == 0 && offCursor == contents.length;
+}
+
+b32 os_delete_file(const char *path) {
+  return unlink(path) == 0;
+}
+
+b32 os_get_temp_dir(char *buf, u32 size) {
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0') {
+    dir = "/tmp";
+  }
+
+  int len = snprintf(buf, size, "%s/", dir);
+  return len > 0 && (u32)len < size;
+}
+
+b32 os_get_cache_dir(char *buf, u32 size) {
+  int len;
+  const char *base = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (base != NULL && base[0] != '\0') {
+    len = snprintf(buf, size, "%s/htmlview/", base);
+  } else if (home != NULL && home[0] != '\0') {
+    len = snprintf(buf, size, "%s/.cache/htmlview/", home);
+  } else {
+    // Without a home the files are only kept until the temporary directory
+    // is cleaned
+    return os_get_temp_dir(buf, size);
+  }
+  if (len <= 0 || (u32)len >= size) {
+    return false;
+  }
+
+  // Creates the parents as well, one separator at a time
+  for (int i = 1; i < len; i++) {
+    if (buf[i] != '/') {
+      continue;
+    }
+
+    buf[i] = '\0';
+    b32 ok = mkdir(buf, 0755) == 0 || errno == EEXIST;
+    buf[i] = '/';
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+u32 os_get_process_id() {
+  return (u32)getpid();
+}
+
+void os_sleep(u32 milliseconds) {
+  struct timespec duration;
+  duration.tv_sec = milliseconds / 1000;
+  duration.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+  while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {
+  }
+}
+
+void os_abort() {
+  exit(1);
+}
+
+u32 os_get_num_cores() {
+  long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+  return numCores > 0 ? (u32)numCores : 1;
+}
+
+struct ThreadStart {
+  os_thread_proc proc;
+  void *user;
+  pthread_t thread;
+};
+
+static void *threadMain(void *param) {
+  ThreadStart *start = (ThreadStart *)param;
+  start->proc(start->user);
+  return NULL;
+}
+
+os_thread os_start_thread(os_thread_proc proc, void *user) {
+  // Unlike a HANDLE, a pthread_t isn't a pointer, so the start parameters
+  // are kept as the thread's handle until it's joined
+  ThreadStart *start = (ThreadStart *)malloc(sizeof(ThreadStart));
+  if (start == NULL) {
+    return nullptr;
+  }
+  start->proc = proc;
+  start->user = user;
+
+  if (pthread_create(&start->thread, NULL, threadMain, start) != 0) {
+    free(start);
+    return nullptr;
+  }
+  return start;
+}
+
+void os_join_thread(os_thread thread) {
+  ThreadStart *start = (ThreadStart *)thread;
+  pthread_join(start->thread, NULL);
+  free(start);
+}
+
+struct Event {
+  pthread_mutex_t lock;
+  pthread_cond_t signaled;
+  b32 isSignaled;
+};
+
+os_event os_create_event() {
+  Event *event = (Event *)malloc(sizeof(Event));
+  if (event == NULL) {
+    return nullptr;
+  }
+
+  if (pthread_mutex_init(&event->lock, NULL) != 0) {
+    free(event);
+    return nullptr;
+  }
+  if (pthread_cond_init(&event->signaled, NULL) != 0) {
+    pthread_mutex_destroy(&event->lock);
+    free(event);
+    return nullptr;
+  }
+  event->isSignaled = false;
+  return event;
+}
+
+void os_destroy_event(os_event handle) {
+  Event *event = (Event *)handle;
+  pthread_cond_destroy(&event->signaled);
+  pthread_mutex_destroy(&event->lock);
+  free(event);
+}
+
+void os_signal_event(os_event handle) {
+  Event *event = (Event *)handle;
+  pthread_mutex_lock(&event->lock);
+  event->isSignaled = true;
+  pthread_mutex_unlock(&event->lock);
+  pthread_cond_signal(&event->signaled);
+}
+
+void os_wait_event(os_event handle) {
+  Event *event = (Event *)handle;
+  pthread_mutex_lock(&event->lock);
+  while (!event->isSignaled) {
+    pthread_cond_wait(&event->signaled, &event->lock);
+  }
+  event->isSignaled = false;
+  pthread_mutex_unlock(&event->lock);
+}
+
+struct ParallelJob {
+  os_task_proc proc;
+  void *user;
+  u32 numTasks;
+  std::atomic<u32> idxNextTask;
+};
+
+static void runParallelTasks(ParallelJob *job) {
+  while (true) {
+    u32 idxTask = job->idxNextTask.fetch_add(1);
+    if (idxTask >= job->numTasks) {
+      break;
+    }
+    job->proc(job->user, idxTask);
+  }
+}
+
+/**
+ * The threads that os_parallel_for hands its tasks to. A job is posted by
+ * bumping `idxJob`; every worker that wakes up while `job` is still set
+ * helps with it.
+ */
+struct WorkerPool {
+  pthread_mutex_t lock;
+  pthread_cond_t jobPosted;
+  pthread_cond_t jobDone;
+  ParallelJob *job;
+  u32 idxJob;
+  // The workers that are running tasks of `job`
+  u32 numBusy;
+  u32 numWorkers;
+};
+
+static WorkerPool gPool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                           PTHREAD_COND_INITIALIZER};
+static pthread_once_t gPoolStarted = PTHREAD_ONCE_INIT;
+// Held by the thread whose job the pool is running
+static pthread_mutex_t gPoolOwner = PTHREAD_MUTEX_INITIALIZER;
+
+static void *poolWorkerMain(void *param) {
+  WorkerPool *pool = (WorkerPool *)param;
+  u32 idxJobSeen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (pool->idxJob == idxJobSeen) {
+      pthread_cond_wait(&pool->jobPosted, &pool->lock);
+    }
+    idxJobSeen = pool->idxJob;
+
+    // The job may already be over by the time this thread wakes up
+    ParallelJob *job = pool->job;
+    if (job == NULL) {
+      continue;
+    }
+
+    pool->numBusy++;
+    pthread_mutex_unlock(&pool->lock);
+    runParallelTasks(job);
+    pthread_mutex_lock(&pool->lock);
+    pool->numBusy--;
+    if (pool->numBusy == 0) {
+      pthread_cond_signal(&pool->jobDone);
+    }
+  }
+  return NULL;
+}
+
+static void startWorkerPool() {
+  // The calling thread is one of the workers
+  u32 numThreads = os_get_num_cores();
+  numThreads = numThreads < 64 ? numThreads : 64;
+  for (u32 i = 1; i < numThreads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, poolWorkerMain, &gPool) != 0) {
+      // The threads that did start pick up the remaining tasks
+      break;
+    }
+    pthread_detach(thread);
+    gPool.numWorkers++;
+  }
+}
+
+void os_parallel_for(u32 numTasks, os_task_proc proc, void *user) {
+  ParallelJob job;
+  job.proc = proc;
+  job.user = user;
+  job.numTasks = numTasks;
+  job.idxNextTask.store(0, std::memory_order_relaxed);
+  if (numTasks <= 1) {
+    runParallelTasks(&job);
+    return;
+  }
+
+  pthread_once(&gPoolStarted, startWorkerPool);
+  if (gPool.numWorkers == 0 || pthread_mutex_trylock(&gPoolOwner) != 0) {
+    runParallelTasks(&job);
+    return;
+  }
+
+  pthread_mutex_lock(&gPool.lock);
+  gPool.job = &job;
+  gPool.idxJob++;
+  pthread_mutex_unlock(&gPool.lock);
+  pthread_cond_broadcast(&gPool.jobPosted);
+
+  runParallelTasks(&job);
+
+  // Every task has been taken; wait for the workers that are still running
+  // theirs, and make sure that the late ones don't touch the job afterwards
+  pthread_mutex_lock(&gPool.lock);
+  while (gPool.numBusy != 0) {
+    pthread_cond_wait(&gPool.jobDone, &gPool.lock);
+  }
+  gPool.job = NULL;
+  pthread_mutex_unlock(&gPool.lock);
+
+  pthread_mutex_unlock(&gPoolOwner);
+}
+
+int AppEntry(Slice<Slice<u8>> argv);
+
+#define NUM_MAX_ARGS (128)
+static Slice<u8> gArgs[NUM_MAX_ARGS];
+
+int main(int numArgs, char **arrArgs) {
+  if (numArgs < 0 || numArgs > NUM_MAX_ARGS) {
+    return -1;
+  }
+
+  for (int idxArg = 0; idxArg < numArgs; idxArg++) {
+    gArgs[idxArg] = {(u8 *)arrArgs[idxArg], (u32)strlen(arrArgs[idxArg])};
+  }
+
+  Slice<Slice<u8>> argv = {gArgs, (u32)numArgs};
+  return AppEntry(argv);
+}
@@ -1,6 +1,8 @@
 #include "htmlview/OS.hpp"
 #include "std/Utils.hpp"
 
+#include <stdio.h>
+
 #define WIN32_LEAN_AND_MEAN
 #include "windows.h"
 
@@ -14,6 +16,85 @@ b32 os_commit_vm(void *ptr, u64 size) {
   return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
 }
 
+Slice<u8> os_map_file(const char *path) {
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return {nullptr, 0};
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+      size.QuadPart > 0xFFFFFFFF) {
+    CloseHandle(file);
+    return {nullptr, 0};
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  // The view keeps the file and the mapping alive on its own
+  CloseHandle(file);
+  if (mapping == NULL) {
+    return {nullptr, 0};
+  }
+
+  void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+  CloseHandle(mapping);
+  if (view == NULL) {
+    return {nullptr, 0};
+  }
+
+  return {(u8 *)view, (u32)size.QuadPart};
+}
+
+void os_unmap_file(Slice<u8> view) {
+  if (view.data != nullptr) {
+    UnmapViewOfFile(view.data);
+  }
+}
+
+b32 os_write_file(const char *path, Slice<u8> contents) {
+  HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  DWORD numWritten = 0;
+  BOOL ok = WriteFile(file, contents.data, contents.length, &numWritten, NULL);
+  CloseHandle(file);
+  return ok && numWritten == contents.length;
+}
+
+b32 os_delete_file(const char *path) {
+  return DeleteFileA(path) != 0;
+}
+
+b32 os_get_temp_dir(char *buf, u32 size) {
+  // The length doesn't include the terminator if the path fit
+  DWORD len = GetTempPathA(size, buf);
+  return len != 0 && len < size;
+}
+
+b32 os_get_cache_dir(char *buf, u32 size) {
+  char base[OS_MAX_PATH];
+  DWORD len = GetEnvironmentVariableA("LOCALAPPDATA", base, sizeof(base));
+  if (len == 0 || len >= sizeof(base)) {
+    // Without a profile the files are only kept until the temporary
+    // directory is cleaned
+    return os_get_temp_dir(buf, size);
+  }
+
+  int lenPath = snprintf(buf, size, "%s\\htmlview\\", base);
+  if (lenPath <= 0 || (u32)lenPath >= size) {
+    return false;
+  }
+  return CreateDirectoryA(buf, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+u32 os_get_process_id() {
+  return GetCurrentProcessId();
+}
+
 void os_sleep(u32 milliseconds) {
   Sleep(milliseconds);
 }
@@ -22,6 +103,177 @@ void os_abort() {
   ExitProcess(1);
 }
 
+u32 os_get_num_cores() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+struct ThreadStart {
+  os_thread_proc proc;
+  void *user;
+};
+
+static DWORD WINAPI threadMain(LPVOID param) {
+  ThreadStart start = *(ThreadStart *)param;
+  HeapFree(GetProcessHeap(), 0, param);
+  start.proc(start.user);
+  return 0;
+}
+
+os_thread os_start_thread(os_thread_proc proc, void *user) {
+  ThreadStart *start =
+      (ThreadStart *)HeapAlloc(GetProcessHeap(), 0, sizeof(ThreadStart));
+  if (start == NULL) {
+    return nullptr;
+  }
+  *start = {proc, user};
+
+  HANDLE thread = CreateThread(NULL, 0, threadMain, start, 0, NULL);
+  if (thread == NULL) {
+    HeapFree(GetProcessHeap(), 0, start);
+    return nullptr;
+  }
+  return thread;
+}
+
+void os_join_thread(os_thread thread) {
+  WaitForSingleObject((HANDLE)thread, INFINITE);
+  CloseHandle((HANDLE)thread);
+}
+
+os_event os_create_event() {
+  return CreateEventA(NULL, FALSE, FALSE, NULL);
+}
+
+void os_destroy_event(os_event event) {
+  CloseHandle((HANDLE)event);
+}
+
+void os_signal_event(os_event event) {
+  SetEvent((HANDLE)event);
+}
+
+void os_wait_event(os_event event) {
+  WaitForSingleObject((HANDLE)event, INFINITE);
+}
+
+struct ParallelJob {
+  os_task_proc proc;
+  void *user;
+  u32 numTasks;
+  volatile LONG idxNextTask;
+};
+
+static void runParallelTasks(ParallelJob *job) {
+  while (true) {
+    u32 idxTask = (u32)InterlockedIncrement(&job->idxNextTask) - 1;
+    if (idxTask >= job->numTasks) {
+      break;
+    }
+    job->proc(job->user, idxTask);
+  }
+}
+
+/**
+ * The threads that os_parallel_for hands its tasks to. A job is posted by
+ * bumping `idxJob`; every worker that wakes up while `job` is still set
+ * helps with it.
+ */
+struct WorkerPool {
+  SRWLOCK lock;
+  CONDITION_VARIABLE jobPosted;
+  CONDITION_VARIABLE jobDone;
+  ParallelJob *job;
+  u32 idxJob;
+  // The workers that are running tasks of `job`
+  u32 numBusy;
+  u32 numWorkers;
+};
+
+static WorkerPool gPool = {SRWLOCK_INIT, CONDITION_VARIABLE_INIT,
+                           CONDITION_VARIABLE_INIT};
+static INIT_ONCE gPoolStarted = INIT_ONCE_STATIC_INIT;
+// Held by the thread whose job the pool is running
+static SRWLOCK gPoolOwner = SRWLOCK_INIT;
+
+static DWORD WINAPI poolWorkerMain(LPVOID param) {
+  WorkerPool *pool = (WorkerPool *)param;
+  u32 idxJobSeen = 0;
+
+  AcquireSRWLockExclusive(&pool->lock);
+  while (true) {
+    while (pool->idxJob == idxJobSeen) {
+      SleepConditionVariableSRW(&pool->jobPosted, &pool->lock, INFINITE, 0);
+    }
+    idxJobSeen = pool->idxJob;
+
+    // The job may already be over by the time this thread wakes up
+    ParallelJob *job = pool->job;
+    if (job == NULL) {
+      continue;
+    }
+
+    pool->numBusy++;
+    ReleaseSRWLockExclusive(&pool->lock);
+    runParallelTasks(job);
+    AcquireSRWLockExclusive(&pool->lock);
+    pool->numBusy--;
+    if (pool->numBusy == 0) {
+      WakeConditionVariable(&pool->jobDone);
+    }
+  }
+}
+
+static BOOL CALLBACK startWorkerPool(PINIT_ONCE, PVOID, PVOID *) {
+  // The calling thread is one of the workers
+  u32 numThreads = os_get_num_cores();
+  numThreads = numThreads < 64 ? numThreads : 64;
+  for (u32 i = 1; i < numThreads; i++) {
+    HANDLE thread = CreateThread(NULL, 0, poolWorkerMain, &gPool, 0, NULL);
+    if (thread == NULL) {
+      // The threads that did start pick up the remaining tasks
+      break;
+    }
+    CloseHandle(thread);
+    gPool.numWorkers++;
+  }
+  return TRUE;
+}
+
+void os_parallel_for(u32 numTasks, os_task_proc proc, void *user) {
+  ParallelJob job = {proc, user, numTasks, 0};
+  if (numTasks <= 1) {
+    runParallelTasks(&job);
+    return;
+  }
+
+  InitOnceExecuteOnce(&gPoolStarted, startWorkerPool, NULL, NULL);
+  if (gPool.numWorkers == 0 || !TryAcquireSRWLockExclusive(&gPoolOwner)) {
+    runParallelTasks(&job);
+    return;
+  }
+
+  AcquireSRWLockExclusive(&gPool.lock);
+  gPool.job = &job;
+  gPool.idxJob++;
+  ReleaseSRWLockExclusive(&gPool.lock);
+  WakeAllConditionVariable(&gPool.jobPosted);
+
+  runParallelTasks(&job);
+
+  // Every task has been taken; wait for the workers that are still running
+  // theirs, and make sure that the late ones don't touch the job afterwards
+  AcquireSRWLockExclusive(&gPool.lock);
+  while (gPool.numBusy != 0) {
+    SleepConditionVariableSRW(&gPool.jobDone, &gPool.lock, INFINITE, 0);
+  }
+  gPool.job = NULL;
+  ReleaseSRWLockExclusive(&gPool.lock);
+
+  ReleaseSRWLockExclusive(&gPoolOwner);
+}
+
 int AppEntry(Slice<Slice<u8>> argv);
 
 #define NUM_MAX_ARGS (128)
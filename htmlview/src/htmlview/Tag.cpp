@@ -0,0 +1,105 @@
+#include "htmlview/Tag.hpp"
+
+const TagInfo TAG_INFO[(u32)TagId::Count] = {
+    {{nullptr, 0}, 0, 0},
+#define HTML_TAG_INFO(id, name, categories, level) \
+  {{(u8 *)name, sizeof(name) - 1}, categories, level},
+    HTML_TAGS(HTML_TAG_INFO)
+#undef HTML_TAG_INFO
+};
+
+// The perfect hash below is computed at compile time from the tag list
+
+static const u32 NUM_HASH_SLOTS = 256;
+static const u32 MAX_TAG_NAME_LENGTH = 16;
+
+struct TagName {
+  const char *str;
+  u32 length;
+};
+
+static constexpr TagName TAG_NAMES[] = {
+    {"", 0},
+#define HTML_TAG_NAME(id, name, categories, level) {name, sizeof(name) - 1},
+    HTML_TAGS(HTML_TAG_NAME)
+#undef HTML_TAG_NAME
+};
+
+static_assert(sizeof(TAG_NAMES) / sizeof(TAG_NAMES[0]) == (u32)TagId::Count);
+
+/**
+ * Seeded FNV-1a over the name with ASCII letters folded to lowercase. Tag names
+ * only contain alphanumeric characters, for which `| 0x20` is enough.
+ */
+template <typename C>
+static constexpr u32 hashTagName(const C *str, u32 length, u32 seed) {
+  u32 hash = seed;
+  for (u32 i = 0; i < length; i++) {
+    hash = (hash ^ (u8(str[i]) | 0x20)) * 16777619u;
+  }
+  return hash >> 24;
+}
+
+static constexpr b32 isCollisionFree(u32 seed) {
+  b32 used[NUM_HASH_SLOTS] = {};
+  for (u32 i = 1; i < (u32)TagId::Count; i++) {
+    u32 slot = hashTagName(TAG_NAMES[i].str, TAG_NAMES[i].length, seed);
+    if (used[slot]) {
+      return false;
+    }
+    used[slot] = true;
+  }
+  return true;
+}
+
+static constexpr u32 findHashSeed() {
+  for (u32 seed = 2166136261u; seed < 2166136261u + 65536; seed++) {
+    if (isCollisionFree(seed)) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+struct TagHashTable {
+  u32 seed;
+  TagId slots[NUM_HASH_SLOTS];
+};
+
+static constexpr TagHashTable buildHashTable() {
+  TagHashTable ret = {};
+  ret.seed = findHashSeed();
+  for (u32 i = 1; i < (u32)TagId::Count; i++) {
+    u32 slot = hashTagName(TAG_NAMES[i].str, TAG_NAMES[i].length, ret.seed);
+    ret.slots[slot] = (TagId)i;
+  }
+  return ret;
+}
+
+static constexpr TagHashTable TAG_HASH_TABLE = buildHashTable();
+static_assert(TAG_HASH_TABLE.seed != 0, "No perfect hash seed was found");
+
+TagId Tag_fromName(Slice<u8> name) {
+  if (name.length == 0 || name.length > MAX_TAG_NAME_LENGTH) {
+    return TagId::Unknown;
+  }
+
+  u32 slot = hashTagName(name.data, name.length, TAG_HASH_TABLE.seed);
+  TagId candidate = TAG_HASH_TABLE.slots[slot];
+  const TagName &candidateName = TAG_NAMES[(u32)candidate];
+  if (candidateName.length != name.length) {
+    return TagId::Unknown;
+  }
+
+  for (u32 i = 0; i < name.length; i++) {
+    u8 ch = name.data[i];
+    if ('A' <= ch && ch <= 'Z') {
+      ch |= 0x20;
+    }
+    if (ch != (u8)candidateName.str[i]) {
+      return TagId::Unknown;
+    }
+  }
+
+  return candidate;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "std/Slice.hpp"
+#include "std/Types.h"
+
+enum TagCategory : u32 {
+  TC_Block = 1 << 0,
+  TC_Inline = 1 << 1,
+  // Closed by "generate implied end tags"
+  TC_ImpliedEnd = 1 << 2,
+  // Never has any contents, e.g. <br>
+  TC_Void = 1 << 3,
+  TC_Heading = 1 << 4,
+  // Closes an open <p> when it starts
+  TC_ClosesP = 1 << 5,
+  // Delimits the scope in "has an element in scope"
+  TC_Scope = 1 << 6,
+};
+
+// X(identifier, name, categories, heading level)
+#define HTML_TAGS(X)                                \
+  X(Html, "html", TC_Scope, 0)                      \
+  X(Head, "head", 0, 0)                             \
+  X(Title, "title", 0, 0)                           \
+  X(Body, "body", TC_Block, 0)                      \
+  X(Address, "address", TC_Block | TC_ClosesP, 0)   \
+  X(Div, "div", TC_Block | TC_ClosesP, 0)           \
+  X(Dl, "dl", TC_Block | TC_ClosesP, 0)             \
+  X(Ul, "ul", TC_ClosesP, 0)                        \
+  X(P, "p", TC_Block | TC_ClosesP | TC_ImpliedEnd, 0) \
+  X(Dd, "dd", TC_Block | TC_ImpliedEnd, 0)          \
+  X(Dt, "dt", TC_Block | TC_ImpliedEnd, 0)          \
+  X(Header, "header", TC_Block, 0)                  \
+  X(H1, "h1", TC_Block | TC_Heading, 1)             \
+  X(H2, "h2", TC_Block | TC_Heading, 2)             \
+  X(H3, "h3", TC_Block | TC_Heading, 3)             \
+  X(H4, "h4", TC_Block | TC_Heading, 4)             \
+  X(H5, "h5", TC_Block | TC_Heading, 5)             \
+  X(H6, "h6", TC_Block | TC_Heading, 6)             \
+  X(A, "a", TC_Inline, 0)                           \
+  X(Table, "table", TC_Scope, 0)                    \
+  X(Td, "td", TC_Scope, 0)                          \
+  X(Th, "th", TC_Scope, 0)                          \
+  X(Li, "li", TC_ImpliedEnd, 0)                     \
+  X(Optgroup, "optgroup", TC_ImpliedEnd, 0)         \
+  X(Option, "option", TC_ImpliedEnd, 0)             \
+  X(Nextid, "nextid", TC_ImpliedEnd, 0)             \
+  X(Rb, "rb", TC_ImpliedEnd, 0)                     \
+  X(Rp, "rp", TC_ImpliedEnd, 0)                     \
+  X(Rt, "rt", TC_ImpliedEnd, 0)                     \
+  X(Rtc, "rtc", TC_ImpliedEnd, 0)                   \
+  X(Area, "area", TC_Void, 0)                       \
+  X(Base, "base", TC_Void, 0)                       \
+  X(Br, "br", TC_Void, 0)                           \
+  X(Col, "col", TC_Void, 0)                         \
+  X(Embed, "embed", TC_Void, 0)                     \
+  X(Hr, "hr", TC_Void, 0)                           \
+  X(Img, "img", TC_Void, 0)                         \
+  X(Input, "input", TC_Void, 0)                     \
+  X(Link, "link", TC_Void, 0)                       \
+  X(Meta, "meta", TC_Void, 0)                       \
+  X(Source, "source", TC_Void, 0)                   \
+  X(Track, "track", TC_Void, 0)                     \
+  X(Wbr, "wbr", TC_Void, 0)
+
+/**
+ * An interned tag name. Tag names are resolved to an id once by the
+ * tokenizer, so that the rest of the pipeline can compare integers instead of
+ * strings.
+ */
+enum class TagId : u8 {
+  // Any tag that is not in the list above
+  Unknown,
+#define HTML_TAG_ENUM(id, name, categories, level) id,
+  HTML_TAGS(HTML_TAG_ENUM)
+#undef HTML_TAG_ENUM
+      Count,
+};
+
+struct TagInfo {
+  Slice<u8> name;
+  u32 categories;
+  u32 headingLevel;
+};
+
+extern const TagInfo TAG_INFO[(u32)TagId::Count];
+
+/**
+ * Looks up the id of a tag name case-insensitively. Returns TagId::Unknown if
+ * the name is not in the list.
+ */
+TagId Tag_fromName(Slice<u8> name);
+
+inline b32 Tag_hasCategory(TagId tag, u32 categories) {
+  return (TAG_INFO[(u32)tag].categories & categories) != 0;
+}
+
+/**
+ * Returns 1 for <h1>, 2 for <h2> and so on, and 0 for other tags.
+ */
+inline u32 Tag_headingLevel(TagId tag) {
+  return TAG_INFO[(u32)tag].headingLevel;
+}
+
+inline Slice<u8> Tag_name(TagId tag) {
+  return TAG_INFO[(u32)tag].name;
+}
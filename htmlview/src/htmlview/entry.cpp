@@ -1,11 +1,15 @@
 #include "embed/embed.h"
 #include "gpu/Renderer.hpp"
 #include "htmlview/DOM.hpp"
+#include "htmlview/DOMSnapshot.hpp"
 #include "htmlview/HTML.hpp"
+#include "htmlview/HTMLScan.hpp"
 #include "htmlview/HTTP.hpp"
 #include "htmlview/OS.hpp"
 #include "log/log.h"
 #include "std/Arena.h"
+#include "std/Chronometry.h"
+#include "std/Hash.h"
 #include "std/Utils.hpp"
 
 #include "stb/stb_rect_pack.h"
@@ -17,8 +21,18 @@ EMBED_DECL(font_bold);
 
 static Arena arenaPerm;
 static Arena arenaTemp;
+// The fonts and the glyph atlas. They outlive the pages that are shown, so
+// they can't be in arenaPerm, and how much they need depends on the kerning
+// of the fonts, so it grows like the other two.
+static Arena arenaFonts;
+// The tree builder of the page being loaded. It runs on a thread of its own
+// while the page is received, and the thread can't share an arena with the
+// tokenizer.
+static Arena arenaTreeBuilder;
 
 static const i32 EM_SIZE = 16;
+// Font sizes of <h1> to <h6> in ems
+static const f32 HEADING_SIZES[6] = {2.0f, 1.5f, 1.17f, 1.0f, 0.83f, 0.67f};
 
 extern "C" {
 static void Arena_init(Arena *dst) {
@@ -44,10 +58,13 @@ static void Arena_init(Arena *dst) {
 static void setupArenas() {
   Arena_init(&arenaPerm);
   Arena_init(&arenaTemp);
+  Arena_init(&arenaFonts);
+  Arena_init(&arenaTreeBuilder);
 }
 
 void handleOOM(Arena *arena) {
-  if (arena != &arenaPerm && arena != &arenaTemp) {
+  if (arena != &arenaPerm && arena != &arenaTemp && arena != &arenaFonts &&
+      arena != &arenaTreeBuilder) {
     CHECK(!"CANNOT GROW NON-ROOT ARENA: OUT OF MEMORY");
   }
   const u64 SIZ_GROW = 64 * 1024 * 1024;
@@ -91,65 +108,412 @@ enum class FontWeight {
   Bold,
 };
 
+// How much closer or further apart two glyphs are placed than their advances
+// alone would put them
+struct KerningPair {
+  u8 second;
+  f32 adjust;
+};
+
+// Glyphs of every font are rasterized into the pages of a single atlas the
+// first time that they are drawn. A new page is only opened once the others
+// are full. The pages are the layers of one array image, so all text can be
+// drawn without switching images.
+static const u32 GLYPH_ATLAS_PAGE_SIZE = 512;
+static const u32 GLYPH_ATLAS_MAX_PAGES = 8;
+// Empty pixels between the glyphs on a page, so that sampling one of them
+// doesn't pick up its neighbors
+static const u32 GLYPH_ATLAS_PADDING = 1;
+// How many glyphs can be in the atlas at the same time
+static const u32 GLYPH_CACHE_CAPACITY = 8192;
+static const u32 GLYPH_CACHE_MAX_GLYPHS = GLYPH_CACHE_CAPACITY / 4 * 3;
+static const u32 GLYPH_FREE_SLOT = 0xFFFFFFFF;
+// The page of glyphs that have no pixels, like the space
+static const u32 GLYPH_NO_PAGE = 0xFFFFFFFF;
+
+#if HV_SDF_TEXT
+// NOTE: the atlas holds signed distance fields instead of coverage.
+// They are made at this many pixels per em, and the same one is scaled to
+// every size of the face.
+static const f32 GLYPH_SDF_SIZE = 32;
+// How far outside of the outline the field reaches, in pixels
+static const i32 GLYPH_SDF_PADDING = 4;
+// The value on the outline; must match SDF_ON_EDGE in the shader
+static const u8 GLYPH_SDF_ON_EDGE = 128;
+// How much the value changes per pixel of distance
+static const f32 GLYPH_SDF_DIST_SCALE =
+    (f32)GLYPH_SDF_ON_EDGE / GLYPH_SDF_PADDING;
+#endif
+
+struct GlyphAtlasPage {
+  stbrp_context packCtx;
+  Slice<stbrp_node> packNodes;
+  // What the image should contain
+  Slice<u8> pixels;
+  // The rectangle of `pixels` that hasn't been uploaded to the image yet;
+  // empty if dirtyX0 >= dirtyX1
+  u32 dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+  // The last frame in which a glyph on the page was drawn
+  u32 lastUsedFrame;
+};
+
+struct FontFile;
+
+struct CachedGlyph {
+  // The face, scale and codepoint that the glyph was rasterized from; the
+  // codepoint is GLYPH_FREE_SLOT if the slot is empty
+  const FontFile *file;
+  f32 scale;
+  u32 codepoint;
+  u32 idxPage;
+  // Where the glyph is in the glyph table; only glyphs on a page have one
+  u32 idxEntry;
+};
+
+struct GlyphAtlas {
+  GPU_Device gpu;
+  // Has a layer for each page that is open. It's created again with one more
+  // layer whenever a page is opened.
+  GPU_Image image;
+  // Only the first `numPages` are in use. Their pixels follow each other in
+  // memory, in the same order as the layers of the image.
+  Slice<GlyphAtlasPage> pages;
+  u32 numPages;
+  u8 *pixels;
+  // Holds the handles of the images. At most one image is created for each
+  // page, since pages are never closed.
+  Arena imageArena;
+  // The glyphs that are on the pages, hashed by face, scale and codepoint
+  // with linear probing
+  Slice<CachedGlyph> glyphs;
+  u32 numGlyphs;
+  // Counts the frames; glyphs that were drawn in the current one are never
+  // evicted
+  u32 frame;
+
+  // Tells the GPU where the glyphs are on the pages and where their quads go
+  // relative to the pen; text meshes refer to the glyphs by their entry
+  GPU_GlyphTable glyphTable;
+  // What the table should contain
+  Slice<GPU_Glyph> entries;
+  // The entries that no glyph has, taken from the end
+  Slice<u16> freeEntries;
+  u32 numFreeEntries;
+  // The entries that haven't been uploaded to the table yet; empty if
+  // dirtyEntry0 >= dirtyEntry1
+  u32 dirtyEntry0, dirtyEntry1;
+};
+
+static_assert(GLYPH_CACHE_MAX_GLYPHS <= 65536,
+              "GPU_GlyphInstance::idxGlyph holds the entry of a glyph");
+
+struct FontFileKerningPair {
+  u32 second;
+  i32 adjust;
+};
+
+/**
+ * A font file and the parts of its metrics that don't depend on the size, in
+ * font units. These are shared by every size of the font and are cached on
+ * disk, since measuring the kerning takes a while.
+ */
+struct FontFile {
+  const char *data;
+  u32 length;
+
+  b32 hasMetrics;
+  // How far each codepoint below 256 advances the pen
+  Slice<i32> advances;
+  // The kerning pairs that start with codepoint `c` are in
+  // kerningPairs[idxFirstKerningPair[c] .. idxFirstKerningPair[c + 1]), sorted
+  // by their second codepoint
+  Slice<u32> idxFirstKerningPair;
+  Slice<FontFileKerningPair> kerningPairs;
+};
+
+static const u32 FONT_METRICS_MAGIC =
+    'H' | ('V' << 8) | ('F' << 16) | ('M' << 24);
+static const u32 FONT_METRICS_VERSION = 1;
+
+// Followed by the advances, idxFirstKerningPair and the kerning pairs
+struct FontMetricsHeader {
+  u32 magic;
+  u32 version;
+  u64 fontHash;
+  u32 fontLength;
+  u32 numKerningPairs;
+};
+
+static u32 FontMetrics_size(u32 numKerningPairs) {
+  return sizeof(FontMetricsHeader) + 256 * sizeof(i32) + 257 * sizeof(u32) +
+         numKerningPairs * sizeof(FontFileKerningPair);
+}
+
+/**
+ * The path of the cache file of the metrics of a font file, in the cache
+ * directory of the user. Returns false if the path doesn't fit.
+ */
+static b32 getFontMetricsPath(char (&path)[OS_MAX_PATH], u64 fontHash) {
+  char dir[OS_MAX_PATH];
+  if (!os_get_cache_dir(dir, sizeof(dir))) {
+    return false;
+  }
+
+  int len = snprintf(path, sizeof(path), "%shtmlview_font_%016llx.metrics",
+                     dir, (unsigned long long)fontHash);
+  return len > 0 && (u32)len < sizeof(path);
+}
+
+static void FontFile_measure(FontFile *self, Arena *arena) {
+  ArenaTemp temp = getScratch(&arena, 1);
+  stbtt_fontinfo info;
+  stbtt_InitFont(&info, (const u8 *)self->data,
+                 stbtt_GetFontOffsetForIndex((const u8 *)self->data, 0));
+
+  alloc(arena, 256, self->advances);
+  for (u32 ch = 0; ch < 256; ch++) {
+    i32 leftSideBearing;
+    stbtt_GetCodepointHMetrics(&info, ch, &self->advances[ch],
+                               &leftSideBearing);
+  }
+
+  // NOTE: stb only looks kerning up by glyph pairs, so every pair of
+  // codepoints below 256 is tried once here instead of on every measurement
+  i32 glyphs[256];
+  for (u32 ch = 0; ch < 256; ch++) {
+    glyphs[ch] = ch < ' ' ? 0 : stbtt_FindGlyphIndex(&info, ch);
+  }
+
+  b32 hasKerning = info.kern != 0 || info.gpos != 0;
+  alloc(arena, 257, self->idxFirstKerningPair);
+  Vector<FontFileKerningPair> kerningPairs = {};
+  for (u32 first = 0; first < 256; first++) {
+    self->idxFirstKerningPair[first] = kerningPairs.length;
+    if (!hasKerning || glyphs[first] == 0) {
+      continue;
+    }
+
+    for (u32 second = 0; second < 256; second++) {
+      if (glyphs[second] == 0) {
+        continue;
+      }
+
+      i32 adjust =
+          stbtt_GetGlyphKernAdvance(&info, glyphs[first], glyphs[second]);
+      if (adjust != 0) {
+        append(temp.arena, &kerningPairs, {second, adjust});
+      }
+    }
+  }
+  self->idxFirstKerningPair[256] = kerningPairs.length;
+
+  alloc(arena, kerningPairs.length, self->kerningPairs);
+  memcpy(self->kerningPairs.data, kerningPairs.data,
+         kerningPairs.length * sizeof(FontFileKerningPair));
+
+  releaseScratch(temp);
+}
+
+/**
+ * Points the metrics of the font file into a cache file. Returns false if the
+ * cache file is not well-formed or if it was made from a different font.
+ */
+static b32 FontFile_readMetrics(FontFile *self,
+                                Slice<u8> cached,
+                                u64 fontHash) {
+  FontMetricsHeader header;
+  if (cached.length < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, cached.data, sizeof(header));
+  if (header.magic != FONT_METRICS_MAGIC ||
+      header.version != FONT_METRICS_VERSION ||
+      header.fontHash != fontHash || header.fontLength != self->length ||
+      header.numKerningPairs > 256 * 256 ||
+      FontMetrics_size(header.numKerningPairs) != cached.length) {
+    return false;
+  }
+
+  u8 *cur = cached.data + sizeof(header);
+  Slice<i32> advances = {(i32 *)cur, 256};
+  cur += 256 * sizeof(i32);
+  Slice<u32> idxFirstKerningPair = {(u32 *)cur, 257};
+  cur += 257 * sizeof(u32);
+  Slice<FontFileKerningPair> kerningPairs = {(FontFileKerningPair *)cur,
+                                             header.numKerningPairs};
+
+  // The slices of the pairs must stay inside of the pairs
+  for (u32 ch = 0; ch < 256; ch++) {
+    if (idxFirstKerningPair[ch] > idxFirstKerningPair[ch + 1]) {
+      return false;
+    }
+  }
+  if (idxFirstKerningPair[0] != 0 ||
+      idxFirstKerningPair[256] != header.numKerningPairs) {
+    return false;
+  }
+
+  // The second codepoint of a pair indexes tables of 256 entries too
+  for (auto [pair, _] : kerningPairs) {
+    if (pair.second >= 256) {
+      return false;
+    }
+  }
+
+  self->advances = advances;
+  self->idxFirstKerningPair = idxFirstKerningPair;
+  self->kerningPairs = kerningPairs;
+  return true;
+}
+
+static Slice<u8> FontFile_writeMetrics(FontFile *self,
+                                       Arena *arena,
+                                       u64 fontHash) {
+  Slice<u8> ret;
+  alloc(arena, FontMetrics_size(self->kerningPairs.length), ret);
+
+  FontMetricsHeader header = {};
+  header.magic = FONT_METRICS_MAGIC;
+  header.version = FONT_METRICS_VERSION;
+  header.fontHash = fontHash;
+  header.fontLength = self->length;
+  header.numKerningPairs = self->kerningPairs.length;
+
+  u8 *cur = ret.data;
+  memcpy(cur, &header, sizeof(header));
+  cur += sizeof(header);
+  memcpy(cur, self->advances.data, 256 * sizeof(i32));
+  cur += 256 * sizeof(i32);
+  memcpy(cur, self->idxFirstKerningPair.data, 257 * sizeof(u32));
+  cur += 257 * sizeof(u32);
+  memcpy(cur, self->kerningPairs.data,
+         self->kerningPairs.length * sizeof(FontFileKerningPair));
+  return ret;
+}
+
+/**
+ * Maps the metrics of the font file from the cache on disk, or measures the
+ * font and saves them there if there is no usable cache file yet.
+ */
+static void FontFile_loadMetrics(FontFile *self, Arena *arena) {
+  u64 fontHash = fnv64(self->data, self->length);
+  char path[OS_MAX_PATH];
+  b32 hasPath = getFontMetricsPath(path, fontHash);
+
+  // NOTE: the mapping is never closed, the metrics point into it
+  // for as long as the program runs
+  Slice<u8> cached = hasPath ? os_map_file(path) : Slice<u8>{nullptr, 0};
+  if (FontFile_readMetrics(self, cached, fontHash)) {
+    log_info("Font metrics loaded from %s", path);
+    self->hasMetrics = true;
+    return;
+  }
+  os_unmap_file(cached);
+
+  FontFile_measure(self, arena);
+  self->hasMetrics = true;
+  if (!hasPath) {
+    return;
+  }
+
+  ArenaTemp temp = getScratch(&arena, 1);
+  if (!os_write_file(path, FontFile_writeMetrics(self, temp.arena, fontHash))) {
+    log_warn("Failed to write %s", path);
+    // A partly written file would only be rejected on every start
+    os_delete_file(path);
+  }
+  releaseScratch(temp);
+}
+
 struct Font {
   FontStyle style;
   FontWeight weight;
   i32 pointSize;
 
-  stbtt_pack_context packCtx;
-  Slice<stbtt_packedchar> packedChars;
-  GPU_Image image;
-  u32 width, height;
+  // Fonts are only loaded once some text is styled with them
+  FontFile *file;
+  b32 isLoaded;
+
+  stbtt_fontinfo info;
+  // Converts font units to pixels
+  f32 scale;
+  // The scale that the glyphs are rasterized at. It's the same as `scale`,
+  // unless the atlas holds distance fields, which every size shares.
+  f32 glyphScale;
+  // How far each codepoint below 256 advances the pen; the rest are looked up
+  // in the font when needed. Line breaks don't advance it.
+  Slice<f32> advances;
+  b32 hasKerning;
+  // Same as in the FontFile, but already scaled
+  Slice<u32> idxFirstKerningPair;
+  Slice<KerningPair> kerningPairs;
+
   f32 size;
   f32 ascent;
 };
 
-static b32 Font_init(Font *self,
-                     Arena *arena,
-                     GPU_Device gpu,
-                     const char *data,
-                     u32 len,
-                     i32 pointSize,
-                     FontStyle style,
-                     FontWeight weight) {
-  ArenaTemp temp = getScratch(&arena, 1);
-  Slice<u8> pixels;
-  u32 w = 1024;
-  u32 h = 1024;
-  f32 size = STBTT_POINT_SIZE(pointSize);
-  alloc(temp.arena, w * h, pixels);
-  Slice<stbtt_packedchar> packedChars;
-  alloc(arena, 256, packedChars);
-  stbtt_pack_context packCtx;
-  stbtt_PackBegin(&packCtx, pixels.data, w, h, 0, 1, nullptr);
-  stbtt_PackFontRange(&packCtx, (const u8 *)data, 0, size, 0, 256,
-                      packedChars.data);
-  stbtt_PackEnd(&packCtx);
+/**
+ * Describes a font without loading it. It's loaded by Font_load when text is
+ * first styled with it.
+ */
+static void Font_declare(Font *self,
+                         FontFile *file,
+                         i32 pointSize,
+                         FontStyle style,
+                         FontWeight weight) {
+  *self = {};
+  self->file = file;
+  self->pointSize = pointSize;
+  self->style = style;
+  self->weight = weight;
+}
+
+static b32 Font_load(Font *self, Arena *arena) {
+  FontFile *file = self->file;
+  if (!file->hasMetrics) {
+    FontFile_loadMetrics(file, arena);
+  }
+
+  f32 size = STBTT_POINT_SIZE(self->pointSize);
+
+  stbtt_fontinfo info;
+  stbtt_InitFont(&info, (const u8 *)file->data,
+                 stbtt_GetFontOffsetForIndex((const u8 *)file->data, 0));
+  f32 scale = stbtt_ScaleForMappingEmToPixels(&info, (f32)self->pointSize);
 
   f32 ascent, descent, linegap;
-  stbtt_GetScaledFontVMetrics((const u8 *)data, 0, size, &ascent, &descent,
-                              &linegap);
-
-  GPU_ImageDesc fontImageDesc = {};
-  fontImageDesc.format = GPU_PixelFormat::R8;
-  fontImageDesc.width = w;
-  fontImageDesc.height = h;
-  fontImageDesc.pixels = pixels;
-  GPU_Image image;
-  GPU_createImage(gpu, arena, &fontImageDesc, &image);
+  stbtt_GetScaledFontVMetrics((const u8 *)file->data, 0, size, &ascent,
+                              &descent, &linegap);
 
-  releaseScratch(temp);
+  Slice<f32> advances;
+  alloc(arena, 256, advances);
+  for (u32 ch = 0; ch < 256; ch++) {
+    advances[ch] = scale * file->advances[ch];
+  }
+  advances['\r'] = 0;
+  advances['\n'] = 0;
+
+  Slice<KerningPair> kerningPairs;
+  alloc(arena, file->kerningPairs.length, kerningPairs);
+  for (auto [pair, idxPair] : file->kerningPairs) {
+    kerningPairs[idxPair].second = (u8)pair.second;
+    kerningPairs[idxPair].adjust = scale * pair.adjust;
+  }
 
-  self->width = w;
-  self->height = h;
-  self->packCtx = packCtx;
-  self->packedChars = packedChars;
-  self->image = image;
+  self->isLoaded = true;
+  self->info = info;
+  self->scale = scale;
+#if HV_SDF_TEXT
+  self->glyphScale = stbtt_ScaleForMappingEmToPixels(&info, GLYPH_SDF_SIZE);
+#else
+  self->glyphScale = scale;
+#endif
+  self->advances = advances;
+  self->hasKerning = info.kern != 0 || info.gpos != 0;
+  self->idxFirstKerningPair = file->idxFirstKerningPair;
+  self->kerningPairs = kerningPairs;
   self->size = size;
   self->ascent = ascent;
-  self->pointSize = pointSize;
-  self->style = style;
-  self->weight = weight;
   return true;
 }
 
@@ -181,133 +545,657 @@ static u32 findBestFont(Slice<Font> list,
   return idxClosest;
 }
 
-static void Font_getPackedQuad(Font *self,
-                               int codepoint,
-                               f32 *xpos,
-                               f32 *ypos,
-                               stbtt_aligned_quad *aq) {
-  stbtt_GetPackedQuad(self->packedChars.data, self->width, self->height,
-                      codepoint, xpos, ypos, aq, 0);
+/**
+ * Decodes the UTF-8 sequence at `idxChar` and stores the offset of the next
+ * one in `idxNext`. Bytes that don't begin a valid sequence are taken to be
+ * Latin-1 characters, so pages in that encoding still come out right.
+ */
+static u32 decodeUtf8(Slice<u8> text, u32 idxChar, u32 &idxNext) {
+  const u8 *chars = text.data;
+  u32 lead = chars[idxChar];
+  idxNext = idxChar + 1;
+  if (lead < 0x80) {
+    return lead;
+  }
+
+  u32 length, codepoint, minCodepoint;
+  if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    codepoint = lead & 0x1F;
+    minCodepoint = 0x80;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    codepoint = lead & 0x0F;
+    minCodepoint = 0x800;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    codepoint = lead & 0x07;
+    minCodepoint = 0x10000;
+  } else {
+    return lead;
+  }
+
+  if (idxChar + length > text.length) {
+    return lead;
+  }
+
+  for (u32 i = 1; i < length; i++) {
+    u32 next = chars[idxChar + i];
+    if ((next & 0xC0) != 0x80) {
+      return lead;
+    }
+    codepoint = (codepoint << 6) | (next & 0x3F);
+  }
+
+  // Overlong encodings, surrogates and values past the last plane
+  if (codepoint < minCodepoint || codepoint > 0x10FFFF ||
+      (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+    return lead;
+  }
+
+  idxNext = idxChar + length;
+  return codepoint;
+}
+
+/**
+ * Decodes the last character of the text, which must not be empty.
+ */
+static u32 decodeLastUtf8(Slice<u8> text) {
+  // Back up to the byte that the last sequence would start at
+  u32 idxChar = text.length - 1;
+  while (idxChar > 0 && text.length - idxChar < 4 &&
+         (text.data[idxChar] & 0xC0) == 0x80) {
+    idxChar--;
+  }
+
+  u32 idxNext;
+  u32 codepoint = decodeUtf8(text, idxChar, idxNext);
+  // If that's not a sequence that ends the text, the last byte stands alone
+  return idxNext == text.length ? codepoint : text.data[text.length - 1];
 }
 
-static void Font_measureText(Font *self,
-                             Slice<u8> text,
-                             f32 x0,
-                             f32 x1,
-                             v2 start,
-                             v2 *out,
-                             f32 *xCursor) {
-  f32 x = start.x;
-  // f32 y = start.y + -self->size;
-  f32 y = start.y + self->ascent;
-  const f32 width = x1 - x0;
+static void GlyphAtlasPage_markDirty(GlyphAtlasPage *self,
+                                     u32 x0,
+                                     u32 y0,
+                                     u32 x1,
+                                     u32 y1) {
+  if (self->dirtyX0 >= self->dirtyX1) {
+    self->dirtyX0 = x0;
+    self->dirtyY0 = y0;
+    self->dirtyX1 = x1;
+    self->dirtyY1 = y1;
+    return;
+  }
 
-  f32 y0 = y;
+  self->dirtyX0 = min(self->dirtyX0, x0);
+  self->dirtyY0 = min(self->dirtyY0, y0);
+  self->dirtyX1 = max(self->dirtyX1, x1);
+  self->dirtyY1 = max(self->dirtyY1, y1);
+}
 
-  *out = {0, 0};
+static void GlyphAtlas_markEntryDirty(GlyphAtlas *self, u32 idxEntry) {
+  if (self->dirtyEntry0 >= self->dirtyEntry1) {
+    self->dirtyEntry0 = idxEntry;
+    self->dirtyEntry1 = idxEntry + 1;
+    return;
+  }
 
-  // FIXME(danielm): utf-8
-  // FIXME(danielm): overflow wrap
-  u32 idxChar = 0;
-  while (idxChar < text.length) {
-    if (text[idxChar] == '\r' || text[idxChar] == '\n') {
-      idxChar++;
+  self->dirtyEntry0 = min(self->dirtyEntry0, idxEntry);
+  self->dirtyEntry1 = max(self->dirtyEntry1, idxEntry + 1);
+}
+
+static void GlyphAtlasPage_resetPacker(GlyphAtlasPage *self) {
+  // The right and bottom edges of the page are padded by leaving them out
+  stbrp_init_target(&self->packCtx, GLYPH_ATLAS_PAGE_SIZE - GLYPH_ATLAS_PADDING,
+                    GLYPH_ATLAS_PAGE_SIZE - GLYPH_ATLAS_PADDING,
+                    self->packNodes.data, self->packNodes.length);
+}
+
+static b32 GlyphAtlas_init(GlyphAtlas *self, Arena *arena, GPU_Device gpu) {
+  // NOTE: only address space is set aside for the pixels of the
+  // pages here; a page commits its part once it's opened
+  const u32 SIZ_PAGE = GLYPH_ATLAS_PAGE_SIZE * GLYPH_ATLAS_PAGE_SIZE;
+  u8 *pixels = (u8 *)os_reserve_vm(u64(SIZ_PAGE) * GLYPH_ATLAS_MAX_PAGES);
+  if (!pixels) {
+    return false;
+  }
+
+  *self = {};
+  self->gpu = gpu;
+  self->pixels = pixels;
+
+  alloc(arena, GLYPH_ATLAS_MAX_PAGES, self->pages);
+  for (auto [page, idxPage] : self->pages) {
+    page.pixels = {pixels + idxPage * SIZ_PAGE, SIZ_PAGE};
+    alloc(arena, GLYPH_ATLAS_PAGE_SIZE, page.packNodes);
+  }
+
+  const u32 SIZ_IMAGE_ARENA = 4 * 1024;
+  self->imageArena.beg = alloc<u8>(arena, SIZ_IMAGE_ARENA);
+  self->imageArena.end = self->imageArena.beg + SIZ_IMAGE_ARENA;
+
+  alloc(arena, GLYPH_CACHE_CAPACITY, self->glyphs);
+  for (auto [glyph, _] : self->glyphs) {
+    glyph.codepoint = GLYPH_FREE_SLOT;
+  }
+
+  // Every glyph that has pixels has an entry, so there are never more of
+  // them in use than there are glyphs
+  GPU_GlyphTableDesc tableDesc = {};
+  tableDesc.capacity = GLYPH_CACHE_MAX_GLYPHS;
+  if (!GPU_createGlyphTable(gpu, arena, &tableDesc, &self->glyphTable)) {
+    return false;
+  }
+  alloc(arena, GLYPH_CACHE_MAX_GLYPHS, self->entries);
+  alloc(arena, GLYPH_CACHE_MAX_GLYPHS, self->freeEntries);
+  for (auto [entry, idxEntry] : self->freeEntries) {
+    entry = (u16)(GLYPH_CACHE_MAX_GLYPHS - 1 - idxEntry);
+  }
+  self->numFreeEntries = GLYPH_CACHE_MAX_GLYPHS;
+  return true;
+}
+
+/**
+ * Starts a new frame. The glyphs drawn from now on are kept in the atlas
+ * until the next frame begins.
+ */
+static void GlyphAtlas_beginFrame(GlyphAtlas *self) {
+  self->frame++;
+}
+
+/**
+ * Keeps the glyphs on the page in the atlas during this frame, because meshes
+ * that are still shown use them.
+ */
+static void GlyphAtlas_touchPage(GlyphAtlas *self, u32 idxPage) {
+  self->pages[idxPage].lastUsedFrame = self->frame;
+}
+
+/**
+ * Returns the slot of the glyph in the glyph table, or the free slot where it
+ * would go.
+ */
+static CachedGlyph *GlyphAtlas_findGlyphSlot(GlyphAtlas *self,
+                                             const FontFile *file,
+                                             f32 scale,
+                                             u32 codepoint) {
+  u32 mask = self->glyphs.length - 1;
+  u32 face = (u32)((uintptr_t)file >> 4) ^ (u32)(scale * 65536.0f);
+  u32 hash = (codepoint ^ face * 0x9E3779B9u) * 2654435761u;
+  u32 idxSlot = (hash ^ (hash >> 16)) & mask;
+  while (self->glyphs[idxSlot].codepoint != GLYPH_FREE_SLOT &&
+         (self->glyphs[idxSlot].codepoint != codepoint ||
+          self->glyphs[idxSlot].file != file ||
+          self->glyphs[idxSlot].scale != scale)) {
+    idxSlot = (idxSlot + 1) & mask;
+  }
+  return &self->glyphs[idxSlot];
+}
+
+/**
+ * Opens the next page. The image gets a layer for it by being replaced with a
+ * larger one, which starts out with what the pages already contain.
+ */
+static b32 GlyphAtlas_openPage(GlyphAtlas *self) {
+  if (self->numPages == GLYPH_ATLAS_MAX_PAGES) {
+    return false;
+  }
+
+  GlyphAtlasPage &page = self->pages[self->numPages];
+  if (!os_commit_vm(page.pixels.data, page.pixels.length)) {
+    return false;
+  }
+
+  u32 numLayers = self->numPages + 1;
+  GPU_ImageDesc imageDesc = {};
+  imageDesc.format = GPU_PixelFormat::R8;
+  imageDesc.width = GLYPH_ATLAS_PAGE_SIZE;
+  imageDesc.height = GLYPH_ATLAS_PAGE_SIZE;
+  imageDesc.numLayers = numLayers;
+  imageDesc.pixels = {self->pixels, numLayers * page.pixels.length};
+  imageDesc.isUpdatable = true;
+  GPU_Image image;
+  if (!GPU_createImage(self->gpu, &self->imageArena, &imageDesc, &image)) {
+    return false;
+  }
+  if (self->image) {
+    GPU_destroyImage(self->gpu, self->image);
+  }
+  self->image = image;
+
+  // The new image already has everything that was waiting to be uploaded
+  for (u32 idxPage = 0; idxPage < self->numPages; idxPage++) {
+    self->pages[idxPage].dirtyX0 = self->pages[idxPage].dirtyX1 = 0;
+  }
+
+  GlyphAtlasPage_resetPacker(&page);
+  page.lastUsedFrame = self->frame;
+  self->numPages++;
+  return true;
+}
+
+/**
+ * Removes the glyphs on the page from the table and frees their entries, along
+ * with the glyphs that have no pixels: those are cheap to look up again and no
+ * mesh refers to them.
+ */
+static void GlyphAtlas_dropGlyphs(GlyphAtlas *self, u32 idxPage) {
+  // The other glyphs are inserted again, since the probe sequences of some of
+  // them may run through the slots that are freed up
+  ArenaTemp temp = getScratch(nullptr, 0);
+  Slice<CachedGlyph> oldGlyphs = duplicate(temp.arena, self->glyphs);
+  for (auto [glyph, _] : self->glyphs) {
+    glyph.codepoint = GLYPH_FREE_SLOT;
+  }
+  self->numGlyphs = 0;
+  for (auto [glyph, _] : oldGlyphs) {
+    if (glyph.codepoint == GLYPH_FREE_SLOT || glyph.idxPage == GLYPH_NO_PAGE) {
       continue;
     }
-    f32 nextX = x;
-    stbtt_aligned_quad aq;
-    // NOTE(danielm): y is never written by stbtt
-    Font_getPackedQuad(self, text[idxChar], &nextX, &y, &aq);
-
-    if (nextX > x1) {
-      // If this is not the very first glyph on the line
-      if (false && nextX - x < width) {
-        // Try again on the next line
-        y = y + -self->size;
-        x = x0;
-        continue;
-      }
+    if (glyph.idxPage == idxPage) {
+      self->freeEntries[self->numFreeEntries++] = (u16)glyph.idxEntry;
+      continue;
     }
+    *GlyphAtlas_findGlyphSlot(self, glyph.file, glyph.scale,
+                              glyph.codepoint) = glyph;
+    self->numGlyphs++;
+  }
+  releaseScratch(temp);
+}
 
-    x = nextX;
-    idxChar++;
+/**
+ * Empties the page that was drawn from the longest time ago and drops its
+ * glyphs from the table. Pages drawn from in this frame are never picked.
+ * Returns false if there is no such page.
+ */
+static b32 GlyphAtlas_evictPage(GlyphAtlas *self, u32 &idxPage) {
+  idxPage = GLYPH_NO_PAGE;
+  for (u32 i = 0; i < self->numPages; i++) {
+    GlyphAtlasPage &page = self->pages[i];
+    if (page.lastUsedFrame == self->frame) {
+      continue;
+    }
+    if (idxPage == GLYPH_NO_PAGE ||
+        page.lastUsedFrame < self->pages[idxPage].lastUsedFrame) {
+      idxPage = i;
+    }
   }
 
-  f32 dy = y - y0;
-  out->y = dy;
-  *xCursor = x;
+  if (idxPage == GLYPH_NO_PAGE) {
+    return false;
+  }
+
+  GlyphAtlasPage &page = self->pages[idxPage];
+  zeroMemory(page.pixels);
+  GlyphAtlasPage_markDirty(&page, 0, 0, GLYPH_ATLAS_PAGE_SIZE,
+                           GLYPH_ATLAS_PAGE_SIZE);
+  GlyphAtlasPage_resetPacker(&page);
+  page.lastUsedFrame = self->frame;
+
+  GlyphAtlas_dropGlyphs(self, idxPage);
+  return true;
 }
 
-static void Font_drawText(Font *self,
-                          Arena *arena,
-                          Vector<GPU_Vertex> &vertices,
-                          Vector<u32> &indices,
-                          Slice<u8> text,
-                          f32 x0,
-                          f32 x1,
-                          v2 start,
-                          v4 color) {
-  f32 x = start.x;
-  // f32 y = start.y + -self->size;
-  f32 y = start.y + self->ascent;
-  const f32 width = x1 - x0;
+/**
+ * Finds room for the rectangle on one of the pages, opening a new page or
+ * evicting an old one if they are all full.
+ */
+static b32 GlyphAtlas_packRect(GlyphAtlas *self,
+                               stbrp_rect &rect,
+                               u32 &idxPage) {
+  for (idxPage = 0; idxPage < self->numPages; idxPage++) {
+    stbrp_pack_rects(&self->pages[idxPage].packCtx, &rect, 1);
+    if (rect.was_packed) {
+      return true;
+    }
+  }
 
-  // FIXME(danielm): utf-8
-  // FIXME(danielm): overflow wrap
-  u32 idxChar = 0;
-  while (idxChar < text.length) {
-    if (text[idxChar] == '\r' || text[idxChar] == '\n') {
-      idxChar++;
+  if (GlyphAtlas_openPage(self)) {
+    idxPage = self->numPages - 1;
+  } else if (!GlyphAtlas_evictPage(self, idxPage)) {
+    return false;
+  }
+
+  // Fails only if the glyph is larger than a page
+  stbrp_pack_rects(&self->pages[idxPage].packCtx, &rect, 1);
+  return rect.was_packed;
+}
+
+/**
+ * Looks up the glyph of the codepoint in the font, rasterizing it into the
+ * atlas if it's not there yet. Returns false if there is no room for it in
+ * this frame.
+ */
+static b32 GlyphAtlas_getGlyph(GlyphAtlas *self,
+                               const Font *font,
+                               u32 codepoint,
+                               CachedGlyph *&out) {
+  const FontFile *file = font->file;
+  f32 scale = font->glyphScale;
+  out = GlyphAtlas_findGlyphSlot(self, file, scale, codepoint);
+  if (out->codepoint == codepoint) {
+    if (out->idxPage != GLYPH_NO_PAGE) {
+      GlyphAtlas_touchPage(self, out->idxPage);
+    }
+    return true;
+  }
+
+  if (self->numGlyphs >= GLYPH_CACHE_MAX_GLYPHS) {
+    GlyphAtlas_dropGlyphs(self, GLYPH_NO_PAGE);
+  }
+  if (self->numGlyphs >= GLYPH_CACHE_MAX_GLYPHS) {
+    u32 idxEvicted;
+    if (!GlyphAtlas_evictPage(self, idxEvicted) ||
+        self->numGlyphs >= GLYPH_CACHE_MAX_GLYPHS) {
+      return false;
+    }
+  }
+
+  i32 glyphIndex = stbtt_FindGlyphIndex(&font->info, codepoint);
+#if HV_SDF_TEXT
+  // The box of the field is larger than the glyph by the padding
+  i32 ix0 = 0, iy0 = 0, fieldWidth = 0, fieldHeight = 0;
+  u8 *field = stbtt_GetGlyphSDF(&font->info, scale, glyphIndex,
+                                GLYPH_SDF_PADDING, GLYPH_SDF_ON_EDGE,
+                                GLYPH_SDF_DIST_SCALE, &fieldWidth, &fieldHeight,
+                                &ix0, &iy0);
+  i32 ix1 = ix0 + fieldWidth;
+  i32 iy1 = iy0 + fieldHeight;
+#else
+  i32 ix0, iy0, ix1, iy1;
+  stbtt_GetGlyphBitmapBox(&font->info, glyphIndex, scale, scale, &ix0, &iy0,
+                          &ix1, &iy1);
+#endif
+  u32 width = ix1 - ix0;
+  u32 height = iy1 - iy0;
+
+  CachedGlyph glyph = {};
+  glyph.file = file;
+  glyph.scale = scale;
+  glyph.codepoint = codepoint;
+  glyph.idxPage = GLYPH_NO_PAGE;
+
+  if (width != 0 && height != 0) {
+    stbrp_rect rect = {};
+    rect.w = width + GLYPH_ATLAS_PADDING;
+    rect.h = height + GLYPH_ATLAS_PADDING;
+    u32 idxPage;
+    if (!GlyphAtlas_packRect(self, rect, idxPage)) {
+#if HV_SDF_TEXT
+      stbtt_FreeSDF(field, nullptr);
+#endif
+      return false;
+    }
+
+    GlyphAtlasPage &page = self->pages[idxPage];
+    u32 x = rect.x + GLYPH_ATLAS_PADDING;
+    u32 y = rect.y + GLYPH_ATLAS_PADDING;
+    u8 *dst = page.pixels.data + y * GLYPH_ATLAS_PAGE_SIZE + x;
+#if HV_SDF_TEXT
+    for (u32 row = 0; row < height; row++) {
+      memcpy(dst + row * GLYPH_ATLAS_PAGE_SIZE, field + row * width, width);
+    }
+    stbtt_FreeSDF(field, nullptr);
+#else
+    stbtt_MakeGlyphBitmap(&font->info, dst, width, height,
+                          GLYPH_ATLAS_PAGE_SIZE, scale, scale, glyphIndex);
+#endif
+    GlyphAtlasPage_markDirty(&page, x, y, x + width, y + height);
+    GlyphAtlas_touchPage(self, idxPage);
+
+    // Packing the glyph may have evicted a page, which frees up entries, so
+    // this is done afterwards
+    CHECK(self->numFreeEntries > 0);
+    u32 idxEntry = self->freeEntries[--self->numFreeEntries];
+    const f32 texelSize = 1.0f / GLYPH_ATLAS_PAGE_SIZE;
+    GPU_Glyph &entry = self->entries[idxEntry];
+    entry.offset0 = {(f32)ix0, (f32)iy0};
+    entry.offset1 = {(f32)ix1, (f32)iy1};
+    entry.texcoord0 = {x * texelSize, y * texelSize};
+    entry.texcoord1 = {(x + width) * texelSize, (y + height) * texelSize};
+    entry.layer = idxPage;
+#if HV_SDF_TEXT
+    entry.isDistanceField = true;
+#else
+    entry.isDistanceField = false;
+#endif
+    GlyphAtlas_markEntryDirty(self, idxEntry);
+
+    glyph.idxPage = idxPage;
+    glyph.idxEntry = idxEntry;
+  }
+
+  // Evicting a page rebuilds the table, so the slot is looked up again
+  out = GlyphAtlas_findGlyphSlot(self, file, scale, codepoint);
+  *out = glyph;
+  self->numGlyphs++;
+  return true;
+}
+
+/**
+ * Uploads the parts of the pages and the entries of the glyph table that
+ * changed since the last upload.
+ */
+static void GlyphAtlas_uploadGlyphs(GlyphAtlas *self) {
+  for (u32 idxPage = 0; idxPage < self->numPages; idxPage++) {
+    GlyphAtlasPage &page = self->pages[idxPage];
+    if (page.dirtyX0 >= page.dirtyX1) {
       continue;
     }
-    f32 nextX = x;
-    stbtt_aligned_quad aq;
-    // NOTE(danielm): y is never written by stbtt
-    Font_getPackedQuad(self, text[idxChar], &nextX, &y, &aq);
-
-    if (nextX > x1) {
-      // If this is not the very first glyph on the line
-      if (false && nextX - x < width) {
-        // Try again on the next line
-        y = y + -self->size;
-        x = x0;
-        continue;
+
+    u32 width = page.dirtyX1 - page.dirtyX0;
+    u32 height = page.dirtyY1 - page.dirtyY0;
+    u32 offset = page.dirtyY0 * GLYPH_ATLAS_PAGE_SIZE + page.dirtyX0;
+    u32 length = (height - 1) * GLYPH_ATLAS_PAGE_SIZE + width;
+    GPU_updateImageRegion(self->gpu, self->image, idxPage, page.dirtyX0,
+                          page.dirtyY0, width, height,
+                          {page.pixels.data + offset, length},
+                          GLYPH_ATLAS_PAGE_SIZE);
+    page.dirtyX0 = page.dirtyX1 = 0;
+  }
+
+  if (self->dirtyEntry0 < self->dirtyEntry1) {
+    GPU_updateGlyphTable(self->gpu, self->glyphTable, self->dirtyEntry0,
+                         {self->entries.data + self->dirtyEntry0,
+                          self->dirtyEntry1 - self->dirtyEntry0});
+    self->dirtyEntry0 = self->dirtyEntry1 = 0;
+  }
+}
+
+static f32 Font_getKerning(Font *self, u32 first, u32 second) {
+  if (first < 256 && second < 256) {
+    u32 idxEnd = self->idxFirstKerningPair[first + 1];
+    for (u32 i = self->idxFirstKerningPair[first]; i < idxEnd; i++) {
+      KerningPair &pair = self->kerningPairs[i];
+      if (pair.second >= second) {
+        return pair.second == second ? pair.adjust : 0;
       }
     }
+    return 0;
+  }
+
+  if (!self->hasKerning) {
+    return 0;
+  }
+  return self->scale *
+         stbtt_GetCodepointKernAdvance(&self->info, first, second);
+}
+
+static f32 Font_getCodepointAdvance(Font *self, u32 codepoint) {
+  if (codepoint < 256) {
+    return self->advances[codepoint];
+  }
+
+  i32 advance, leftSideBearing;
+  stbtt_GetCodepointHMetrics(&self->info, codepoint, &advance,
+                             &leftSideBearing);
+  return self->scale * advance;
+}
+
+/**
+ * Returns how far the pen moves from the character that begins at `idxChar`
+ * to the next one.
+ */
+static f32 Font_getAdvance(Font *self, Slice<u8> text, u32 idxChar) {
+  u32 idxNext;
+  u32 codepoint = decodeUtf8(text, idxChar, idxNext);
+  f32 ret = Font_getCodepointAdvance(self, codepoint);
+  if (idxNext < text.length) {
+    ret += Font_getKerning(self, codepoint, decodeUtf8(text, idxNext, idxNext));
+  }
+  return ret;
+}
+
+/**
+ * Returns how far the text advances the pen on a single line.
+ */
+static f32 Font_measureAdvance(Font *self, Slice<u8> text) {
+  const f32 *advances = self->advances.data;
+  const u8 *chars = text.data;
+
+  // NOTE: the sum is split into four independent lanes so that the
+  // lookups and additions of consecutive characters don't wait on each other.
+  // This only works as long as every byte is a character of its own.
+  f32 lanes[4] = {0, 0, 0, 0};
+  u32 idxChar = 0;
+  for (; idxChar + 4 <= text.length; idxChar += 4) {
+    if ((chars[idxChar + 0] | chars[idxChar + 1] | chars[idxChar + 2] |
+         chars[idxChar + 3]) &
+        0x80) {
+      break;
+    }
+    lanes[0] += advances[chars[idxChar + 0]];
+    lanes[1] += advances[chars[idxChar + 1]];
+    lanes[2] += advances[chars[idxChar + 2]];
+    lanes[3] += advances[chars[idxChar + 3]];
+  }
+  while (idxChar < text.length) {
+    u32 codepoint = decodeUtf8(text, idxChar, idxChar);
+    lanes[0] += Font_getCodepointAdvance(self, codepoint);
+  }
+  f32 x = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+  if (self->hasKerning && text.length != 0) {
+    u32 idxNext;
+    u32 prev = decodeUtf8(text, 0, idxNext);
+    while (idxNext < text.length) {
+      u32 cur = decodeUtf8(text, idxNext, idxNext);
+      x += Font_getKerning(self, prev, cur);
+      prev = cur;
+    }
+  }
 
-    u32 idxTL = vertices.length;
-    u32 idxTR = idxTL + 1;
-    u32 idxBR = idxTL + 2;
-    u32 idxBL = idxTL + 3;
+  return x;
+}
 
-    u32 *ind = append(arena, &indices, 6);
-    ind[0] = idxTL;
-    ind[1] = idxTR;
-    ind[2] = idxBL;
-    ind[3] = idxBL;
-    ind[4] = idxTR;
-    ind[5] = idxBR;
+/**
+ * A part of a text node that is drawn on a single line.
+ */
+struct LineBox {
+  // Where the pen starts; the top of the line
+  v2 position;
+  // The characters of the text node on this line
+  u32 offset;
+  u32 length;
+};
+
+/**
+ * A run of non-whitespace characters of a text node and the whitespace that
+ * follows it. Lines are only broken between words.
+ */
+struct TextWord {
+  u32 offset;
+  u32 length;
+  // How far the characters of the word alone advance the pen; this is what
+  // has to fit on the line
+  f32 advance;
+  // How far the pen is from the start of the word when the next word begins
+  f32 advanceWithSpace;
+};
 
-    GPU_Vertex *corners = append(arena, &vertices, 4);
+/**
+ * Packs the color into 8 bits per channel, red in the lowest byte.
+ */
+static u32 packColor(v4 color) {
+  u32 r = (u32)(f32_saturate(color.x) * 255.0f + 0.5f);
+  u32 g = (u32)(f32_saturate(color.y) * 255.0f + 0.5f);
+  u32 b = (u32)(f32_saturate(color.z) * 255.0f + 0.5f);
+  u32 a = (u32)(f32_saturate(color.w) * 255.0f + 0.5f);
+  return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+/**
+ * Appends an instance for each glyph of the text to `glyphs`, and sets the
+ * bits of the atlas pages that the glyphs are on in `usedPages`. `words` are
+ * the measured words of the text; every word starts where layout put it.
+ */
+static void Font_drawText(Font *self,
+                          GlyphAtlas *atlas,
+                          Arena *arena,
+                          Vector<GPU_GlyphInstance> &glyphs,
+                          u32 &usedPages,
+                          Slice<u8> text,
+                          Slice<TextWord> words,
+                          Slice<LineBox> lines,
+                          v4 color) {
+  // From the pixels that the glyphs were rasterized at to the size of the font
+  const f32 glyphToPixels = self->scale / self->glyphScale;
+  const u16 scale = (u16)min(glyphToPixels * GPU_GLYPH_SCALE_ONE + 0.5f,
+                             65535.0f);
+  const u32 packedColor = packColor(color);
+
+  for (auto [line, _] : lines) {
+    // Lines begin with a word; find it
+    u32 idxWord = 0;
+    u32 idxEnd = words.length;
+    while (idxWord < idxEnd) {
+      u32 idxMid = idxWord + (idxEnd - idxWord) / 2;
+      if (words[idxMid].offset < line.offset) {
+        idxWord = idxMid + 1;
+      } else {
+        idxEnd = idxMid;
+      }
+    }
 
-    corners[0].position = {aq.x0, aq.y0};
-    corners[0].texcoord0 = {aq.s0, aq.t0};
-    corners[0].color0 = color;
+    f32 wordX = line.position.x;
+    // f32 y = line.position.y + -self->size;
+    f32 y = line.position.y + self->ascent;
+
+    for (; idxWord < words.length &&
+           words[idxWord].offset < line.offset + line.length;
+         idxWord++) {
+      TextWord &word = words[idxWord];
+      Slice<u8> wordText = {text.data + word.offset, word.length};
+
+      // NOTE: the advances of the characters are summed in another order
+      // than Font_measureAdvance does, so the pen is put back to what layout
+      // measured at every word instead of letting the difference add up
+      f32 x = wordX;
+      u32 idxNext;
+      for (u32 idxChar = 0; idxChar < wordText.length; idxChar = idxNext) {
+        u32 codepoint = decodeUtf8(wordText, idxChar, idxNext);
+        f32 nextX = x + Font_getAdvance(self, wordText, idxChar);
+        CachedGlyph *glyph;
+        if (codepoint == '\r' || codepoint == '\n' ||
+            !GlyphAtlas_getGlyph(atlas, self, codepoint, glyph) ||
+            glyph->idxPage == GLYPH_NO_PAGE) {
+          x = nextX;
+          continue;
+        }
 
-    corners[1].position = {aq.x1, aq.y0};
-    corners[1].texcoord0 = {aq.s1, aq.t0};
-    corners[1].color0 = color;
+        usedPages |= 1u << glyph->idxPage;
 
-    corners[2].position = {aq.x1, aq.y1};
-    corners[2].texcoord0 = {aq.s1, aq.t1};
-    corners[2].color0 = color;
+        GPU_GlyphInstance *instance = append(arena, &glyphs);
+        instance->position = {x, y};
+        instance->idxGlyph = (u16)glyph->idxEntry;
+        instance->scale = scale;
+        instance->color = packedColor;
 
-    corners[3].position = {aq.x0, aq.y1};
-    corners[3].texcoord0 = {aq.s0, aq.t1};
-    corners[3].color0 = color;
+        x = nextX;
+      }
 
-    x = nextX;
-    idxChar++;
+      wordX += word.advanceWithSpace;
+    }
   }
 }
 
@@ -316,8 +1204,28 @@ struct PageRenderer {
   GPU_Surface surface;
 
   Slice<Font> fonts;
+  // The fonts are loaded into this on first use, which is usually while a
+  // page is shown and the permanent arena belongs to that page
+  Arena *fontArena;
+  // Shared by all fonts
+  GlyphAtlas atlas;
 };
 
+/**
+ * Returns the font, loading it first if nothing has used it yet. Fonts must
+ * be loaded before the text is measured on the worker threads.
+ */
+static Font *PageRenderer_useFont(PageRenderer &renderer, u32 idxFont) {
+  Font *font = &renderer.fonts[idxFont];
+  if (!font->isLoaded) {
+    if (!Font_load(font, renderer.fontArena)) {
+      log_error("Failed to load font %u", idxFont);
+      os_abort();
+    }
+  }
+  return font;
+}
+
 struct NodeLayoutInfo {
   v2 position;
   v2 size;
@@ -325,6 +1233,10 @@ struct NodeLayoutInfo {
   f32 parentX0, parentX1;
 
   f32 lineBoxY;
+
+  // Text nodes only: where their line boxes are
+  u32 idxFirstLine;
+  u32 numLines;
 };
 
 static f32 bottomOf(const NodeLayoutInfo &i) {
@@ -353,161 +1265,228 @@ struct TextStyleInfo {
   u32 idxFont;
 };
 
-static Slice<TextStyleInfo> computeTextStyles(Arena *arena,
-                                              DOM_Tree &domTree,
-                                              Slice<Font> availableFonts) {
-  Slice<TextStyleInfo> ret;
-  alloc(arena, domTree.textData.length, ret);
-
-  struct StackEntry {
-    u32 idxNode;
+/**
+ * Returns the index of `style` in the table, adding it if it's not there yet.
+ * Pages only use a handful of distinct styles, so a linear search is enough.
+ */
+static u16 internTextStyle(Arena *arena,
+                           Vector<TextStyleInfo> &styles,
+                           const TextStyleInfo &style) {
+  for (u32 i = 0; i < styles.length; i++) {
+    TextStyleInfo &cur = styles[i];
+    if (cur.fontSize == style.fontSize && cur.fontWeight == style.fontWeight &&
+        cur.color.x == style.color.x && cur.color.y == style.color.y &&
+        cur.color.z == style.color.z && cur.color.w == style.color.w) {
+      return (u16)i;
+    }
+  }
 
-    TextStyleInfo textStyle;
-  };
+  CHECK(styles.length <= 0xFFFF);
+  append(arena, &styles, style);
+  return (u16)(styles.length - 1);
+}
 
+/**
+ * Computes the distinct text styles used by the page into `outStyles` and
+ * the index of the style of each text node into `outTextStyleIndex`.
+ */
+static void computeTextStyles(Arena *arena,
+                              DOM_Tree &domTree,
+                              PageRenderer &renderer,
+                              Slice<TextStyleInfo> &outStyles,
+                              Slice<u16> &outTextStyleIndex) {
+  alloc(arena, domTree.textData.length, outTextStyleIndex);
+
+  // The style of the text inside of each element. Parents precede their
+  // children in the tree, so a single sweep over the nodes is enough.
   ArenaTemp temp = getScratch(&arena, 1);
-  Vector<StackEntry> stack =
-      vectorWithInitialCapacity<StackEntry>(temp.arena, 256);
+  Vector<TextStyleInfo> styles = {};
+  Slice<u16> elementStyles;
+  alloc(temp.arena, domTree.elementData.length, elementStyles);
 
   TextStyleInfo defaultTextStyle = {{0, 0, 0, 1}, FontWeight::Normal, 16};
-  *append(temp.arena, &stack) = {domTree.idxHtmlNode, defaultTextStyle};
-
-  while (stack.length != 0) {
-    StackEntry cur = stack[stack.length - 1];
+  u16 idxDefaultStyle = internTextStyle(temp.arena, styles, defaultTextStyle);
 
-    stack.length--;
+  for (auto [node, _] : domTree.nodes) {
+    u16 idxParentStyle = idxDefaultStyle;
+    if (node.idxParent != DOM_INVALID_INDEX) {
+      idxParentStyle =
+          elementStyles[domTree.nodes[node.idxParent].idxElement];
+    }
 
-    DOM_Node &node = domTree.nodes[cur.idxNode];
     if (node.kind == DOM_NodeKind::Text) {
-      ret[node.idxText] = cur.textStyle;
+      outTextStyleIndex[node.idxText] = idxParentStyle;
     } else {
       DOM_ElementData &elemData = domTree.elementData[node.idxElement];
 
-      TextStyleInfo ownStyle = cur.textStyle;
+      u16 idxOwnStyle = idxParentStyle;
+      TextStyleInfo ownStyle = styles[idxParentStyle];
 
-      if (equalCaseInsensitive(elemData.name, TAG_H1)) {
-        ownStyle.fontSize = 2.0f * EM_SIZE;
-        ownStyle.fontWeight = FontWeight::Bold;
-      } else if (equalCaseInsensitive(elemData.name, TAG_H2)) {
-        ownStyle.fontSize = 1.5f * EM_SIZE;
-        ownStyle.fontWeight = FontWeight::Bold;
-      } else if (equalCaseInsensitive(elemData.name, TAG_H3)) {
-        ownStyle.fontSize = 1.17f * EM_SIZE;
+      u32 headingLevel = Tag_headingLevel(elemData.tag);
+      if (headingLevel != 0) {
+        ownStyle.fontSize = HEADING_SIZES[headingLevel - 1] * EM_SIZE;
         ownStyle.fontWeight = FontWeight::Bold;
-      } else if (equalCaseInsensitive(elemData.name, TAG_H4)) {
-        ownStyle.fontSize = 1.0f * EM_SIZE;
-        ownStyle.fontWeight = FontWeight::Bold;
-      } else if (equalCaseInsensitive(elemData.name, TAG_H5)) {
-        ownStyle.fontSize = 0.83f * EM_SIZE;
-        ownStyle.fontWeight = FontWeight::Bold;
-      } else if (equalCaseInsensitive(elemData.name, TAG_H6)) {
-        ownStyle.fontSize = 0.67f * EM_SIZE;
-        ownStyle.fontWeight = FontWeight::Bold;
-      } else if (equalCaseInsensitive(elemData.name, TAG_A)) {
+        idxOwnStyle = internTextStyle(temp.arena, styles, ownStyle);
+      } else if (elemData.tag == TagId::A) {
         ownStyle.color = {22 / 255.0f, 0, 233 / 255.0f, 1};
         // TODO(danielm): text-underline
+        idxOwnStyle = internTextStyle(temp.arena, styles, ownStyle);
       }
 
-      for (auto [idxChild, _] : node.children) {
-        *append(temp.arena, &stack) = {idxChild, ownStyle};
-      }
+      elementStyles[node.idxElement] = idxOwnStyle;
     }
   }
 
+  // Select fonts based on style; only the fonts picked here are loaded
+  alloc(arena, styles.length, outStyles);
+  for (u32 i = 0; i < outStyles.length; i++) {
+    outStyles[i] = styles[i];
+    outStyles[i].idxFont = findBestFont(renderer.fonts, outStyles[i].fontSize,
+                                        FontStyle::Normal,
+                                        outStyles[i].fontWeight);
+    PageRenderer_useFont(renderer, outStyles[i].idxFont);
+  }
+
   releaseScratch(temp);
+}
+
+struct TextMetrics {
+  // The words of the text node are words[idxFirstWord .. idxFirstWord +
+  // numWords)
+  u32 idxFirstWord;
+  u32 numWords;
+  b32 isWhitespaceOnly;
+};
 
-  // Select fonts based on style
-  for (u32 i = 0; i < ret.length; i++) {
-    ret[i].idxFont = findBestFont(availableFonts, ret[i].fontSize,
-                                  FontStyle::Normal, ret[i].fontWeight);
+/**
+ * The parts of the layout that don't depend on the size of the viewport. They
+ * are computed once per page and reused whenever the page is laid out again,
+ * e.g. after the window has been resized.
+ */
+struct PageLayoutCache {
+  // The distinct text styles of the page
+  Slice<TextStyleInfo> styles;
+
+  // Per text node
+  Slice<u16> textStyleIndex;
+  Slice<TextMetrics> textMetrics;
+  // The words of all text nodes, measured with their font
+  Slice<TextWord> words;
+
+  // The resolved href of each <a> element, in the order of
+  // DOM_Tree_elementsWithTag(TagId::A); empty if it has none
+  Slice<Slice<u8>> anchorHrefs;
+};
+
+/**
+ * Grows the parent of the node so that it contains the node. This is done
+ * once for every element, as soon as its size is final: for leaves when
+ * they are laid out and for the others when they are finalized. The parent
+ * is finalized in turn before any of its ancestors is looked at again, so
+ * the heights reach the root without walking up the tree.
+ *
+ * Text nodes are only accounted for when their parent is finalized.
+ */
+static void foldIntoParent(Slice<NodeLayoutInfo> nodeLayoutInfo,
+                           DOM_Node *node,
+                           u32 idxNode) {
+  if (node->idxParent == DOM_INVALID_INDEX) {
+    return;
   }
 
-  return ret;
+  NodeLayoutInfo &parentLayout = nodeLayoutInfo[node->idxParent];
+  f32 selfBottomY = bottomOf(nodeLayoutInfo[idxNode]);
+  parentLayout.size.y =
+      max(parentLayout.size.y, selfBottomY - parentLayout.position.y);
 }
 
-static void expandSizeOfAncestorBlocks(Slice<NodeLayoutInfo> nodeLayoutInfo,
-                                       DOM_Node *node,
-                                       u32 idxNode,
-                                       DOM_Tree &domTree) {
-  if (true) {
-    f32 selfBottomY = bottomOf(nodeLayoutInfo[idxNode]);
-    u32 idxAncestor = node->idxParent;
-    while (idxAncestor != DOM_INVALID_INDEX) {
-      NodeLayoutInfo &ancestorLayout = nodeLayoutInfo[idxAncestor];
-      DOM_Node &ancestorNode = domTree.nodes[idxAncestor];
-      DOM_ElementData &ancestorElemData =
-          domTree.elementData[ancestorNode.idxElement];
-
-      if (!DOM_isBlock(ancestorElemData)) {
-        // break;
-      }
+/**
+ * Called once all descendants of the node have been laid out.
+ */
+static void finalizeSize(Slice<NodeLayoutInfo> nodeLayoutInfo,
+                         DOM_Tree &domTree,
+                         u32 idxNode) {
+  DOM_Node *node = &domTree.nodes[idxNode];
+  NodeLayoutInfo &selfLayout = nodeLayoutInfo[idxNode];
+  for (u32 i = 0; i < node->children.length; i++) {
+    u32 idxChild = node->children[i];
+    f32 childHeight = bottomOf(nodeLayoutInfo[idxChild]) - selfLayout.position.y;
+    selfLayout.size.y = max(selfLayout.size.y, childHeight);
+  }
+  foldIntoParent(nodeLayoutInfo, node, idxNode);
+  if (node->idxParent != DOM_INVALID_INDEX) {
+    NodeLayoutInfo &parentLayout = nodeLayoutInfo[node->idxParent];
+    if (node->kind == DOM_NodeKind::Element &&
+        DOM_isBlock(domTree.elementData[node->idxElement])) {
+      parentLayout.lineBoxY = bottomOf(nodeLayoutInfo[idxNode]);
+    }
+  }
+}
 
-      f32 prev = ancestorLayout.size.y;
-      f32 selfBottomYInAncestorSpace = selfBottomY - ancestorLayout.position.y;
-      ancestorLayout.size.y =
-          max(ancestorLayout.size.y, selfBottomYInAncestorSpace);
+/**
+ * Finalizes the sizes of the nodes whose subtree ends with `idxLast`, from the
+ * innermost one outwards.
+ */
+static void finalizeSubtreesEndingAt(Slice<NodeLayoutInfo> nodeLayoutInfo,
+                                     DOM_Tree &domTree,
+                                     u32 idxLast) {
+  u32 idxAncestor = domTree.nodes[idxLast].idxParent;
+  while (idxAncestor != DOM_INVALID_INDEX &&
+         domTree.nodes[idxAncestor].idxLastDescendant == idxLast) {
+    finalizeSize(nodeLayoutInfo, domTree, idxAncestor);
+    idxAncestor = domTree.nodes[idxAncestor].idxParent;
+  }
+}
 
-      idxAncestor = ancestorNode.idxParent;
+/**
+ * Moves the current line of the inline elements that a text node is in, and
+ * of the block around them, down by `dy` after the text has been broken into
+ * more than one line.
+ */
+static void moveLineBoxDown(Slice<NodeLayoutInfo> nodeLayoutInfo,
+                            DOM_Tree &domTree,
+                            u32 idxNode,
+                            f32 dy) {
+  while (idxNode != DOM_INVALID_INDEX) {
+    NodeLayoutInfo &layoutInfo = nodeLayoutInfo[idxNode];
+    DOM_Node *node = &domTree.nodes[idxNode];
+    layoutInfo.lineBoxY += dy;
+    if (!DOM_isInline(domTree.elementData[node->idxElement])) {
+      // Blocks that come after the text are placed below all of its lines
+      layoutInfo.size.y += dy;
+      return;
     }
+    idxNode = node->idxParent;
   }
 }
 
+/**
+ * Lays out the page for the given viewport. The text nodes are broken into
+ * lines against the width of their parent; their lines are appended to
+ * `lineBoxes` in document order.
+ */
 static Slice<NodeLayoutInfo> doLayout(Arena *arena,
                                       PageRenderer &renderer,
                                       DOM_Tree &domTree,
                                       v2 viewportSize,
-                                      Slice<TextStyleInfo> textStyleInfo) {
+                                      PageLayoutCache &cache,
+                                      Slice<LineBox> &outLineBoxes) {
   Slice<NodeLayoutInfo> nodeLayoutInfo;
   alloc(arena, domTree.nodes.length, nodeLayoutInfo);
-
-  struct LayoutStackEntry {
-    u32 idxNode;
-    u32 idxParentNode;
-    b32 finalizeSize;
-  };
-
-  ArenaTemp temp = getScratch(&arena, 1);
-  Vector<LayoutStackEntry> queue =
-      vectorWithInitialCapacity<LayoutStackEntry>(temp.arena, 256);
-  *append(temp.arena, &queue) = {domTree.idxHtmlNode, DOM_INVALID_INDEX};
+  Vector<LineBox> lineBoxes = {};
 
   f32 xCursor = 0;
   f32 lineBoxHeight = 0;
-  b32 lastTextEndedWithWhitespace = false;
-
-  while (queue.length > 0) {
-    LayoutStackEntry &top = queue[queue.length - 1];
-
-    auto [idxNode, idxParentNode, finalizeSize] = top;
-    DOM_Node *node = &domTree.nodes[idxNode];
-
-    queue.length--;
-    DOM_Node *parentNode = nullptr;
 
-    if (idxParentNode != DOM_INVALID_INDEX) {
-      parentNode = &domTree.nodes[idxParentNode];
+  // The nodes are in pre-order, so this visits them in document order
+  u32 numNodes = domTree.nodes.length;
+  for (u32 idxNode = 0; idxNode < numNodes; idxNode++) {
+    if (idxNode != 0) {
+      finalizeSubtreesEndingAt(nodeLayoutInfo, domTree, idxNode - 1);
     }
 
-    if (finalizeSize) {
-      NodeLayoutInfo &selfLayout = nodeLayoutInfo[idxNode];
-      for (u32 i = 0; i < node->children.length; i++) {
-        u32 idxChild = node->children[i];
-        f32 childHeight =
-            bottomOf(nodeLayoutInfo[idxChild]) - selfLayout.position.y;
-        selfLayout.size.y = max(selfLayout.size.y, childHeight);
-      }
-      expandSizeOfAncestorBlocks(nodeLayoutInfo, node, idxNode, domTree);
-      if (idxParentNode != DOM_INVALID_INDEX) {
-        NodeLayoutInfo &parentLayout = nodeLayoutInfo[idxParentNode];
-        DOM_ElementData &parentElemData =
-            domTree.elementData[parentNode->idxElement];
-        if (node->kind == DOM_NodeKind::Element &&
-            DOM_isBlock(domTree.elementData[node->idxElement])) {
-          parentLayout.lineBoxY = bottomOf(nodeLayoutInfo[idxNode]);
-        }
-      }
-      continue;
-    }
+    DOM_Node *node = &domTree.nodes[idxNode];
+    u32 idxParentNode = node->idxParent;
 
     b32 isPrevElemBlock = false;
     b32 isPrevElemInline = false;
@@ -527,9 +1506,6 @@ static Slice<NodeLayoutInfo> doLayout(Arena *arena,
       DCHECK(node->children.length == 0);
       DCHECK(idxNode != idxParentNode);
 
-      b32 addWhitespace = !lastTextEndedWithWhitespace;
-      lastTextEndedWithWhitespace = true;
-
       NodeLayoutInfo &parentLayoutInfo = nodeLayoutInfo[idxParentNode];
       if (parentLayoutInfo.size.x <= 0) {
         continue;
@@ -543,56 +1519,61 @@ static Slice<NodeLayoutInfo> doLayout(Arena *arena,
       f32 lineBoxY = parentLayoutInfo.lineBoxY;
 
       DOM_TextData &textData = domTree.textData[node->idxText];
-      TextStyleInfo textStyle = textStyleInfo[node->idxText];
+      TextStyleInfo &textStyle =
+          cache.styles[cache.textStyleIndex[node->idxText]];
+      TextMetrics &metrics = cache.textMetrics[node->idxText];
       Font *font = &renderer.fonts[textStyle.idxFont];
 
       if (textData.contents.length == 0) {
         continue;
       }
 
-      b32 whitespaceOnly = true;
-      for (u32 i = 0; i < textData.contents.length; i++) {
-        if (!HTML_isWhitespace(textData.contents[i])) {
-          whitespaceOnly = false;
-          break;
-        }
-      }
-
-      if (whitespaceOnly) {
+      if (metrics.isWhitespaceOnly) {
         nodeLayoutInfo[idxNode].size = {0, 0};
         continue;
       }
 
-      lastTextEndedWithWhitespace =
-          HTML_isWhitespace(textData.contents[textData.contents.length - 1]);
-
-      v2 size;
-      v2 start = {xCursor, parentLayoutInfo.size.y};
-      // Measure text size
+      f32 lineHeight = -font->size;
+      f32 x0 = parentLayoutInfo.position.x;
+      f32 x1 = parentLayoutInfo.position.x + parentLayoutInfo.size.x;
+      lineBoxHeight = max(lineBoxHeight, lineHeight);
+
+      // Fill the lines greedily with the words, starting where the inline
+      // content before this node ended. A word that doesn't fit goes on the
+      // next line unless it is the first one on its line.
+      NodeLayoutInfo &layoutInfo = nodeLayoutInfo[idxNode];
+      layoutInfo.idxFirstLine = lineBoxes.length;
+      f32 y = lineBoxY;
+      LineBox line = {{xCursor, y}, 0, 0};
+      for (u32 i = 0; i < metrics.numWords; i++) {
+        TextWord &word = cache.words[metrics.idxFirstWord + i];
+        if (xCursor + word.advance > x1 && xCursor > x0) {
+          if (line.length != 0) {
+            *append(arena, &lineBoxes) = line;
+          }
+          y += lineHeight;
+          xCursor = x0;
+          line = {{xCursor, y}, word.offset, 0};
+        }
 
-      if (addWhitespace) {
-        Font_measureText(font, SLICE_FROM_STRLIT(" "),
-                         parentLayoutInfo.position.x,
-                         parentLayoutInfo.position.x + parentLayoutInfo.size.x,
-                         start, &size, &xCursor);
+        line.length = word.offset + word.length - line.offset;
+        xCursor += word.advanceWithSpace;
       }
+      *append(arena, &lineBoxes) = line;
+      layoutInfo.numLines = lineBoxes.length - layoutInfo.idxFirstLine;
 
-      Font_measureText(font, textData.contents, parentLayoutInfo.position.x,
-                       parentLayoutInfo.position.x + parentLayoutInfo.size.x,
-                       start, &size, &xCursor);
-      lineBoxHeight = max(lineBoxHeight, size.y + -font->size);
+      LineBox &firstLine = lineBoxes[layoutInfo.idxFirstLine];
+      layoutInfo.size.x = 0;
+      layoutInfo.size.y = y - firstLine.position.y + lineHeight;
+      DCHECK(layoutInfo.size.y >= 0);
+      layoutInfo.position = firstLine.position;
 
-      nodeLayoutInfo[idxNode].size.x = 0;
-      nodeLayoutInfo[idxNode].size.y = size.y + -font->size;
-      DCHECK(nodeLayoutInfo[idxNode].size.y >= 0);
-      nodeLayoutInfo[idxNode].position.x = start.x;
-      nodeLayoutInfo[idxNode].position.y = lineBoxY;
+      layoutInfo.parentX0 = x0;
+      layoutInfo.parentX1 = x1;
 
-      parentLayoutInfo.lineBoxY += size.y;
-
-      nodeLayoutInfo[idxNode].parentX0 = parentLayoutInfo.position.x;
-      nodeLayoutInfo[idxNode].parentX1 =
-          parentLayoutInfo.position.x + parentLayoutInfo.size.x;
+      if (y > lineBoxY) {
+        moveLineBoxDown(nodeLayoutInfo, domTree, idxParentNode, y - lineBoxY);
+      }
     } else {
       DCHECK(idxNode != idxParentNode);
 
@@ -607,10 +1588,10 @@ static Slice<NodeLayoutInfo> doLayout(Arena *arena,
         if (isPrevElemBlock) {
           xCursor = parentLayoutInfo.position.x;
         }
-      } else if (equalCaseInsensitiveLit(elemData.name, "html")) {
+      } else if (elemData.tag == TagId::Html) {
         nodeLayoutInfo[domTree.idxHtmlNode].position = {0, 0};
         nodeLayoutInfo[domTree.idxHtmlNode].size = {viewportSize.x, 0};
-      } else if (equalCaseInsensitiveLit(elemData.name, "title")) {
+      } else if (elemData.tag == TagId::Title) {
         nodeLayoutInfo[idxNode].position = {0, 0};
         nodeLayoutInfo[idxNode].size = {0, 0};
       } else {
@@ -624,20 +1605,8 @@ static Slice<NodeLayoutInfo> doLayout(Arena *arena,
         isBlock = true;
       }
 
-      expandSizeOfAncestorBlocks(nodeLayoutInfo, node, idxNode, domTree);
-
-      // Push children into the queue in reverse order so that they'll be
-      // processed in order
-      for (u32 i = node->children.length - 1; i < node->children.length; i--) {
-        u32 idxChild = node->children[i];
-        DCHECK(idxChild != DOM_INVALID_INDEX);
-        DCHECK(idxChild < domTree.nodes.length);
-        // b32 lastChild = i == 0;
-        b32 finalizeSize = i == node->children.length - 1;
-        if (finalizeSize) {
-          *append(temp.arena, &queue) = {idxNode, idxParentNode, finalizeSize};
-        }
-        *append(temp.arena, &queue) = {idxChild, idxNode, false};
+      if (node->children.length == 0) {
+        foldIntoParent(nodeLayoutInfo, node, idxNode);
       }
     }
 
@@ -645,10 +1614,297 @@ static Slice<NodeLayoutInfo> doLayout(Arena *arena,
     DCHECK(nodeLayoutInfo[idxNode].size.y >= 0);
   }
 
-  releaseScratch(temp);
+  if (numNodes != 0) {
+    finalizeSubtreesEndingAt(nodeLayoutInfo, domTree, numNodes - 1);
+  }
+
+  outLineBoxes = {lineBoxes.data, lineBoxes.length};
   return nodeLayoutInfo;
 }
 
+// Text is turned into meshes in horizontal bands of the page of this height,
+// and only for the bands around the viewport
+static const f32 TEXT_TILE_HEIGHT = 512;
+// How far above and below the viewport the bands are kept ready, so that
+// scrolling doesn't have to wait for them
+static const f32 TEXT_TILE_PREFETCH = 512;
+
+// How long an idle window sleeps before it checks whether it can draw again
+static const u32 IDLE_WAIT_MS = 500;
+
+// A line box and the text node that it belongs to
+struct TextRun {
+  u32 idxText;
+  u32 idxLine;
+};
+
+/**
+ * The line boxes of a page bucketed by the band that their top is in. The
+ * runs of band `i` are runs[idxFirstRun[i] .. idxFirstRun[i + 1]), in
+ * document order.
+ */
+struct TextTileIndex {
+  Slice<u32> idxFirstRun;
+  Slice<TextRun> runs;
+};
+
+static void TextTileIndex_init(TextTileIndex *self,
+                               Arena *arena,
+                               DOM_Tree &domTree,
+                               Slice<NodeLayoutInfo> nodeLayoutInfo,
+                               Slice<LineBox> lineBoxes) {
+  u32 numTiles = 0;
+  for (auto [line, _] : lineBoxes) {
+    numTiles = max(numTiles, (u32)(line.position.y / TEXT_TILE_HEIGHT) + 1);
+  }
+
+  // Counting sort by band; the line boxes are already in document order
+  alloc(arena, numTiles + 1, self->idxFirstRun);
+  for (auto [line, _] : lineBoxes) {
+    self->idxFirstRun[(u32)(line.position.y / TEXT_TILE_HEIGHT) + 1]++;
+  }
+  for (u32 i = 1; i <= numTiles; i++) {
+    self->idxFirstRun[i] += self->idxFirstRun[i - 1];
+  }
+
+  ArenaTemp temp = getScratch(&arena, 1);
+  Slice<u32> idxNextRun;
+  alloc(temp.arena, numTiles, idxNextRun);
+  memcpy(idxNextRun.data, self->idxFirstRun.data, numTiles * sizeof(u32));
+
+  alloc(arena, lineBoxes.length, self->runs);
+  for (auto [text, idxText] : domTree.textData) {
+    NodeLayoutInfo &layoutInfo = nodeLayoutInfo[text.idxNode];
+    for (u32 i = 0; i < layoutInfo.numLines; i++) {
+      u32 idxLine = layoutInfo.idxFirstLine + i;
+      u32 idxTile = (u32)(lineBoxes[idxLine].position.y / TEXT_TILE_HEIGHT);
+      self->runs[idxNextRun[idxTile]++] = {idxText, idxLine};
+    }
+  }
+
+  releaseScratch(temp);
+}
+
+static u32 TextTileIndex_numTiles(TextTileIndex *self) {
+  return self->idxFirstRun.length != 0 ? self->idxFirstRun.length - 1 : 0;
+}
+
+static_assert(GLYPH_ATLAS_MAX_PAGES <= 32,
+              "TextTile::usedPages has a bit for each page of the atlas");
+
+/**
+ * The mesh of one band of the page. It holds the text of every font, since
+ * they all share the glyph atlas.
+ */
+struct TextTile {
+  b32 isLoaded;
+  u32 idxTile;
+  // Null if there is no text in the band
+  GPU_Mesh mesh;
+  // Bit `i` is set if the mesh uses page `i` of the glyph atlas
+  u32 usedPages;
+
+  // Holds the handle of the mesh; it is emptied whenever the tile is
+  // unloaded, so streaming bands in and out doesn't grow the page arena
+  Arena arena;
+  Arena arenaEmpty;
+};
+
+static void TextTile_init(TextTile *self, Arena *arena) {
+  const u32 SIZ_ARENA = 4 * 1024;
+  self->arenaEmpty.beg = alloc<u8>(arena, SIZ_ARENA);
+  self->arenaEmpty.end = self->arenaEmpty.beg + SIZ_ARENA;
+}
+
+static void TextTile_load(TextTile *self,
+                          PageRenderer &renderer,
+                          DOM_Tree &domTree,
+                          PageLayoutCache &cache,
+                          Slice<LineBox> lineBoxes,
+                          TextTileIndex &index,
+                          u32 idxTile) {
+  self->isLoaded = true;
+  self->idxTile = idxTile;
+  self->arena = self->arenaEmpty;
+
+  ArenaTemp temp = getScratch(nullptr, 0);
+  Vector<GPU_GlyphInstance> glyphs = {};
+  self->usedPages = 0;
+
+  for (u32 i = index.idxFirstRun[idxTile]; i < index.idxFirstRun[idxTile + 1];
+       i++) {
+    TextRun &run = index.runs[i];
+    TextStyleInfo &style = cache.styles[cache.textStyleIndex[run.idxText]];
+    Font *font = &renderer.fonts[style.idxFont];
+    TextMetrics &metrics = cache.textMetrics[run.idxText];
+    Font_drawText(font, &renderer.atlas, temp.arena, glyphs, self->usedPages,
+                  domTree.textData[run.idxText].contents,
+                  {cache.words.data + metrics.idxFirstWord, metrics.numWords},
+                  {&lineBoxes[run.idxLine], 1}, style.color);
+  }
+
+  self->mesh = nullptr;
+  if (glyphs.length != 0) {
+    // The GPU keeps its own copy, so the scratch arena is enough here
+    GPU_MeshDesc meshDesc = {};
+    meshDesc.glyphs = {glyphs.data, glyphs.length};
+    GPU_createMesh(renderer.gpu, &self->arena, &meshDesc, &self->mesh);
+  }
+
+  releaseScratch(temp);
+}
+
+static void TextTile_unload(TextTile *self, PageRenderer &renderer) {
+  if (!self->isLoaded) {
+    return;
+  }
+
+  if (self->mesh) {
+    GPU_destroyMesh(renderer.gpu, self->mesh);
+    self->mesh = nullptr;
+  }
+  self->isLoaded = false;
+}
+
+/**
+ * Makes sure that exactly the bands that overlap [y0, y1) are loaded, reusing
+ * the ones that already are. Called once per frame.
+ */
+static void updateTextTiles(Slice<TextTile> tiles,
+                            PageRenderer &renderer,
+                            DOM_Tree &domTree,
+                            PageLayoutCache &cache,
+                            Slice<LineBox> lineBoxes,
+                            TextTileIndex &index,
+                            f32 y0,
+                            f32 y1) {
+  u32 numTiles = TextTileIndex_numTiles(&index);
+  u32 idxFirst = (u32)(max(y0, 0.0f) / TEXT_TILE_HEIGHT);
+  u32 idxLimit = min((u32)(max(y1, 0.0f) / TEXT_TILE_HEIGHT) + 1, numTiles);
+
+  GlyphAtlas_beginFrame(&renderer.atlas);
+
+  for (auto [tile, _] : tiles) {
+    if (tile.isLoaded &&
+        (tile.idxTile < idxFirst || tile.idxTile >= idxLimit)) {
+      TextTile_unload(&tile, renderer);
+    }
+  }
+
+  // The glyphs of the bands that stay loaded must not be evicted to make room
+  // for the new ones
+  for (auto [tile, _] : tiles) {
+    if (!tile.isLoaded) {
+      continue;
+    }
+    for (u32 idxPage = 0; idxPage < GLYPH_ATLAS_MAX_PAGES; idxPage++) {
+      if (tile.usedPages & (1u << idxPage)) {
+        GlyphAtlas_touchPage(&renderer.atlas, idxPage);
+      }
+    }
+  }
+
+  for (u32 idxTile = idxFirst; idxTile < idxLimit; idxTile++) {
+    TextTile *free = nullptr;
+    b32 isLoaded = false;
+    for (auto [tile, _] : tiles) {
+      if (tile.isLoaded && tile.idxTile == idxTile) {
+        isLoaded = true;
+        break;
+      }
+      if (!tile.isLoaded && !free) {
+        free = &tile;
+      }
+    }
+
+    if (!isLoaded) {
+      CHECK(free);
+      TextTile_load(free, renderer, domTree, cache, lineBoxes, index, idxTile);
+    }
+  }
+
+  GlyphAtlas_uploadGlyphs(&renderer.atlas);
+}
+
+/**
+ * Allocates enough tiles to cover the viewport and the prefetched bands
+ * around it, wherever their edges fall.
+ */
+static Slice<TextTile> allocTextTiles(Arena *arena, f32 viewportHeight) {
+  u32 numTextTiles =
+      (u32)((viewportHeight + 2 * TEXT_TILE_PREFETCH) / TEXT_TILE_HEIGHT) + 2;
+  Slice<TextTile> textTiles;
+  alloc(arena, numTextTiles, textTiles);
+  for (auto [tile, _] : textTiles) {
+    TextTile_init(&tile, arena);
+  }
+  return textTiles;
+}
+
+/**
+ * Loads the bands around the viewport and records the commands that draw the
+ * page scrolled down by `documentYOffset`. The commands are allocated in
+ * `arena`.
+ */
+static Slice<GPU_RenderCmd> recordPage(Arena *arena,
+                                       PageRenderer &renderer,
+                                       DOM_Tree &domTree,
+                                       PageLayoutCache &cache,
+                                       Slice<LineBox> lineBoxes,
+                                       TextTileIndex &index,
+                                       Slice<TextTile> tiles,
+                                       v2 viewportSize,
+                                       f32 documentYOffset) {
+  Vector<GPU_RenderCmd> renderCmds = {};
+
+  GPU_RenderCmd *setView = append(arena, &renderCmds);
+  setView->kind = GPU_CmdKind::SetView;
+  setView->setView.projection = mat4x4_id();
+
+  f32 l = 0;
+  f32 r = viewportSize.x;
+  f32 t = documentYOffset;
+  f32 b = viewportSize.y + documentYOffset;
+  setView->setView.projection.c0.x = 2.0f / (r - l);
+  setView->setView.projection.c1.y = 2.0f / (t - b);
+  setView->setView.projection.c2.z = 1.0f;
+  setView->setView.projection.c3.x = -(r + l) / (r - l);
+  setView->setView.projection.c3.y = -(t + b) / (t - b);
+  setView->setView.projection.c3.z = 0;
+
+  updateTextTiles(tiles, renderer, domTree, cache, lineBoxes, index,
+                  t - TEXT_TILE_PREFETCH, b + TEXT_TILE_PREFETCH);
+
+  if (renderer.atlas.image) {
+    GPU_RenderCmd *bindImage = append(arena, &renderCmds);
+    bindImage->kind = GPU_CmdKind::BindImage;
+    bindImage->bindImage.image = renderer.atlas.image;
+    bindImage->bindImage.colorSpace = GCS_Linear;
+
+    GPU_RenderCmd *bindGlyphTable = append(arena, &renderCmds);
+    bindGlyphTable->kind = GPU_CmdKind::BindGlyphTable;
+    bindGlyphTable->bindGlyphTable.table = renderer.atlas.glyphTable;
+  }
+
+  // NOTE: the prefetched tiles are drawn as well; they are clipped, and there
+  // are only ever a few of them
+  for (auto [tile, _] : tiles) {
+    if (!tile.isLoaded || !tile.mesh) {
+      continue;
+    }
+
+    GPU_RenderCmd *bindMesh = append(arena, &renderCmds);
+    bindMesh->kind = GPU_CmdKind::BindMesh;
+    bindMesh->bindMesh.mesh = tile.mesh;
+
+    GPU_RenderCmd *draw = append(arena, &renderCmds);
+    draw->kind = GPU_CmdKind::RenderInstance;
+    draw->renderInstance = {};
+  }
+
+  return copyToSlice(arena, renderCmds);
+}
+
 struct InteractiveElement {
   v2 position;
   v2 size;
@@ -686,90 +1942,504 @@ static Slice<u8> joinPaths(Arena *arena, Slice<u8> left, Slice<u8> right) {
       shrinkFromLeft(&curRight);
     }
   }
-
-  *append(temp.arena, &cur) = '\0';
-
-  Slice<u8> ret = copyToSlice(arena, cur);
-  releaseScratch(temp);
-  return ret;
+
+  *append(temp.arena, &cur) = '\0';
+
+  Slice<u8> ret = copyToSlice(arena, cur);
+  releaseScratch(temp);
+  return ret;
+}
+
+static Slice<u8> joinUrls(Arena *arena, Slice<u8> base, Slice<u8> rel) {
+  ArenaTemp temp = getScratch(&arena, 1);
+
+  Url right;
+  if (Url_initFromString(&right, temp.arena, rel)) {
+    // The right-hand side is a complete url
+    releaseScratch(temp);
+    return duplicate(arena, rel);
+  }
+  resetScratch(temp);
+
+  Url left;
+  if (!Url_initFromString(&left, temp.arena, base)) {
+    // Pages that were read from a file have nothing to resolve against
+    releaseScratch(temp);
+    return duplicate(arena, rel);
+  }
+
+  Slice<u8> combinedPath = joinPaths(temp.arena, left.path, rel);
+
+  left.path = combinedPath;
+  Slice<u8> ret = Url_format(arena, &left);
+
+  releaseScratch(temp);
+  return ret;
+}
+
+// The text is measured in chunks of at least this many bytes
+static const u32 MIN_MEASURE_CHUNK_SIZE = 64 * 1024;
+static const u32 MAX_MEASURE_CHUNKS = 64;
+
+/**
+ * Finds the end of the word that starts at `idxStart`. Returns the index
+ * after the whitespace that follows it.
+ */
+static u32 findEndOfWord(Slice<u8> contents, u32 idxStart, u32 &idxEndOfWord) {
+  u32 idxChar = idxStart;
+  while (idxChar < contents.length && !HTML_isWhitespace(contents[idxChar])) {
+    idxChar++;
+  }
+  idxEndOfWord = idxChar;
+  while (idxChar < contents.length && HTML_isWhitespace(contents[idxChar])) {
+    idxChar++;
+  }
+  return idxChar;
+}
+
+struct TextMeasureChunk {
+  u32 idxFirstText;
+  u32 idxLimitText;
+};
+
+/**
+ * The text nodes are measured in two parallel passes: the first one counts
+ * the words of every text node so that each of them knows where its words go,
+ * the second one measures the words into place. Neither allocates.
+ */
+struct TextMeasureJob {
+  Slice<Font> fonts;
+  DOM_Tree *domTree;
+  PageLayoutCache *cache;
+  Slice<TextMeasureChunk> chunks;
+};
+
+static void countWordsTask(void *user, u32 idxChunk) {
+  TextMeasureJob *J = (TextMeasureJob *)user;
+  TextMeasureChunk &chunk = J->chunks[idxChunk];
+  for (u32 idxText = chunk.idxFirstText; idxText < chunk.idxLimitText;
+       idxText++) {
+    Slice<u8> contents = J->domTree->textData[idxText].contents;
+    TextMetrics &metrics = J->cache->textMetrics[idxText];
+    metrics.isWhitespaceOnly = true;
+
+    u32 idxChar = 0;
+    while (idxChar < contents.length) {
+      u32 idxStart = idxChar;
+      u32 idxEndOfWord;
+      idxChar = findEndOfWord(contents, idxStart, idxEndOfWord);
+      if (idxEndOfWord != idxStart) {
+        metrics.isWhitespaceOnly = false;
+      }
+      metrics.numWords++;
+    }
+  }
+}
+
+static void measureWordsTask(void *user, u32 idxChunk) {
+  TextMeasureJob *J = (TextMeasureJob *)user;
+  TextMeasureChunk &chunk = J->chunks[idxChunk];
+  for (u32 idxText = chunk.idxFirstText; idxText < chunk.idxLimitText;
+       idxText++) {
+    Slice<u8> contents = J->domTree->textData[idxText].contents;
+    TextMetrics &metrics = J->cache->textMetrics[idxText];
+    u16 idxStyle = J->cache->textStyleIndex[idxText];
+    Font *font = &J->fonts[J->cache->styles[idxStyle].idxFont];
+    TextWord *words = J->cache->words.data + metrics.idxFirstWord;
+
+    u32 idxChar = 0;
+    for (u32 idxWord = 0; idxWord < metrics.numWords; idxWord++) {
+      u32 idxStart = idxChar;
+      u32 idxEndOfWord;
+      idxChar = findEndOfWord(contents, idxStart, idxEndOfWord);
+
+      TextWord &word = words[idxWord];
+      word.offset = idxStart;
+      word.length = idxChar - idxStart;
+      word.advance = Font_measureAdvance(
+          font, {contents.data + idxStart, idxEndOfWord - idxStart});
+      // Only the whitespace is measured again, along with the kerning
+      // around it
+      word.advanceWithSpace = word.advance;
+      if (idxStart != idxEndOfWord && idxEndOfWord < contents.length) {
+        u32 lastCodepoint = decodeLastUtf8(
+            {contents.data + idxStart, idxEndOfWord - idxStart});
+        word.advanceWithSpace +=
+            Font_getKerning(font, lastCodepoint, contents[idxEndOfWord]);
+      }
+      for (u32 i = idxEndOfWord; i < idxChar; i++) {
+        word.advanceWithSpace += Font_getAdvance(font, contents, i);
+      }
+    }
+  }
 }
 
-static Slice<u8> joinUrls(Arena *arena, Slice<u8> base, Slice<u8> rel) {
+/**
+ * Splits the text nodes into words and measures them with the font of their
+ * node. Only depends on the styles of the text, so the nodes are spread
+ * across all cores.
+ */
+static void measureTextNodes(PageLayoutCache *self,
+                             Arena *arena,
+                             PageRenderer &renderer,
+                             DOM_Tree &domTree,
+                             u32 maxChunks) {
   ArenaTemp temp = getScratch(&arena, 1);
+  Slice<DOM_TextData> texts = domTree.textData;
+  alloc(arena, texts.length, self->textMetrics);
 
-  Url right;
-  if (Url_initFromString(&right, temp.arena, rel)) {
-    // The right-hand side is a complete url
-    releaseScratch(temp);
-    return duplicate(arena, rel);
+  // The text is part of the source, so its length fits
+  u32 numBytes = 0;
+  for (auto [text, _] : texts) {
+    numBytes += text.contents.length;
   }
-  resetScratch(temp);
+  u32 numChunks = min(min(os_get_num_cores(), numBytes / MIN_MEASURE_CHUNK_SIZE),
+                      maxChunks);
+  numChunks = max(numChunks, 1u);
+
+  // Split the nodes so that every chunk has about the same number of bytes.
+  // Chunks that get no nodes stay empty.
+  TextMeasureJob J = {renderer.fonts, &domTree, self, {}};
+  alloc(temp.arena, numChunks, J.chunks);
+  u32 numBytesBefore = 0;
+  u32 idxChunk = 0;
+  for (auto [text, idxText] : texts) {
+    u32 numBytesTarget = (u32)((u64)numBytes * (idxChunk + 1) / numChunks);
+    if (idxChunk + 1 < numChunks && numBytesBefore >= numBytesTarget) {
+      J.chunks[idxChunk].idxLimitText = idxText;
+      idxChunk++;
+      J.chunks[idxChunk].idxFirstText = idxText;
+    }
+    numBytesBefore += text.contents.length;
+  }
+  J.chunks[idxChunk].idxLimitText = texts.length;
 
-  Url left;
-  Url_initFromString(&left, temp.arena, base);
+  os_parallel_for(numChunks, countWordsTask, &J);
 
-  Slice<u8> combinedPath = joinPaths(temp.arena, left.path, rel);
+  u32 numWords = 0;
+  for (auto [metrics, _] : self->textMetrics) {
+    metrics.idxFirstWord = numWords;
+    numWords += metrics.numWords;
+  }
+  alloc(arena, numWords, self->words);
 
-  left.path = combinedPath;
-  Slice<u8> ret = Url_format(arena, &left);
+  os_parallel_for(numChunks, measureWordsTask, &J);
 
   releaseScratch(temp);
-  return ret;
+}
+
+static void PageLayoutCache_init(PageLayoutCache *self,
+                                 Arena *arena,
+                                 PageRenderer &renderer,
+                                 DOM_Tree &domTree,
+                                 Slice<u8> location) {
+  computeTextStyles(arena, domTree, renderer, self->styles,
+                    self->textStyleIndex);
+
+  measureTextNodes(self, arena, renderer, domTree, MAX_MEASURE_CHUNKS);
+
+  // Both lists are in document order, so the href of each anchor can be found
+  // by walking them in lockstep
+  Slice<u32> anchors = DOM_Tree_elementsWithTag(&domTree, TagId::A);
+  Slice<DOM_AttributeEntry> hrefs =
+      DOM_Tree_elementsWithAttribute(&domTree, DOM_AttrId::Href);
+  u32 idxHref = 0;
+
+  alloc(arena, anchors.length, self->anchorHrefs);
+  for (auto [idxElement, idxAnchor] : anchors) {
+    while (idxHref < hrefs.length && hrefs[idxHref].idxElement < idxElement) {
+      idxHref++;
+    }
+
+    if (idxHref < hrefs.length && hrefs[idxHref].idxElement == idxElement) {
+      self->anchorHrefs[idxAnchor] =
+          joinUrls(arena, location, hrefs[idxHref].value);
+    }
+  }
 }
 
 static Slice<InteractiveElement> getInteractiveElements(
     Arena *arena,
-    Slice<u8> &location,
     Slice<NodeLayoutInfo> layoutInfo,
-    DOM_Tree &domTree) {
-  ArenaTemp temp = getScratch(&arena, 1);
-  Vector<InteractiveElement> elems;
+    DOM_Tree &domTree,
+    PageLayoutCache &cache) {
+  Slice<u32> anchors = DOM_Tree_elementsWithTag(&domTree, TagId::A);
+
+  Slice<InteractiveElement> ret;
+  alloc(arena, anchors.length, ret);
+  for (auto [idxElement, idxAnchor] : anchors) {
+    DOM_ElementData &elemData = domTree.elementData[idxElement];
+    InteractiveElement &ie = ret[idxAnchor];
+    ie.position = layoutInfo[elemData.idxNode].position;
+    ie.size = layoutInfo[elemData.idxNode].size;
+    ie.href = cache.anchorHrefs[idxAnchor];
+  }
+
+  return ret;
+}
+
+static b32 contains(InteractiveElement &elem, v2 pos) {
+  return elem.position.x <= pos.x && pos.x <= elem.position.x + elem.size.x &&
+         elem.position.y <= pos.y && pos.y <= elem.position.y + elem.size.y;
+}
 
-  for (u32 i = 0; i < domTree.elementData.length; i++) {
-    DOM_ElementData &elemData = domTree.elementData[i];
-    if (equalCaseInsensitive(elemData.name, TAG_A)) {
-      InteractiveElement *ie = append(temp.arena, &elems);
+// Interactive elements are bucketed into square cells of this size
+static const f32 HIT_GRID_CELL_SIZE = 128;
+// The grid never has more cells than this; on pages that are larger than it
+// covers, the cells are made larger instead
+static const u32 HIT_GRID_MAX_CELLS = 64 * 1024;
+
+/**
+ * A uniform grid over the interactive elements of a page, so that a point is
+ * only tested against the elements whose bounds touch its cell. The elements
+ * of cell `i` (in row-major order) are
+ * elements[idxFirstElement[i] .. idxFirstElement[i + 1]), in the same order
+ * as in the list that the grid was built from.
+ */
+struct HitGrid {
+  f32 cellSize;
+  u32 numColumns;
+  u32 numRows;
+  Slice<u32> idxFirstElement;
+  Slice<u32> elements;
+};
 
-      ie->position = layoutInfo[elemData.idxNode].position;
-      ie->size = layoutInfo[elemData.idxNode].size;
+static u32 cellCoordinate(f32 pos, f32 cellSize, u32 numCells) {
+  if (pos <= 0) {
+    return 0;
+  }
+  return (u32)min(pos / cellSize, (f32)(numCells - 1));
+}
 
-      b32 foundHref = false;
+/**
+ * Returns the range of cells covered by the element, inclusive.
+ */
+static void HitGrid_getCells(HitGrid *self,
+                             InteractiveElement &elem,
+                             u32 &x0,
+                             u32 &y0,
+                             u32 &x1,
+                             u32 &y1) {
+  f32 cellSize = self->cellSize;
+  x0 = cellCoordinate(elem.position.x, cellSize, self->numColumns);
+  y0 = cellCoordinate(elem.position.y, cellSize, self->numRows);
+  x1 = cellCoordinate(elem.position.x + elem.size.x, cellSize,
+                      self->numColumns);
+  y1 = cellCoordinate(elem.position.y + elem.size.y, cellSize, self->numRows);
+}
 
-      for (auto [attr, _] : elemData.attributes) {
-        if (equalCaseInsensitiveLit(attr.name, "href")) {
-          ie->href = joinUrls(arena, location, attr.value);
-          foundHref = true;
-          break;
-        }
+static void HitGrid_init(HitGrid *self,
+                         Arena *arena,
+                         Slice<InteractiveElement> elems) {
+  f32 width = 0;
+  f32 height = 0;
+  for (auto [elem, _] : elems) {
+    width = max(width, elem.position.x + elem.size.x);
+    height = max(height, elem.position.y + elem.size.y);
+  }
+
+  // Counted in floats, as the number of cells can overflow a u32 before the
+  // cells are grown
+  f32 cellSize = HIT_GRID_CELL_SIZE;
+  while ((floorf(width / cellSize) + 1) * (floorf(height / cellSize) + 1) >
+         HIT_GRID_MAX_CELLS) {
+    cellSize *= 2;
+  }
+  self->cellSize = cellSize;
+  self->numColumns = (u32)(width / cellSize) + 1;
+  self->numRows = (u32)(height / cellSize) + 1;
+  u32 numCells = self->numColumns * self->numRows;
+
+  // Counting sort by cell; an element is in every cell that it touches
+  alloc(arena, numCells + 1, self->idxFirstElement);
+  for (auto [elem, _] : elems) {
+    u32 x0, y0, x1, y1;
+    HitGrid_getCells(self, elem, x0, y0, x1, y1);
+    for (u32 y = y0; y <= y1; y++) {
+      for (u32 x = x0; x <= x1; x++) {
+        self->idxFirstElement[y * self->numColumns + x + 1]++;
       }
+    }
+  }
+  for (u32 i = 1; i <= numCells; i++) {
+    self->idxFirstElement[i] += self->idxFirstElement[i - 1];
+  }
+
+  ArenaTemp temp = getScratch(&arena, 1);
+  Slice<u32> idxNextElement;
+  alloc(temp.arena, numCells, idxNextElement);
+  memcpy(idxNextElement.data, self->idxFirstElement.data,
+         numCells * sizeof(u32));
 
-      if (!foundHref) {
-        ie->href = {nullptr, 0};
+  alloc(arena, self->idxFirstElement[numCells], self->elements);
+  for (auto [elem, idxElem] : elems) {
+    u32 x0, y0, x1, y1;
+    HitGrid_getCells(self, elem, x0, y0, x1, y1);
+    for (u32 y = y0; y <= y1; y++) {
+      for (u32 x = x0; x <= x1; x++) {
+        self->elements[idxNextElement[y * self->numColumns + x]++] = idxElem;
       }
     }
   }
 
-  Slice<InteractiveElement> ret = copyToSlice(arena, elems);
   releaseScratch(temp);
-  return ret;
 }
 
-static b32 intersects(Slice<InteractiveElement> elems, v2 pos, u32 &outIndex) {
-  for (auto [elem, idxElem] : elems) {
-    if (pos.x < elem.position.x || pos.y < elem.position.y) {
-      continue;
+/**
+ * Finds the first element in `elems` that contains the point.
+ */
+static b32 HitGrid_query(HitGrid *self,
+                         Slice<InteractiveElement> elems,
+                         v2 pos,
+                         u32 &outIndex) {
+  if (pos.x < 0 || pos.y < 0) {
+    return false;
+  }
+
+  f32 x = floorf(pos.x / self->cellSize);
+  f32 y = floorf(pos.y / self->cellSize);
+  if (x >= self->numColumns || y >= self->numRows) {
+    return false;
+  }
+
+  u32 idxCell = (u32)y * self->numColumns + (u32)x;
+  for (u32 i = self->idxFirstElement[idxCell];
+       i < self->idxFirstElement[idxCell + 1]; i++) {
+    u32 idxElem = self->elements[i];
+    if (contains(elems[idxElem], pos)) {
+      outIndex = idxElem;
+      return true;
     }
+  }
+  return false;
+}
 
-    if (pos.x > elem.position.x + elem.size.x ||
-        pos.y > elem.position.y + elem.size.y) {
-      continue;
+#if HV_BENCHMARKS
+static void appendString(Arena *arena, Vector<u8> &dst, const char *s) {
+  u32 len = (u32)strlen(s);
+  memcpy(append(arena, &dst, len), s, len);
+}
+
+/**
+ * Lays out a document of `numNodes` blocks, either all nested in one another
+ * or all siblings, and logs how long it takes.
+ */
+static void benchmarkLayoutShape(PageRenderer &renderer,
+                                 u32 numNodes,
+                                 b32 isDeep) {
+  const u32 NUM_PASSES = 4;
+  ArenaTemp temp = getScratch(nullptr, 0);
+
+  Vector<u8> source = {};
+  appendString(temp.arena, source, "<html><body>");
+  for (u32 i = 0; i < numNodes; i++) {
+    appendString(temp.arena, source, isDeep ? "<div>Lorem" : "<div>Lorem</div>");
+  }
+  if (isDeep) {
+    for (u32 i = 0; i < numNodes; i++) {
+      appendString(temp.arena, source, "</div>");
     }
+  }
+  appendString(temp.arena, source, "</body></html>");
+
+  Slice<HTMLToken> tokens = {};
+  HTML_tokenize(temp.arena, {source.data, source.length}, tokens);
+  DOM_Tree tree = {};
+  DOM_Tree_init(&tree, temp.arena, tokens, DTF_BuildIndex);
+  PageLayoutCache cache;
+  PageLayoutCache_init(&cache, temp.arena, renderer, tree, {});
+
+  ArenaTemp layoutTemp = {temp.arena, *temp.arena};
+  TimePoint t0 = chrono_getCurrentTime();
+  for (u32 pass = 0; pass < NUM_PASSES; pass++) {
+    resetScratch(layoutTemp);
+    Slice<LineBox> lineBoxes;
+    doLayout(layoutTemp.arena, renderer, tree, v2(1280, 720), cache,
+             lineBoxes);
+  }
+  TimePoint t1 = chrono_getCurrentTime();
 
-    outIndex = idxElem;
-    return true;
+  log_info("Layout of %u %s blocks: %.3f ms", numNodes,
+           isDeep ? "nested" : "sibling",
+           chrono_secondsBetween(t0, t1) * 1000 / NUM_PASSES);
+
+  releaseScratch(temp);
+}
+
+/**
+ * Times the measuring of the text of a text-heavy page on one thread and on
+ * all cores, and the layout of the page after it.
+ */
+static void benchmarkTextMeasure(PageRenderer &renderer, u32 numParagraphs) {
+  const u32 NUM_PASSES = 4;
+  ArenaTemp temp = getScratch(nullptr, 0);
+
+  Vector<u8> source = {};
+  appendString(temp.arena, source, "<html><body>");
+  for (u32 i = 0; i < numParagraphs; i++) {
+    appendString(temp.arena, source,
+                 i % 8 == 0 ? "<h2>Lorem ipsum dolor sit amet</h2>" : "");
+    appendString(temp.arena, source,
+                 "<p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, "
+                 "sed do eiusmod tempor incididunt ut labore et dolore magna "
+                 "aliqua. Ut enim ad minim veniam, quis nostrud exercitation "
+                 "ullamco laboris nisi ut aliquip ex ea commodo consequat.</p>");
   }
-  return false;
+  appendString(temp.arena, source, "</body></html>");
+
+  Slice<HTMLToken> tokens = {};
+  HTML_tokenize(temp.arena, {source.data, source.length}, tokens);
+  DOM_Tree tree = {};
+  DOM_Tree_init(&tree, temp.arena, tokens, DTF_BuildIndex);
+  PageLayoutCache cache = {};
+  computeTextStyles(temp.arena, tree, renderer, cache.styles,
+                    cache.textStyleIndex);
+
+  f64 measureMs[2];
+  f64 layoutMs = 0;
+  u32 maxChunks[2] = {1, MAX_MEASURE_CHUNKS};
+  ArenaTemp passTemp = {temp.arena, *temp.arena};
+  for (u32 idxMode = 0; idxMode < 2; idxMode++) {
+    TimePoint t0 = chrono_getCurrentTime();
+    for (u32 pass = 0; pass < NUM_PASSES; pass++) {
+      resetScratch(passTemp);
+      measureTextNodes(&cache, passTemp.arena, renderer, tree,
+                       maxChunks[idxMode]);
+    }
+    TimePoint t1 = chrono_getCurrentTime();
+    measureMs[idxMode] = chrono_secondsBetween(t0, t1) * 1000 / NUM_PASSES;
+  }
+
+  // The measurements of the last pass are still there
+  TimePoint t0 = chrono_getCurrentTime();
+  for (u32 pass = 0; pass < NUM_PASSES; pass++) {
+    ArenaTemp layoutTemp = {passTemp.arena, *passTemp.arena};
+    Slice<LineBox> lineBoxes;
+    doLayout(layoutTemp.arena, renderer, tree, v2(1280, 720), cache,
+             lineBoxes);
+    releaseScratch(layoutTemp);
+  }
+  TimePoint t1 = chrono_getCurrentTime();
+  layoutMs = chrono_secondsBetween(t0, t1) * 1000 / NUM_PASSES;
+
+  log_info("Measuring %u KiB of text: %.3f ms on one thread, %.3f ms on all "
+           "%u cores (%.2fx)",
+           source.length / 1024, measureMs[0], measureMs[1],
+           os_get_num_cores(), measureMs[0] / measureMs[1]);
+  log_info("Text layout: %.3f ms before, %.3f ms after the measuring was "
+           "spread (%.2fx)",
+           measureMs[0] + layoutMs, measureMs[1] + layoutMs,
+           (measureMs[0] + layoutMs) / (measureMs[1] + layoutMs));
+
+  releaseScratch(temp);
+}
+
+static void benchmarkLayout(PageRenderer &renderer) {
+  benchmarkLayoutShape(renderer, 10000, true);
+  benchmarkLayoutShape(renderer, 10000, false);
+  benchmarkTextMeasure(renderer, 20000);
 }
+#endif
 
 enum class PageStatus {
   Invalid,
@@ -778,15 +2448,73 @@ enum class PageStatus {
   NavigateBack,
 };
 
-static PageStatus showPage(Arena *arena,
-                           PageRenderer &renderer,
-                           Slice<u8> urlIn,
-                           Slice<u8> &nextUrl) {
+/**
+ * The document being received: it's tokenized and the tree is built as the
+ * chunks of the body arrive.
+ */
+struct PageLoad {
+  HTML_Tokenizer tokenizer;
+  DOM_TreeBuilder *builder;
+};
+
+static b32 feedTokenizer(void *user, i32 code, Slice<u8> chunk) {
+  // Error responses are replaced by our own page
+  if (code != 200) {
+    return true;
+  }
+
+  PageLoad *load = (PageLoad *)user;
+  b32 ok = HTML_Tokenizer_feed(&load->tokenizer, chunk);
+  // Even if the document turned out to be malformed, the part before the
+  // error is shown
+  HTMLTokenStream tokens;
+  HTML_Tokenizer_takeTokens(&load->tokenizer, tokens);
+  DOM_TreeBuilder_feed(load->builder, tokens);
+  return ok;
+}
+
+/**
+ * A parsed document. The tree points into the source, and both live either in
+ * the page arena or in the snapshot that the page was restored from.
+ */
+struct Page {
+  Slice<u8> source;
+  DOM_Tree domTree;
+};
+
+/**
+ * Fetches, tokenizes and parses the document at the URL. Returns false if
+ * it couldn't be fetched at all.
+ */
+static b32 loadPage(Arena *arena, Slice<u8> urlIn, Page &page) {
   char bufError[1024];
 
+  // The tokens and the tree builder are only needed until the tree has been
+  // built. The tree is built on another thread if there's a core for it.
+  ArenaTemp temp = getScratch(&arena, 1);
+  ArenaTemp builderArena = {&arenaTreeBuilder, arenaTreeBuilder};
+  PageLoad load;
+  HTML_Tokenizer_init(&load.tokenizer, arena, temp.arena);
+  load.builder = DOM_TreeBuilder_create(builderArena.arena, 0);
+  if (os_get_num_cores() > 1) {
+    DOM_TreeBuilder_startThread(load.builder, temp.arena);
+  }
+
   HTTP_Response response = {};
-  if (!HTTP_fetch(arena, urlIn, response)) {
-    return PageStatus::Exit;
+  if (!HTTP_fetch(arena, urlIn, response, feedTokenizer, &load)) {
+    if (!load.tokenizer.failed) {
+      // The thread has to be joined before its arena can be released
+      DOM_Tree discarded = {};
+      DOM_TreeBuilder_finish(load.builder, &discarded, temp.arena);
+      releaseScratch(builderArena);
+      releaseScratch(temp);
+      return false;
+    }
+
+    // The fetch was aborted by the tokenizer; what was received is all there
+    // is to the page
+    response.code = 200;
+    response.body = load.tokenizer.document;
   }
 
   Slice<u8> responseBody = response.body;
@@ -810,24 +2538,384 @@ static PageStatus showPage(Arena *arena,
              "<html><head></head><body><h2>%s</h2><p>Failed to load "
              "'%.*s'</p></body></html>",
              msg, FMT_SLICE(urlIn));
-    responseBody = {(u8 *)bufError, (u32)strlen(bufError)};
+    // The page outlives this function, and so must its source
+    responseBody =
+        duplicate(arena, Slice<u8>{(u8 *)bufError, (u32)strlen(bufError)});
   }
 
   // log_info("Response body:\n%.*s", FMT_SLICE(responseBody));
 
-  Slice<HTMLToken> tokens;
-  log_info("Tokenizing");
-  if (!HTML_tokenize(arena, responseBody, tokens)) {
-    log_error("Tokenizer failed");
+  HTMLTokenStream tokens = {};
+  if (response.code == 200) {
+    log_info("Finishing tokenization");
+    if (!HTML_Tokenizer_finish(&load.tokenizer)) {
+      log_error("Tokenizer failed");
+    }
+    HTML_Tokenizer_takeTokens(&load.tokenizer, tokens);
+  } else {
+    log_info("Tokenizing");
+    if (!HTML_tokenize(temp.arena, responseBody, tokens)) {
+      log_error("Tokenizer failed");
+    }
   }
-  // log_info("Printing");
-  // HTML_print(tokens);
+  DOM_TreeBuilder_feed(load.builder, tokens);
 
-  log_info("Building DOM tree");
-  DOM_Tree domTree = {};
-  DOM_Tree_init(&domTree, arena, tokens);
+  log_info("Finishing DOM tree");
+  page.source = responseBody;
+  page.domTree = {};
+  DOM_TreeBuilder_finish(load.builder, &page.domTree, arena, DTF_BuildIndex);
   // log_info("Printing DOM tree:");
-  // DOM_Tree_print(&domTree);
+  // DOM_Tree_print(&page.domTree);
+
+  releaseScratch(builderArena);
+  releaseScratch(temp);
+
+  // Once the builder thread is done, so that it doesn't skew the timings
+#if HV_BENCHMARKS
+  HTML_benchmarkScanner(responseBody);
+  HTML_benchmarkTokenizer(responseBody);
+  DOM_benchmarkTokenEncodings(responseBody);
+  DOM_benchmarkPipeline(responseBody);
+#endif
+
+  return true;
+}
+
+// The font of body text and one for each level of heading
+static const u32 NUM_FONTS = 7;
+
+static void declareFonts(Font (&fonts)[NUM_FONTS],
+                         FontFile *fileRegular,
+                         FontFile *fileBold) {
+  Font_declare(&fonts[0], fileRegular, EM_SIZE, FontStyle::Normal,
+               FontWeight::Normal);
+  for (u32 i = 0; i < 6; i++) {
+    Font_declare(&fonts[i + 1], fileBold, HEADING_SIZES[i] * EM_SIZE,
+                 FontStyle::Normal, FontWeight::Bold);
+  }
+}
+
+#if HV_HEADLESS
+// NOTE: the headless build draws pages with the software renderer instead of
+// showing them in a window. A page is laid out once, and is then scrolled
+// down to the requested offset a step per frame, the way the mouse wheel
+// scrolls it, so that the bands of text are streamed in and out like they are
+// in the window. Every frame is timed, and the last one is written into a PPM
+// file, which can be compared against one that was written earlier.
+//
+// Each frame is also drawn from bands that are all loaded from scratch, into
+// an atlas of their own, and has to come out the same as the one that reused
+// the bands of the frame before it.
+
+// Size of the surface that pages are drawn into
+static const i32 HEADLESS_WIDTH = 400;
+static const i32 HEADLESS_HEIGHT = 300;
+// How far a frame scrolls the page; three notches of the mouse wheel
+static const f32 HEADLESS_SCROLL_STEP = 48;
+// Pages are fetched if their location starts with this, otherwise read from
+// a file
+static const Slice<u8> PROTOCOL_HTTP = SLICE_FROM_STRLIT("http://");
+
+/**
+ * Writes the RGB channels of the RGBA pixels as a binary PPM.
+ */
+static b32 writePPM(const char *path, Slice<u8> pixels, u32 width, u32 height) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  b32 ret = fprintf(f, "P6\n%u %u\n255\n", width, height) > 0;
+  for (u32 i = 0; ret && i < width * height; i++) {
+    ret = fwrite(&pixels[i * 4], 1, 3, f) == 3;
+  }
+  return fclose(f) == 0 && ret;
+}
+
+/**
+ * Reads a binary PPM as written by writePPM into RGB pixels.
+ */
+static b32 readPPM(const char *path,
+                   Arena *arena,
+                   Slice<u8> &rgb,
+                   u32 &width,
+                   u32 &height) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+
+  u32 maxValue;
+  b32 ret = fscanf(f, "P6 %u %u %u", &width, &height, &maxValue) == 3 &&
+            maxValue == 255 && fgetc(f) != EOF && width <= 16384 &&
+            height <= 16384;
+  if (ret) {
+    alloc(arena, width * height * 3, rgb);
+    ret = fread(rgb.data, 1, rgb.length, f) == rgb.length;
+  }
+  fclose(f);
+  return ret;
+}
+
+/**
+ * Compares the RGB channels of the RGBA pixels with the expected ones.
+ * @returns How many pixels differ.
+ */
+static u32 countDifferentPixels(Slice<u8> pixels, Slice<u8> expected) {
+  u32 numDifferent = 0;
+  for (u32 i = 0; i < expected.length / 3; i++) {
+    if (memcmp(&pixels[i * 4], &expected[i * 3], 3) != 0) {
+      numDifferent++;
+    }
+  }
+  return numDifferent;
+}
+
+/**
+ * Builds the tree of a page read from a file. The file stays mapped, since
+ * the tree points into it.
+ */
+static b32 loadLocalPage(Arena *arena, const char *path, Page &page) {
+  page.source = os_map_file(path);
+  if (page.source.length == 0) {
+    return false;
+  }
+
+  page.domTree = {};
+  if (!DOM_Tree_initPipelined(&page.domTree, arena, page.source,
+                              DTF_BuildIndex)) {
+    log_warn("%s is malformed, showing the part before the error", path);
+  }
+  return true;
+}
+
+/**
+ * Checks the frame against the expected image, if one was given.
+ */
+static b32 compareFrame(Slice<u8> pixels, const char *pathExpected) {
+  ArenaTemp temp = getScratch(nullptr, 0);
+  Slice<u8> expected;
+  u32 width, height;
+  b32 ret = false;
+  if (!readPPM(pathExpected, temp.arena, expected, width, height)) {
+    log_error("Failed to read %s", pathExpected);
+  } else if (width != HEADLESS_WIDTH || height != HEADLESS_HEIGHT) {
+    log_error("%s is %ux%u instead of %ux%u", pathExpected, width, height,
+              HEADLESS_WIDTH, HEADLESS_HEIGHT);
+  } else {
+    u32 numDifferent = countDifferentPixels(pixels, expected);
+    if (numDifferent != 0) {
+      log_error("%u pixels differ from %s", numDifferent, pathExpected);
+    } else {
+      log_info("Same as %s", pathExpected);
+      ret = true;
+    }
+  }
+  releaseScratch(temp);
+  return ret;
+}
+
+/**
+ * Lays out the page and scrolls it down to `scrollY` a step per frame,
+ * logging how long each frame took to draw. Returns false if a frame differed
+ * from the same frame drawn from bands that were loaded from scratch.
+ */
+static b32 drawPageHeadless(Arena *arena,
+                             PageRenderer &renderer,
+                             Slice<u8> location,
+                             Page &page,
+                             f32 scrollY) {
+  DOM_Tree &domTree = page.domTree;
+  v2 viewportSize = v2(HEADLESS_WIDTH, HEADLESS_HEIGHT);
+
+  TimePoint t0 = chrono_getCurrentTime();
+  PageLayoutCache layoutCache;
+  PageLayoutCache_init(&layoutCache, arena, renderer, domTree, location);
+  Slice<LineBox> lineBoxes;
+  Slice<NodeLayoutInfo> nodeLayoutInfo =
+      doLayout(arena, renderer, domTree, viewportSize, layoutCache, lineBoxes);
+  TextTileIndex textTileIndex;
+  TextTileIndex_init(&textTileIndex, arena, domTree, nodeLayoutInfo,
+                     lineBoxes);
+  Slice<TextTile> textTiles = allocTextTiles(arena, viewportSize.y);
+  TimePoint t1 = chrono_getCurrentTime();
+  log_info("Layout: %.3f ms", chrono_secondsBetween(t0, t1) * 1000);
+
+  PageRenderer coldRenderer = renderer;
+  if (!GlyphAtlas_init(&coldRenderer.atlas, renderer.fontArena,
+                       renderer.gpu)) {
+    log_error("Failed to reserve memory for the glyph atlas");
+    return false;
+  }
+  Slice<TextTile> coldTiles = allocTextTiles(arena, viewportSize.y);
+  Slice<u8> coldPixels;
+  alloc(arena, HEADLESS_WIDTH * HEADLESS_HEIGHT * 4, coldPixels);
+
+  // Like the mouse wheel, the page can't be scrolled past its end
+  f32 htmlElemHeight = nodeLayoutInfo[domTree.idxHtmlNode].size.y;
+  f32 maxY = max(0.0f, htmlElemHeight - viewportSize.y);
+  scrollY = min(max(scrollY, 0.0f), maxY);
+
+  b32 isConsistent = true;
+  f64 secsTotal = 0;
+  f64 secsSlowest = 0;
+  u32 numFrames = 0;
+  u32 numMaxMeshes = 0;
+  f32 documentYOffset = 0;
+  while (true) {
+    ArenaTemp frame = getScratch(&arena, 1);
+
+    for (auto [tile, _] : coldTiles) {
+      TextTile_unload(&tile, coldRenderer);
+    }
+    GPU_submit(coldRenderer.gpu, coldRenderer.surface,
+               recordPage(frame.arena, coldRenderer, domTree, layoutCache,
+                          lineBoxes, textTileIndex, coldTiles, viewportSize,
+                          documentYOffset));
+    copy(coldPixels, Surface_getPixels(renderer.surface));
+    resetScratch(frame);
+
+    f32 deltaTime;
+    GPU_beginFrame(renderer.gpu, renderer.surface, &deltaTime);
+
+    TimePoint tFrame0 = chrono_getCurrentTime();
+    Slice<GPU_RenderCmd> renderCmds =
+        recordPage(frame.arena, renderer, domTree, layoutCache, lineBoxes,
+                   textTileIndex, textTiles, viewportSize, documentYOffset);
+    GPU_submit(renderer.gpu, renderer.surface, renderCmds);
+    GPU_present(renderer.gpu, renderer.surface);
+    TimePoint tFrame1 = chrono_getCurrentTime();
+    releaseScratch(frame);
+
+    f64 secsFrame = chrono_secondsBetween(tFrame0, tFrame1);
+    log_info("Frame %u at %.0f px: %.3f ms", numFrames, documentYOffset,
+             secsFrame * 1000);
+    if (memcmp(coldPixels.data, Surface_getPixels(renderer.surface).data,
+               coldPixels.length) != 0) {
+      log_error("Frame %u differs from the same frame drawn from new bands",
+                numFrames);
+      isConsistent = false;
+    }
+
+    u32 numMeshes = 0;
+    for (auto [tile, _] : textTiles) {
+      numMeshes += tile.isLoaded && tile.mesh;
+    }
+    numMaxMeshes = max(numMaxMeshes, numMeshes);
+    secsTotal += secsFrame;
+    secsSlowest = secsFrame > secsSlowest ? secsFrame : secsSlowest;
+    numFrames++;
+
+    if (documentYOffset >= scrollY) {
+      break;
+    }
+    documentYOffset = min(documentYOffset + HEADLESS_SCROLL_STEP, scrollY);
+  }
+
+  log_info("%u frames: %.3f ms on average, %.3f ms at most", numFrames,
+           secsTotal * 1000 / numFrames, secsSlowest * 1000);
+  log_info("At most %u meshes of text were loaded at once", numMaxMeshes);
+
+  for (auto [tile, _] : textTiles) {
+    TextTile_unload(&tile, renderer);
+  }
+  for (auto [tile, _] : coldTiles) {
+    TextTile_unload(&tile, coldRenderer);
+  }
+  return isConsistent;
+}
+
+int AppEntry(Slice<Slice<u8>> argv) {
+  if (argv.length < 4) {
+    fprintf(stderr,
+            "USAGE: %.*s {page} {scrollY} {output} [{expected}]\n\n"
+            "  Draws {page}, a file or an http:// URL, scrolled down by\n"
+            "  {scrollY} pixels with the software renderer into {output} as\n"
+            "  a PPM. If {expected} is given, fails unless the output is the\n"
+            "  same as that PPM.\n",
+            FMT_SLICE(argv[0]));
+    return EXIT_FAILURE;
+  }
+
+  // The arguments are the zero-terminated strings that main got
+  Slice<u8> location = argv[1];
+  f32 scrollY = strtof((const char *)argv[2].data, nullptr);
+  const char *pathOutput = (const char *)argv[3].data;
+  const char *pathExpected =
+      argv.length > 4 ? (const char *)argv[4].data : nullptr;
+
+  setupArenas();
+
+  GPU_Device gpu;
+  if (!GPU_create(&arenaPerm, &gpu)) {
+    log_error("GPU_create failed");
+    return EXIT_FAILURE;
+  }
+
+  GPU_HeadlessSurfaceDesc surfDesc = {};
+  surfDesc.header.kind = GSK_Headless;
+  surfDesc.width = HEADLESS_WIDTH;
+  surfDesc.height = HEADLESS_HEIGHT;
+  GPU_Surface surf;
+  if (!GPU_createSurface(gpu, &arenaPerm, &surfDesc.header, &surf)) {
+    log_error("GPU_createSurface failed");
+    GPU_destroy(gpu);
+    return EXIT_FAILURE;
+  }
+
+  FontFile fileRegular = {font_regular, (u32)font_regular_len};
+  FontFile fileBold = {font_bold, (u32)font_bold_len};
+  Font fonts[NUM_FONTS];
+  declareFonts(fonts, &fileRegular, &fileBold);
+
+  PageRenderer pageRenderer = {gpu, surf, {fonts, NUM_FONTS}, &arenaFonts};
+  if (!GlyphAtlas_init(&pageRenderer.atlas, pageRenderer.fontArena, gpu)) {
+    log_error("Failed to reserve memory for the glyph atlas");
+    Surface_destroy(surf);
+    GPU_destroy(gpu);
+    return EXIT_FAILURE;
+  }
+
+  Page page = {};
+  b32 isLocal = !startsWith(location, PROTOCOL_HTTP);
+  b32 isLoaded =
+      isLocal ? loadLocalPage(&arenaPerm, (const char *)location.data, page)
+              : loadPage(&arenaPerm, location, page);
+  if (!isLoaded) {
+    log_error("Failed to load %.*s", FMT_SLICE(location));
+    Surface_destroy(surf);
+    GPU_destroy(gpu);
+    return EXIT_FAILURE;
+  }
+
+  int ret = EXIT_SUCCESS;
+  if (!drawPageHeadless(&arenaPerm, pageRenderer, location, page, scrollY)) {
+    ret = EXIT_FAILURE;
+  }
+
+  Slice<u8> pixels = Surface_getPixels(surf);
+  if (!writePPM(pathOutput, pixels, HEADLESS_WIDTH, HEADLESS_HEIGHT)) {
+    log_error("Failed to write %s", pathOutput);
+    ret = EXIT_FAILURE;
+  }
+  if (pathExpected != nullptr && !compareFrame(pixels, pathExpected)) {
+    ret = EXIT_FAILURE;
+  }
+
+  if (isLocal) {
+    os_unmap_file(page.source);
+  }
+  Surface_destroy(surf);
+  GPU_destroy(gpu);
+  return ret;
+}
+#else
+static PageStatus showPage(Arena *arena,
+                           PageRenderer &renderer,
+                           Slice<u8> urlIn,
+                           Page &page,
+                           Slice<u8> &nextUrl) {
+  DOM_Tree &domTree = page.domTree;
 
   i32 viewportWidth, viewportHeight;
   Surface_getSize(renderer.surface, &viewportWidth, &viewportHeight);
@@ -842,96 +2930,71 @@ static PageStatus showPage(Arena *arena,
 
   // Look for the first title element, check if it only has text inside and set
   // the siteTitle to that text
-  for (auto [elem, _] : domTree.elementData) {
-    if (equalCaseInsensitive(elem.name, TAG_TITLE)) {
-      DOM_Node &node = domTree.nodes[elem.idxNode];
-      if (node.children.length == 1) {
-        DOM_Node &child = domTree.nodes[node.children[0]];
-        if (child.kind == DOM_NodeKind::Text) {
-          siteTitle = domTree.textData[node.idxText].contents;
-        }
+  Slice<u32> titles = DOM_Tree_elementsWithTag(&domTree, TagId::Title);
+  if (titles.length != 0) {
+    DOM_ElementData &elem = domTree.elementData[titles[0]];
+    DOM_Node &node = domTree.nodes[elem.idxNode];
+    if (node.children.length == 1) {
+      DOM_Node &child = domTree.nodes[node.children[0]];
+      if (child.kind == DOM_NodeKind::Text) {
+        siteTitle = domTree.textData[node.idxText].contents;
       }
-      break;
     }
   }
 
   f32 documentYOffset = 0;
+  // In window space
+  v2 cursorPos = {-1, -1};
+
+  // Only the line breaking and the positioning are redone when the viewport
+  // is resized
+  PageLayoutCache layoutCache;
+  PageLayoutCache_init(&layoutCache, arena, renderer, domTree, urlIn);
 
   PageStatus pageStatus = PageStatus::Invalid;
   while (pageStatus == PageStatus::Invalid) {
     ArenaTemp layout = {arena, *arena};
-    Slice<TextStyleInfo> textStyleInfo =
-        computeTextStyles(layout.arena, domTree, renderer.fonts);
+    Slice<LineBox> lineBoxes;
     Slice<NodeLayoutInfo> nodeLayoutInfo =
         doLayout(layout.arena, renderer, domTree,
-                 v2(viewportWidth, viewportHeight), textStyleInfo);
-    Slice<InteractiveElement> interactiveElements =
-        getInteractiveElements(layout.arena, urlIn, nodeLayoutInfo, domTree);
-
-    struct TextBatch {
-      GPU_Image fontAtlas;
-      GPU_Mesh mesh;
-    };
-
-    const u32 numFonts = renderer.fonts.length;
-    Slice<TextBatch> textBatches;
-    alloc(layout.arena, numFonts, textBatches);
-
-    // Generate and create GPU meshes; bin quads based on the font that
-    // they use
-    {
-      ArenaTemp temp = getScratch(&layout.arena, 1);
-      Slice<Vector<GPU_Vertex>> verticesPerFont;
-      Slice<Vector<u32>> indicesPerFont;
-
-      alloc(temp.arena, renderer.fonts.length, verticesPerFont);
-      alloc(temp.arena, renderer.fonts.length, indicesPerFont);
-
-      for (auto [text, idxText] : domTree.textData) {
-        NodeLayoutInfo &layoutInfo = nodeLayoutInfo[text.idxNode];
-        v2 start = layoutInfo.position;
-        f32 x0 = layoutInfo.parentX0;
-        f32 x1 = layoutInfo.parentX1;
-        if (x1 - x0 <= 0) {
-          continue;
-        }
-        TextStyleInfo &style = textStyleInfo[idxText];
-        Font *font = &renderer.fonts[style.idxFont];
-        Vector<GPU_Vertex> &vertices = verticesPerFont[style.idxFont];
-        Vector<u32> &indices = indicesPerFont[style.idxFont];
-        Font_drawText(font, temp.arena, vertices, indices, text.contents, x0,
-                      x1, start, style.color);
-      }
-
-      Slice<GPU_MeshDesc> meshDesc;
-      alloc(temp.arena, numFonts, meshDesc);
-      for (u32 i = 0; i < numFonts; i++) {
-        if (verticesPerFont[i].length == 0 || indicesPerFont[i].length == 0) {
-          continue;
-        }
-        meshDesc[i].vertexData = copyToSlice(arena, verticesPerFont[i]);
-        meshDesc[i].indices = copyToSlice(arena, indicesPerFont[i]);
-        GPU_Mesh mesh;
-        GPU_createMesh(renderer.gpu, layout.arena, &meshDesc[i],
-                       &textBatches[i].mesh);
-        textBatches[i].fontAtlas = renderer.fonts[i].image;
+                 v2(viewportWidth, viewportHeight), layoutCache, lineBoxes);
+    Slice<InteractiveElement> interactiveElements = getInteractiveElements(
+        layout.arena, nodeLayoutInfo, domTree, layoutCache);
+    HitGrid hitGrid;
+    HitGrid_init(&hitGrid, layout.arena, interactiveElements);
+
+    TextTileIndex textTileIndex;
+    TextTileIndex_init(&textTileIndex, layout.arena, domTree, nodeLayoutInfo,
+                       lineBoxes);
+
+    Slice<TextTile> textTiles = allocTextTiles(layout.arena, viewportHeight);
+
+    // Whether the window doesn't show the page as it is now
+    b32 isDamaged = true;
+    // Whether the last frame could be drawn; it can't while the window is
+    // hidden
+    b32 canDraw = true;
+    while (!Surface_wasClosed(renderer.surface)) {
+      // NOTE: nothing moves on a page by itself, so when the window
+      // shows it as it is, we sleep until something happens instead of
+      // drawing the same frame again. A window that couldn't draw is only
+      // woken up by the timeout, to find out whether it's visible again.
+      if (!isDamaged || !canDraw) {
+        Surface_waitForEvents(renderer.surface, IDLE_WAIT_MS);
       }
 
-      releaseScratch(temp);
-    }
-
-    while (!Surface_wasClosed(renderer.surface)) {
       ArenaTemp frame = getScratch(&layout.arena, 1);
 
-      f32 deltaTime;
-      GPU_beginFrame(renderer.gpu, renderer.surface, &deltaTime);
       Slice<GPU_Event> events =
           Surface_getEvents(renderer.gpu, frame.arena, renderer.surface);
 
+      // Whether what's under the cursor might have changed
+      b32 hasCursorMoved = false;
       for (auto [ev, _] : events) {
         switch (ev.kind) {
           case GET_MouseWheel: {
-            documentYOffset =
+            hasCursorMoved = true;
+            f32 newYOffset =
                 max(0.0f, documentYOffset - ev.mouseWheel.y * 16.0f);
             f32 maxY = viewportHeight;
             f32 htmlElemHeight = nodeLayoutInfo[domTree.idxHtmlNode].size.y;
@@ -940,7 +3003,16 @@ static PageStatus showPage(Arena *arena,
             } else {
               maxY = htmlElemHeight - viewportHeight;
             }
-            documentYOffset = min(documentYOffset, maxY);
+            newYOffset = min(newYOffset, maxY);
+            if (newYOffset != documentYOffset) {
+              documentYOffset = newYOffset;
+              isDamaged = true;
+            }
+            break;
+          }
+          case GET_MouseMoveAbs: {
+            cursorPos = {(f32)ev.mouseMoveAbs.x, (f32)ev.mouseMoveAbs.y};
+            hasCursorMoved = true;
             break;
           }
           case GET_MouseUp: {
@@ -948,8 +3020,8 @@ static PageStatus showPage(Arena *arena,
             cursorPosPageSpace.x = ev.mouseUp.x;
             cursorPosPageSpace.y = ev.mouseUp.y + documentYOffset;
             u32 idxClickedElem;
-            if (intersects(interactiveElements, cursorPosPageSpace,
-                           idxClickedElem)) {
+            if (HitGrid_query(&hitGrid, interactiveElements,
+                              cursorPosPageSpace, idxClickedElem)) {
               nextUrl = interactiveElements[idxClickedElem].href;
               pageStatus = PageStatus::NavigateToUrl;
             }
@@ -964,50 +3036,41 @@ static PageStatus showPage(Arena *arena,
             }
             break;
           }
+          case GET_Redraw: {
+            isDamaged = true;
+            break;
+          }
           default:
             (void)ev;
             break;
         }
       }
 
-      Vector<GPU_RenderCmd> renderCmds = {};
-
-      GPU_RenderCmd *setView = append(frame.arena, &renderCmds);
-      setView->kind = GPU_CmdKind::SetView;
-      setView->setView.projection = mat4x4_id();
-
-      f32 l = 0;
-      f32 r = viewportWidth;
-      f32 t = documentYOffset;
-      f32 b = viewportHeight + documentYOffset;
-      setView->setView.projection.c0.x = 2.0f / (r - l);
-      setView->setView.projection.c1.y = 2.0f / (t - b);
-      setView->setView.projection.c2.z = 1.0f;
-      setView->setView.projection.c3.x = -(r + l) / (r - l);
-      setView->setView.projection.c3.y = -(t + b) / (t - b);
-      setView->setView.projection.c3.z = 0;
-
-      for (auto [textBatch, _] : textBatches) {
-        if (!textBatch.mesh) {
-          continue;
-        }
-        GPU_RenderCmd *bindMesh = append(frame.arena, &renderCmds);
-        bindMesh->kind = GPU_CmdKind::BindMesh;
-        bindMesh->bindMesh.mesh = textBatch.mesh;
-
-        GPU_RenderCmd *bindImage = append(frame.arena, &renderCmds);
-        bindImage->kind = GPU_CmdKind::BindImage;
-        bindImage->bindImage.image = textBatch.fontAtlas;
-        bindImage->bindImage.colorSpace = GCS_Linear;
-
-        GPU_RenderCmd *draw = append(frame.arena, &renderCmds);
-        draw->kind = GPU_CmdKind::RenderInstance;
-        draw->renderInstance = {};
+      // Links are hovered on every mouse move, which the grid makes cheap.
+      // Hovering only changes the mouse cursor, which the window draws by
+      // itself, so the page isn't damaged by it.
+      if (hasCursorMoved && cursorPos.x >= 0) {
+        v2 cursorPosPageSpace = {cursorPos.x, cursorPos.y + documentYOffset};
+        u32 idxHoveredElem;
+        b32 isOverLink = HitGrid_query(&hitGrid, interactiveElements,
+                                       cursorPosPageSpace, idxHoveredElem);
+        Surface_setCursor(renderer.surface, isOverLink ? GC_Hand : GC_Arrow);
+      }
+
+      if (isDamaged) {
+        f32 deltaTime;
+        canDraw = GPU_beginFrame(renderer.gpu, renderer.surface, &deltaTime);
       }
 
-      GPU_submit(renderer.gpu, renderer.surface,
-                 copyToSlice(frame.arena, renderCmds));
-      GPU_present(renderer.gpu, renderer.surface);
+      if (isDamaged && canDraw) {
+        Slice<GPU_RenderCmd> renderCmds = recordPage(
+            frame.arena, renderer, domTree, layoutCache, lineBoxes,
+            textTileIndex, textTiles, v2(viewportWidth, viewportHeight),
+            documentYOffset);
+        GPU_submit(renderer.gpu, renderer.surface, renderCmds);
+        GPU_present(renderer.gpu, renderer.surface);
+        isDamaged = false;
+      }
       releaseScratch(frame);
 
       i32 w, h;
@@ -1025,12 +3088,8 @@ static PageStatus showPage(Arena *arena,
     }
 
     // Cleanup meshes
-    for (auto [textBatch, _] : textBatches) {
-      if (!textBatch.mesh) {
-        continue;
-      }
-
-      GPU_destroyMesh(renderer.gpu, textBatch.mesh);
+    for (auto [tile, _] : textTiles) {
+      TextTile_unload(&tile, renderer);
     }
 
     resetScratch(layout);
@@ -1046,6 +3105,25 @@ static PageStatus showPage(Arena *arena,
 static Slice<u8> DEFAULT_URL =
     SLICE_FROM_STRLIT("http://info.cern.ch/hypertext/WWW/TheProject.html");
 
+static const u32 HISTORY_MAX_ENTRIES = 32;
+
+/**
+ * The path of the snapshot of the page at the given depth of the history.
+ * Snapshots are kept in the temporary directory under the ID of the process,
+ * so that they never mix with those of another session. Returns false if the
+ * path doesn't fit.
+ */
+static b32 getHistorySnapshotPath(char (&path)[OS_MAX_PATH], u32 idxEntry) {
+  char dir[OS_MAX_PATH];
+  if (!os_get_temp_dir(dir, sizeof(dir))) {
+    return false;
+  }
+
+  int len = snprintf(path, sizeof(path), "%shtmlview_history_%u_%u.dom", dir,
+                     os_get_process_id(), idxEntry);
+  return len > 0 && (u32)len < sizeof(path);
+}
+
 int AppEntry(Slice<Slice<u8>> argv) {
   Slice<u8> initialUrl = DEFAULT_URL;
 
@@ -1073,31 +3151,35 @@ int AppEntry(Slice<Slice<u8>> argv) {
     return false;
   }
 
-  Font fonts[7];
-
-  Font_init(&fonts[0], &arenaPerm, gpu, font_regular, font_regular_len, EM_SIZE,
-            FontStyle::Normal, FontWeight::Normal);
-  Font_init(&fonts[1], &arenaPerm, gpu, font_bold, font_bold_len,
-            2.0f * EM_SIZE, FontStyle::Normal, FontWeight::Bold);
-  Font_init(&fonts[2], &arenaPerm, gpu, font_bold, font_bold_len,
-            1.5f * EM_SIZE, FontStyle::Normal, FontWeight::Bold);
-  Font_init(&fonts[3], &arenaPerm, gpu, font_bold, font_bold_len,
-            1.17f * EM_SIZE, FontStyle::Normal, FontWeight::Bold);
-  Font_init(&fonts[4], &arenaPerm, gpu, font_bold, font_bold_len, EM_SIZE,
-            FontStyle::Normal, FontWeight::Bold);
-  Font_init(&fonts[5], &arenaPerm, gpu, font_bold, font_bold_len,
-            0.83f * EM_SIZE, FontStyle::Normal, FontWeight::Bold);
-  Font_init(&fonts[6], &arenaPerm, gpu, font_bold, font_bold_len,
-            0.67f * EM_SIZE, FontStyle::Normal, FontWeight::Bold);
+  FontFile fileRegular = {font_regular, (u32)font_regular_len};
+  FontFile fileBold = {font_bold, (u32)font_bold_len};
+  Font fonts[NUM_FONTS];
+  declareFonts(fonts, &fileRegular, &fileBold);
 
   Arena historyArena;
   historyArena.beg = alloc<u8>(&arenaPerm, 64 * 1024);
   historyArena.end = historyArena.beg + 64 * 1024;
-  Slice<u8> historyArr[32];
+  Slice<u8> historyArr[HISTORY_MAX_ENTRIES];
   // This vector is backed by the stack
-  Vector<Slice<u8>> history = {historyArr, 0, 32};
+  Vector<Slice<u8>> history = {historyArr, 0, HISTORY_MAX_ENTRIES};
+  // Every entry in the history has a snapshot of the parsed page saved next to
+  // it, so going back restores the page instead of fetching and parsing it
+  // again
+  b32 restoreFromHistory = false;
+  // The snapshots at depths below this may exist and are deleted at exit
+  u32 numSnapshotPaths = 0;
+
+  PageRenderer pageRenderer = {gpu, surf, {fonts, NUM_FONTS}, &arenaFonts};
+  if (!GlyphAtlas_init(&pageRenderer.atlas, pageRenderer.fontArena, gpu)) {
+    log_error("Failed to reserve memory for the glyph atlas");
+    Surface_destroy(surf);
+    GPU_destroy(gpu);
+    return false;
+  }
 
-  PageRenderer pageRenderer = {gpu, surf, {fonts, 7}};
+#if HV_BENCHMARKS
+  benchmarkLayout(pageRenderer);
+#endif
 
   ArenaTemp temp = {&arenaTemp, arenaTemp};
   Slice<u8> nextLocation = duplicate(temp.arena, initialUrl);
@@ -1106,14 +3188,53 @@ int AppEntry(Slice<Slice<u8>> argv) {
     ArenaTemp pageArena = {&arenaPerm, arenaPerm};
     Slice<u8> urlToLoad = duplicate(pageArena.arena, nextLocation);
     resetScratch(temp);
-    log_info("Loading %.*s", FMT_SLICE(urlToLoad));
-    PageStatus status =
-        showPage(pageArena.arena, pageRenderer, urlToLoad, nextLocation);
+
+    char pathSnapshot[OS_MAX_PATH];
+    Page page = {};
+    // The page points into the snapshot if it was restored from one
+    Slice<u8> snapshot = {};
+    if (restoreFromHistory &&
+        getHistorySnapshotPath(pathSnapshot, history.length)) {
+      snapshot = os_map_file(pathSnapshot);
+      if (snapshot.length != 0 &&
+          DOM_Snapshot_load(snapshot, urlToLoad, &page.domTree, page.source)) {
+        log_info("Restored %.*s from %s", FMT_SLICE(urlToLoad), pathSnapshot);
+      } else {
+        log_warn("Snapshot %s is missing or invalid", pathSnapshot);
+        os_unmap_file(snapshot);
+        snapshot = {};
+      }
+    }
+    restoreFromHistory = false;
+
+    if (snapshot.length == 0) {
+      log_info("Loading %.*s", FMT_SLICE(urlToLoad));
+      if (!loadPage(pageArena.arena, urlToLoad, page)) {
+        break;
+      }
+    }
+
+    PageStatus status = showPage(pageArena.arena, pageRenderer, urlToLoad,
+                                 page, nextLocation);
     if (status == PageStatus::NavigateToUrl) {
       nextLocation = duplicate(temp.arena, nextLocation);
       log_info("Navigating to %.*s", FMT_SLICE(nextLocation));
 
-      if (history.length < 32) {
+      if (history.length < HISTORY_MAX_ENTRIES) {
+        Slice<u8> pageSnapshot = DOM_Snapshot_write(
+            pageArena.arena, &page.domTree, page.source, urlToLoad);
+        // The file may be the one that is mapped right now
+        os_unmap_file(snapshot);
+        snapshot = {};
+        if (getHistorySnapshotPath(pathSnapshot, history.length)) {
+          numSnapshotPaths = max(numSnapshotPaths, history.length + 1);
+          if (!os_write_file(pathSnapshot, pageSnapshot)) {
+            log_warn("Failed to write %s", pathSnapshot);
+            // Don't leave a partly written file behind
+            os_delete_file(pathSnapshot);
+          }
+        }
+
         history.data[history.length] = duplicate(&historyArena, urlToLoad);
         history.length++;
       } else {
@@ -1124,6 +3245,7 @@ int AppEntry(Slice<Slice<u8>> argv) {
         Slice<u8> prevUrl = history[history.length - 1];
         nextLocation = duplicate(temp.arena, prevUrl);
         history.length--;
+        restoreFromHistory = true;
         log_info("Going back to %.*s", FMT_SLICE(nextLocation));
         // historyArena acts like a stack, so the end of it must be allocated
         // for this entry
@@ -1133,15 +3255,28 @@ int AppEntry(Slice<Slice<u8>> argv) {
         // Reload the current page
         nextLocation = duplicate(temp.arena, urlToLoad);
       }
-    } else {
+    }
+
+    os_unmap_file(snapshot);
+    if (status != PageStatus::NavigateToUrl &&
+        status != PageStatus::NavigateBack) {
       break;
     }
 
     releaseScratch(pageArena);
   }
 
+  // The snapshots are of no use to any other session
+  for (u32 idxEntry = 0; idxEntry < numSnapshotPaths; idxEntry++) {
+    char pathSnapshot[OS_MAX_PATH];
+    if (getHistorySnapshotPath(pathSnapshot, idxEntry)) {
+      os_delete_file(pathSnapshot);
+    }
+  }
+
   Surface_destroy(surf);
   GPU_destroy(gpu);
 
   return 0;
 }
+#endif
@@ -2,9 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define WIN32 1
-
-#if WIN32
+#if _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #endif
@@ -13,7 +11,7 @@
 #include <time.h>
 #endif
 
-#if WIN32
+#if _WIN32
 TimePoint chrono_getCurrentTime() {
   TimePoint ret = 0;
 
@@ -58,7 +56,7 @@ f64 chrono_secondsBetween(TimePoint t0, TimePoint t1) {
   u64 ticks0, ticks1;
   memcpy(&ticks0, &t0, sizeof(t0));
   memcpy(&ticks1, &t1, sizeof(t1));
-  auto delta = ticks1 - ticks0;
+  u64 delta = ticks1 - ticks0;
 
   return delta / (f64)1000000000;
 }
@@ -52,6 +52,15 @@ void alloc(Arena *arena, u32 length, Slice<T> &dst) {
   dst.data = alloc<T>(arena, length);
 }
 
+/**
+ * Creates a new slice with the specified length; its contents are undefined.
+ */
+template <typename T>
+void allocNZ(Arena *arena, u32 length, Slice<T> &dst) {
+  dst.length = length;
+  dst.data = (T *)allocNZ(arena, sizeof(T), alignof(T), length);
+}
+
 template <typename T>
 void zeroMemory(Slice<T> s) {
   memset(s.data, 0, s.length * sizeof(T));
@@ -62,7 +62,8 @@ T *append(Arena *arena, Vector<T> *dst) {
   if (dst->length + 1 > dst->capacity) {
     CHECK(dst->capacity <= 268435456);
     u32 newCap = (dst->capacity * 24) / 16;
-    if (newCap == 0) {
+    // Growing by half doesn't grow a single element
+    if (newCap < 4) {
       newCap = 4;
     }
 